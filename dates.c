@@ -36,6 +36,12 @@
 #include <stdio.h>
 #include <assert.h>
 #include <pthread.h>
+#include <langinfo.h>
+#include <stdint.h>
+#include <limits.h>
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
 
 int tm_is_TZ_owner = 0;         // Not optimized by default
 
@@ -54,13 +60,17 @@ const char *const TM_REF_UNDEFINED = &tm_ref_undefined;
 #endif
 #define WALLCLOCK_MAX_LENGTH 200
 static size_t nb_registered_wallclocks = 0;
-static char registered_wallclock[WALLCLOCK_MAX_LENGTH][WALLCLOCK_MAX_NB] = { 0 };       // Set everything to 0 (even though already the default behavior for static variables)
+static char registered_wallclock[WALLCLOCK_MAX_NB][WALLCLOCK_MAX_LENGTH] = { 0 };       // Set everything to 0 (even though already the default behavior for static variables)
+// Open addressing hash index of registered wallclocks: slot + 1, 0 for an empty entry.
+#define WALLCLOCK_HASH_SIZE 4096        // Power of 2, greater than twice WALLCLOCK_MAX_NB
+static size_t registered_wallclock_hash[WALLCLOCK_HASH_SIZE] = { 0 };
 
 static const char *TM_LOCALTIMEZONE_NAME = 0;   // 0 means system timezone
 // Make the API Thread safe (MT-Safe env locale to be precise, see see man attributes(7)):
 static pthread_mutex_t tzset_mutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_mutex_t wallclock_mutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_mutex_t localtimename_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t zoneyear_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 static const char *
 tm_utctimezone (void)
@@ -93,17 +103,40 @@ tm_localtimezone (void)
     return tm_systemtimezone ();
 }
 
+// FNV-1a
+static size_t
+tm_wallclockhash (const char *wc)
+{
+  uint32_t h = 2166136261U;
+  for (; *wc; wc++)
+    h = (h ^ (unsigned char) *wc) * 16777619U;
+  return h & (WALLCLOCK_HASH_SIZE - 1);
+}
+
+// Index in the hash table where wc is (or should be inserted). wallclock_mutex should be locked.
+static size_t
+tm_wallclockfind (const char *wc)
+{
+  size_t h = tm_wallclockhash (wc);
+  while (registered_wallclock_hash[h] && strcmp (registered_wallclock[registered_wallclock_hash[h] - 1], wc))
+    h = (h + 1) & (WALLCLOCK_HASH_SIZE - 1);
+  return h;
+}
+
 static void
 tm_unregisterwallclock (const char *wc)
 {
   pthread_mutex_lock (&wallclock_mutex);
-  if (wc && *wc)
+  size_t h;
+  if (wc && *wc && registered_wallclock_hash[h = tm_wallclockfind (wc)])
+  {
+    *registered_wallclock[registered_wallclock_hash[h] - 1] = 0;
+    // Rare: the hash index is rebuilt.
+    memset (registered_wallclock_hash, 0, sizeof (registered_wallclock_hash));
     for (size_t i = 0; i < nb_registered_wallclocks; i++)
-      if (!strcmp (registered_wallclock[i], wc))
-      {
-        *registered_wallclock[i] = 0;
-        break;
-      }
+      if (*registered_wallclock[i])
+        registered_wallclock_hash[tm_wallclockfind (registered_wallclock[i])] = i + 1;
+  }
   pthread_mutex_unlock (&wallclock_mutex);
 }
 
@@ -120,32 +153,26 @@ tm_getregisteredwallclock (const char *wc, int add)
     return (errno = EINVAL), TM_REF_UNDEFINED;
 
   pthread_mutex_lock (&wallclock_mutex);
-  size_t islot = nb_registered_wallclocks;
+  size_t h = tm_wallclockfind (wc);
   const char *ret = 0;
-  for (size_t i = 0; i < nb_registered_wallclocks; i++)
-    if (!strcmp (registered_wallclock[i], wc))
-    {
-      ret = registered_wallclock[i];
-      pthread_mutex_unlock (&wallclock_mutex);
-      return ret;
-    }
-    else if (islot == nb_registered_wallclocks && *registered_wallclock[i] == 0)
-      islot = i;
-
-  if (!add)
+  if (registered_wallclock_hash[h])
   {
+    ret = registered_wallclock[registered_wallclock_hash[h] - 1];
     pthread_mutex_unlock (&wallclock_mutex);
-    return TM_REF_UNDEFINED;
+    return ret;
   }
 
-  if (islot < nb_registered_wallclocks)
+  if (!add)
   {
-    ret = strncpy (registered_wallclock[islot], wc, WALLCLOCK_MAX_LENGTH - 1);
     pthread_mutex_unlock (&wallclock_mutex);
-    return ret;
+    return TM_REF_UNDEFINED;
   }
 
-  if (nb_registered_wallclocks == WALLCLOCK_MAX_NB || strlen (wc) >= WALLCLOCK_MAX_LENGTH)
+  size_t islot = 0;
+  while (islot < nb_registered_wallclocks && *registered_wallclock[islot])
+    islot++;
+
+  if (islot == WALLCLOCK_MAX_NB || strlen (wc) >= WALLCLOCK_MAX_LENGTH)
   {
     errno = ENOMEM;
     perror ("Wallclock registration");
@@ -153,7 +180,10 @@ tm_getregisteredwallclock (const char *wc, int add)
     return tm_systemtimezone ();
   }
 
-  ret = strncpy (registered_wallclock[nb_registered_wallclocks++], wc, WALLCLOCK_MAX_LENGTH - 1);
+  ret = strcpy (registered_wallclock[islot], wc);
+  registered_wallclock_hash[h] = islot + 1;
+  if (islot == nb_registered_wallclocks)
+    nb_registered_wallclocks++;
   pthread_mutex_unlock (&wallclock_mutex);
   return ret;
 }
@@ -390,186 +420,554 @@ tm_todaylightsavingextrasummertime (struct tm *date)
 }
 
 /*****************************************************
-*   CONSTRUCTORS                                     *
+*   CALENDAR ARITHMETICS                             *
 *****************************************************/
-tm_status
-tm_make_ir (struct tm *tm, tm_predefined_instant instant, const char *rep)
+// Proleptic Gregorian calendar, without any reference to timezone (see http://howardhinnant.github.io/date_algorithms.html)
+
+/// Number of days elapsed since 1970-01-01.
+static long int
+tm_daysfromcivil (long int year, int month, int day)
 {
-  time_t now = time (0);        // time syscall
+  year -= month <= 2;
+  long int era = (year >= 0 ? year : year - 399) / 400;
+  long int yoe = year - era * 400;      // [0, 399]
+  long int doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;      // [0, 365]
+  long int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy; // [0, 146096]
+  return era * 146097 + doe - 719468;
+}
 
-  if (rep == TM_REF_UNCHANGED)
-    rep = tm_getwallclock (*tm);
+/// Date of the day number days elapsed since 1970-01-01.
+static void
+tm_civilfromdays (long int days, long int *year, int *month, int *day)
+{
+  days += 719468;
+  long int era = (days >= 0 ? days : days - 146096) / 146097;
+  long int doe = days - era * 146097;   // [0, 146096]
+  long int yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365; // [0, 399]
+  long int doy = doe - (365 * yoe + yoe / 4 - yoe / 100);       // [0, 365]
+  long int mp = (5 * doy + 2) / 153;    // [0, 11]
+  *day = (int) (doy - (153 * mp + 2) / 5 + 1);
+  *month = (int) (mp < 10 ? mp + 3 : mp - 9);
+  *year = yoe + era * 400 + (*month <= 2);
+}
 
-  if (tm_isutctimezone (rep))
+/// Day number (elapsed since 1970-01-01) of an instant expressed in seconds since the Epoch, rounded toward minus infinity.
+static long int
+tm_daysfromseconds (time_t seconds)
+{
+  return (long int) (seconds >= 0 ? seconds / 86400 : -((-seconds + 86399) / 86400));
+}
+
+static int
+tm_isleapcivilyear (long int year)
+{
+  return year % 4 == 0 && (year % 100 != 0 || year % 400 == 0);
+}
+
+static int
+tm_daysincivilmonth (long int year, int month)
+{
+  static const int days[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+  return month == 2 ? 28 + tm_isleapcivilyear (year) : days[month - 1];
+}
+
+/// Day of week (0 for Sunday) of a day number.
+static int
+tm_dayofweekfromdays (long int days)
+{
+  return (int) (((days + 4) % 7 + 7) % 7);      // 1970-01-01 was a Thursday
+}
+
+/// Day number of the Monday of the first ISO week of isoyear (the week with January 4 in it).
+static long int
+tm_isoweekonefromyear (long int isoyear)
+{
+  long int jan4 = tm_daysfromcivil (isoyear, 1, 4);
+  return jan4 - (tm_dayofweekfromdays (jan4) + 6) % 7;
+}
+
+/// 53 if the ISO year starts on a Thursday (or on a Wednesday for leap years), 52 otherwise.
+static int
+tm_isoweeksinyear (long int isoyear)
+{
+  int jan1 = tm_dayofweekfromdays (tm_daysfromcivil (isoyear, 1, 1));
+  return jan1 == 4 || (jan1 == 3 && tm_isleapcivilyear (isoyear)) ? 53 : 52;
+}
+
+/// ISO week date (weekday from 1 for Monday to 7 for Sunday) of a day number.
+static void
+tm_isoweekdatefromdays (long int days, long int *isoyear, int *week, int *weekday)
+{
+  long int year;
+  int month, day;
+  tm_civilfromdays (days + 3 - (tm_dayofweekfromdays (days) + 6) % 7, &year, &month, &day);      // The Thursday of the week gives the ISO year
+  *isoyear = year;
+  *week = (int) ((days - tm_isoweekonefromyear (year)) / 7 + 1);
+  *weekday = (tm_dayofweekfromdays (days) + 6) % 7 + 1;
+}
+
+/*****************************************************
+*   ZONE TRANSITION TABLES                           *
+*****************************************************/
+// The UTC offsets of a wallclock are cached once for all, for every registered wallclock (and for system time),
+// as a sorted list of transitions over a bounded range of years.
+// Outside this range, functions fall back to mktime (see tm_normalize).
+#ifndef TM_ZONETABLE_FIRSTYEAR
+#  define TM_ZONETABLE_FIRSTYEAR 1900
+#endif
+#ifndef TM_ZONETABLE_LASTYEAR
+#  define TM_ZONETABLE_LASTYEAR 2150
+#endif
+#ifndef TM_ZONETABLE_MINUSES
+#  define TM_ZONETABLE_MINUSES 100      // Dates set on a wallclock by mktime before its table is built (a build costs about 700 calls of mktime).
+#endif
+#define TM_ZONETABLE_PROBE (2 * 86400)  // Shorter than the shortest interval between transitions of the TZ database (3.99 days in Africa/Freetown).
+#define TM_ZONETABLE_CHUNK 10           // Years probed per lock of tzset_mutex
+#define TM_ZONETABLE_MAXOFFSET (26 * 3600)      // Greater than any UTC offset.
+
+typedef struct
+{
+  time_t at;                    // UTC instant from which gmtoff and isdst apply
+  long int gmtoff;
+  int isdst;
+} tm_zonetransition;
+
+typedef struct
+{
+  long int first;               // Day number of January 1st
+  int nb;                       // Number of days in the year
+  int delta[367];               // UTC instant of the beginning of day first + i, minus (first + i) * 86400 (delta[nb] for January 1st of next year)
+} tm_zoneyear;
+#define TM_ZONEYEAR_UNRESOLVED INT_MIN  // delta of a midnight skipped or repeated
+
+typedef struct
+{
+  char wc[WALLCLOCK_MAX_LENGTH];        // Wallclock the table was built for ("" for system time)
+  time_t begin, end;            // UTC instants covered by the table
+  tm_zoneyear *years[TM_ZONETABLE_LASTYEAR - TM_ZONETABLE_FIRSTYEAR + 1];     // Beginnings of days, built on first use of each year
+  size_t nb;
+  tm_zonetransition tr[];       // tr[0].at == begin
+} tm_zonetable;
+
+typedef struct
+{
+  int nb;                       // Number of UTC instants matching a local time: 0 inside a gap, 2 inside an overlap, 1 otherwise.
+  tm_zonetransition tr[2];      // Matching UTC instants (at) and UTC offsets, earliest first (inside a gap, tr[0] is the transition which ends the gap).
+} tm_zonelocal;
+
+#define TM_ZONETABLE_SLOTS (sizeof (registered_wallclock) / sizeof (*registered_wallclock) + 1)        // Last slot for system time
+static tm_zonetable *zone_tables[TM_ZONETABLE_SLOTS] = { 0 };
+static unsigned int zone_uses[TM_ZONETABLE_SLOTS] = { 0 };      // Uses of wallclocks without table, up to TM_ZONETABLE_MINUSES
+static pthread_rwlock_t zonetable_rwlock = PTHREAD_RWLOCK_INITIALIZER;
+
+static size_t
+tm_zonetableslot (const char *wc)
+{
+  if (wc == tm_systemtimezone ())
+    return TM_ZONETABLE_SLOTS - 1;
+  uintptr_t base = (uintptr_t) * registered_wallclock;
+  uintptr_t p = (uintptr_t) wc;
+  if (p < base || p >= base + sizeof (registered_wallclock) || (p - base) % sizeof (*registered_wallclock))
+    return TM_ZONETABLE_SLOTS;  // Not a registered wallclock (UTC or undefined)
+  return (p - base) / sizeof (*registered_wallclock);
+}
+
+static int
+tm_zonetablesame (struct tm *a, const tm_zonetransition *b)
+{
+  return a->tm_gmtoff == b->gmtoff && (a->tm_isdst > 0) == b->isdst;
+}
+
+/// Probes localtime_r every TM_ZONETABLE_PROBE seconds inside [from, to], and bisects down to the second where UTC offset or DST changes.
+/// @remark TZ must already be set to the wallclock of the table (tzset_mutex locked), and zt must hold the transition in effect at from.
+static int
+tm_zonetableprobe (tm_zonetable **pzt, size_t *cap, time_t from, time_t to)
+{
+  tm_zonetable *zt = *pzt;
+  struct tm lt;
+  int ok = 1;
+  for (time_t lo = from, hi; ok && lo < to; lo = hi)
   {
-    rep = tm_getregisteredwallclock (rep, 0);
-    gmtime_r (&now, tm);        // time syscall
+    hi = to - lo > TM_ZONETABLE_PROBE ? lo + TM_ZONETABLE_PROBE : to;
+    if (!(ok = localtime_r (&hi, &lt) != 0) || tm_zonetablesame (&lt, zt->tr + zt->nb - 1))
+      continue;
+    for (time_t l = lo, h = hi; ok; )   // Offset of zt->tr[zt->nb - 1] at l, other offset at h
+      if (h - l <= 1)
+      {
+        if (zt->nb == *cap)
+        {
+          tm_zonetable *nzt = realloc (zt, sizeof (*zt) + (*cap *= 2) * sizeof (*zt->tr));
+          if (!(ok = nzt != 0))
+            break;
+          *pzt = zt = nzt;
+        }
+        if ((ok = localtime_r (&h, &lt) != 0))
+          zt->tr[zt->nb++] = (tm_zonetransition) { h, lt.tm_gmtoff, lt.tm_isdst > 0 };
+        break;
+      }
+      else
+      {
+        time_t m = l + (h - l) / 2;
+        if ((ok = localtime_r (&m, &lt) != 0))
+          *(tm_zonetablesame (&lt, zt->tr + zt->nb - 1) ? &l : &h) = m;
+      }
   }
-  else
+  return ok;
+}
+
+/// Builds the transition table of a wallclock from localtime_r, TM_ZONETABLE_CHUNK years at a time:
+/// tzset_mutex is released between chunks so that the other threads are not blocked during the whole build.
+static tm_zonetable *
+tm_zonetablebuild (const char *wc)
+{
+  size_t cap = 64;
+  tm_zonetable *zt = malloc (sizeof (*zt) + cap * sizeof (*zt->tr));
+  if (!zt)
+    return 0;
+  strncpy (zt->wc, wc ? wc : "", WALLCLOCK_MAX_LENGTH - 1);
+  zt->wc[WALLCLOCK_MAX_LENGTH - 1] = 0;
+  zt->begin = (time_t) tm_daysfromcivil (TM_ZONETABLE_FIRSTYEAR, 1, 1) * 86400;
+  zt->end = (time_t) tm_daysfromcivil (TM_ZONETABLE_LASTYEAR + 1, 1, 1) * 86400;
+  memset (zt->years, 0, sizeof (zt->years));
+  zt->nb = 0;
+
+  int ok = 1;
+  for (long int year = TM_ZONETABLE_FIRSTYEAR; ok && year <= TM_ZONETABLE_LASTYEAR; year += TM_ZONETABLE_CHUNK)
   {
-    rep = tm_getregisteredwallclock (rep, 1);
+    time_t from = (time_t) tm_daysfromcivil (year, 1, 1) * 86400;
+    time_t to = year + TM_ZONETABLE_CHUNK > TM_ZONETABLE_LASTYEAR ? zt->end - 1 : (time_t) tm_daysfromcivil (year + TM_ZONETABLE_CHUNK, 1, 1) * 86400;
+
     pthread_mutex_lock (&tzset_mutex);
     const char *old_tz;
-    if (tm_tzset (rep, &old_tz) == TM_ERROR)
+    if (tm_tzset (wc, &old_tz) == TM_ERROR)
     {
       pthread_mutex_unlock (&tzset_mutex);
-      return (errno = EINVAL), TM_ERROR;
+      ok = 0;
+      break;
     }
-    localtime_r (&now, tm);     // time syscall. For portable code, tzset(3) should be called before localtime_r().
+    if (!zt->nb)
+    {
+      struct tm lt;
+      if ((ok = localtime_r (&zt->begin, &lt) != 0))    // time syscall
+        zt->tr[zt->nb++] = (tm_zonetransition) { zt->begin, lt.tm_gmtoff, lt.tm_isdst > 0 };
+    }
+    if (ok)
+      ok = tm_zonetableprobe (&zt, &cap, from, to);
     tm_tzunset (old_tz);
     pthread_mutex_unlock (&tzset_mutex);
   }
-  tm->tm_zone = rep;
 
-  if (instant == TM_TODAY)
+  if (!ok)
   {
-    tm->tm_sec = tm->tm_min = tm->tm_hour = 0;
-    tm->tm_isdst = -1;          // Let timezone information and system databases define DST flag.
-    return tm_normalize (tm, 0);
+    free (zt);
+    return 0;
   }
-  else if (instant == TM_NOW)
-    return TM_OK;
-  else
-    return (errno = EINVAL), TM_ERROR;
+  return zt;
 }
 
-tm_status
-tm_make_dtrc (struct tm *tm, int year, tm_month month, int day, int hour, int min, int sec, const char *rep, tm_time_precedence clock)
+static void
+tm_zonetablefree (tm_zonetable *zt)
 {
-  if (rep == TM_REF_UNCHANGED)
-    rep = tm_getwallclock (*tm);
-  rep = tm_getregisteredwallclock (rep, 1);
+  if (!zt)
+    return;
+  for (size_t i = 0; i < sizeof (zt->years) / sizeof (*zt->years); i++)
+    free (zt->years[i]);
+  free (zt);
+}
 
-  tm->tm_year = year - 1900;
-  if (tm->tm_year > year)
-    return (errno = EINVAL), TM_ERROR;
-  tm->tm_mon = (typeof (tm->tm_mon)) (month - 1);
-  tm->tm_mday = day;
-  tm->tm_hour = hour;
-  tm->tm_min = min;
-  tm->tm_sec = sec;
-  tm->tm_zone = rep;
-  tm->tm_isdst = -1;            // Let timezone information and system databases define DST flag.
+/// Gets the transition table of a wallclock, built on first use.
+/// @returns Table read-locked until tm_zonetablerelease is called, or 0 if not available (UTC, unregistered or invalid wallclock).
+static const tm_zonetable *
+tm_zonetableacquire (const char *wc)
+{
+  size_t slot = tm_zonetableslot (wc);
+  if (slot >= TM_ZONETABLE_SLOTS || (wc && !*wc))
+    return 0;
 
-  time_t ret;
-  if (tm_normalize (tm, &ret) == TM_ERROR)
-    return (errno = EINVAL), TM_ERROR;
-  if (!tm_isutctimezone (rep))
+  for (int built = 0; built < 2; built++)
   {
-    if (clock == TM_DST_OVER_ST)
-      tm_todaylightsavingextrasummertime (tm);
-    else if (clock == TM_ST_OVER_DST)
-      tm_todaylightsavingextrawintertime (tm);
-    else
-      return (errno = EINVAL), TM_ERROR;
+    pthread_rwlock_rdlock (&zonetable_rwlock);
+    tm_zonetable *zt = zone_tables[slot];
+    if (zt && !strcmp (zt->wc, wc ? wc : ""))   // The slot of a wallclock might have been reused since.
+      return zt;
+    pthread_rwlock_unlock (&zonetable_rwlock);
+
+    int saveerrno = errno;
+    zt = tm_zonetablebuild (wc);
+    errno = saveerrno;
+    if (!zt)
+      return 0;
+    pthread_rwlock_wrlock (&zonetable_rwlock);
+    tm_zonetablefree (zone_tables[slot]);
+    zone_tables[slot] = zt;
+    pthread_rwlock_unlock (&zonetable_rwlock);
   }
+  return 0;
+}
 
-  if (tm->tm_year == year - 1900 && tm->tm_mon == (typeof (tm->tm_mon)) (month - 1) && tm->tm_mday == day && tm->tm_hour == hour && tm->tm_min == min && tm->tm_sec == sec)
-    return TM_OK;
-  else
-    return (errno = EINVAL), TM_ERROR;
+/// Gets the transition table of a wallclock for the callers which can fall back to mktime.
+/// The table is only built once the wallclock has been used TM_ZONETABLE_MINUSES times: a few dates set on many wallclocks are left to mktime.
+/// @returns Table read-locked until tm_zonetablerelease is called, or 0 if not built yet or not available.
+static const tm_zonetable *
+tm_zonetableacquireused (const char *wc)
+{
+  size_t slot = tm_zonetableslot (wc);
+  if (slot < TM_ZONETABLE_SLOTS && __atomic_load_n (zone_uses + slot, __ATOMIC_RELAXED) < TM_ZONETABLE_MINUSES)
+  {
+    pthread_rwlock_rdlock (&zonetable_rwlock);
+    tm_zonetable *zt = zone_tables[slot];
+    if (zt && !strcmp (zt->wc, wc ? wc : ""))   // Already built for another use
+      return zt;
+    pthread_rwlock_unlock (&zonetable_rwlock);
+    if (__atomic_add_fetch (zone_uses + slot, 1, __ATOMIC_RELAXED) < TM_ZONETABLE_MINUSES)
+      return 0;
+  }
+  return tm_zonetableacquire (wc);
 }
 
-// tm should have been initialized with tm_set first.
-tm_status
-tm_setdatefromstring (struct tm *tm, const char *buf, const char *rep, tm_time_precedence clock)
+static void
+tm_zonetablerelease (const tm_zonetable *zt)
 {
-  char *ret;
+  if (zt)
+    pthread_rwlock_unlock (&zonetable_rwlock);
+}
 
-  ret = strptime (buf, "%x", tm);       // time syscall
-  if (!ret || *ret)
-    ret = strptime (buf, "%Ex", tm);
-  if (!ret || *ret)
-    ret = strptime (buf, "%Y-%m-%d", tm);
-  if (!ret || *ret)
-    ret = strptime (buf, "%Y−%m−%d", tm);
-  if (!ret || *ret)
-    ret = strptime (buf, "%Y %m %d", tm);
-  if (!ret || *ret)
-    return (errno = EINVAL), TM_ERROR;
+/// Drops the transition table of a wallclock, to be built again from the time zone database on next use.
+static void
+tm_zonetableinvalidate (const char *wc)
+{
+  size_t slot = tm_zonetableslot (wc);
+  if (slot >= TM_ZONETABLE_SLOTS)
+    return;
+  pthread_rwlock_wrlock (&zonetable_rwlock);
+  tm_zonetablefree (zone_tables[slot]);
+  zone_tables[slot] = 0;
+  pthread_rwlock_unlock (&zonetable_rwlock);
+}
 
-  int year = tm->tm_year + 1900;        /* tm_year is the number of years since 1900. */
+/// Index of the transition in effect at UTC instant utc, in [zt->begin, zt->end).
+static size_t
+tm_zonetableindex (const tm_zonetable *zt, time_t utc)
+{
+  size_t lo = 0, hi = zt->nb;   // zt->tr[lo].at <= utc < zt->tr[hi].at
+  while (hi - lo > 1)
+  {
+    size_t mid = lo + (hi - lo) / 2;
+    if (zt->tr[mid].at <= utc)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  return lo;
+}
 
-  if (year >= 0 && year < 100)
+/// Finds the UTC instants matching a local time.
+/// @param [in] local Seconds elapsed since 1970-01-01 00:00:00 on the wallclock
+/// @returns TM_ERROR if local is out of the range of the table.
+static tm_status
+tm_zonetableclassify (const tm_zonetable *zt, time_t local, tm_zonelocal *res)
+{
+  if (local - TM_ZONETABLE_MAXOFFSET < zt->begin || local + TM_ZONETABLE_MAXOFFSET >= zt->end)
+    return TM_ERROR;
+
+  res->nb = 0;
+  size_t gap = zt->nb;
+  for (size_t i = tm_zonetableindex (zt, local - TM_ZONETABLE_MAXOFFSET);
+       i < zt->nb && zt->tr[i].at <= local + TM_ZONETABLE_MAXOFFSET && res->nb < 2; i++)
   {
-    time_t now = time (0);      // time syscall
-    struct tm tm_now;
-    tzset ();
-    localtime_r (&now, &tm_now);        // time syscall
-    int current_year = tm_now.tm_year + 1900;   /* tm_year is the number of years since 1900. */
+    time_t utc = local - zt->tr[i].gmtoff;
+    if (utc >= zt->tr[i].at && (i + 1 == zt->nb || utc < zt->tr[i + 1].at))
+    {
+      res->tr[res->nb] = zt->tr[i];
+      res->tr[res->nb++].at = utc;
+    }
+    else if (utc < zt->tr[i].at && gap == zt->nb)
+      gap = i;                  // First transition after local time
+  }
+  if (!res->nb && gap < zt->nb)
+    res->tr[0] = zt->tr[gap];   // Transition which skipped local time
+  return TM_OK;
+}
 
-    tm->tm_year += (typeof (tm->tm_year)) lround ((current_year - year) / 100.) * 100;
+/// Gets the UTC instants of the beginnings of the days of a year, built on first use.
+/// Only a unique local midnight is recorded: a midnight skipped or repeated is left to mktime (as TM_ST_OVER_DST resolves it), see tm_zonetableday.
+/// @returns 0 if the year is not fully covered by the table.
+/// @remark Called with the table read-locked: a year already published is read without locking, missing years are built under zoneyear_mutex.
+static const tm_zoneyear *
+tm_zonetableyear (const tm_zonetable *zt, long int year)
+{
+  if (year <= TM_ZONETABLE_FIRSTYEAR || year >= TM_ZONETABLE_LASTYEAR)
+    return 0;
+  tm_zoneyear **slot = (tm_zoneyear **) zt->years + (year - TM_ZONETABLE_FIRSTYEAR);
+  tm_zoneyear *zy = __atomic_load_n (slot, __ATOMIC_ACQUIRE);
+  if (zy)
+    return zy;
+
+  pthread_mutex_lock (&zoneyear_mutex);
+  if (!(zy = *slot) && (zy = malloc (sizeof (*zy))))
+  {
+    zy->first = tm_daysfromcivil (year, 1, 1);
+    zy->nb = tm_isleapcivilyear (year) ? 366 : 365;
+    tm_zonelocal zl;
+    for (int i = 0; zy && i <= zy->nb; i++)
+    {
+      time_t midnight = (time_t) (zy->first + i) * 86400;
+      if (tm_zonetableclassify (zt, midnight, &zl) == TM_ERROR)
+      {
+        free (zy);
+        zy = 0;
+      }
+      else
+        zy->delta[i] = zl.nb == 1 ? (int) (zl.tr[0].at - midnight) : TM_ZONEYEAR_UNRESOLVED;
+    }
+    __atomic_store_n (slot, zy, __ATOMIC_RELEASE);      // Published once fully built, for the lock-free reads above
   }
-  if (rep == TM_REF_UNCHANGED)
-    rep = tm_getwallclock (*tm);
-  rep = tm_getregisteredwallclock (rep, 1);
-  tm->tm_zone = rep;
-  tm->tm_isdst = -1;            // Let timezone information and system databases define DST flag.
+  pthread_mutex_unlock (&zoneyear_mutex);
+  return zy;
+}
 
-  struct tm copy = *tm;
+/// UTC instants of the beginning and of the end of a day on the wallclock of table zt.
+/// @returns TM_ERROR if the year of the day is not covered by the table, or if the day begins or ends at a midnight skipped or repeated.
+static tm_status
+tm_zonetableday (const tm_zonetable *zt, long int year, int month, int day, time_t *begin, time_t *end)
+{
+  const tm_zoneyear *zy = month < 1 || month > 12 || day < 1 || day > tm_daysincivilmonth (year, month) ? 0 : tm_zonetableyear (zt, year);
+  if (!zy)
+    return TM_ERROR;
+  long int days = tm_daysfromcivil (year, month, day);
+  int first = zy->delta[days - zy->first], next = zy->delta[days + 1 - zy->first];
+  if (first == TM_ZONEYEAR_UNRESOLVED || next == TM_ZONEYEAR_UNRESOLVED)
+    return TM_ERROR;
+  *begin = (time_t) days * 86400 + first;
+  *end = (time_t) (days + 1) * 86400 + next;
+  return TM_OK;
+}
 
-  time_t retval;
-  if (tm_normalize (tm, &retval) == TM_ERROR)
-    return (errno = EINVAL), TM_ERROR;
-  if (!tm_isutctimezone (rep))
+/// Sets dt to the UTC instant utc represented on wallclock wc, without switching TZ.
+/// @returns TM_ERROR if the transition table of wc is not available (or not built yet, see tm_zonetableacquireused) or does not cover utc.
+static tm_status
+tm_zonetablelocaltime (const char *wc, time_t utc, struct tm *dt)
+{
+  const tm_zonetable *zt = tm_zonetableacquireused (wc);
+  if (!zt || utc < zt->begin || utc >= zt->end)
   {
-    if (clock == TM_DST_OVER_ST)
-      tm_todaylightsavingextrasummertime (tm);
-    else if (clock == TM_ST_OVER_DST)
-      tm_todaylightsavingextrawintertime (tm);
-    else
-      return (errno = EINVAL), TM_ERROR;
+    tm_zonetablerelease (zt);
+    return TM_ERROR;
   }
+  tm_zonetransition tr = zt->tr[tm_zonetableindex (zt, utc)];
+  tm_zonetablerelease (zt);
 
-  if (tm->tm_year == copy.tm_year && tm->tm_mon == copy.tm_mon && tm->tm_mday == copy.tm_mday
-      && tm->tm_hour == copy.tm_hour && tm->tm_min == copy.tm_min && tm->tm_sec == copy.tm_sec)
-    return TM_OK;
-  else
-    return (errno = EINVAL), TM_ERROR;
+  time_t local = utc + tr.gmtoff;
+  if (!gmtime_r (&local, dt))   // time syscall
+    return TM_ERROR;
+  dt->tm_gmtoff = tr.gmtoff;
+  dt->tm_isdst = tr.isdst;
+  dt->tm_zone = wc;
+  return TM_OK;
 }
 
-// tm should have been initialized with tm_set first.
-tm_status
-tm_settimefromstring (struct tm *tm, const char *buf, const char *rep, tm_time_precedence clock)
+/// Seconds elapsed since 1970-01-01 00:00:00 on the wallclock of a normalized date.
+static time_t
+tm_tolocalseconds (struct tm date)
 {
-  char *ret;
+  return (time_t) tm_daysfromcivil (date.tm_year + 1900L, date.tm_mon + 1, date.tm_mday) * 86400 +
+    date.tm_hour * 3600 + date.tm_min * 60 + date.tm_sec;
+}
 
-  tm->tm_hour = tm->tm_min = tm->tm_sec = 0;
-  ret = strptime (buf, "%X", tm);       // time syscall
-  if (!ret || *ret)
-    ret = strptime (buf, "%EX", tm);
-  if (!ret || *ret)
-    ret = strptime (buf, "%H:%M:%S", tm);
-  if (!ret || *ret)
-    ret = strptime (buf, "%H %M %S", tm);
-  if (!ret || *ret)
-    ret = strptime (buf, "%H:%M", tm);
-  if (!ret || *ret)
-    ret = strptime (buf, "%H %M", tm);
-  if (!ret || *ret)
-    return (errno = EINVAL), TM_ERROR;
+/// Sets the fields of date (from tm_sec to tm_yday) from the seconds elapsed since 1970-01-01 00:00:00 on its wallclock, as gmtime_r would do.
+static void
+tm_fromlocalseconds (time_t local, struct tm *date)
+{
+  long int days = (long int) (local / 86400 - (local % 86400 < 0)), year;
+  int sod = (int) (local - (time_t) days * 86400), month, day;
+  tm_civilfromdays (days, &year, &month, &day);
+  date->tm_year = (int) (year - 1900);
+  date->tm_mon = month - 1;
+  date->tm_mday = day;
+  date->tm_hour = sod / 3600;
+  date->tm_min = sod / 60 % 60;
+  date->tm_sec = sod % 60;
+  date->tm_wday = tm_dayofweekfromdays (days);
+  date->tm_yday = (int) (days - tm_daysfromcivil (year, 1, 1));
+}
 
-  if (rep == TM_REF_UNCHANGED)
-    rep = tm_getwallclock (*tm);
-  rep = tm_getregisteredwallclock (rep, 1);
-  tm->tm_zone = rep;
-  tm->tm_isdst = -1;            // Let timezone information and system databases define DST flag.
+/// Returns 1 if date lies inside the overlap where DST gets out of effect, 0 otherwise.
+static int
+tm_isinsideoverlap (struct tm date)
+{
+  if (tm_isutctimezone (date.tm_zone))
+    return 0;
 
-  struct tm copy = *tm;
+  const tm_zonetable *zt = tm_zonetableacquire (date.tm_zone);
+  tm_zonelocal zl;
+  if (zt && tm_zonetableclassify (zt, tm_tolocalseconds (date), &zl) == TM_OK)
+  {
+    tm_zonetablerelease (zt);
+    return zl.nb == 2 && zl.tr[0].isdst != zl.tr[1].isdst;
+  }
+  tm_zonetablerelease (zt);
+  return tm_isdaylightsavingextrasummertime (date) || tm_isdaylightsavingextrawintertime (date);
+}
 
-  time_t retval;
-  if (tm_normalize (tm, &retval) == TM_ERROR)
+/// Sets the date and time held by the fields of tm (from tm_year to tm_sec) on wallclock rep.
+/// The local time is classified (unique, inside a DST gap or inside a DST overlap) by a single lookup in the transition table of rep,
+/// and clock decides between the two instants of an overlap.
+/// @returns TM_ERROR if the fields are out of range or inside a DST gap (the local time does not exist).
+/// @remark On error, tm is normalized (as mktime would do).
+static tm_status
+tm_resolvefields (struct tm *tm, const char *rep, tm_time_precedence clock)
+{
+  tm->tm_zone = rep;
+  if (!tm_isutctimezone (rep) && clock != TM_DST_OVER_ST && clock != TM_ST_OVER_DST)
     return (errno = EINVAL), TM_ERROR;
-  if (!tm_isutctimezone (rep))
+
+  if (tm->tm_year <= INT_MAX - 1901 && tm->tm_mon >= 0 && tm->tm_mon <= 11 && tm->tm_mday >= 1 &&
+      tm->tm_mday <= tm_daysincivilmonth (tm->tm_year + 1900L, tm->tm_mon + 1) &&
+      tm->tm_hour >= 0 && tm->tm_hour <= 23 && tm->tm_min >= 0 && tm->tm_min <= 59 && tm->tm_sec >= 0 && tm->tm_sec <= 59)
   {
-    if (clock == TM_DST_OVER_ST)
-      tm_todaylightsavingextrasummertime (tm);
-    else if (clock == TM_ST_OVER_DST)
-      tm_todaylightsavingextrawintertime (tm);
+    time_t local = tm_tolocalseconds (*tm);
+    struct tm dt;
+    if (tm_isutctimezone (rep))
+    {
+      if (gmtime_r (&local, &dt))       // time syscall
+      {
+        *tm = dt;
+        tm->tm_zone = rep;
+        return TM_OK;
+      }
+    }
     else
-      return (errno = EINVAL), TM_ERROR;
+    {
+      const tm_zonetable *zt = tm_zonetableacquireused (rep);
+      tm_zonelocal zl;
+      // Overlaps which are not due to DST (UTC offset changes without DST change) are left to mktime.
+      if (zt && tm_zonetableclassify (zt, local, &zl) == TM_OK && zl.nb && (zl.nb < 2 || zl.tr[0].isdst != zl.tr[1].isdst)
+          && gmtime_r (&local, &dt))    // time syscall
+      {
+        tm_zonetablerelease (zt);
+        const tm_zonetransition *tr = zl.tr;
+        if (zl.nb == 2 && (tr[1].isdst > 0) == (clock == TM_DST_OVER_ST))
+          tr++;
+        *tm = dt;
+        tm->tm_gmtoff = tr->gmtoff;
+        tm->tm_isdst = tr->isdst;
+        tm->tm_zone = rep;
+        return TM_OK;
+      }
+      tm_zonetablerelease (zt);
+    }
   }
 
+  // Out of the range of the transition table, fields out of range or inside a DST gap: let mktime resolve the local time, then apply clock inside an overlap.
+  struct tm copy = *tm;
+  tm->tm_isdst = -1;            // Let timezone information and system databases define DST flag.
+  if (tm_normalize (tm, 0) == TM_ERROR)
+    return (errno = EINVAL), TM_ERROR;
+  if (clock == TM_DST_OVER_ST)
+    tm_todaylightsavingextrasummertime (tm);
+  else
+    tm_todaylightsavingextrawintertime (tm);
+
   if (tm->tm_year == copy.tm_year && tm->tm_mon == copy.tm_mon && tm->tm_mday == copy.tm_mday
       && tm->tm_hour == copy.tm_hour && tm->tm_min == copy.tm_min && tm->tm_sec == copy.tm_sec)
     return TM_OK;
@@ -577,9 +975,418 @@ tm_settimefromstring (struct tm *tm, const char *buf, const char *rep, tm_time_p
     return (errno = EINVAL), TM_ERROR;
 }
 
+/*****************************************************
+*   CONSTRUCTORS                                     *
+*****************************************************/
+/// Sets tm to the instant now (seconds since the Epoch) or to midnight of its day, on wallclock rep.
+static tm_status
+tm_make_irat (struct tm *tm, time_t now, tm_predefined_instant instant, const char *rep)
+{
+  if (tm_isutctimezone (rep))
+  {
+    rep = tm_getregisteredwallclock (rep, 0);
+    gmtime_r (&now, tm);        // time syscall
+  }
+  else
+  {
+    rep = tm_getregisteredwallclock (rep, 1);
+    pthread_mutex_lock (&tzset_mutex);
+    const char *old_tz;
+    if (tm_tzset (rep, &old_tz) == TM_ERROR)
+    {
+      pthread_mutex_unlock (&tzset_mutex);
+      return (errno = EINVAL), TM_ERROR;
+    }
+    localtime_r (&now, tm);     // time syscall. For portable code, tzset(3) should be called before localtime_r().
+    tm_tzunset (old_tz);
+    pthread_mutex_unlock (&tzset_mutex);
+  }
+  tm->tm_zone = rep;
+
+  if (instant == TM_TODAY)
+  {
+    tm->tm_sec = tm->tm_min = tm->tm_hour = 0;
+    tm->tm_isdst = -1;          // Let timezone information and system databases define DST flag.
+    return tm_normalize (tm, 0);
+  }
+  else if (instant == TM_NOW)
+    return TM_OK;
+  else
+    return (errno = EINVAL), TM_ERROR;
+}
+
+int tm_is_now_cached = 0;       // Not cached by default
+
+// Per thread cache of the current time, for the last wallclocks used.
+#define TM_NOWCACHE_SIZE 4
+typedef struct
+{
+  int used;
+  const char *wc;               // Registered wallclock (0 for system time)
+  time_t now;                   // Second represented by dt
+  struct tm dt;
+  time_t todayfrom, todayuntil; // UTC instants of the day represented by today: [todayfrom, todayuntil)
+  struct tm today;
+} tm_nowcache;
+static _Thread_local tm_nowcache tm_nowcaches[TM_NOWCACHE_SIZE];
+static _Thread_local size_t tm_nowcachenext;
+
+/// Current time, in seconds since the Epoch, read from the coarse clock (no system call) where available.
+static time_t
+tm_coarsenow (void)
+{
+#ifdef CLOCK_REALTIME_COARSE
+  struct timespec ts;
+  if (!clock_gettime (CLOCK_REALTIME_COARSE, &ts))
+    return ts.tv_sec;
+#endif
+  return time (0);              // time syscall
+}
+
+/// Sets tm to the current time (or midnight of the current day) from the cache of the calling thread.
+static tm_status
+tm_make_ircached (struct tm *tm, tm_predefined_instant instant, const char *rep)
+{
+  const char *wc = tm_getregisteredwallclock (rep, !tm_isutctimezone (rep));
+  tm_nowcache *c = 0;
+  for (size_t i = 0; !c && i < TM_NOWCACHE_SIZE; i++)
+    if (tm_nowcaches[i].used && tm_nowcaches[i].wc == wc)
+      c = tm_nowcaches + i;
+  if (!c)
+  {
+    c = tm_nowcaches + tm_nowcachenext;
+    tm_nowcachenext = (tm_nowcachenext + 1) % TM_NOWCACHE_SIZE;
+    memset (c, 0, sizeof (*c));
+    c->used = 1;
+    c->wc = wc;
+    c->now = (time_t) - 1;
+  }
+
+  time_t now = tm_coarsenow ();
+  if (instant == TM_NOW)
+  {
+    if (c->now != now)
+    {
+      if (tm_make_irat (&c->dt, now, TM_NOW, wc) == TM_ERROR)
+        return (c->used = 0), TM_ERROR;
+      c->now = now;
+    }
+    *tm = c->dt;
+    return TM_OK;
+  }
+
+  if (now < c->todayfrom || now >= c->todayuntil)
+  {
+    struct tm tomorrow;
+    time_t until;
+    if (tm_make_irat (&c->today, now, TM_TODAY, wc) == TM_ERROR)
+      return (c->used = 0), TM_ERROR;
+    tomorrow = c->today;
+    tomorrow.tm_mday++;
+    tomorrow.tm_isdst = -1;     // Let timezone information and system databases define DST flag.
+    if (tm_normalize (&tomorrow, &until) == TM_ERROR)
+      return (c->used = 0), TM_ERROR;
+    c->todayfrom = tm_tolocalseconds (c->today) - c->today.tm_gmtoff;
+    c->todayuntil = until;
+  }
+  *tm = c->today;
+  return TM_OK;
+}
+
+tm_status
+tm_make_ir (struct tm *tm, tm_predefined_instant instant, const char *rep)
+{
+  if (rep == TM_REF_UNCHANGED)
+    rep = tm_getwallclock (*tm);
+
+  if (tm_is_now_cached && (instant == TM_NOW || instant == TM_TODAY))
+    return tm_make_ircached (tm, instant, rep);
+  return tm_make_irat (tm, time (0), instant, rep);     // time syscall
+}
+
+tm_status
+tm_make_dtrc (struct tm *tm, int year, tm_month month, int day, int hour, int min, int sec, const char *rep, tm_time_precedence clock)
+{
+  if (rep == TM_REF_UNCHANGED)
+    rep = tm_getwallclock (*tm);
+  rep = tm_getregisteredwallclock (rep, 1);
+
+  tm->tm_year = year - 1900;
+  if (tm->tm_year > year)
+    return (errno = EINVAL), TM_ERROR;
+  tm->tm_mon = (typeof (tm->tm_mon)) (month - 1);
+  tm->tm_mday = day;
+  tm->tm_hour = hour;
+  tm->tm_min = min;
+  tm->tm_sec = sec;
+
+  return tm_resolvefields (tm, rep, clock);
+}
+
+// Formats tried in turn by tm_setdatefromstring and tm_settimefromstring (resp.), until one matches the whole string.
+static const char *const tm_dateformats[] = { "%x", "%Ex", "%Y-%m-%d", "%Y−%m−%d", "%Y %m %d" };
+static const char *const tm_timeformats[] = { "%X", "%EX", "%H:%M:%S", "%H %M %S", "%H:%M", "%H %M" };
+
+#define TM_PARSER_MAX_FORMATS (sizeof (tm_timeformats) / sizeof (*tm_timeformats))
+#define TM_PARSER_MAX_PATTERN 128
+
+static int
+tm_getcurrentyear (void)
+{
+  time_t now = time (0);        // time syscall
+  struct tm tm_now;
+  tzset ();
+  localtime_r (&now, &tm_now);  // time syscall
+  return tm_now.tm_year + 1900; /* tm_year is the number of years since 1900. */
+}
+
+// Years on two digits are taken in the century closest to current_year (looked up only for such years if current_year is null).
+static void
+tm_setcentury (struct tm *tm, const int *current_year)
+{
+  int year = tm->tm_year + 1900;        /* tm_year is the number of years since 1900. */
+
+  if (year >= 0 && year < 100)
+    tm->tm_year += (typeof (tm->tm_year)) lround (((current_year ? *current_year : tm_getcurrentyear ()) - year) / 100.) * 100;
+}
+
+// Completes a date or time parsed by strptime: tm is represented on wallclock rep and should be left unchanged by normalization.
+static tm_status
+tm_setfromparsed (struct tm *tm, const char *rep, tm_time_precedence clock)
+{
+  if (rep == TM_REF_UNCHANGED)
+    rep = tm_getwallclock (*tm);
+  rep = tm_getregisteredwallclock (rep, 1);
+
+  return tm_resolvefields (tm, rep, clock);
+}
+
+// tm should have been initialized with tm_set first.
+tm_status
+tm_setdatefromstring (struct tm *tm, const char *buf, const char *rep, tm_time_precedence clock)
+{
+  char *ret = 0;
+
+  for (size_t i = 0; (!ret || *ret) && i < sizeof (tm_dateformats) / sizeof (*tm_dateformats); i++)
+    ret = strptime (buf, tm_dateformats[i], tm);        // time syscall
+  if (!ret || *ret)
+    return (errno = EINVAL), TM_ERROR;
+
+  tm_setcentury (tm, 0);
+  return tm_setfromparsed (tm, rep, clock);
+}
+
+// tm should have been initialized with tm_set first.
+tm_status
+tm_settimefromstring (struct tm *tm, const char *buf, const char *rep, tm_time_precedence clock)
+{
+  char *ret = 0;
+
+  tm->tm_hour = tm->tm_min = tm->tm_sec = 0;
+  for (size_t i = 0; (!ret || *ret) && i < sizeof (tm_timeformats) / sizeof (*tm_timeformats); i++)
+    ret = strptime (buf, tm_timeformats[i], tm);        // time syscall
+  if (!ret || *ret)
+    return (errno = EINVAL), TM_ERROR;
+
+  return tm_setfromparsed (tm, rep, clock);
+}
+
+// Adaptive parser: the format which matched last is tried first, since strings of a same source (e.g. a column of a spreadsheet)
+// usually share the same format.
+// Locale dependent formats (%x, %Ex, %X and %EX) are expanded once for all when the parser is created, as is the current year.
+typedef struct
+{
+  size_t nb;
+  size_t last;                  // Index of the pattern which matched last
+  char pattern[TM_PARSER_MAX_FORMATS][TM_PARSER_MAX_PATTERN];
+} tm_parserformats;
+
+struct tm_parser
+{
+  int current_year;
+  tm_parserformats date, time;
+};
+
+static void
+tm_parser_expand (tm_parserformats *pf, const char *const *formats, size_t nb)
+{
+  pf->nb = pf->last = 0;
+  for (size_t i = 0; i < nb; i++)
+  {
+    const char *pattern = formats[i];
+    if (!strcmp (pattern, "%x"))
+      pattern = nl_langinfo (D_FMT);
+    else if (!strcmp (pattern, "%X"))
+      pattern = nl_langinfo (T_FMT);
+    else if (!strcmp (pattern, "%Ex"))
+      pattern = nl_langinfo (ERA_D_FMT);
+    else if (!strcmp (pattern, "%EX"))
+      pattern = nl_langinfo (ERA_T_FMT);
+    if (!pattern || !*pattern)  // No alternative era in the locale: same as %x or %X.
+      continue;
+    if (strlen (pattern) >= TM_PARSER_MAX_PATTERN)
+      pattern = formats[i];
+    for (size_t j = 0; j < pf->nb && pattern; j++)
+      if (!strcmp (pf->pattern[j], pattern))
+        pattern = 0;            // Already there
+    if (pattern)
+      strcpy (pf->pattern[pf->nb++], pattern);
+  }
+}
+
+tm_parser *
+tm_parser_create (void)
+{
+  tm_parser *parser = malloc (sizeof (*parser));
+  if (!parser)
+    return (errno = ENOMEM), (tm_parser *) 0;
+
+  parser->current_year = tm_getcurrentyear ();
+  tm_parser_expand (&parser->date, tm_dateformats, sizeof (tm_dateformats) / sizeof (*tm_dateformats));
+  tm_parser_expand (&parser->time, tm_timeformats, sizeof (tm_timeformats) / sizeof (*tm_timeformats));
+  return parser;
+}
+
+void
+tm_parser_free (tm_parser *parser)
+{
+  free (parser);
+}
+
+static int
+tm_parser_match (tm_parserformats *pf, const char *buf, struct tm *tm)
+{
+  char *ret = strptime (buf, pf->pattern[pf->last], tm);        // time syscall
+  for (size_t i = 0; (!ret || *ret) && i < pf->nb; i++)
+    if (i != pf->last && (ret = strptime (buf, pf->pattern[i], tm)) && !*ret)   // time syscall
+      pf->last = i;
+  return ret && !*ret;
+}
+
+// tm should have been initialized with tm_set first.
+tm_status
+tm_parser_setdate (tm_parser *parser, struct tm *tm, const char *buf, const char *rep, tm_time_precedence clock)
+{
+  if (!parser || !tm || !buf)
+    return (errno = EINVAL), TM_ERROR;
+  if (!tm_parser_match (&parser->date, buf, tm))
+    return (errno = EINVAL), TM_ERROR;
+
+  tm_setcentury (tm, &parser->current_year);
+  return tm_setfromparsed (tm, rep, clock);
+}
+
+// tm should have been initialized with tm_set first.
+tm_status
+tm_parser_settime (tm_parser *parser, struct tm *tm, const char *buf, const char *rep, tm_time_precedence clock)
+{
+  if (!parser || !tm || !buf)
+    return (errno = EINVAL), TM_ERROR;
+  tm->tm_hour = tm->tm_min = tm->tm_sec = 0;
+  if (!tm_parser_match (&parser->time, buf, tm))
+    return (errno = EINVAL), TM_ERROR;
+
+  return tm_setfromparsed (tm, rep, clock);
+}
+
+// Sets dt to the absolute instant utc.
+// dt is represented in local time if the UTC offset of local time at that instant equals utcoffset, and in UTC otherwise.
+static tm_status
+tm_setfromutcoffset (struct tm *dt, time_t utc, int utcoffset)
+{
+  // The representation in local time is taken from its transition table (no TZ switching) if it covers utc.
+  struct tm localdt;
+  if (tm_zonetablelocaltime (tm_getregisteredwallclock (TM_REF_LOCALTIME, 1), utc, &localdt) == TM_ERROR)
+  {
+    if (!gmtime_r (&utc, &localdt))     // time syscall
+      return (errno = EINVAL), TM_ERROR;
+    localdt.tm_zone = tm_getregisteredwallclock (TM_REF_UTC, 0);
+    if (tm_changetowallclock (&localdt, TM_REF_LOCALTIME) == TM_ERROR)
+      return (errno = EINVAL), TM_ERROR;
+  }
+  if (tm_getutcoffset (localdt) == utcoffset)   // Does UTC offset match with local time ?
+  {
+    *dt = localdt;
+    return TM_OK;
+  }
+
+  if (!gmtime_r (&utc, dt))     // time syscall
+    return (errno = EINVAL), TM_ERROR;
+  dt->tm_zone = tm_getregisteredwallclock (TM_REF_UTC, 0);
+  return TM_OK;
+}
+
+// Fast path for the fixed layouts of machine-generated timestamps: YYYY-MM-DDThh:mm:ssZ (20 bytes) and YYYY-MM-DDThh:mm:ss.sssZ (24 bytes).
+// Digits and separators of the 16 first bytes are checked at once, digit pairs are converted with multiply-add.
+// Returns TM_ERROR, without setting errno, if str does not have this exact shape or holds values that the general parser handles (24:00:00, leap second).
+static tm_status
+tm_parseiso8601fixed (const char *str, time_t *utc)
+{
+  size_t len = strnlen (str, 25);
+  if ((len != 20 || str[19] != 'Z') && (len != 24 || str[19] != '.' || str[23] != 'Z'))
+    return TM_ERROR;
+
+  int year, month, day, hour, min, sec;
+#ifdef __SSE2__
+  // "YYYY-MM-DDThh:mm"
+  const __m128i v = _mm_loadu_si128 ((const __m128i *) str);
+  const __m128i d = _mm_sub_epi8 (v, _mm_set1_epi8 ('0'));
+  const __m128i isdigit = _mm_cmpeq_epi8 (_mm_min_epu8 (d, _mm_set1_epi8 (9)), d);      // bytes - '0' <= 9 (unsigned)
+  const __m128i digitlanes = _mm_setr_epi8 (-1, -1, -1, -1, 0, -1, -1, 0, -1, -1, 0, -1, -1, 0, -1, -1);
+  const __m128i separators = _mm_setr_epi8 (0, 0, 0, 0, '-', 0, 0, '-', 0, 0, 'T', 0, 0, ':', 0, 0);
+  const __m128i valid = _mm_or_si128 (_mm_and_si128 (isdigit, digitlanes), _mm_cmpeq_epi8 (v, separators));
+  if (_mm_movemask_epi8 (valid) != 0xFFFF)
+    return TM_ERROR;
+
+  // Digit pairs starting at even positions (YY, YY, DD, mm), then at odd positions (MM, hh), as 10 * tens + units.
+  const __m128i weights = _mm_setr_epi16 (10, 1, 10, 1, 10, 1, 10, 1);
+  const __m128i zero = _mm_setzero_si128 ();
+  const __m128i d1 = _mm_srli_si128 (d, 1);
+  int even[8], odd[8];
+  _mm_storeu_si128 ((__m128i *) even, _mm_madd_epi16 (_mm_unpacklo_epi8 (d, zero), weights));
+  _mm_storeu_si128 ((__m128i *) (even + 4), _mm_madd_epi16 (_mm_unpackhi_epi8 (d, zero), weights));
+  _mm_storeu_si128 ((__m128i *) odd, _mm_madd_epi16 (_mm_unpacklo_epi8 (d1, zero), weights));
+  _mm_storeu_si128 ((__m128i *) (odd + 4), _mm_madd_epi16 (_mm_unpackhi_epi8 (d1, zero), weights));
+  year = 100 * even[0] + even[1];
+  month = odd[2];
+  day = even[4];
+  hour = odd[5];
+  min = even[7];
+#else
+  static const char layout[] = "0000-00-00T00:00";
+  for (size_t i = 0; i < sizeof (layout) - 1; i++)
+    if (layout[i] == '0' ? (unsigned) (str[i] - '0') > 9 : str[i] != layout[i])
+      return TM_ERROR;
+#  define TM_DIGITS2(s) (10 * ((s)[0] - '0') + (s)[1] - '0')
+  year = 100 * TM_DIGITS2 (str) + TM_DIGITS2 (str + 2);
+  month = TM_DIGITS2 (str + 5);
+  day = TM_DIGITS2 (str + 8);
+  hour = TM_DIGITS2 (str + 11);
+  min = TM_DIGITS2 (str + 14);
+#  undef TM_DIGITS2
+#endif
+
+  // ":ss" and optional ".sss"
+  if (str[16] != ':' || (unsigned) (str[17] - '0') > 9 || (unsigned) (str[18] - '0') > 9)
+    return TM_ERROR;
+  sec = 10 * (str[17] - '0') + str[18] - '0';
+  if (len == 24 && ((unsigned) (str[20] - '0') > 9 || (unsigned) (str[21] - '0') > 9 || (unsigned) (str[22] - '0') > 9))
+    return TM_ERROR;
+
+  if (month < 1 || month > 12 || day < 1 || day > tm_daysincivilmonth (year, month) || hour > 23 || min > 59 || sec > 59)
+    return TM_ERROR;
+
+  *utc = (time_t) tm_daysfromcivil (year, month, day) * 86400 + 3600 * hour + 60 * min + sec;
+  return TM_OK;
+}
+
 tm_status
 tm_setfromiso8601 (struct tm *dt, char *str)
 {
+  time_t utc;
+  if (tm_parseiso8601fixed (str, &utc) == TM_OK)
+    return tm_setfromutcoffset (dt, utc, 0);
+
   // <date>T<time><tz>
   // <date> is YYYY-MM-DD or YYYYMMDD,
   //   YYYY indicates a four-digit year, 0000 through 9999.
@@ -692,717 +1499,4372 @@ tm_setfromiso8601 (struct tm *dt, char *str)
   return TM_OK;
 }
 
-static tm_status
-tm_tostring_fmt (struct tm dt, size_t max, char *str, const char *fmt)
-{
-  assert (fmt && *fmt);
-  if (!str || !max)
-    return (errno = EINVAL), TM_ERROR;
+// Names used by RFC 2822 and HTTP dates, whatever the regional settings.
+static const char tm_rfcdaynames[7][4] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+static const char tm_rfcmonthnames[12][4] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+static const char *const tm_rfcdayfullnames[7] = { "Sunday", "Monday", "Tuesday", "Wednesday", "Thursday", "Friday", "Saturday" };
 
-  // Provided that the result string, including the terminating null byte, does not exceed max bytes, strftime() returns the number of bytes (excluding the terminating null byte) placed in the array str.
-  // If the length of the result string (including the terminating null byte) would exceed max bytes, then strftime() returns 0, and the contents of the array are undefined.
-  // The return value 0 does not necessarily indicate an error. But POSIX.1-2001 does not specify any errno settings.
-  // This makes it impossible to distinguish this error case from cases where the format string legitimately produces a zero-length output string. For example, in many locales %p yields an empty string.
-  return strftime (str, max, fmt, &dt) ? TM_OK : TM_ERROR;      // time syscall.
+// Three ASCII letters packed into an integer, case ignored.
+static uint32_t
+tm_rfcnamekey (const char *p)
+{
+  return (uint32_t) (p[0] | 0x20) << 16 | (uint32_t) (p[1] | 0x20) << 8 | (uint32_t) (p[2] | 0x20);
 }
 
-tm_status
-tm_toiso8601 (struct tm dt, size_t max, char *str, int sep)
+// Compares n ASCII letters, case ignored (strncasecmp depends on regional settings).
+static int
+tm_rfcnameequals (const char *p, const char *name, size_t n)
 {
-  if (sep)
-    return tm_tostring_fmt (dt, max, str, "%Y-%m-%dT%H:%M:%S%z");
-  else
-    return tm_tostring_fmt (dt, max, str, "%Y%m%dT%H%M%S%z");
+  for (size_t i = 0; i < n; i++)
+    if (!p[i] || (p[i] | 0x20) != (name[i] | 0x20))
+      return 0;
+  return 1;
 }
 
-tm_status
-tm_timetostring (struct tm dt, size_t max, char *str)
+// Reads a name of three letters (case insensitive) among names.
+static const char *
+tm_rfcscanname (const char *p, const char (*names)[4], int nb, int *index)
 {
-  const char *fmt[] = { "%X", "%X (%Z)", "%X (UTC%z)", "%X (%Z,UTC%z)" };
-  size_t index = 2U * (tm_isinsidedaylightsavingtimeoverlap (dt) ? 1 : 0) + (tm_isdefinedinlocaltime (dt) ? 0 : 1);
-  return tm_tostring_fmt (dt, max, str, fmt[index]);
+  if (!p || !p[0] || !p[1] || !p[2])
+    return 0;
+  uint32_t key = tm_rfcnamekey (p);
+  for (int i = 0; i < nb; i++)
+    if (tm_rfcnamekey (names[i]) == key)
+    {
+      *index = i;
+      return p + 3;
+    }
+  return 0;
 }
 
-tm_status
-tm_datetostring (struct tm dt, size_t max, char *str)
+// Reads from min to max decimal digits.
+static const char *
+tm_rfcscandigits (const char *p, int min, int max, int *value)
 {
-  const char *fmt = "%x";
-  if (!tm_isdefinedinlocaltime (dt))
-    fmt = "%x (%Z)";
-  return tm_tostring_fmt (dt, max, str, fmt);
+  int n = 0;
+  if (!p)
+    return 0;
+  for (*value = 0; n < max && *p >= '0' && *p <= '9'; n++, p++)
+    *value = *value * 10 + (*p - '0');
+  return n >= min ? p : 0;
 }
 
-tm_status
-tm_tostring (struct tm dt, size_t max, char *str)
+static const char *
+tm_rfcscanchar (const char *p, char c)
 {
-  const char *fmt[] = { "%x %X", "%x %X (%Z)", "%x %X (UTC%z)", "%x %X (%Z,UTC%z)" };
-  size_t index = 2U * (tm_isinsidedaylightsavingtimeoverlap (dt) ? 1 : 0) + (tm_isdefinedinlocaltime (dt) ? 0 : 1);
-  return tm_tostring_fmt (dt, max, str, fmt[index]);
+  return p && *p == c ? p + 1 : 0;
 }
 
-tm_status
-dt_tostring (struct tm dt, size_t max, char *str)
+// Folding white spaces (RFC 2822 FWS), optional.
+static const char *
+tm_rfcskipspaces (const char *p)
 {
-  return tm_tostring_fmt (dt, max, str, "%x");
+  while (p && (*p == ' ' || *p == '\t' || (*p == '\r' && p[1] == '\n' && (p[2] == ' ' || p[2] == '\t'))))
+    p += *p == '\r' ? 2 : 1;
+  return p;
 }
 
-tm_status
-dt_toiso8601 (struct tm dt, size_t max, char *str, int sep)
+// At least one white space.
+static const char *
+tm_rfcscanspaces (const char *p)
 {
-  if (sep)
-    return tm_tostring_fmt (dt, max, str, "%Y-%m-%d");
-  else
-    return tm_tostring_fmt (dt, max, str, "%Y%m%d");
+  return p && (*p == ' ' || *p == '\t') ? tm_rfcskipspaces (p) : 0;
 }
 
-tm_status
-dt_setfromiso8601 (struct tm *dt, char *str)
+// Checks the fields and computes the UTC instant they denote.
+static tm_status
+tm_rfcfieldstoutc (long int year, int month, int day, int hour, int min, int sec, int utcoffset, int wday, time_t *utc)
 {
-  if (tm_setfromiso8601 (dt, str) == TM_ERROR)
-    return TM_ERROR;
+  if (month < 1 || month > 12 || day < 1 || day > tm_daysincivilmonth (year, month) || hour > 23 || min > 59 || sec > 60)
+    return (errno = EINVAL), TM_ERROR;
+  if (sec == 60)                // 60 is only used to denote an added leap second managed by the system, and is ignored here
+    sec = 59;
 
-  dt->tm_zone = tm_getregisteredwallclock (TM_REF_UTC, 0);
+  long int days = tm_daysfromcivil (year, month, day);
+  if (wday >= 0 && wday != tm_dayofweekfromdays (days))
+    return (errno = EINVAL), TM_ERROR;
+  *utc = (time_t) days * 86400 + hour * 3600 + min * 60 + sec - utcoffset;
   return TM_OK;
 }
 
-tm_status
-dt_make_ir (struct tm *date, const char *wc)
+// Checks the fields and sets dt as tm_setfromiso8601 does.
+static tm_status
+tm_setfromrfcfields (struct tm *dt, long int year, int month, int day, int hour, int min, int sec, int utcoffset, int wday)
 {
-  if (tm_make_ir (date, TM_TODAY, wc) == TM_ERROR)
+  time_t utc;
+  if (tm_rfcfieldstoutc (year, month, day, hour, min, sec, utcoffset, wday, &utc) == TM_ERROR)
     return TM_ERROR;
+  return tm_setfromutcoffset (dt, utc, utcoffset);
+}
 
-  date->tm_zone = tm_getregisteredwallclock (TM_REF_UTC, 0);
-  return TM_OK;
+// RFC 3339: YYYY-MM-DDThh:mm:ss[.s+](Z|±hh:mm), T and Z being case insensitive, T possibly replaced by a space.
+// unknownoffset is set if the offset to local time is unknown (Z or -00:00, see RFC 9557).
+// Returns the end of the scanned string, 0 on error.
+static const char *
+tm_rfcscan3339 (const char *str, time_t *utc, int *utcoffset, int *unknownoffset)
+{
+  int year, month, day, hour, min, sec, gh = 0, gm = 0, sign = 1;
+  const char *p = tm_rfcscandigits (str, 4, 4, &year);
+  p = tm_rfcscandigits (tm_rfcscanchar (p, '-'), 2, 2, &month);
+  p = tm_rfcscandigits (tm_rfcscanchar (p, '-'), 2, 2, &day);
+  if (!p || (*p != 'T' && *p != 't' && *p != ' '))
+    return 0;
+  p = tm_rfcscandigits (p + 1, 2, 2, &hour);
+  p = tm_rfcscandigits (tm_rfcscanchar (p, ':'), 2, 2, &min);
+  p = tm_rfcscandigits (tm_rfcscanchar (p, ':'), 2, 2, &sec);
+  if (p && *p == '.' && p[1] >= '0' && p[1] <= '9')
+    for (p++; *p >= '0' && *p <= '9'; p++)
+      ;                         // Decimal fraction of second is ignored
+  *unknownoffset = p && (*p == 'Z' || *p == 'z');
+  if (*unknownoffset)
+    p++;
+  else if (p && (*p == '+' || *p == '-'))
+  {
+    sign = *p == '-' ? -1 : 1;
+    p = tm_rfcscandigits (p + 1, 2, 2, &gh);
+    p = tm_rfcscandigits (tm_rfcscanchar (p, ':'), 2, 2, &gm);
+    *unknownoffset = sign < 0 && !gh && !gm;
+  }
+  else
+    p = 0;
+  if (!p || gh > 23 || gm > 59)
+    return 0;
+
+  *utcoffset = sign * (gh * 3600 + gm * 60);
+  return tm_rfcfieldstoutc (year, month, day, hour, min, sec, *utcoffset, -1, utc) == TM_OK ? p : 0;
 }
 
-/*****************************************************
-*   CONVERTERS                                       *
-**************************************************** */
+tm_status
+tm_setfromrfc3339 (struct tm *dt, const char *str)
+{
+  time_t utc;
+  int utcoffset, unknownoffset;
+  const char *p = str ? tm_rfcscan3339 (str, &utc, &utcoffset, &unknownoffset) : 0;
+  if (!dt || !p || *p)
+    return (errno = EINVAL), TM_ERROR;
 
-static tm_status
-tm_toutcrepresentation (struct tm *date)
+  return tm_setfromutcoffset (dt, utc, utcoffset);
+}
+
+// RFC 9557 time-zone-name: parts separated by '/', each starting with a letter, '.' or '_', followed by letters, digits, '.', '_', '-' or '+',
+// and other than "." and "..". Different spellings of a same zone (Europe//Paris, ./Europe/Paris) are thus rejected.
+static int
+tm_rfciszonename (const char *name)
 {
-  if (!tm_isdefinedinutc (*date))
+  for (const char *part = name;; part++)
   {
-    time_t local;
-    if (tm_normalize (date, &local) != TM_ERROR && gmtime_r (&local, date)      // time syscall
-        && date->tm_year + 1900 + 1 > date->tm_year)
-    {
-      date->tm_zone = tm_getregisteredwallclock (TM_REF_UTC, 0);
-      return TM_OK;
-    }
-    else
-      return (errno = EINVAL), TM_ERROR;
+    size_t n = strspn (part, "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789._-+");
+    if (!n || (*part >= '0' && *part <= '9') || *part == '-' || *part == '+' || (n == 1 && *part == '.')
+        || (n == 2 && part[0] == '.' && part[1] == '.'))
+      return 0;
+    part += n;
+    if (*part != '/')
+      return !*part;
   }
-  else
-    return TM_OK;
 }
 
-static tm_status
-tm_totimezonerepresentation (struct tm *date, const char *rep)
+// Registered wallclock of a time zone suffix: an unknown zone is checked by tzset before being registered,
+// so that invalid suffixes do not fill the registry. A full registry is reported as an error rather than falling back to system time.
+static const char *
+tm_rfcresolvezone (const char *name)
+{
+  if (!tm_rfciszonename (name))
+    return TM_REF_UNDEFINED;
+  const char *wc = tm_getregisteredwallclock (name, 0);
+  if (wc != TM_REF_UNDEFINED)
+    return wc;
+
+  pthread_mutex_lock (&tzset_mutex);
+  const char *old_tz;
+  tm_status ret = tm_tzset (name, &old_tz);
+  if (ret == TM_OK)
+    tm_tzunset (old_tz);
+  pthread_mutex_unlock (&tzset_mutex);
+  if (ret == TM_ERROR || !(wc = tm_getregisteredwallclock (name, 1)) || wc == TM_REF_UNDEFINED || strcmp (wc, name))
+    return TM_REF_UNDEFINED;
+  return wc;
+}
+
+// RFC 9557: RFC 3339 date and time, followed by a time zone suffix [Zone] and suffix tags [key=value],
+// any of them possibly flagged as critical by a leading '!' ([!Zone]).
+// dt is represented in the time zone of the suffix (or as tm_setfromrfc3339 does without time zone suffix).
+tm_status
+tm_setfromrfc9557 (struct tm *dt, const char *str)
 {
   time_t utc;
-  if (tm_normalize (date, &utc) != TM_ERROR)
+  int utcoffset, unknownoffset;
+  const char *p = str ? tm_rfcscan3339 (str, &utc, &utcoffset, &unknownoffset) : 0;
+  if (!dt || !p)
+    return (errno = EINVAL), TM_ERROR;
+
+  const char *wc = 0;
+  int critical = 0;
+  for (int first = 1; *p == '['; first = 0)
   {
-    rep = tm_getregisteredwallclock (rep, 1);
-    pthread_mutex_lock (&tzset_mutex);
-    const char *old_tz;
-    if (tm_tzset (rep, &old_tz) == TM_ERROR)
-    {
-      pthread_mutex_unlock (&tzset_mutex);
-      return TM_ERROR;
-    }
-    if (localtime_r (&utc, date)        // time syscall
-        && date->tm_year + 1900 + 1 > date->tm_year)
+    const char *q = strchr (p, ']');
+    size_t n;
+    if (!q || (n = (size_t) (q - ++p)) == 0)
+      return (errno = EINVAL), TM_ERROR;
+    int flag = *p == '!';
+    p += flag, n -= (size_t) flag;
+    if (!n || memchr (p, '[', n))
+      return (errno = EINVAL), TM_ERROR;
+    if (memchr (p, '=', n))     // Suffix tag, ignored unless critical
     {
-      tm_tzunset (old_tz);
-      pthread_mutex_unlock (&tzset_mutex);
-      date->tm_zone = rep;
-      return TM_OK;
+      if (flag)
+        return (errno = EINVAL), TM_ERROR;
     }
+    else if (!first || n >= WALLCLOCK_MAX_LENGTH)       // The time zone suffix comes first
+      return (errno = EINVAL), TM_ERROR;
     else
     {
-      tm_tzunset (old_tz);
-      pthread_mutex_unlock (&tzset_mutex);
-      return (errno = EINVAL), TM_ERROR;
+      char name[WALLCLOCK_MAX_LENGTH];
+      memcpy (name, p, n);
+      name[n] = 0;
+      critical = flag;
+      if (*name == '+' || *name == '-') // Numeric offset
+      {
+        int gh, gm;
+        const char *r = tm_rfcscandigits (tm_rfcscanchar (tm_rfcscandigits (name + 1, 2, 2, &gh), ':'), 2, 2, &gm);
+        if (!r || *r || gh > 23 || gm > 59)
+          return (errno = EINVAL), TM_ERROR;
+        int offset = (*name == '-' ? -1 : 1) * (gh * 3600 + gm * 60);
+        if (critical && !unknownoffset && offset != utcoffset)  // Inconsistent offset
+          return (errno = EINVAL), TM_ERROR;
+        utcoffset = offset;
+      }
+      else if ((wc = tm_rfcresolvezone (name)) == TM_REF_UNDEFINED)
+        return (errno = EINVAL), TM_ERROR;
     }
+    p = q + 1;
   }
-  else
+  if (*p)
+    return (errno = EINVAL), TM_ERROR;
+
+  if (!wc)
+    return tm_setfromutcoffset (dt, utc, utcoffset);
+
+  // The date and time, and its UTC offset, are taken from the transition table of the time zone (no TZ switching).
+  struct tm local;
+  if (tm_zonetablelocaltime (wc, utc, &local) == TM_ERROR       // Out of the range of the table
+      && (tm_setfromutcoffset (&local, utc, utcoffset) == TM_ERROR || tm_changetowallclock (&local, wc) == TM_ERROR))
     return (errno = EINVAL), TM_ERROR;
+  if (critical && !unknownoffset && local.tm_gmtoff != utcoffset)       // Inconsistent offset
+    return (errno = EINVAL), TM_ERROR;
+  *dt = local;
+  return TM_OK;
 }
 
-// wc should conform to format accepted by tzset (see man tzset)
-// On Linux, possible values can be listed with command 'find /usr/share/zoneinfo \! -type d | sort'
-tm_status
-tm_changetowallclock (struct tm *date, const char *wc)
+// Obsolete time zones of RFC 822 (military zones are considered as -0000, i.e. UTC, as advised by RFC 2822).
+static const char *
+tm_rfcscanzone (const char *p, int *utcoffset)
 {
-  if (tm_isutctimezone (wc))
-    return tm_toutcrepresentation (date);
-  else
-    return tm_totimezonerepresentation (date, wc);
-}
+  static const struct
+  {
+    const char name[4];
+    int utcoffset;
+  } zones[] = { {"UT", 0}, {"GMT", 0}, {"EST", -5}, {"EDT", -4}, {"CST", -6}, {"CDT", -5}, {"MST", -7}, {"MDT", -6}, {"PST", -8}, {"PDT", -7} };
 
-/*****************************************************
-*   CALENDAR PROPERTIES                              *
-*****************************************************/
+  if (p && (*p == '+' || *p == '-'))
+  {
+    int sign = *p == '-' ? -1 : 1, hhmm;
+    if (!(p = tm_rfcscandigits (p + 1, 4, 4, &hhmm)) || hhmm % 100 > 59)
+      return 0;
+    *utcoffset = sign * (hhmm / 100 * 3600 + hhmm % 100 * 60);
+    return p;
+  }
+  size_t n = 0;
+  while (p && n < 4 && ((p[n] | 0x20) >= 'a' && (p[n] | 0x20) <= 'z'))
+    n++;
+  if (n == 1)
+    return (*utcoffset = 0), p + 1;
+  for (size_t i = 0; n > 1 && n < 4 && i < sizeof (zones) / sizeof (*zones); i++)
+    if (strlen (zones[i].name) == n && tm_rfcnameequals (p, zones[i].name, n))
+      return (*utcoffset = zones[i].utcoffset * 3600), p + n;
+  return 0;
+}
 
-int
-tm_getdaysinyear (int year)
+// RFC 2822: [Day,] DD Mon YYYY hh:mm[:ss] zone, where zone is ±hhmm or an obsolete zone name (GMT, UT, EST, ...).
+tm_status
+tm_setfromrfc2822 (struct tm *dt, const char *str)
 {
-  struct tm debut, fin;
-  if (tm_set (&debut, year, TM_JANUARY, 1, 0, 0, 0) == TM_OK && tm_set (&fin, year + 1, TM_JANUARY, 1, 0, 0, 0) == TM_OK)
-    return tm_diffcalendardays (debut, fin);
-  else
-    return (errno = EINVAL), 0;
+  int wday = -1, day, month, year, hour, min, sec = 0, utcoffset = 0;
+  const char *p = tm_rfcskipspaces (str);
+  if (p && ((*p | 0x20) >= 'a' && (*p | 0x20) <= 'z'))
+    p = tm_rfcskipspaces (tm_rfcscanchar (tm_rfcskipspaces (tm_rfcscanname (p, tm_rfcdaynames, 7, &wday)), ','));
+  p = tm_rfcscanspaces (tm_rfcscandigits (p, 1, 2, &day));
+  p = tm_rfcscanspaces (tm_rfcscanname (p, tm_rfcmonthnames, 12, &month));
+  const char *q = p;
+  p = tm_rfcscandigits (p, 2, 9, &year);
+  if (p && p - q == 2)          // Obsolete years on 2 or 3 digits (RFC 2822, section 4.3)
+    year += year < 50 ? 2000 : 1900;
+  else if (p && p - q == 3)
+    year += 1900;
+  p = tm_rfcscanspaces (p);
+  p = tm_rfcscandigits (p, 2, 2, &hour);
+  p = tm_rfcskipspaces (tm_rfcscanchar (tm_rfcskipspaces (p), ':'));
+  p = tm_rfcscandigits (p, 2, 2, &min);
+  const char *r = tm_rfcskipspaces (p);
+  if (r && *r == ':')
+    p = tm_rfcscandigits (tm_rfcskipspaces (r + 1), 2, 2, &sec);
+  p = tm_rfcskipspaces (tm_rfcscanzone (tm_rfcscanspaces (p), &utcoffset));
+  if (!dt || !p || *p)
+    return (errno = EINVAL), TM_ERROR;
+
+  return tm_setfromrfcfields (dt, year, month + 1, day, hour, min, sec, utcoffset, wday);
 }
 
-int
-tm_isleapyear (int year)
+// hh:mm:ss
+static const char *
+tm_rfcscantime (const char *p, int *hour, int *min, int *sec)
 {
-  // Nonzero if year is a leap year (every 4 years, except every 100th isn't, and every 400th is).
-  return tm_getdaysinyear (year) == 366 ? 1 : 0;
-  //return year % 400 == 0 || (year % 4 == 0 && year % 100 != 0);
+  p = tm_rfcscandigits (p, 2, 2, hour);
+  p = tm_rfcscandigits (tm_rfcscanchar (p, ':'), 2, 2, min);
+  return tm_rfcscandigits (tm_rfcscanchar (p, ':'), 2, 2, sec);
 }
 
-int                             /* set_errno */
-tm_getweeksinisoyear (int isoyear)
+// HTTP-date (RFC 9110, section 5.6.7): IMF-fixdate "Sun, 06 Nov 1994 08:49:37 GMT",
+// and the obsolete formats RFC 850 "Sunday, 06-Nov-94 08:49:37 GMT" and asctime "Sun Nov  6 08:49:37 1994".
+tm_status
+tm_setfromhttpdate (struct tm *dt, const char *str)
 {
-  struct tm date;
-
-  if (isoyear + 1 < isoyear || tm_make_dtrc (&date, isoyear + 1, TM_JANUARY, 4, 0, 0, 0, TM_REF_LOCALTIME, TM_ST_OVER_DST) == TM_ERROR || tm_adddays (&date, -7) == TM_ERROR)
-    return (errno = EINVAL), 0;
+  int wday = -1, day, month, year, hour, min, sec;
+  const char *p = tm_rfcscanname (str, tm_rfcdaynames, 7, &wday);
+  if (p && *p == ',')           // IMF-fixdate
+  {
+    p = tm_rfcscandigits (tm_rfcscanchar (p + 1, ' '), 2, 2, &day);
+    p = tm_rfcscanname (tm_rfcscanchar (p, ' '), tm_rfcmonthnames, 12, &month);
+    p = tm_rfcscandigits (tm_rfcscanchar (p, ' '), 4, 4, &year);
+    p = tm_rfcscantime (tm_rfcscanchar (p, ' '), &hour, &min, &sec);
+    p = tm_rfcscanchar (p, ' ');
+    p = p && tm_rfcnameequals (p, "GMT", 3) ? p + 3 : 0;
+  }
+  else if (p && *p == ' ')      // asctime
+  {
+    p = tm_rfcscanname (p + 1, tm_rfcmonthnames, 12, &month);
+    p = tm_rfcscanchar (p, ' ');
+    p = tm_rfcscandigits (p && *p == ' ' ? p + 1 : p, 1, 2, &day);
+    p = tm_rfcscantime (tm_rfcscanchar (p, ' '), &hour, &min, &sec);
+    p = tm_rfcscandigits (tm_rfcscanchar (p, ' '), 4, 4, &year);
+  }
+  else if (p)                   // RFC 850
+  {
+    size_t n = strlen (tm_rfcdayfullnames[wday]);
+    p = tm_rfcnameequals (str, tm_rfcdayfullnames[wday], n) ? tm_rfcscanchar (str + n, ',') : 0;
+    p = tm_rfcscandigits (tm_rfcscanchar (p, ' '), 2, 2, &day);
+    p = tm_rfcscanname (tm_rfcscanchar (p, '-'), tm_rfcmonthnames, 12, &month);
+    p = tm_rfcscandigits (tm_rfcscanchar (p, '-'), 2, 2, &year);
+    p = tm_rfcscantime (tm_rfcscanchar (p, ' '), &hour, &min, &sec);
+    p = tm_rfcscanchar (p, ' ');
+    p = p && tm_rfcnameequals (p, "GMT", 3) ? p + 3 : 0;
+    if (p)
+    {
+      // A year on two digits which appears to be more than 50 years in the future is in the past.
+      time_t now = time (0);    // time syscall
+      long int current_year;
+      int m, d;
+      tm_civilfromdays (tm_daysfromseconds (now), &current_year, &m, &d);
+      year += (int) (current_year - current_year % 100);
+      if (year > current_year + 50)
+        year -= 100;
+    }
+  }
+  if (!dt || !p || *p)
+    return (errno = EINVAL), TM_ERROR;
 
-  return tm_getisoweek (date);
+  return tm_setfromrfcfields (dt, year, month + 1, day, hour, min, sec, 0, wday);
 }
 
-int                             /* set_errno */
-tm_getdaysinmonth (int year, tm_month month)
+// ISO 8601 week date: YYYY-Www-D or YYYYWwwD (or YYYY-Www and YYYYWww for the Monday).
+// Returns the end of the scanned string, 0 on error.
+static const char *
+tm_isoscanweekdate (const char *str, long int *days)
 {
-  int ret = 1;                  // not 0
-
-  struct tm date;
-
-  if (tm_make_dtrc (&date, year, month, 1, 0, 0, 0, TM_REF_LOCALTIME, TM_ST_OVER_DST) == TM_ERROR)
-    return (errno = EINVAL), 0;
-
-  ret -= tm_getdayofyear (date);
-  if (tm_addmonths (&date, 1) == TM_ERROR || tm_adddays (&date, -1) == TM_ERROR)
-    return (errno = EINVAL), 0;
-  ret += tm_getdayofyear (date);
+  int year, week, weekday = 1;
+  const char *p = tm_rfcscandigits (str, 4, 4, &year);
+  int extended = p && *p == '-';
+  p = tm_rfcscandigits (tm_rfcscanchar (extended ? p + 1 : p, 'W'), 2, 2, &week);
+  if (p && (extended ? *p == '-' : *p >= '0' && *p <= '9'))
+    p = tm_rfcscandigits (extended ? p + 1 : p, 1, 1, &weekday);
+  if (!p || week < 1 || week > tm_isoweeksinyear (year) || weekday < 1 || weekday > 7)
+    return 0;
 
-  return ret;
+  *days = tm_isoweekonefromyear (year) + 7 * (week - 1) + weekday - 1;
+  return p;
 }
 
-int                             /* set_errno */
-tm_getsecondsinday (int year, tm_month month, int day, const char *rep)
+// ISO 8601 ordinal date: YYYY-DDD or YYYYDDD.
+static const char *
+tm_isoscanordinaldate (const char *str, long int *days)
 {
-  if (rep == TM_REF_UNCHANGED)
-    return (errno = EINVAL), 0;
-
-  struct tm date;
-
-  if (tm_make_dtrc (&date, year, month, day, 0, 0, 0, rep, TM_ST_OVER_DST) == TM_ERROR)
-    return (errno = EINVAL), 0;
-
-  time_t deb, fin;
-
-  if (tm_normalize (&date, &deb) == TM_ERROR || tm_adddays (&date, 1) == TM_ERROR || tm_normalize (&date, &fin) == TM_ERROR)
-    return (errno = EINVAL), 0;
+  int year, yday;
+  const char *p = tm_rfcscandigits (str, 4, 4, &year);
+  p = tm_rfcscandigits (p && *p == '-' ? p + 1 : p, 3, 3, &yday);
+  if (!p || yday < 1 || yday > 365 + tm_isleapcivilyear (year))
+    return 0;
 
-  return (int) (fin - deb);
+  *days = tm_daysfromcivil (year, 1, 1) + yday - 1;
+  return p;
 }
 
-int                             /* set_errno */
-tm_getfirstweekdayinmonth (int year, tm_month month, tm_dayofweek dow)
+// Sets dt to midnight of day number days, on wallclock wc (without any normalization in UTC).
+static tm_status
+tm_setfromdays (struct tm *dt, long int days, const char *wc)
 {
-  if (dow < 1 || dow > 7)
-    return (errno = EINVAL), 0;
+  if (!tm_isutctimezone (wc))
+  {
+    long int year;
+    int month, day;
+    tm_civilfromdays (days, &year, &month, &day);
+    return tm_make_dtrc (dt, (int) year, month, day, 0, 0, 0, wc, TM_ST_OVER_DST);
+  }
 
-  struct tm date;
+  time_t utc = (time_t) days * 86400;
+  if (!gmtime_r (&utc, dt))     // time syscall
+    return (errno = EINVAL), TM_ERROR;
+  dt->tm_zone = tm_getregisteredwallclock (TM_REF_UTC, 0);
+  return TM_OK;
+}
 
-  if (tm_make_dtrc (&date, year, month, 1, 0, 0, 0, TM_REF_LOCALTIME, TM_ST_OVER_DST) == TM_ERROR)
-    return (errno = EINVAL), 0;
+tm_status
+tm_setfromisoweekdate (struct tm *dt, const char *str, const char *wc)
+{
+  long int days;
+  const char *p = str ? tm_isoscanweekdate (str, &days) : 0;
+  if (!dt || !p || *p)
+    return (errno = EINVAL), TM_ERROR;
 
-  return (int) ((dow - tm_getdayofweek (date) + 7U) % 7U + 1U);
+  return tm_setfromdays (dt, days, wc);
 }
 
-int                             /* set_errno */
-tm_getlastweekdayinmonth (int year, tm_month month, tm_dayofweek dow)
+tm_status
+tm_setfromisoordinaldate (struct tm *dt, const char *str, const char *wc)
 {
-  if (dow < 1 || dow > 7)
-    return (errno = EINVAL), 0;
-
-  struct tm date;
+  long int days;
+  const char *p = str ? tm_isoscanordinaldate (str, &days) : 0;
+  if (!dt || !p || *p)
+    return (errno = EINVAL), TM_ERROR;
 
-  int savederrno = errno;
-  errno = 0;
-  int last = tm_getdaysinmonth (year, month);
-  if (errno)
-    return 0;
-  errno = savederrno;
+  return tm_setfromdays (dt, days, wc);
+}
 
-  if (tm_make_dtrc (&date, year, month, last, 0, 0, 0, TM_REF_LOCALTIME, TM_ST_OVER_DST) == TM_ERROR)
+// Day numbers (elapsed since 1970-01-01) of n strings.
+// Returns the number of strings converted; stops at the first invalid string and sets errno to EINVAL.
+size_t
+tm_daysfromisoweekdate_n (const char *const *in, size_t n, long int *days)
+{
+  if (n && (!in || !days))
     return (errno = EINVAL), 0;
 
-  int diff = (int) (dow - tm_getdayofweek (date));
-
-  return last + diff + (diff > 0 ? -7 : 0);
+  for (size_t i = 0; i < n; i++)
+  {
+    const char *p = in[i] ? tm_isoscanweekdate (in[i], days + i) : 0;
+    if (!p || *p)
+      return (errno = EINVAL), i;
+  }
+  return n;
 }
 
-int                             /* set_errno */
-tm_getfirstweekdayinisoyear (int isoyear, tm_dayofweek dow)
+size_t
+tm_daysfromisoordinaldate_n (const char *const *in, size_t n, long int *days)
 {
-  if (dow < 1 || dow > 7)
+  if (n && (!in || !days))
     return (errno = EINVAL), 0;
 
-  struct tm date;
-
-  int savederrno = errno;
-  errno = 0;
-  int ret = tm_getfirstweekdayinmonth (isoyear, TM_JANUARY, dow) + 7;
-  if (errno)
-    return 0;
-  errno = savederrno;
+  for (size_t i = 0; i < n; i++)
+  {
+    const char *p = in[i] ? tm_isoscanordinaldate (in[i], days + i) : 0;
+    if (!p || *p)
+      return (errno = EINVAL), i;
+  }
+  return n;
+}
 
-  if (tm_make_dtrc (&date, isoyear, TM_JANUARY, ret, 0, 0, 0, TM_REF_LOCALTIME, TM_ST_OVER_DST) == TM_ERROR)
-    return (errno = EINVAL), 0;
+static tm_status
+tm_tostring_fmt (struct tm dt, size_t max, char *str, const char *fmt)
+{
+  assert (fmt && *fmt);
+  if (!str || !max)
+    return (errno = EINVAL), TM_ERROR;
 
-  return ret + 7 - 7 * tm_getisoweek (date);
+  // Provided that the result string, including the terminating null byte, does not exceed max bytes, strftime() returns the number of bytes (excluding the terminating null byte) placed in the array str.
+  // If the length of the result string (including the terminating null byte) would exceed max bytes, then strftime() returns 0, and the contents of the array are undefined.
+  // The return value 0 does not necessarily indicate an error. But POSIX.1-2001 does not specify any errno settings.
+  // This makes it impossible to distinguish this error case from cases where the format string legitimately produces a zero-length output string. For example, in many locales %p yields an empty string.
+  return strftime (str, max, fmt, &dt) ? TM_OK : TM_ERROR;      // time syscall.
 }
 
-/*****************************************************
-*   DATE PROPERTIES                                  *
-*****************************************************/
+static const char tm_digitpairs[] =
+  "00010203040506070809" "10111213141516171819" "20212223242526272829" "30313233343536373839" "40414243444546474849"
+  "50515253545556575859" "60616263646566676869" "70717273747576777879" "80818283848586878889" "90919293949596979899";
 
-tm_dayofweek
-tm_getdayofweek (struct tm date)
+static char *
+tm_writedigits2 (char *p, int value)
 {
-  return (date.tm_wday + 6) % 7 + 1;    /* Monday = 1, Sunday = 7 */
+  memcpy (p, tm_digitpairs + 2 * value, 2);
+  return p + 2;
 }
 
-tm_month
-tm_getmonth (struct tm date)
+// At least 4 digits, as required by ISO 8601.
+static char *
+tm_writeyear (char *p, long int year)
 {
-  return date.tm_mon + 1;       /* January = 1, December = 12 */
+  if (year < 0)
+  {
+    *p++ = '-';
+    year = -year;
+  }
+  if (year < 10000)
+  {
+    p = tm_writedigits2 (p, (int) (year / 100));
+    return tm_writedigits2 (p, (int) (year % 100));
+  }
+  char digits[24];
+  size_t n = 0;
+  for (; year; year /= 10)
+    digits[n++] = (char) ('0' + year % 10);
+  while (n)
+    *p++ = digits[--n];
+  return p;
 }
 
-int
-tm_getyear (struct tm date)
+static char *
+tm_writeinteger (char *p, long int value, int width, char pad)
 {
-  if (date.tm_year + 1900 < date.tm_year)
-    return (errno = EINVAL), 0;
-  return date.tm_year + 1900;
+  char digits[24];
+  int n = 0;
+  unsigned long int u = value < 0 ? 0UL - (unsigned long int) value : (unsigned long int) value;
+  do
+    digits[n++] = (char) ('0' + u % 10);
+  while (u /= 10);
+  if (value < 0)
+    *p++ = '-';
+  for (int i = n; i < width; i++)
+    *p++ = pad;
+  while (n)
+    *p++ = digits[--n];
+  return p;
 }
 
-int
-tm_getday (struct tm date)
+static char *
+tm_writeutcoffset (char *p, long int gmtoff, int options)
 {
-  return date.tm_mday;
+  if (options & TM_ISO8601_NO_OFFSET)
+    return p;
+  if (!gmtoff && (options & TM_ISO8601_OFFSET_Z))
+  {
+    *p++ = 'Z';
+    return p;
+  }
+  *p++ = gmtoff < 0 ? '-' : '+';
+  if (gmtoff < 0)
+    gmtoff = -gmtoff;
+  gmtoff /= 60;                 // Seconds are ignored, as strftime does for %z
+  p = tm_writedigits2 (p, (int) (gmtoff / 60 % 100));
+  if (options & TM_ISO8601_OFFSET_COLON)
+    *p++ = ':';
+  return tm_writedigits2 (p, (int) (gmtoff % 60));
 }
 
-int
-tm_gethour (struct tm date)
+// hh:mm:ss, the three pairs of digits being converted at once in the lanes of a 64-bit word (SWAR).
+static char *
+tm_writetimeofday (char *p, int seconds)
 {
-  return date.tm_hour;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  uint64_t lanes = (uint64_t) (seconds / 3600) | (uint64_t) (seconds / 60 % 60) << 24 | (uint64_t) (seconds % 60) << 48;
+  uint64_t tens = ((lanes * 103) >> 10) & 0x000F00000F00000FULL;        // x * 103 / 1024 == x / 10 for x < 100
+  uint64_t units = lanes - tens * 10;
+  uint64_t word = tens | units << 8 | 0x30303A30303A3030ULL;    // "00:00:00"
+  memcpy (p, &word, 8);
+  return p + 8;
+#else
+  p = tm_writedigits2 (p, seconds / 3600);
+  *p++ = ':';
+  p = tm_writedigits2 (p, seconds / 60 % 60);
+  *p++ = ':';
+  return tm_writedigits2 (p, seconds % 60);
+#endif
 }
 
-int
-tm_getminute (struct tm date)
+// Fields written as pairs of digits must be in range (tm_sec up to 60 for a leap second): dt is not normalized by the formatters.
+static int
+tm_isformattable (struct tm dt)
 {
-  return date.tm_min;
+  return dt.tm_mon >= 0 && dt.tm_mon <= 11 && dt.tm_mday >= 1 && dt.tm_mday <= 31 && dt.tm_hour >= 0 && dt.tm_hour <= 23 && dt.tm_min >= 0
+    && dt.tm_min <= 59 && dt.tm_sec >= 0 && dt.tm_sec <= 60;
 }
 
-int
-tm_getsecond (struct tm date)
+/// Writes YYYYMMDDThhmmss±hhmm (or one of its forms, according to options), without decimal fraction of second.
+/// @param [out] secend Offset of the end of the seconds (where the decimal fraction should be inserted), if the time of day is written.
+static char *
+tm_writeiso8601 (char *buf, struct tm dt, int options, size_t *secend)
 {
-  return date.tm_sec;
+  char *p = (options & TM_ISO8601_YEAR_UNPADDED) ? tm_writeinteger (buf, (long int) dt.tm_year + 1900, 1, '0')
+    : tm_writeyear (buf, (long int) dt.tm_year + 1900);
+  if (options & TM_ISO8601_EXTENDED)
+    *p++ = '-';
+  p = tm_writedigits2 (p, dt.tm_mon + 1);
+  if (options & TM_ISO8601_EXTENDED)
+    *p++ = '-';
+  p = tm_writedigits2 (p, dt.tm_mday);
+  *secend = (size_t) (p - buf);
+  if (!(options & TM_ISO8601_DATE_ONLY))
+  {
+    *p++ = 'T';
+    p = tm_writedigits2 (p, dt.tm_hour);
+    if (options & TM_ISO8601_EXTENDED)
+      *p++ = ':';
+    p = tm_writedigits2 (p, dt.tm_min);
+    if (options & TM_ISO8601_EXTENDED)
+      *p++ = ':';
+    p = tm_writedigits2 (p, dt.tm_sec);
+    *secend = (size_t) (p - buf);
+    p = tm_writeutcoffset (p, dt.tm_gmtoff, options);
+  }
+  return p;
 }
 
+// Per thread cache of the last string formatted by tm_formatiso8601, for the last wallclocks (and options) used:
+// timestamps of logs are usually formatted in sequence, within the same hour.
+#define TM_ISO8601CACHE_SIZE 4
+typedef struct
+{
+  int used;
+  const char *wc;
+  int options;
+  int year, mon, mday, hour, min, sec;
+  long int gmtoff;
+  size_t len, secend;
+  char str[64];                 // Without decimal fraction of second
+} tm_iso8601cache;
+static _Thread_local tm_iso8601cache tm_iso8601caches[TM_ISO8601CACHE_SIZE];
+static _Thread_local size_t tm_iso8601cachenext;
+
+/// Returns the string formatted by tm_writeiso8601 from the cache of the calling thread.
+/// The string is written again if the hour, the day or the UTC offset has changed since the last call, otherwise only minutes and seconds are patched.
+static const tm_iso8601cache *
+tm_iso8601cached (struct tm dt, int options)
+{
+  tm_iso8601cache *c = 0;
+  for (size_t i = 0; !c && i < TM_ISO8601CACHE_SIZE; i++)
+    if (tm_iso8601caches[i].used && tm_iso8601caches[i].wc == dt.tm_zone && tm_iso8601caches[i].options == options)
+      c = tm_iso8601caches + i;
+
+  if (!c || c->hour != dt.tm_hour || c->mday != dt.tm_mday || c->mon != dt.tm_mon || c->year != dt.tm_year || c->gmtoff != dt.tm_gmtoff)
+  {
+    if (!c)
+    {
+      c = tm_iso8601caches + tm_iso8601cachenext;
+      tm_iso8601cachenext = (tm_iso8601cachenext + 1) % TM_ISO8601CACHE_SIZE;
+    }
+    c->len = (size_t) (tm_writeiso8601 (c->str, dt, options, &c->secend) - c->str);
+    c->used = 1;
+    c->wc = dt.tm_zone;
+    c->options = options;
+    c->year = dt.tm_year;
+    c->mon = dt.tm_mon;
+    c->mday = dt.tm_mday;
+    c->hour = dt.tm_hour;
+    c->gmtoff = dt.tm_gmtoff;
+  }
+  else if (c->min != dt.tm_min || c->sec != dt.tm_sec)
+  {
+    tm_writedigits2 (c->str + c->secend - 2, dt.tm_sec);
+    tm_writedigits2 (c->str + c->secend - ((options & TM_ISO8601_EXTENDED) ? 5 : 4), dt.tm_min);
+  }
+  c->min = dt.tm_min;
+  c->sec = dt.tm_sec;
+  return c;
+}
+
+// Locale-free formatter: does not call strftime, does not take any lock, and returns the number of bytes written (excluding the terminating null byte),
+// or 0 if the result, including the terminating null byte, would exceed max bytes.
+// digits (from 0 to 9) is the number of digits of the decimal fraction of second, taken from nanoseconds.
+size_t
+tm_formatiso8601 (struct tm dt, size_t max, char *str, int options, int digits, long int nanoseconds)
+{
+  if (!str || !max || digits < 0 || digits > 9 || nanoseconds < 0 || nanoseconds > 999999999 || !tm_isformattable (dt))
+    return (errno = EINVAL), 0;
+
+  char buf[64];
+  const char *src = buf;
+  size_t len, secend;
+  if (options & TM_ISO8601_DATE_ONLY)
+    len = (size_t) (tm_writeiso8601 (buf, dt, options, &secend) - buf), digits = 0;
+  else
+  {
+    const tm_iso8601cache *c = tm_iso8601cached (dt, options);
+    src = c->str;
+    len = c->len;
+    secend = c->secend;
+  }
+
+  size_t total = len + (digits ? (size_t) digits + 1 : 0);
+  if (total >= max)
+    return 0;
+  if (!digits)
+    memcpy (str, src, len);
+  else
+  {
+    memcpy (str, src, secend);
+    char *p = str + secend;
+    *p++ = '.';
+    for (int i = 9; i > digits; i--)
+      nanoseconds /= 10;
+    for (int i = digits; i > 0; i--, nanoseconds /= 10)
+      p[i - 1] = (char) ('0' + nanoseconds % 10);
+    memcpy (p + digits, src + secend, len - secend);
+  }
+  str[total] = 0;
+  return total;
+}
+
+// Records YYYY-MM-DDThh:mm:ss±hh:mm written back to back, each followed by sep (unless sep is 0).
+// The date prefix and the UTC offset are formatted once for consecutive instants falling on the same day and having the same offset.
+// Returns the number of bytes written (without any terminating null byte); stops before the first record that would exceed outcap and sets errno to EOVERFLOW.
+size_t
+tm_formatiso8601_n (const tm_instant *in, size_t n, char *out, size_t outcap, char sep)
+{
+  if ((n && !in) || (outcap && !out))
+    return (errno = EINVAL), 0;
+
+  char prefix[32], offset[8];   // YYYY-MM-DDT and ±hh:mm
+  size_t prefixlen = 0;
+  long int prefixday = 0;
+  int prefixoffset = 0;
+  char *p = out;
+  for (size_t i = 0; i < n; i++)
+  {
+    time_t local = in[i].utc + in[i].utcoffset;
+    long int day = tm_daysfromseconds (local);
+    if (!prefixlen || in[i].utcoffset != prefixoffset)
+    {
+      tm_writeutcoffset (offset, in[i].utcoffset, TM_ISO8601_OFFSET_COLON);
+      prefixoffset = in[i].utcoffset;
+    }
+    if (!prefixlen || day != prefixday)
+    {
+      long int year;
+      int month, mday;
+      tm_civilfromdays (day, &year, &month, &mday);
+      char *q = tm_writeyear (prefix, year);
+      *q++ = '-';
+      q = tm_writedigits2 (q, month);
+      *q++ = '-';
+      q = tm_writedigits2 (q, mday);
+      *q++ = 'T';
+      prefixlen = (size_t) (q - prefix);
+      prefixday = day;
+    }
+
+    if (outcap - (size_t) (p - out) < prefixlen + 8 + 6 + (sep ? 1 : 0))
+    {
+      errno = EOVERFLOW;
+      break;
+    }
+    memcpy (p, prefix, prefixlen);
+    p = tm_writetimeofday (p + prefixlen, (int) (local - (time_t) day * 86400));
+    memcpy (p, offset, 6);
+    p += 6;
+    if (sep)
+      *p++ = sep;
+  }
+  return (size_t) (p - out);
+}
+
+// Compiled formats: conversion specifications which do not depend on regional settings are executed natively,
+// the others (and those with flags, field width or modifiers) are delegated to strftime at run time.
+typedef enum
+{
+  TM_FOP_TEXT,
+  TM_FOP_STRFTIME,
+  TM_FOP_YEAR,                  // %Y
+  TM_FOP_CENTURY,               // %C
+  TM_FOP_YEAR2,                 // %y
+  TM_FOP_MONTH,                 // %m
+  TM_FOP_DAY,                   // %d
+  TM_FOP_DAYSPACE,              // %e
+  TM_FOP_HOUR,                  // %H
+  TM_FOP_HOUR12,                // %I
+  TM_FOP_MINUTE,                // %M
+  TM_FOP_SECOND,                // %S
+  TM_FOP_DAYOFYEAR,             // %j
+  TM_FOP_DAYOFWEEK,             // %u
+  TM_FOP_DAYOFWEEK0,            // %w
+  TM_FOP_UTCOFFSET,             // %z
+  TM_FOP_ZONE,                  // %Z
+} tm_formatopcode;
+
+typedef struct
+{
+  tm_formatopcode code;
+  size_t offset, length;        // Text (or strftime format) in the pool
+} tm_formatop;
+
+struct tm_format
+{
+  size_t nb;
+  tm_formatop *op;
+  char *pool;
+  size_t poollength;
+};
+
+static void
+tm_format_emit (tm_format *prog, tm_formatopcode code, const char *text, size_t length)
+{
+  tm_formatop *last = prog->nb ? prog->op + prog->nb - 1 : 0;
+  if (code == TM_FOP_TEXT && last && last->code == TM_FOP_TEXT)
+    last->length += length;     // Consecutive texts are contiguous in the pool
+  else
+    prog->op[prog->nb++] = (tm_formatop) { code, prog->poollength, length };
+  memcpy (prog->pool + prog->poollength, text, length);
+  prog->poollength += length;
+  if (code == TM_FOP_STRFTIME)
+  {
+    // A trailing space lets distinguish an empty result (e.g. %p in some locales) from an overflow: strftime returns 0 in both cases.
+    memcpy (prog->pool + prog->poollength, " ", 2);
+    prog->poollength += 2;
+  }
+}
+
+tm_format *
+tm_format_compile (const char *fmt)
+{
+  if (!fmt)
+    return (errno = EINVAL), (tm_format *) 0;
+
+  size_t len = strlen (fmt);
+  size_t maxop = 3 * len + 1;   // %D, %F or %T is compiled into 5 operations.
+  size_t maxpool = 2 * len + 2;
+  tm_format *prog = malloc (sizeof (*prog) + maxop * sizeof (*prog->op) + maxpool);
+  if (!prog)
+    return (errno = ENOMEM), (tm_format *) 0;
+  prog->nb = 0;
+  prog->op = (tm_formatop *) (prog + 1);
+  prog->pool = (char *) (prog->op + maxop);
+  prog->poollength = 0;
+
+  for (const char *p = fmt; *p;)
+  {
+    if (*p != '%')
+    {
+      size_t n = strcspn (p, "%");
+      tm_format_emit (prog, TM_FOP_TEXT, p, n);
+      p += n;
+      continue;
+    }
+    const char *spec = p++;
+    p += strspn (p, "_-0^#");   // flags
+    p += strspn (p, "0123456789");      // field width
+    p += strspn (p, "EO");      // modifiers
+    if (!*p)
+    {
+      tm_format_emit (prog, TM_FOP_STRFTIME, spec, (size_t) (p - spec));
+      break;
+    }
+    if (p != spec + 1)
+    {
+      tm_format_emit (prog, TM_FOP_STRFTIME, spec, (size_t) (++p - spec));
+      continue;
+    }
+    switch (*p++)
+    {
+#define TM_FOP(c, code) case c: tm_format_emit (prog, code, "", 0); break
+        TM_FOP ('Y', TM_FOP_YEAR);
+        TM_FOP ('C', TM_FOP_CENTURY);
+        TM_FOP ('y', TM_FOP_YEAR2);
+        TM_FOP ('m', TM_FOP_MONTH);
+        TM_FOP ('d', TM_FOP_DAY);
+        TM_FOP ('e', TM_FOP_DAYSPACE);
+        TM_FOP ('H', TM_FOP_HOUR);
+        TM_FOP ('I', TM_FOP_HOUR12);
+        TM_FOP ('M', TM_FOP_MINUTE);
+        TM_FOP ('S', TM_FOP_SECOND);
+        TM_FOP ('j', TM_FOP_DAYOFYEAR);
+        TM_FOP ('u', TM_FOP_DAYOFWEEK);
+        TM_FOP ('w', TM_FOP_DAYOFWEEK0);
+        TM_FOP ('z', TM_FOP_UTCOFFSET);
+        TM_FOP ('Z', TM_FOP_ZONE);
+#undef TM_FOP
+      case '%':
+        tm_format_emit (prog, TM_FOP_TEXT, "%", 1);
+        break;
+      case 'n':
+        tm_format_emit (prog, TM_FOP_TEXT, "\n", 1);
+        break;
+      case 't':
+        tm_format_emit (prog, TM_FOP_TEXT, "\t", 1);
+        break;
+      case 'D':                // %m/%d/%y
+        tm_format_emit (prog, TM_FOP_MONTH, "", 0);
+        tm_format_emit (prog, TM_FOP_TEXT, "/", 1);
+        tm_format_emit (prog, TM_FOP_DAY, "", 0);
+        tm_format_emit (prog, TM_FOP_TEXT, "/", 1);
+        tm_format_emit (prog, TM_FOP_YEAR2, "", 0);
+        break;
+      case 'F':                // %Y-%m-%d
+        tm_format_emit (prog, TM_FOP_YEAR, "", 0);
+        tm_format_emit (prog, TM_FOP_TEXT, "-", 1);
+        tm_format_emit (prog, TM_FOP_MONTH, "", 0);
+        tm_format_emit (prog, TM_FOP_TEXT, "-", 1);
+        tm_format_emit (prog, TM_FOP_DAY, "", 0);
+        break;
+      case 'T':                // %H:%M:%S
+      case 'R':                // %H:%M
+        tm_format_emit (prog, TM_FOP_HOUR, "", 0);
+        tm_format_emit (prog, TM_FOP_TEXT, ":", 1);
+        tm_format_emit (prog, TM_FOP_MINUTE, "", 0);
+        if (p[-1] == 'R')
+          break;
+        tm_format_emit (prog, TM_FOP_TEXT, ":", 1);
+        tm_format_emit (prog, TM_FOP_SECOND, "", 0);
+        break;
+      default:                 // Depends on regional settings (%a, %b, %c, %p, %x, %X...), or is not supported (%G, %s, %V...)
+        tm_format_emit (prog, TM_FOP_STRFTIME, spec, (size_t) (p - spec));
+        break;
+    }
+  }
+  return prog;
+}
+
+void
+tm_format_free (tm_format *prog)
+{
+  free (prog);
+}
+
+// Returns the number of bytes written (excluding the terminating null byte), or 0 if str is too small.
+size_t
+tm_format_run (const tm_format *prog, struct tm dt, size_t max, char *str)
+{
+  if (!prog || !str || !max || !tm_isformattable (dt))
+    return (errno = EINVAL), 0;
+
+  char *p = str;
+  char buf[32], scratch[256];
+  long int year = dt.tm_year + 1900L;
+  for (size_t i = 0; i < prog->nb; i++)
+  {
+    const tm_formatop *op = prog->op + i;
+    size_t room = max - (size_t) (p - str);
+    char *q = buf;
+    switch (op->code)
+    {
+      case TM_FOP_TEXT:
+        if (op->length >= room)
+          return 0;
+        memcpy (p, prog->pool + op->offset, op->length);
+        p += op->length;
+        continue;
+      case TM_FOP_ZONE:
+      case TM_FOP_STRFTIME:
+      {
+        const char *spec = prog->pool + op->offset;
+        if (op->code == TM_FOP_ZONE && dt.tm_zone)
+        {
+          size_t n = strlen (dt.tm_zone);
+          if (n >= room)
+            return 0;
+          memcpy (p, dt.tm_zone, n);
+          p += n;
+          continue;
+        }
+        else if (op->code == TM_FOP_ZONE)
+          spec = "%Z ";         // Name of the system timezone
+        size_t n = strftime (p, room, spec, &dt);       // time syscall
+        if (!n && room < sizeof (scratch))
+        {
+          // The result may fit exactly without its trailing space.
+          n = strftime (scratch, sizeof (scratch), spec, &dt);
+          if (n > room)
+            return 0;
+          memcpy (p, scratch, n ? n - 1 : 0);
+        }
+        if (!n)
+          return 0;
+        p += n - 1;             // Trailing space removed
+        continue;
+      }
+      case TM_FOP_YEAR:
+        q = tm_writeinteger (q, year, 1, '0');
+        break;
+      case TM_FOP_CENTURY:
+        q = tm_writeinteger (q, (year >= 0 ? year : year - 99) / 100, 1, '0');      // as glibc does
+        break;
+      case TM_FOP_YEAR2:
+        q = tm_writedigits2 (q, (int) ((year % 100 + 100) % 100));
+        break;
+      case TM_FOP_MONTH:
+        q = tm_writedigits2 (q, dt.tm_mon + 1);
+        break;
+      case TM_FOP_DAY:
+        q = tm_writedigits2 (q, dt.tm_mday);
+        break;
+      case TM_FOP_DAYSPACE:
+        q = tm_writeinteger (q, dt.tm_mday, 2, ' ');
+        break;
+      case TM_FOP_HOUR:
+        q = tm_writedigits2 (q, dt.tm_hour);
+        break;
+      case TM_FOP_HOUR12:
+        q = tm_writedigits2 (q, dt.tm_hour % 12 ? dt.tm_hour % 12 : 12);
+        break;
+      case TM_FOP_MINUTE:
+        q = tm_writedigits2 (q, dt.tm_min);
+        break;
+      case TM_FOP_SECOND:
+        q = tm_writedigits2 (q, dt.tm_sec);
+        break;
+      case TM_FOP_DAYOFYEAR:
+        q = tm_writeinteger (q, dt.tm_yday + 1, 3, '0');
+        break;
+      case TM_FOP_DAYOFWEEK:
+        *q++ = (char) ('0' + (dt.tm_wday ? dt.tm_wday : 7));
+        break;
+      case TM_FOP_DAYOFWEEK0:
+        *q++ = (char) ('0' + dt.tm_wday);
+        break;
+      case TM_FOP_UTCOFFSET:
+        q = tm_writeutcoffset (q, dt.tm_gmtoff, TM_ISO8601_BASIC);
+        break;
+    }
+    if ((size_t) (q - buf) >= room)
+      return 0;
+    memcpy (p, buf, (size_t) (q - buf));
+    p += q - buf;
+  }
+  *p = 0;
+  return (size_t) (p - str);
+}
+
+tm_status
+tm_toiso8601 (struct tm dt, size_t max, char *str, int sep)
+{
+  return tm_formatiso8601 (dt, max, str, TM_ISO8601_YEAR_UNPADDED | (sep ? TM_ISO8601_EXTENDED : TM_ISO8601_BASIC)) ? TM_OK : TM_ERROR;
+}
+
+// RFC 3339: YYYY-MM-DDThh:mm:ss±hh:mm, or YYYY-MM-DDThh:mm:ssZ for dates and times defined in UTC.
+tm_status
+tm_torfc3339 (struct tm dt, size_t max, char *str)
+{
+  if (dt.tm_year + 1900L < 0 || dt.tm_year + 1900L > 9999)
+    return (errno = EINVAL), TM_ERROR;
+  int options = TM_ISO8601_EXTENDED | TM_ISO8601_OFFSET_COLON | (tm_isutctimezone (dt.tm_zone) ? TM_ISO8601_OFFSET_Z : 0);
+  return tm_formatiso8601 (dt, max, str, options) ? TM_OK : TM_ERROR;
+}
+
+// RFC 9557: RFC 3339 followed by the time zone suffix [Zone] (omitted for system time).
+tm_status
+tm_torfc9557 (struct tm dt, size_t max, char *str)
+{
+  if (tm_torfc3339 (dt, max, str) == TM_ERROR)
+    return TM_ERROR;
+  if (!dt.tm_zone)
+    return TM_OK;
+  size_t len = strlen (str), n = strlen (dt.tm_zone);
+  if (len + n + 2 >= max)
+    return TM_ERROR;
+  str[len] = '[';
+  memcpy (str + len + 1, dt.tm_zone, n);
+  memcpy (str + len + n + 1, "]", 2);
+  return TM_OK;
+}
+
+// Day, DD Mon YYYY hh:mm:ss
+static char *
+tm_writerfcdate (char *p, int wday, long int year, int month, int day, int seconds)
+{
+  memcpy (p, tm_rfcdaynames[wday], 3);
+  memcpy (p + 3, ", ", 2);
+  p = tm_writedigits2 (p + 5, day);
+  *p++ = ' ';
+  memcpy (p, tm_rfcmonthnames[month - 1], 3);
+  p[3] = ' ';
+  p = tm_writeyear (p + 4, year);
+  *p++ = ' ';
+  return tm_writetimeofday (p, seconds);
+}
+
+static tm_status
+tm_copyformatted (const char *buf, size_t len, size_t max, char *str)
+{
+  if (len >= max)
+    return TM_ERROR;
+  memcpy (str, buf, len);
+  str[len] = 0;
+  return TM_OK;
+}
+
+// RFC 2822: Day, DD Mon YYYY hh:mm:ss ±hhmm
+tm_status
+tm_torfc2822 (struct tm dt, size_t max, char *str)
+{
+  if (!str || !max || dt.tm_year + 1900L < 0 || dt.tm_wday < 0 || dt.tm_wday > 6 || !tm_isformattable (dt))
+    return (errno = EINVAL), TM_ERROR;
+
+  char buf[64];
+  char *p = tm_writerfcdate (buf, dt.tm_wday, dt.tm_year + 1900L, dt.tm_mon + 1, dt.tm_mday, dt.tm_hour * 3600 + dt.tm_min * 60 + dt.tm_sec);
+  *p++ = ' ';
+  p = tm_writeutcoffset (p, dt.tm_gmtoff, TM_ISO8601_BASIC);
+  return tm_copyformatted (buf, (size_t) (p - buf), max, str);
+}
+
+// HTTP-date (IMF-fixdate): Day, DD Mon YYYY hh:mm:ss GMT, whatever the wallclock of dt.
+tm_status
+tm_tohttpdate (struct tm dt, size_t max, char *str)
+{
+  time_t utc = tm_tolocalseconds (dt) - dt.tm_gmtoff;
+  long int days = tm_daysfromseconds (utc), year;
+  int month, day;
+  tm_civilfromdays (days, &year, &month, &day);
+  if (!str || !max || year < 0 || year > 9999)
+    return (errno = EINVAL), TM_ERROR;
+
+  char buf[64];
+  char *p = tm_writerfcdate (buf, tm_dayofweekfromdays (days), year, month, day, (int) (utc - (time_t) days * 86400));
+  memcpy (p, " GMT", 4);
+  return tm_copyformatted (buf, (size_t) (p + 4 - buf), max, str);
+}
+
+// ISO 8601 week date: YYYY-Www-D if sep is set, YYYYWwwD otherwise.
+tm_status
+tm_toisoweekdate (struct tm dt, size_t max, char *str, int sep)
+{
+  if (!str || !max)
+    return (errno = EINVAL), TM_ERROR;
+
+  long int isoyear;
+  int week, weekday;
+  tm_isoweekdatefromdays (tm_daysfromcivil (dt.tm_year + 1900L, dt.tm_mon + 1, dt.tm_mday), &isoyear, &week, &weekday);
+  char buf[32];
+  char *p = tm_writeyear (buf, isoyear);
+  if (sep)
+    *p++ = '-';
+  *p++ = 'W';
+  p = tm_writedigits2 (p, week);
+  if (sep)
+    *p++ = '-';
+  *p++ = (char) ('0' + weekday);
+  return tm_copyformatted (buf, (size_t) (p - buf), max, str);
+}
+
+// ISO 8601 ordinal date: YYYY-DDD if sep is set, YYYYDDD otherwise.
+tm_status
+tm_toisoordinaldate (struct tm dt, size_t max, char *str, int sep)
+{
+  if (!str || !max || dt.tm_yday < 0 || dt.tm_yday > 365)
+    return (errno = EINVAL), TM_ERROR;
+
+  char buf[32];
+  char *p = tm_writeyear (buf, dt.tm_year + 1900L);
+  if (sep)
+    *p++ = '-';
+  *p++ = (char) ('0' + (dt.tm_yday + 1) / 100);
+  p = tm_writedigits2 (p, (dt.tm_yday + 1) % 100);
+  return tm_copyformatted (buf, (size_t) (p - buf), max, str);
+}
+
+// Formats used by tm_tostring, tm_timetostring and tm_datetostring, compiled once for all,
+// indexed by 2 * (inside DST overlap) + (not defined in local time).
+static const char *const tm_tostring_fmt_src[][4] = {
+  {"%x %X", "%x %X (%Z)", "%x %X (UTC%z)", "%x %X (%Z,UTC%z)"},
+  {"%X", "%X (%Z)", "%X (UTC%z)", "%X (%Z,UTC%z)"},
+  {"%x", "%x (%Z)", "%x", "%x (%Z)"},
+};
+
+static tm_format *tm_tostring_prog[3][4] = { 0 };
+static pthread_once_t tm_tostring_once = PTHREAD_ONCE_INIT;
+
+static void
+tm_tostring_compile (void)
+{
+  for (size_t i = 0; i < 3; i++)
+    for (size_t j = 0; j < 4; j++)
+      tm_tostring_prog[i][j] = tm_format_compile (tm_tostring_fmt_src[i][j]);
+}
+
+static tm_status
+tm_tostring_run (struct tm dt, size_t max, char *str, size_t kind)
+{
+  if (!str || !max)
+    return (errno = EINVAL), TM_ERROR;
+
+  pthread_once (&tm_tostring_once, tm_tostring_compile);
+  // DST overlap is taken from the transition table of the wallclock rather than from two extra normalizations.
+  size_t index = 2U * (kind != 2 && tm_isinsideoverlap (dt) ? 1 : 0) + (tm_isdefinedinlocaltime (dt) ? 0 : 1);
+  if (!tm_tostring_prog[kind][index])
+    return tm_tostring_fmt (dt, max, str, tm_tostring_fmt_src[kind][index]);
+  return tm_format_run (tm_tostring_prog[kind][index], dt, max, str) ? TM_OK : TM_ERROR;
+}
+
+tm_status
+tm_timetostring (struct tm dt, size_t max, char *str)
+{
+  return tm_tostring_run (dt, max, str, 1);
+}
+
+tm_status
+tm_datetostring (struct tm dt, size_t max, char *str)
+{
+  return tm_tostring_run (dt, max, str, 2);
+}
+
+tm_status
+tm_tostring (struct tm dt, size_t max, char *str)
+{
+  return tm_tostring_run (dt, max, str, 0);
+}
+
+tm_status
+dt_tostring (struct tm dt, size_t max, char *str)
+{
+  return tm_tostring_fmt (dt, max, str, "%x");
+}
+
+tm_status
+dt_toiso8601 (struct tm dt, size_t max, char *str, int sep)
+{
+  return tm_formatiso8601 (dt, max, str, TM_ISO8601_DATE_ONLY | TM_ISO8601_YEAR_UNPADDED | (sep ? TM_ISO8601_EXTENDED : TM_ISO8601_BASIC)) ? TM_OK : TM_ERROR;
+}
+
+tm_status
+dt_setfromiso8601 (struct tm *dt, char *str)
+{
+  if (tm_setfromiso8601 (dt, str) == TM_ERROR)
+    return TM_ERROR;
+
+  dt->tm_zone = tm_getregisteredwallclock (TM_REF_UTC, 0);
+  return TM_OK;
+}
+
+tm_status
+dt_make_ir (struct tm *date, const char *wc)
+{
+  if (tm_make_ir (date, TM_TODAY, wc) == TM_ERROR)
+    return TM_ERROR;
+
+  date->tm_zone = tm_getregisteredwallclock (TM_REF_UTC, 0);
+  return TM_OK;
+}
+
+/*****************************************************
+*   CONVERTERS                                       *
+**************************************************** */
+
+static tm_status
+tm_toutcrepresentation (struct tm *date)
+{
+  if (!tm_isdefinedinutc (*date))
+  {
+    time_t local;
+    if (tm_normalize (date, &local) != TM_ERROR && gmtime_r (&local, date)      // time syscall
+        && date->tm_year + 1900 + 1 > date->tm_year)
+    {
+      date->tm_zone = tm_getregisteredwallclock (TM_REF_UTC, 0);
+      return TM_OK;
+    }
+    else
+      return (errno = EINVAL), TM_ERROR;
+  }
+  else
+    return TM_OK;
+}
+
+static tm_status
+tm_totimezonerepresentation (struct tm *date, const char *rep)
+{
+  time_t utc;
+  if (tm_normalize (date, &utc) != TM_ERROR)
+  {
+    rep = tm_getregisteredwallclock (rep, 1);
+    pthread_mutex_lock (&tzset_mutex);
+    const char *old_tz;
+    if (tm_tzset (rep, &old_tz) == TM_ERROR)
+    {
+      pthread_mutex_unlock (&tzset_mutex);
+      return TM_ERROR;
+    }
+    if (localtime_r (&utc, date)        // time syscall
+        && date->tm_year + 1900 + 1 > date->tm_year)
+    {
+      tm_tzunset (old_tz);
+      pthread_mutex_unlock (&tzset_mutex);
+      date->tm_zone = rep;
+      return TM_OK;
+    }
+    else
+    {
+      tm_tzunset (old_tz);
+      pthread_mutex_unlock (&tzset_mutex);
+      return (errno = EINVAL), TM_ERROR;
+    }
+  }
+  else
+    return (errno = EINVAL), TM_ERROR;
+}
+
+// wc should conform to format accepted by tzset (see man tzset)
+// On Linux, possible values can be listed with command 'find /usr/share/zoneinfo \! -type d | sort'
+tm_status
+tm_changetowallclock (struct tm *date, const char *wc)
+{
+  if (tm_isutctimezone (wc))
+    return tm_toutcrepresentation (date);
+  else
+    return tm_totimezonerepresentation (date, wc);
+}
+
+/*****************************************************
+*   CALENDAR PROPERTIES                              *
+*****************************************************/
+
+int
+tm_getdaysinyear (int year)
+{
+  if (year > INT_MAX - 1 || year < INT_MIN + 1900)     // Years out of the range of struct tm (as for tm_set)
+    return (errno = EINVAL), 0;
+  return tm_isleapcivilyear (year) ? 366 : 365;
+}
+
+int
+tm_isleapyear (int year)
+{
+  // Nonzero if year is a leap year (every 4 years, except every 100th isn't, and every 400th is).
+  return tm_getdaysinyear (year) == 366 ? 1 : 0;
+}
+
+int                             /* set_errno */
+tm_getweeksinisoyear (int isoyear)
+{
+  if (isoyear > INT_MAX - 2 || isoyear < INT_MIN + 1900)       // Years out of the range of struct tm (as for tm_set)
+    return (errno = EINVAL), 0;
+
+  return tm_isoweeksinyear (isoyear);
+}
+
+int                             /* set_errno */
+tm_getdaysinmonth (int year, tm_month month)
+{
+  if (year > INT_MAX - 2 || year < INT_MIN + 1900 || month < TM_JANUARY || month > TM_DECEMBER)    // Years out of the range of struct tm (as for tm_set)
+    return (errno = EINVAL), 0;
+  return tm_daysincivilmonth (year, month);
+}
+
+int                             /* set_errno */
+tm_getsecondsinday (int year, tm_month month, int day, const char *rep)
+{
+  if (rep == TM_REF_UNCHANGED)
+    return (errno = EINVAL), 0;
+
+  const char *wc = tm_getregisteredwallclock (rep, 1);
+  if (year < INT_MIN + 1900 || month < TM_JANUARY || month > TM_DECEMBER || day < 1 || day > tm_daysincivilmonth (year, month) ||
+      wc == TM_REF_UNDEFINED)
+    return (errno = EINVAL), 0;
+  if (tm_isutctimezone (wc))
+    return 86400;
+
+  // Days mostly lie inside the range of the transition table of the wallclock.
+  const tm_zonetable *zt = tm_zonetableacquire (wc);
+  time_t deb, fin;
+  tm_status status = zt ? tm_zonetableday (zt, year, month, day, &deb, &fin) : TM_ERROR;
+  tm_zonetablerelease (zt);
+  if (status == TM_OK)
+    return (int) (fin - deb);
+
+  struct tm date;
+
+  if (tm_make_dtrc (&date, year, month, day, 0, 0, 0, wc, TM_ST_OVER_DST) == TM_ERROR)
+    return (errno = EINVAL), 0;
+
+  if (tm_normalize (&date, &deb) == TM_ERROR || tm_adddays (&date, 1) == TM_ERROR || tm_normalize (&date, &fin) == TM_ERROR)
+    return (errno = EINVAL), 0;
+
+  return (int) (fin - deb);
+}
+
+int                             /* set_errno */
+tm_getfirstweekdayinmonth (int year, tm_month month, tm_dayofweek dow)
+{
+  if (dow < 1 || dow > 7)
+    return (errno = EINVAL), 0;
+
+  struct tm date;
+
+  if (tm_make_dtrc (&date, year, month, 1, 0, 0, 0, TM_REF_LOCALTIME, TM_ST_OVER_DST) == TM_ERROR)
+    return (errno = EINVAL), 0;
+
+  return (int) ((dow - tm_getdayofweek (date) + 7U) % 7U + 1U);
+}
+
+int                             /* set_errno */
+tm_getlastweekdayinmonth (int year, tm_month month, tm_dayofweek dow)
+{
+  if (dow < 1 || dow > 7)
+    return (errno = EINVAL), 0;
+
+  struct tm date;
+
+  int savederrno = errno;
+  errno = 0;
+  int last = tm_getdaysinmonth (year, month);
+  if (errno)
+    return 0;
+  errno = savederrno;
+
+  if (tm_make_dtrc (&date, year, month, last, 0, 0, 0, TM_REF_LOCALTIME, TM_ST_OVER_DST) == TM_ERROR)
+    return (errno = EINVAL), 0;
+
+  int diff = (int) (dow - tm_getdayofweek (date));
+
+  return last + diff + (diff > 0 ? -7 : 0);
+}
+
+int                             /* set_errno */
+tm_getfirstweekdayinisoyear (int isoyear, tm_dayofweek dow)
+{
+  if (dow < 1 || dow > 7)
+    return (errno = EINVAL), 0;
+
+  struct tm date;
+
+  int savederrno = errno;
+  errno = 0;
+  int ret = tm_getfirstweekdayinmonth (isoyear, TM_JANUARY, dow) + 7;
+  if (errno)
+    return 0;
+  errno = savederrno;
+
+  if (tm_make_dtrc (&date, isoyear, TM_JANUARY, ret, 0, 0, 0, TM_REF_LOCALTIME, TM_ST_OVER_DST) == TM_ERROR)
+    return (errno = EINVAL), 0;
+
+  return ret + 7 - 7 * tm_getisoweek (date);
+}
+
+/*****************************************************
+*   DATE PROPERTIES                                  *
+*****************************************************/
+
+tm_dayofweek
+tm_getdayofweek (struct tm date)
+{
+  return (date.tm_wday + 6) % 7 + 1;    /* Monday = 1, Sunday = 7 */
+}
+
+tm_month
+tm_getmonth (struct tm date)
+{
+  return date.tm_mon + 1;       /* January = 1, December = 12 */
+}
+
+int
+tm_getyear (struct tm date)
+{
+  if (date.tm_year + 1900 < date.tm_year)
+    return (errno = EINVAL), 0;
+  return date.tm_year + 1900;
+}
+
+int
+tm_getday (struct tm date)
+{
+  return date.tm_mday;
+}
+
+int
+tm_gethour (struct tm date)
+{
+  return date.tm_hour;
+}
+
+int
+tm_getminute (struct tm date)
+{
+  return date.tm_min;
+}
+
+int
+tm_getsecond (struct tm date)
+{
+  return date.tm_sec;
+}
+
+int
+tm_getdayofyear (struct tm date)
+{
+  return date.tm_yday + 1;      /* 1/1 = 1, 31/12 = 365 or 366 */
+}
+
+int
+tm_getisoweek (struct tm date)
+{
+
+  /** ISO 8601 week date: The first week of a year (starting on Monday) is :
+     - the first week that contains at least 4 days of calendar year.
+     - the week that contains the first Thursday of a year.
+     - the week with January 4 in it
+   */
+
+  int week = (date.tm_yday - (date.tm_wday + 6) % 7 + 10) / 7;
+
+  if (week == 0)
+    return (date.tm_yday + 365 + tm_isleapyear (date.tm_year + 1900 - 1) - (date.tm_wday + 6) % 7 + 10) / 7;
+  else if (week > 52 && ((date.tm_yday - 365 - tm_isleapyear (date.tm_year + 1900) - (date.tm_wday + 6) % 7 + 10) / 7) > 0)
+    return (date.tm_yday - 365 - tm_isleapyear (date.tm_year + 1900) - (date.tm_wday + 6) % 7 + 10) / 7;
+  else
+    return week;
+}
+
+int
+tm_getisoyear (struct tm date)
+{
+  /* Year of which ISO week of date belongs to. */
+  int week = (date.tm_yday - (date.tm_wday + 6) % 7 + 10) / 7;
+
+  int isoyear;
+  if (week == 0)
+    isoyear = date.tm_year + 1900 - 1;
+  else if (week > 52 && ((date.tm_yday - 365 - tm_isleapyear (date.tm_year + 1900) - (date.tm_wday + 6) % 7 + 10) / 7) > 0)
+    isoyear = date.tm_year + 1900 + 1;
+  else
+    isoyear = date.tm_year + 1900;
+  if (isoyear < date.tm_year)
+    errno = EINVAL;
+  return isoyear;
+}
+
+int
+tm_isdaylightsavingtimeineffect (struct tm date)
+{
+  if (date.tm_isdst > 0)
+    return 1;
+  else if (date.tm_isdst == 0)
+    return 0;
+  else
+    return (errno = EINVAL), 0;
+}
+
+int
+tm_isinsidedaylightsavingtimeoverlap (struct tm date)
+{
+  return tm_isinsideoverlap (date);
+}
+
+int
+tm_getutcoffset (struct tm date)
+{
+  return (int) date.tm_gmtoff;
+}
+
+int                             /* set errno */
+tm_getsecondsofday (struct tm date)
+{
+  if (tm_isutctimezone (date.tm_zone))
+    return date.tm_hour * 3600 + date.tm_min * 60 + date.tm_sec;
+
+  const tm_zonetable *zt = tm_zonetableacquire (date.tm_zone);
+  time_t deb, fin;
+  tm_status status = zt ? tm_zonetableday (zt, date.tm_year + 1900L, date.tm_mon + 1, date.tm_mday, &deb, &fin) : TM_ERROR;
+  tm_zonetablerelease (zt);
+  if (status == TM_OK)
+    return (int) (tm_tolocalseconds (date) - date.tm_gmtoff - deb);
+
+  struct tm tmp = date;
+
+  if (tm_make_dtrc (&tmp, tm_getyear (date), tm_getmonth (date), tm_getday (date), 0, 0, 0, TM_REF_UNCHANGED,
+                    TM_ST_OVER_DST /* Suppose DST does get into effect just before midnight */ ) == TM_ERROR)
+    return 0;
+
+  return (int) tm_diffseconds (tmp, date);
+}
+
+/*****************************************************
+*   OPERATORS                                        *
+*****************************************************/
+
+tm_status
+tm_addseconds (struct tm *date, long int nbSecs)
+{
+  time_t t0;
+  if (tm_normalize (date, &t0) == TM_ERROR)
+    return TM_ERROR;
+  if ((nbSecs > 0 && t0 + (time_t) nbSecs < t0) || (nbSecs < 0 && t0 + (time_t) nbSecs > t0))
+  {
+    errno = EOVERFLOW;
+    return TM_ERROR;
+  }
+  t0 += nbSecs;
+
+  if (tm_isdefinedinwallclock (*date, TM_REF_UTC))
+  {
+    if ((gmtime_r (&t0, date)   // time syscall
+         && date->tm_year + 1900 + 1 > date->tm_year))
+    {
+      date->tm_zone = tm_getregisteredwallclock (TM_REF_UTC, 0);
+      return TM_OK;
+    }
+    else
+    {
+      errno = EOVERFLOW;
+      return TM_ERROR;
+    }
+  }
+  else
+  {
+    const char *rep = tm_getregisteredwallclock (date->tm_zone, 0);
+    pthread_mutex_lock (&tzset_mutex);
+    const char *old_tz;
+    if (tm_tzset (rep, &old_tz) == TM_ERROR)
+    {
+      pthread_mutex_unlock (&tzset_mutex);
+      return TM_ERROR;
+    }
+    if ((localtime_r (&t0, date)        // time syscall
+         && date->tm_year + 1900 + 1 > date->tm_year))
+    {
+      date->tm_zone = rep;
+      tm_tzunset (old_tz);
+      pthread_mutex_unlock (&tzset_mutex);
+      return TM_OK;
+    }
+    else
+    {
+      tm_tzunset (old_tz);
+      pthread_mutex_unlock (&tzset_mutex);
+      errno = EOVERFLOW;
+      return TM_ERROR;
+    }
+  }
+}
+
+tm_status
+tm_adddays (struct tm *date, int nbDays)
+{
+  if ((nbDays > 0 && date->tm_mday + nbDays < date->tm_mday) || (nbDays < 0 && date->tm_mday + nbDays > date->tm_mday))
+  {
+    errno = EOVERFLOW;
+    return TM_ERROR;
+  }
+  date->tm_mday += nbDays;
+  date->tm_isdst = -1;          // Let timezone information and system databases define DST flag.
+
+  tm_status ret = tm_normalize (date, 0);
+  if (ret != TM_OK)
+    errno = EOVERFLOW;
+  return ret;
+}
+
+tm_status
+tm_addmonths (struct tm *date, int nbMonths)
+{
+  int mday = date->tm_mday;     // Day of the month (1-31)
+
+  if ((nbMonths > 0 && date->tm_mon + nbMonths < date->tm_mon) || (nbMonths < 0 && date->tm_mon + nbMonths > date->tm_mon))
+  {
+    errno = EOVERFLOW;
+    return TM_ERROR;
+  }
+  date->tm_mon += nbMonths;
+  date->tm_isdst = -1;          // Let timezone information and system databases define DST flag.
+
+  tm_status ret = tm_normalize (date, 0);
+  if (ret == TM_OK && date->tm_mday != mday)    // Handles lasts days of month
+  {
+    date->tm_mday = 0;          // A 0 in tm_mday is interpreted as meaning the last day of the preceding month.
+    ret = tm_normalize (date, 0);
+  }
+  else if (ret == TM_ERROR)
+    errno = EOVERFLOW;
+  return ret;
+}
+
+tm_status
+tm_trimtime (struct tm *tm)
+{
+  tm->tm_sec = tm->tm_min = tm->tm_hour = 0;
+  tm->tm_isdst = -1;            // Let timezone information and system databases define DST flag.
+
+  return tm_normalize (tm, 0);
+}
+
+// ISO 8601 duration: [±]PnYnMnWnDTnHnMnS, each component being optional (but at least one), in this order.
+tm_status
+tm_setdurationfromiso8601 (tm_duration *duration, const char *str)
+{
+  if (!duration || !str)
+    return (errno = EINVAL), TM_ERROR;
+
+  static const char designators[] = "YMWDHMS";
+  tm_duration d = { 0 };
+  int *const fields[] = { &d.years, &d.months, &d.weeks, &d.days, &d.hours, &d.minutes, &d.seconds };
+  int sign = 1;
+  if (*str == '-' || *str == '+')
+    sign = *str++ == '-' ? -1 : 1;
+  if (*str++ != 'P')
+    return (errno = EINVAL), TM_ERROR;
+
+  int next = 0, end = 4, nb = 0;        // Designators allowed: next to end - 1 (date part), then 4 to 6 after T (time part)
+  for (const char *p = str; *p;)
+  {
+    if (*p == 'T')
+    {
+      if (end == 7 || !p[1])
+        return (errno = EINVAL), TM_ERROR;
+      next = 4, end = 7, p++;
+      continue;
+    }
+    int value;
+    if (!(p = tm_rfcscandigits (p, 1, 9, &value)))
+      return (errno = EINVAL), TM_ERROR;
+    while (next < end && designators[next] != *p)
+      next++;
+    if (next == end)
+      return (errno = EINVAL), TM_ERROR;
+    *fields[next++] = sign * value;
+    nb++, p++;
+  }
+  if (!nb)
+    return (errno = EINVAL), TM_ERROR;
+
+  *duration = d;
+  return TM_OK;
+}
+
+// ISO 8601 duration: PnYnMnWnDTnHnMnS, null components omitted (PT0S for a null duration), prefixed by - if negative.
+tm_status
+tm_durationtoiso8601 (tm_duration duration, size_t max, char *str)
+{
+  static const char designators[] = "YMWDHMS";
+  const int fields[] = { duration.years, duration.months, duration.weeks, duration.days, duration.hours, duration.minutes, duration.seconds };
+  int negative = 0, positive = 0;
+  for (size_t i = 0; i < sizeof (fields) / sizeof (*fields); i++)
+    negative |= fields[i] < 0, positive |= fields[i] > 0;
+  if (!str || !max || (negative && positive))
+    return (errno = EINVAL), TM_ERROR;
+
+  char buf[96];
+  char *p = buf;
+  if (negative)
+    *p++ = '-';
+  *p++ = 'P';
+  for (size_t i = 0; i < sizeof (fields) / sizeof (*fields); i++)
+  {
+    if (i == 4 && (fields[4] || fields[5] || fields[6] || !(negative || positive)))
+      *p++ = 'T';
+    if (fields[i] || (i == 6 && !(negative || positive)))
+    {
+      p = tm_writeinteger (p, negative ? -(long int) fields[i] : fields[i], 1, '0');
+      *p++ = designators[i];
+    }
+  }
+  return tm_copyformatted (buf, (size_t) (p - buf), max, str);
+}
+
+/// Adds the nominal components of a duration to the fields of a date, keeping the time of day.
+/// Years and months are added together, then the day is clamped to the last day of the month (as by tm_addmonths), then weeks and days are added.
+static tm_status
+tm_durationtofields (struct tm *date, const tm_duration *d)
+{
+  if (!d->years && !d->months && !d->weeks && !d->days)
+    return TM_OK;
+
+  long int months = (date->tm_year + 1900L) * 12 + date->tm_mon + d->years * 12L + d->months;
+  long int year = (months >= 0 ? months : months - 11) / 12;
+  int month = (int) (months - year * 12) + 1;
+  int day = tm_daysincivilmonth (year, month);
+  if (date->tm_mday < day)
+    day = date->tm_mday;
+  tm_civilfromdays (tm_daysfromcivil (year, month, day) + d->weeks * 7L + d->days, &year, &month, &day);
+  if (year - 1900 > INT_MAX || year - 1900 < INT_MIN)
+    return TM_ERROR;
+
+  date->tm_year = (int) (year - 1900);
+  date->tm_mon = month - 1;
+  date->tm_mday = day;
+  date->tm_isdst = -1;          // Let timezone information and system databases define DST flag.
+  return TM_OK;
+}
+
+/// Adds a duration to a date, with a single normalization.
+/// @remark TZ must already be set to the wallclock of date (tzset_mutex locked) unless utc is set.
+static tm_status
+tm_adddurationtz (struct tm *date, const tm_duration *d, int utc)
+{
+  struct tm old = *date;
+  const char *wc = date->tm_zone;
+  time_t seconds = (time_t) d->hours * 3600 + (time_t) d->minutes * 60 + d->seconds;
+  time_t t;
+
+  if (tm_durationtofields (date, d) == TM_ERROR)
+    return (*date = old), (errno = EOVERFLOW), TM_ERROR;
+  if (utc)
+    t = tm_tolocalseconds (*date);
+  else
+  {
+    int saveerrno = errno;
+    errno = 0;
+    t = mktime (date);          // if structure members are outside their valid interval, they will be normalized.
+    if (errno)
+      return (*date = old), (errno = EOVERFLOW), TM_ERROR;
+    errno = saveerrno;
+  }
+  if ((seconds > 0 && t + seconds < t) || (seconds < 0 && t + seconds > t))
+    return (*date = old), (errno = EOVERFLOW), TM_ERROR;
+
+  t += seconds;
+  if ((utc || seconds) && !(utc ? gmtime_r (&t, date) : localtime_r (&t, date)))
+    return (*date = old), (errno = EOVERFLOW), TM_ERROR;
+  if (date->tm_year + 1900 + 1 < date->tm_year)
+    return (*date = old), (errno = EOVERFLOW), TM_ERROR;
+  date->tm_zone = wc;
+  return TM_OK;
+}
+
+tm_status
+tm_addduration (struct tm *date, tm_duration duration)
+{
+  if (!date)
+    return (errno = EINVAL), TM_ERROR;
+  return tm_addduration_n (date, 1, duration) == 1 ? TM_OK : TM_ERROR;
+}
+
+// Dates should all be defined in the same wallclock: TZ is set once for all.
+size_t
+tm_addduration_n (struct tm *dates, size_t n, tm_duration duration)
+{
+  if (!n)
+    return 0;
+  if (!dates)
+    return (errno = EINVAL), 0;
+
+  size_t i = 0;
+  const char *rep = tm_getregisteredwallclock (dates->tm_zone, 0);
+  if (tm_isutctimezone (rep))
+  {
+    for (; i < n; i++)
+      if (!tm_isdefinedinwallclock (dates[i], rep))
+        return (errno = EINVAL), i;
+      else if (tm_adddurationtz (dates + i, &duration, 1) == TM_ERROR)
+        return i;
+    return i;
+  }
+
+  pthread_mutex_lock (&tzset_mutex);
+  const char *old_tz;
+  if (tm_tzset (rep, &old_tz) == TM_ERROR)
+  {
+    pthread_mutex_unlock (&tzset_mutex);
+    return (errno = EINVAL), 0;
+  }
+  for (; i < n; i++)
+    if (!tm_isdefinedinwallclock (dates[i], rep))
+    {
+      errno = EINVAL;
+      break;
+    }
+    else if (tm_adddurationtz (dates + i, &duration, 0) == TM_ERROR)
+      break;
+  tm_tzunset (old_tz);
+  pthread_mutex_unlock (&tzset_mutex);
+  return i;
+}
+
+// Pending operations of a builder, in the order they are applied when resolved.
+#define TM_BUILDER_DATE 1
+#define TM_BUILDER_MONTHS 2
+#define TM_BUILDER_DAYS 4
+#define TM_BUILDER_TIME 8
+#define TM_BUILDER_SECONDS 16
+#define TM_BUILDER_STRICTTIME 32        // Time of day set by tm_builder_settime rather than by tm_builder_trimtime
+
+void
+tm_builder_init (tm_builder *builder, struct tm date, tm_time_precedence clock)
+{
+  if (!builder)
+    return;
+  memset (builder, 0, sizeof (*builder));
+  builder->date = date;
+  builder->precedence = clock;
+}
+
+/// Applies pending operations on the date of a builder, with a single normalization.
+/// Pending operations are discarded, whatever the result.
+static tm_status
+tm_builder_resolve (tm_builder *b)
+{
+  int pending = b->pending;
+  b->pending = 0;
+  if (!pending)
+    return TM_OK;
+
+  struct tm tm = b->date;
+  if (pending & (TM_BUILDER_DATE | TM_BUILDER_MONTHS | TM_BUILDER_DAYS | TM_BUILDER_TIME))
+  {
+    if (pending & TM_BUILDER_DATE)
+    {
+      tm.tm_year = b->year - 1900;
+      tm.tm_mon = b->month - 1;
+      tm.tm_mday = b->day;
+    }
+    tm_duration nominal = {.months = pending & TM_BUILDER_MONTHS ? b->months : 0,.days = pending & TM_BUILDER_DAYS ? b->days : 0 };
+    if (tm_durationtofields (&tm, &nominal) == TM_ERROR)
+      return (errno = EOVERFLOW), TM_ERROR;
+    if (pending & TM_BUILDER_TIME)
+    {
+      tm.tm_hour = b->hour;
+      tm.tm_min = b->minute;
+      tm.tm_sec = b->second;
+    }
+    if (pending & (TM_BUILDER_DATE | TM_BUILDER_STRICTTIME))    // Fields are checked, and DST overlaps are resolved, as by tm_set
+    {
+      if (tm.tm_year > INT_MAX - 1900 ||
+          tm_make_dtrc (&tm, tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, TM_REF_UNCHANGED, b->precedence) == TM_ERROR)
+        return (errno = EINVAL), TM_ERROR;
+    }
+    else
+    {
+      tm.tm_isdst = -1;         // Let timezone information and system databases define DST flag, as by tm_adddays or tm_trimtime.
+      if (tm_normalize (&tm, 0) == TM_ERROR)
+        return (errno = EOVERFLOW), TM_ERROR;
+    }
+  }
+
+  if ((pending & TM_BUILDER_SECONDS) && b->seconds)
+  {
+    // tm is normalized: its UTC time is deduced without calling mktime.
+    const char *wc = tm.tm_zone;
+    time_t t = tm_tolocalseconds (tm) - tm.tm_gmtoff;
+    if ((b->seconds > 0 && t + (time_t) b->seconds < t) || (b->seconds < 0 && t + (time_t) b->seconds > t))
+      return (errno = EOVERFLOW), TM_ERROR;
+    t += b->seconds;
+    if (tm_isutctimezone (wc))
+    {
+      if (!gmtime_r (&t, &tm) || tm.tm_year + 1900 + 1 < tm.tm_year)   // time syscall
+        return (errno = EOVERFLOW), TM_ERROR;
+      tm.tm_zone = wc;
+    }
+    else
+    {
+      struct tm normalized = tm;
+      if (tm_zonetablelocaltime (wc, t, &tm) == TM_ERROR)
+      {
+        tm = normalized;
+        if (tm_addseconds (&tm, b->seconds) == TM_ERROR)
+          return TM_ERROR;
+      }
+    }
+  }
+
+  b->date = tm;
+  return TM_OK;
+}
+
+/// Resolves pending operations of a builder which should be applied after an operation op, so that op can be deferred.
+static tm_status
+tm_builder_defer (tm_builder *b, int op)
+{
+  if ((b->pending & (2 * TM_BUILDER_SECONDS - 1)) >= 2 * op)
+    return tm_builder_resolve (b);
+  return TM_OK;
+}
+
+tm_status
+tm_builder_setdate (tm_builder *builder, int year, tm_month month, int day)
+{
+  if (!builder || year < INT_MIN + 1900 || month < TM_JANUARY || month > TM_DECEMBER || day < 1 || day > tm_daysincivilmonth (year, (int) month))
+    return (errno = EINVAL), TM_ERROR;
+  if (tm_builder_defer (builder, TM_BUILDER_DATE) == TM_ERROR)
+    return TM_ERROR;
+
+  builder->year = year;
+  builder->month = (int) month;
+  builder->day = day;
+  builder->pending |= TM_BUILDER_DATE;
+  return TM_OK;
+}
+
+tm_status
+tm_builder_settime (tm_builder *builder, int hour, int min, int sec)
+{
+  if (!builder || hour < 0 || hour > 23 || min < 0 || min > 59 || sec < 0 || sec > 59)
+    return (errno = EINVAL), TM_ERROR;
+  if (tm_builder_defer (builder, TM_BUILDER_TIME) == TM_ERROR)
+    return TM_ERROR;
+
+  builder->hour = hour;
+  builder->minute = min;
+  builder->second = sec;
+  builder->pending |= TM_BUILDER_TIME | TM_BUILDER_STRICTTIME;
+  return TM_OK;
+}
+
+tm_status
+tm_builder_trimtime (tm_builder *builder)
+{
+  if (!builder)
+    return (errno = EINVAL), TM_ERROR;
+  if (tm_builder_defer (builder, TM_BUILDER_TIME) == TM_ERROR)
+    return TM_ERROR;
+
+  builder->hour = builder->minute = builder->second = 0;
+  builder->pending = (builder->pending | TM_BUILDER_TIME) & ~TM_BUILDER_STRICTTIME;
+  return TM_OK;
+}
+
+tm_status
+tm_builder_addseconds (tm_builder *builder, long int nbSecs)
+{
+  if (!builder)
+    return (errno = EINVAL), TM_ERROR;
+  if (!(builder->pending & TM_BUILDER_SECONDS))
+    builder->seconds = 0;
+  else if ((nbSecs > 0 && builder->seconds > LONG_MAX - nbSecs) || (nbSecs < 0 && builder->seconds < LONG_MIN - nbSecs))
+  {
+    if (tm_builder_resolve (builder) == TM_ERROR)
+      return TM_ERROR;
+    builder->seconds = 0;
+  }
+
+  builder->seconds += nbSecs;
+  builder->pending |= TM_BUILDER_SECONDS;
+  return TM_OK;
+}
+
+tm_status
+tm_builder_adddays (tm_builder *builder, int nbDays)
+{
+  if (!builder)
+    return (errno = EINVAL), TM_ERROR;
+  if (tm_builder_defer (builder, TM_BUILDER_DAYS) == TM_ERROR)
+    return TM_ERROR;
+  if (!(builder->pending & TM_BUILDER_DAYS))
+    builder->days = 0;
+  else if ((nbDays > 0 && builder->days > INT_MAX - nbDays) || (nbDays < 0 && builder->days < INT_MIN - nbDays))
+  {
+    if (tm_builder_resolve (builder) == TM_ERROR)
+      return TM_ERROR;
+    builder->days = 0;
+  }
+
+  builder->days += nbDays;
+  builder->pending |= TM_BUILDER_DAYS;
+  return TM_OK;
+}
+
+tm_status
+tm_builder_addmonths (tm_builder *builder, int nbMonths)
+{
+  if (!builder)
+    return (errno = EINVAL), TM_ERROR;
+  if (tm_builder_defer (builder, TM_BUILDER_MONTHS) == TM_ERROR)
+    return TM_ERROR;
+  if (!(builder->pending & TM_BUILDER_MONTHS))
+    builder->months = 0;
+  // Successive additions of months can be merged unless the day of month might be limited to the last day of an intermediate month.
+  else if ((builder->pending & TM_BUILDER_DATE ? builder->day : builder->date.tm_mday) > 28 ||
+           (nbMonths > 0 && builder->months > INT_MAX - nbMonths) || (nbMonths < 0 && builder->months < INT_MIN - nbMonths))
+  {
+    if (tm_builder_resolve (builder) == TM_ERROR)
+      return TM_ERROR;
+    builder->months = 0;
+  }
+
+  builder->months += nbMonths;
+  builder->pending |= TM_BUILDER_MONTHS;
+  return TM_OK;
+}
+
+tm_status
+tm_builder_get (tm_builder *builder, struct tm *date)
+{
+  if (!builder || !date)
+    return (errno = EINVAL), TM_ERROR;
+  if (tm_builder_resolve (builder) == TM_ERROR)
+    return TM_ERROR;
+  *date = builder->date;
+  return TM_OK;
+}
+
+/*****************************************************
+*   COMPARATORS                                      *
+*****************************************************/
 int
-tm_getdayofyear (struct tm date)
+tm_equals (struct tm a, struct tm b)
+{
+  return (a.tm_sec == b.tm_sec && a.tm_min == b.tm_min && a.tm_hour == b.tm_hour &&
+          a.tm_mday == b.tm_mday && a.tm_mon == b.tm_mon && a.tm_year == b.tm_year && a.tm_gmtoff == b.tm_gmtoff && a.tm_zone == b.tm_zone);
+}
+
+long int
+tm_diffseconds (struct tm debut, struct tm fin)
+{
+  time_t d, f;
+  if (tm_normalize (&fin, &f) == TM_OK && tm_normalize (&debut, &d) == TM_OK)
+    return f - d;
+
+  errno = EINVAL;               // Both dates have been normalized at creation, errno should not be set.
+  return (time_t) - 1;
+
+}
+
+int
+tm_compare (const void *pdebut, const void *pfin)
+{
+  long int diff = -tm_diffseconds (*(const struct tm *) pdebut, *(const struct tm *) pfin);
+
+  return diff < 0 ? -1 : (diff > 0 ? 1 : 0);
+}
+
+int                             /* set_errno */
+tm_diffcalendardays (struct tm debut, struct tm fin)
+{
+  if (tm_getwallclock (debut) != tm_getwallclock (fin))
+    return (errno = EINVAL), 0;
+
+  int coeff = 1;
+  int ret = 0;
+
+  if (fin.tm_year < debut.tm_year)
+  {
+    struct tm tmp = debut;
+
+    debut = fin;
+    fin = tmp;
+    coeff = -1;
+  }
+  ret = fin.tm_yday - debut.tm_yday;
+
+  debut.tm_mon = 11;
+  debut.tm_mday = 31;
+  for (; debut.tm_year < fin.tm_year; debut.tm_year++)
+  {
+    if (tm_normalize (&debut, 0) == TM_ERROR)
+      return (errno = EINVAL), TM_ERROR;
+    ret += debut.tm_yday + 1;
+  }
+
+  return coeff * ret;
+}
+
+int                             /* set_errno */
+tm_diffdays (struct tm debut, struct tm fin, int *seconds)
+{
+  if (tm_getwallclock (debut) != tm_getwallclock (fin))
+    return (errno = EINVAL), 0;
+
+  int coeff = 1;
+
+  if (tm_diffseconds (debut, fin) < 0)
+  {
+    struct tm tmp = debut;
+
+    debut = fin;
+    fin = tmp;
+    coeff = -1;
+  }
+
+  int ret = tm_diffcalendardays (debut, fin);
+
+  if (fin.tm_hour < debut.tm_hour || (fin.tm_hour == debut.tm_hour && fin.tm_min < debut.tm_min) ||
+      (fin.tm_hour == debut.tm_hour && fin.tm_min == debut.tm_min && fin.tm_sec < debut.tm_sec))
+    if (ret > 0)
+      ret--;
+
+  if (seconds)
+  {
+    tm_adddays (&debut, ret);
+    *seconds = coeff * (int) tm_diffseconds (debut, fin);
+  }
+
+  return coeff * ret;
+}
+
+int                             /* set errno */
+tm_diffweeks (struct tm debut, struct tm fin, int *days, int *seconds)
+{
+  int d = tm_diffdays (debut, fin, seconds);
+
+  if (days)
+    *days = d >= 0 ? d % 7 : -((-d) % 7);
+
+  return d / 7;
+}
+
+int                             /* set_errno */
+tm_diffcalendarmonths (struct tm debut, struct tm fin)
+{
+  if (tm_getwallclock (debut) != tm_getwallclock (fin))
+    return (errno = EINVAL), 0;
+
+  return 12 * (fin.tm_year - debut.tm_year) + fin.tm_mon - debut.tm_mon;
+}
+
+int                             /* set_errno */
+tm_diffmonths (struct tm debut, struct tm fin, int *days, int *seconds)
+{
+  if (tm_getwallclock (debut) != tm_getwallclock (fin))
+    return (errno = EINVAL), 0;
+
+  int coeff = 1;
+
+  if (tm_diffseconds (debut, fin) < 0)
+  {
+    struct tm tmp = debut;
+
+    debut = fin;
+    fin = tmp;
+    coeff = -1;
+  }
+
+  int ret = tm_diffcalendarmonths (debut, fin);
+
+  if (fin.tm_mday < debut.tm_mday ||
+      (fin.tm_mday == debut.tm_mday && fin.tm_hour < debut.tm_hour) ||
+      (fin.tm_mday == debut.tm_mday && fin.tm_hour == debut.tm_hour && fin.tm_min < debut.tm_min) ||
+      (fin.tm_mday == debut.tm_mday && fin.tm_hour == debut.tm_hour && fin.tm_min == debut.tm_min && fin.tm_sec < debut.tm_sec))
+    if (ret > 0)
+      ret--;
+
+  tm_addmonths (&debut, ret);
+  int d = coeff * tm_diffdays (debut, fin, seconds);
+  if (days)
+    *days = d;
+  if (seconds)
+    *seconds *= coeff;
+
+  return coeff * ret;
+}
+
+int                             /* set_errno */
+tm_diffcalendaryears (struct tm debut, struct tm fin)
+{
+  if (tm_getwallclock (debut) != tm_getwallclock (fin))
+    return (errno = EINVAL), 0;
+
+  return tm_getyear (fin) - tm_getyear (debut);
+}
+
+int                             /* set_errno */
+tm_diffyears (struct tm debut, struct tm fin, int *months, int *days, int *seconds)
+{
+  int m = tm_diffmonths (debut, fin, days, seconds);
+
+  if (months)
+    *months = m >= 0 ? m % 12 : -((-m) % 12);
+  return m / 12;
+}
+
+int                             /* set_errno */
+tm_diffisoyears (struct tm debut, struct tm fin)
+{
+  if (tm_getwallclock (debut) != tm_getwallclock (fin))
+    return (errno = EINVAL), 0;
+
+  return tm_getisoyear (fin) - tm_getisoyear (debut);
+}
+
+time_t
+tm_tobinary (struct tm date)
+{
+  struct tm dt0;
+  tm_set (&dt0, 1970, TM_JANUARY, 1, 0, 0, 0, TM_REF_UTC);      // Epoch, 1970-01-01 00:00:00 +0000 (UTC).
+  return tm_diffseconds (dt0, date);
+}
+
+tm_instant
+tm_toinstant (struct tm date)
+{
+  tm_instant ret = { 0, 0 };
+  time_t utc;
+  if (tm_normalize (&date, &utc) == TM_ERROR)
+    return (errno = EINVAL), ret;
+  ret.utc = utc;
+  ret.utcoffset = (int) date.tm_gmtoff;
+  return ret;
+}
+
+tm_status
+tm_frombinary (struct tm *date, time_t binary, const char *rep)
+{
+  if (rep == TM_REF_UNCHANGED)
+    rep = tm_getwallclock (*date);
+
+  struct tm dt0;
+  tm_set (&dt0, 1970, TM_JANUARY, 1, 0, 0, 0, TM_REF_UTC);      // Epoch, 1970-01-01 00:00:00 +0000 (UTC).
+  *date = dt0;
+  if (tm_addseconds (date, binary) == TM_OK && tm_changetowallclock (date, rep) == TM_OK)
+    return TM_OK;
+  else
+    return TM_ERROR;
+}
+
+/*****************************************************
+*   SCHEDULES                                        *
+*****************************************************/
+#define TM_CRON_DAY_STAR 1      // Day of month unrestricted (field starting with *)
+#define TM_CRON_WEEKDAY_STAR 2  // Day of week unrestricted (field starting with *)
+#define TM_CRON_MAXYEARS 400    // Period of the Gregorian calendar: a schedule which does not fire within never fires.
+
+/// Index of the first bit set in mask from index bit, or -1.
+static int
+tm_cronnextbit (unsigned long long mask, int bit)
+{
+  if (bit >= 64 || !(mask >>= bit))
+    return -1;
+#if defined(__GNUC__)
+  return bit + __builtin_ctzll (mask);
+#else
+  for (; !(mask & 1); mask >>= 1)
+    bit++;
+  return bit;
+#endif
+}
+
+// Reads a value, either decimal or one of nbnames names (standing for min, min + 1...).
+static const char *
+tm_cronscanvalue (const char *p, int min, int max, const char (*names)[4], int nbnames, int *value)
+{
+  int index;
+  const char *q;
+  if (names && (q = tm_rfcscanname (p, names, nbnames, &index)))
+  {
+    *value = min + index;
+    return q;
+  }
+  return (p = tm_rfcscandigits (p, 1, 2, value)) && *value >= min && *value <= max ? p : 0;
+}
+
+// Reads a field of a cron expression: comma separated list of *, n or n-m, each optionally followed by /step.
+static const char *
+tm_cronscanfield (const char *p, int min, int max, const char (*names)[4], int nbnames, unsigned long long *mask, int *star)
+{
+  *mask = 0;
+  *star = *p == '*';
+  for (;; p++)
+  {
+    int lo = min, hi = max, step = 1;
+    if (*p == '*')
+      p++;
+    else
+    {
+      if (!(p = tm_cronscanvalue (p, min, max, names, nbnames, &lo)))
+        return 0;
+      if (*p == '-')
+      {
+        if (!(p = tm_cronscanvalue (p + 1, min, max, names, nbnames, &hi)) || hi < lo)
+          return 0;
+      }
+      else if (*p != '/')
+        hi = lo;                // n/step stands for n-max/step
+    }
+    if (*p == '/' && (!(p = tm_rfcscandigits (p + 1, 1, 2, &step)) || !step))
+      return 0;
+    for (int v = lo; v <= hi; v += step)
+      *mask |= 1ULL << v;
+    if (*p != ',')
+      return p;
+  }
+}
+
+tm_status
+tm_cron_compile (tm_cron *cron, const char *expr)
+{
+  static const char *const macros[][2] = {
+    {"@yearly", "0 0 1 1 *"}, {"@annually", "0 0 1 1 *"}, {"@monthly", "0 0 1 * *"}, {"@weekly", "0 0 * * 0"},
+    {"@daily", "0 0 * * *"}, {"@midnight", "0 0 * * *"}, {"@hourly", "0 * * * *"},
+  };
+  static const struct
+  {
+    int min, max;
+    const char (*names)[4];
+    int nbnames;
+  } fields[] = { {0, 59, 0, 0}, {0, 23, 0, 0}, {1, 31, 0, 0}, {1, 12, tm_rfcmonthnames, 12}, {0, 7, tm_rfcdaynames, 7} };
+
+  if (!cron || !expr)
+    return (errno = EINVAL), TM_ERROR;
+
+  const char *p = tm_rfcskipspaces (expr);
+  if (*p == '@')
+  {
+    for (size_t i = 0; i < sizeof (macros) / sizeof (*macros); i++)
+    {
+      size_t len = strlen (macros[i][0]);
+      if (tm_rfcnameequals (p, macros[i][0], len) && !*tm_rfcskipspaces (p + len))
+        return tm_cron_compile (cron, macros[i][1]);
+    }
+    return (errno = EINVAL), TM_ERROR;
+  }
+
+  unsigned long long masks[5];
+  int stars[5];
+  for (size_t i = 0; i < 5 && p; i++)
+    if (!i || (p = tm_rfcscanspaces (p)))
+      p = tm_cronscanfield (p, fields[i].min, fields[i].max, fields[i].names, fields[i].nbnames, masks + i, stars + i);
+  if (!p || *tm_rfcskipspaces (p))
+    return (errno = EINVAL), TM_ERROR;
+
+  cron->minutes = masks[0];
+  cron->hours = (unsigned long int) masks[1];
+  cron->days = (unsigned long int) masks[2];
+  cron->months = (unsigned int) masks[3];
+  cron->weekdays = (unsigned int) ((masks[4] | masks[4] >> 7) & 0x7F);  // 7 stands for Sunday, as 0
+  cron->flags = (stars[2] ? TM_CRON_DAY_STAR : 0) | (stars[4] ? TM_CRON_WEEKDAY_STAR : 0);
+  return TM_OK;
+}
+
+static int
+tm_cronisvalid (const tm_cron *cron)
+{
+  return cron->minutes && !(cron->minutes & ~0xFFFFFFFFFFFFFFFULL) && cron->hours && !(cron->hours & ~0xFFFFFFUL) &&
+    cron->days && !(cron->days & ~0xFFFFFFFEUL) && cron->months && !(cron->months & ~0x1FFEU) && cron->weekdays && !(cron->weekdays & ~0x7FU);
+}
+
+/// 1 if cron selects the day number days (day of month day).
+static int
+tm_cronisday (const tm_cron *cron, long int days, int day)
+{
+  int bymonthday = (int) (cron->days >> day & 1);
+  int byweekday = (int) (cron->weekdays >> tm_dayofweekfromdays (days) & 1);
+  // As for Vixie cron, a day matches either field if both are restricted.
+  return (cron->flags & (TM_CRON_DAY_STAR | TM_CRON_WEEKDAY_STAR)) ? bymonthday && byweekday : bymonthday || byweekday;
+}
+
+/// First local time selected by cron, from local, jumping over months, days and hours which are not selected.
+/// @param [in] local Seconds elapsed since 1970-01-01 00:00:00 on the wallclock
+static tm_status
+tm_cronnextlocal (const tm_cron *cron, time_t local, time_t *next)
+{
+  long int days = (long int) (local / 86400 - (local % 86400 < 0));
+  long int sod = (long int) (local - (time_t) days * 86400);
+  if ((sod = (sod + 59) / 60 * 60) == 86400)
+    days++, sod = 0;
+
+  for (long int limit = days + TM_CRON_MAXYEARS * 366L; days < limit;)
+  {
+    long int year;
+    int month, day;
+    tm_civilfromdays (days, &year, &month, &day);
+    if (!(cron->months >> month & 1))
+    {
+      int m = tm_cronnextbit (cron->months, month + 1);
+      if (m < 0)
+        year++, m = tm_cronnextbit (cron->months, 1);
+      days = tm_daysfromcivil (year, m, 1), sod = 0;
+      continue;
+    }
+    int hour;
+    if (!tm_cronisday (cron, days, day) || (hour = tm_cronnextbit (cron->hours, (int) (sod / 3600))) < 0)
+    {
+      days++, sod = 0;
+      continue;
+    }
+    int minute = tm_cronnextbit (cron->minutes, hour == sod / 3600 ? (int) (sod / 60 % 60) : 0);
+    if (minute < 0)
+    {
+      if ((sod = (hour + 1) * 3600L) == 86400)
+        days++, sod = 0;
+      continue;
+    }
+    *next = (time_t) days * 86400 + hour * 3600 + minute * 60;
+    return TM_OK;
+  }
+  return (errno = EINVAL), TM_ERROR;
+}
+
+// Origin of the search for next firings, shared by a batch of schedules.
+typedef struct
+{
+  const tm_zonetable *zt;       // 0 for UTC
+  time_t after;                 // UTC instant after which schedules fire
+  time_t local;                 // Local time of after + 1 second
+  time_t from, until;           // Local times within [from, until) are unique and have the UTC offset of after (tr).
+  tm_zonetransition tr;
+} tm_cronorigin;
+
+static tm_status
+tm_cronoriginset (tm_cronorigin *origin, const tm_zonetable *zt, time_t after)
+{
+  origin->zt = zt;
+  origin->after = after;
+  origin->local = after + 1;
+  origin->from = origin->until = 0;
+  origin->tr = (tm_zonetransition) { 0, 0, 0 };
+  if (!zt)
+    return TM_OK;
+  if (after < zt->begin || after >= zt->end)
+    return (errno = EINVAL), TM_ERROR;
+
+  size_t i = tm_zonetableindex (zt, after);
+  const tm_zonetransition *tr = zt->tr + i;
+  origin->tr = *tr;
+  origin->local += tr->gmtoff;
+  // Local times after the end of a preceding overlap, and before the start of a following gap or overlap
+  origin->from = tr->at + (i && tr[-1].gmtoff > tr->gmtoff ? tr[-1].gmtoff : tr->gmtoff);
+  origin->until = i + 1 < zt->nb ? tr[1].at + (tr[1].gmtoff < tr->gmtoff ? tr[1].gmtoff : tr->gmtoff) : origin->from;
+  return TM_OK;
+}
+
+/// First UTC instant strictly after origin selected by cron, and its UTC offset.
+/// A local time skipped by a DST gap fires when the gap ends, and a local time repeated by a DST overlap fires once, at its first occurrence.
+static tm_status
+tm_cronnextutc (const tm_cron *cron, const tm_cronorigin *origin, tm_zonetransition *next)
+{
+  for (time_t local = origin->local;; local += 60)
+  {
+    if (tm_cronnextlocal (cron, local, &local) == TM_ERROR)
+      return TM_ERROR;
+    tm_zonelocal zl;
+    if (!origin->zt)
+      return (*next = (tm_zonetransition) { local, 0, 0 }), TM_OK;
+    else if (local >= origin->from && local < origin->until)
+      return (*next = origin->tr), (next->at = local - origin->tr.gmtoff), TM_OK;
+    else if (tm_zonetableclassify (origin->zt, local, &zl) == TM_ERROR)
+      return (errno = EINVAL), TM_ERROR;
+    else if (zl.tr[0].at > origin->after)
+      return (*next = zl.tr[0]), TM_OK;
+    // Otherwise, second occurrence of a repeated local time.
+  }
+}
+
+size_t
+tm_cron_next_n (const tm_cron *crons, size_t n, struct tm after, struct tm *next, const char *wallclock)
+{
+  if (!crons || !next)
+    return (errno = EINVAL), 0;
+  if (wallclock == TM_REF_UNCHANGED)
+    wallclock = tm_getwallclock (after);
+  const char *wc = tm_getregisteredwallclock (wallclock, 1);
+  if (wc == TM_REF_UNDEFINED)
+    return (errno = EINVAL), 0;
+
+  const tm_zonetable *zt = 0;
+  if (!tm_isutctimezone (wc) && !(zt = tm_zonetableacquire (wc)))
+    return (errno = EINVAL), 0;
+
+  // The transition table is acquired, and after is located in it, once for all schedules.
+  tm_cronorigin origin;
+  size_t i = 0;
+  tm_zonetransition tr;
+  if (tm_cronoriginset (&origin, zt, tm_tolocalseconds (after) - after.tm_gmtoff) == TM_OK)
+    for (; i < n; i++)
+    {
+      if (!tm_cronisvalid (crons + i))
+      {
+        errno = EINVAL;
+        break;
+      }
+      if (tm_cronnextutc (crons + i, &origin, &tr) == TM_ERROR)
+        break;
+      tm_fromlocalseconds (tr.at + tr.gmtoff, next + i);
+      next[i].tm_gmtoff = tr.gmtoff;
+      next[i].tm_isdst = tr.isdst;
+      next[i].tm_zone = wc;
+    }
+  tm_zonetablerelease (zt);
+  return i;
+}
+
+tm_status
+tm_cron_next (const tm_cron *cron, struct tm after, struct tm *next, const char *wallclock)
+{
+  return tm_cron_next_n (cron, 1, after, next, wallclock) == 1 ? TM_OK : TM_ERROR;
+}
+
+#define TM_TIMERWHEEL_BITS 6
+#define TM_TIMERWHEEL_SLOTS (1 << TM_TIMERWHEEL_BITS)   // Per level
+#define TM_TIMERWHEEL_LEVELS 5  // Timers due in more than 2^30 seconds (34 years) are cascaded again.
+#define TM_TIMERWHEEL_BATCH 64  // Maximum number of timers passed at once to the expiration handler
+
+// Hierarchical timer wheel: a slot of level l holds the timers due within 2^(6 * l) seconds;
+// the timers of a slot are cascaded down to the lower level when the clock reaches the beginning of the slot.
+struct tm_timerwheel
+{
+  time_t clock;                 // Next second to process: timers due before have expired.
+  size_t nb;                    // Pending timers
+  uint64_t occupied[TM_TIMERWHEEL_LEVELS];      // Non empty slots
+  tm_timer *slots[TM_TIMERWHEEL_LEVELS][TM_TIMERWHEEL_SLOTS];
+  tm_timer *zones[TM_ZONETABLE_SLOTS + 1];      // Pending timers per wallclock (the last one for UTC)
+};
+
+/// UTC instant of the wall time held by deadline, as currently defined on its wallclock.
+/// A local time skipped by DST resolves to the end of the gap, and a repeated local time to the occurrence having the UTC offset of deadline (the first one otherwise).
+static time_t
+tm_timerresolve (struct tm deadline)
+{
+  time_t local = tm_tolocalseconds (deadline);
+  if (tm_isutctimezone (deadline.tm_zone))
+    return local;
+
+  time_t at = local - deadline.tm_gmtoff;       // Out of the range of the transition table
+  const tm_zonetable *zt = tm_zonetableacquire (deadline.tm_zone);
+  tm_zonelocal zl;
+  if (zt && tm_zonetableclassify (zt, local, &zl) == TM_OK)
+    at = zl.nb == 2 && zl.tr[1].gmtoff == deadline.tm_gmtoff ? zl.tr[1].at : zl.tr[0].at;
+  tm_zonetablerelease (zt);
+  return at;
+}
+
+static void
+tm_timerwheelplace (tm_timerwheel *wheel, tm_timer *timer)
+{
+  time_t due = timer->at < wheel->clock ? wheel->clock : timer->at;
+  int level = 0;
+  while (level < TM_TIMERWHEEL_LEVELS - 1 && (due - wheel->clock) >> (TM_TIMERWHEEL_BITS * (level + 1)))
+    level++;
+  if ((due - wheel->clock) >> (TM_TIMERWHEEL_BITS * TM_TIMERWHEEL_LEVELS))
+    due = wheel->clock + ((time_t) 1 << (TM_TIMERWHEEL_BITS * TM_TIMERWHEEL_LEVELS)) - 1;      // Cascaded again later
+  int index = (int) ((due >> (TM_TIMERWHEEL_BITS * level)) & (TM_TIMERWHEEL_SLOTS - 1));
+
+  tm_timer **head = &wheel->slots[level][index];
+  if ((timer->next = *head))
+    timer->next->pprev = &timer->next;
+  timer->pprev = head;
+  *head = timer;
+  timer->slot = level * TM_TIMERWHEEL_SLOTS + index;
+  wheel->occupied[level] |= 1ULL << index;
+}
+
+static void
+tm_timerwheelunplace (tm_timerwheel *wheel, tm_timer *timer)
+{
+  if ((*timer->pprev = timer->next))
+    timer->next->pprev = timer->pprev;
+  timer->pprev = 0;
+  int level = timer->slot / TM_TIMERWHEEL_SLOTS, index = timer->slot % TM_TIMERWHEEL_SLOTS;
+  if (!wheel->slots[level][index])
+    wheel->occupied[level] &= ~(1ULL << index);
+}
+
+tm_timerwheel *
+tm_timerwheel_create (struct tm now)
+{
+  tm_timerwheel *wheel = calloc (1, sizeof (*wheel));
+  if (!wheel)
+    return (errno = ENOMEM), (tm_timerwheel *) 0;
+  wheel->clock = tm_tolocalseconds (now) - now.tm_gmtoff;
+  return wheel;
+}
+
+void
+tm_timerwheel_free (tm_timerwheel *wheel)
+{
+  free (wheel);
+}
+
+tm_status
+tm_timerwheel_insert (tm_timerwheel *wheel, tm_timer *timer, struct tm deadline, void *data)
+{
+  if (!wheel || !timer)
+    return (errno = EINVAL), TM_ERROR;
+
+  timer->deadline = deadline;
+  timer->data = data;
+  timer->at = tm_timerresolve (deadline);
+  tm_timerwheelplace (wheel, timer);
+
+  tm_timer **head = &wheel->zones[tm_zonetableslot (deadline.tm_zone)];
+  if ((timer->zonenext = *head))
+    timer->zonenext->zonepprev = &timer->zonenext;
+  timer->zonepprev = head;
+  *head = timer;
+  wheel->nb++;
+  return TM_OK;
+}
+
+tm_status
+tm_timerwheel_cancel (tm_timerwheel *wheel, tm_timer *timer)
+{
+  if (!wheel || !timer || !timer->pprev)        // Not pending
+    return (errno = EINVAL), TM_ERROR;
+
+  tm_timerwheelunplace (wheel, timer);
+  if ((*timer->zonepprev = timer->zonenext))
+    timer->zonenext->zonepprev = timer->zonepprev;
+  wheel->nb--;
+  return TM_OK;
+}
+
+/// Processes the second wheel->clock: cascades the slots of upper levels beginning at that second, and expires the timers due.
+static size_t
+tm_timerwheeltick (tm_timerwheel *wheel, void (*expire) (tm_timer ** timers, size_t n, void *arg), void *arg)
+{
+  time_t t = wheel->clock;
+  for (int level = 1; level < TM_TIMERWHEEL_LEVELS && !((t >> (TM_TIMERWHEEL_BITS * (level - 1))) & (TM_TIMERWHEEL_SLOTS - 1)); level++)
+  {
+    int index = (int) ((t >> (TM_TIMERWHEEL_BITS * level)) & (TM_TIMERWHEEL_SLOTS - 1));
+    tm_timer *timer = wheel->slots[level][index], *next;
+    wheel->slots[level][index] = 0;
+    wheel->occupied[level] &= ~(1ULL << index);
+    for (; timer; timer = next)
+    {
+      next = timer->next;
+      tm_timerwheelplace (wheel, timer);
+    }
+  }
+
+  // Timers due are moved out of the wheel first (the handler may insert or cancel timers).
+  int index = (int) (t & (TM_TIMERWHEEL_SLOTS - 1));
+  tm_timer *expired = wheel->slots[0][index];
+  wheel->slots[0][index] = 0;
+  wheel->occupied[0] &= ~(1ULL << index);
+  if (expired)
+    expired->pprev = &expired;
+  wheel->clock = t + 1;
+
+  size_t total = 0;
+  while (expired)
+  {
+    tm_timer *batch[TM_TIMERWHEEL_BATCH];
+    size_t n = 0;
+    for (; expired && n < TM_TIMERWHEEL_BATCH; n++)
+    {
+      tm_timer *timer = batch[n] = expired;
+      if ((expired = timer->next))
+        expired->pprev = &expired;
+      timer->pprev = 0;
+      if ((*timer->zonepprev = timer->zonenext))
+        timer->zonenext->zonepprev = timer->zonepprev;
+      wheel->nb--;
+    }
+    expire (batch, n, arg);
+    total += n;
+  }
+  return total;
+}
+
+size_t
+tm_timerwheel_advance (tm_timerwheel *wheel, struct tm now, void (*expire) (tm_timer ** timers, size_t n, void *arg), void *arg)
+{
+  if (!wheel || !expire)
+    return (errno = EINVAL), 0;
+
+  time_t until = tm_tolocalseconds (now) - now.tm_gmtoff;
+  size_t total = 0;
+  while (wheel->clock <= until)
+  {
+    // Seconds without anything to do are skipped: the wheel jumps to the next non empty slot of level 0,
+    // or to the next cascade of the lowest non empty level.
+    time_t target = until + 1;
+    int level = 0;
+    while (wheel->nb && !wheel->occupied[level])
+      level++;
+    if (wheel->nb && !level)
+    {
+      int index = (int) (wheel->clock & (TM_TIMERWHEEL_SLOTS - 1));
+      int next = tm_cronnextbit (wheel->occupied[0], index);
+      target = next >= 0 ? wheel->clock + next - index : (wheel->clock | (TM_TIMERWHEEL_SLOTS - 1)) + 1;
+    }
+    else if (wheel->nb)
+    {
+      time_t mask = ((time_t) 1 << (TM_TIMERWHEEL_BITS * level)) - 1;
+      target = (wheel->clock & mask) ? (wheel->clock | mask) + 1 : wheel->clock;
+    }
+    if (target > until)
+    {
+      wheel->clock = until + 1;
+      break;
+    }
+    wheel->clock = target;
+    total += tm_timerwheeltick (wheel, expire, arg);
+  }
+  return total;
+}
+
+size_t
+tm_timerwheel_reanchor (tm_timerwheel *wheel, const char *wallclock)
+{
+  const char *wc = wheel ? tm_getregisteredwallclock (wallclock, 0) : TM_REF_UNDEFINED;
+  if (wc == TM_REF_UNDEFINED)
+    return (errno = EINVAL), 0;
+
+  tm_zonetableinvalidate (wc);  // UTC offsets are read again from the time zone database.
+  size_t nb = 0;
+  for (tm_timer *timer = wheel->zones[tm_zonetableslot (wc)]; timer; timer = timer->zonenext)
+  {
+    time_t at = tm_timerresolve (timer->deadline);
+    if (at != timer->at)
+    {
+      tm_timerwheelunplace (wheel, timer);
+      timer->at = at;
+      tm_timerwheelplace (wheel, timer);
+      nb++;
+    }
+  }
+  return nb;
+}
+
+#define TM_RRULE_DAILYLIMIT (TM_CRON_MAXYEARS * 366L)   // Days without occurrence after which a rule is considered exhausted
+
+// Reads an integer from 1 to max, signed if sign is set.
+static const char *
+tm_rrulescaninteger (const char *p, int max, int sign, int *value)
+{
+  int negative = sign && p && *p == '-';
+  if (sign && p && (*p == '-' || *p == '+'))
+    p++;
+  if (!(p = tm_rfcscandigits (p, 1, 6, value)) || *value < 1 || *value > max)
+    return 0;
+  if (negative)
+    *value = -*value;
+  return p;
+}
+
+// YYYYMMDD (until the end of the day), YYYYMMDDThhmmss (local time) or YYYYMMDDThhmmssZ (UTC time).
+static const char *
+tm_rrulescanuntil (const char *p, tm_rrule *rule)
+{
+  int year, month, day, hour = 23, min = 59, sec = 59;
+  if (!(p = tm_rfcscandigits (tm_rfcscandigits (tm_rfcscandigits (p, 4, 4, &year), 2, 2, &month), 2, 2, &day)) ||
+      month < 1 || month > 12 || day < 1 || day > tm_daysincivilmonth (year, month))
+    return 0;
+  if (*p == 'T' && (!(p = tm_rfcscandigits (tm_rfcscandigits (tm_rfcscandigits (p + 1, 2, 2, &hour), 2, 2, &min), 2, 2, &sec)) ||
+                    hour > 23 || min > 59 || sec > 59))
+    return 0;
+  rule->until = 1;
+  if (*p == 'Z')
+    p++, rule->until = 2;
+  rule->untiltime = (time_t) tm_daysfromcivil (year, month, day) * 86400 + hour * 3600 + min * 60 + sec;
+  return p;
+}
+
+tm_status
+tm_rrule_compile (tm_rrule *rule, const char *str)
+{
+  static const char *const parts[] = { "FREQ=", "INTERVAL=", "COUNT=", "UNTIL=", "BYMONTH=", "BYMONTHDAY=", "BYDAY=", "BYSETPOS=" };
+  static const char *const frequencies[] = { "YEARLY", "MONTHLY", "WEEKLY", "DAILY" };
+  static const char *const daynames[] = { "SU", "MO", "TU", "WE", "TH", "FR", "SA" };
+  if (!rule || !str)
+    return (errno = EINVAL), TM_ERROR;
+
+  memset (rule, 0, sizeof (*rule));
+  rule->interval = 1;
+  const char *p = tm_rfcnameequals (str, "RRULE:", 6) ? str + 6 : str;
+  int seen = 0, value, ordinals = 0;
+  do
+  {
+    size_t k = 0;
+    while (k < sizeof (parts) / sizeof (*parts) && !tm_rfcnameequals (p, parts[k], strlen (parts[k])))
+      k++;
+    if (k == sizeof (parts) / sizeof (*parts) || (seen >> k & 1))
+      return (errno = EINVAL), TM_ERROR;
+    seen |= 1 << k;
+    p += strlen (parts[k]);
+    switch (k)
+    {
+      case 0:
+        value = 0;
+        while (value < 4 && !tm_rfcnameequals (p, frequencies[value], strlen (frequencies[value])))
+          value++;
+        if (value < 4)
+          rule->freq = (tm_rrule_frequency) value, p += strlen (frequencies[value]);
+        else
+          p = 0;
+        break;
+      case 1:
+        p = tm_rrulescaninteger (p, 9999, 0, &rule->interval);
+        break;
+      case 2:
+        p = tm_rrulescaninteger (p, 999999, 0, &rule->count);
+        break;
+      case 3:
+        p = tm_rrulescanuntil (p, rule);
+        break;
+      case 4:
+        do
+          if ((p = tm_rrulescaninteger (p, 12, 0, &value)))
+            rule->bymonth |= 1U << value;
+        while (p && *p == ',' && ++p);
+        break;
+      case 5:
+        do
+          if ((p = tm_rrulescaninteger (p, 31, 1, &value)))
+            *(value > 0 ? &rule->bymonthday : &rule->bymonthdayneg) |= 1UL << (value > 0 ? value : -value);
+        while (p && *p == ',' && ++p);
+        break;
+      case 6:
+        do
+        {
+          value = 0;
+          if (*p == '+' || *p == '-' || (*p >= '0' && *p <= '9'))
+            p = tm_rrulescaninteger (p, 53, 1, &value);
+          size_t d = 0;
+          while (p && d < 7 && !tm_rfcnameequals (p, daynames[d], 2))
+            d++;
+          if (p && d < 7)
+          {
+            p += 2;
+            ordinals |= value != 0;
+            *(value >= 0 ? rule->byday + d : rule->bydayneg + d) |= 1ULL << (value >= 0 ? value : -value);
+          }
+          else
+            p = 0;
+        }
+        while (p && *p == ',' && ++p);
+        break;
+      case 7:
+        do
+          if ((p = tm_rrulescaninteger (p, 366, 1, &value)) && rule->nbsetpos < TM_RRULE_MAXSETPOS)
+            rule->bysetpos[rule->nbsetpos++] = value;
+          else
+            p = 0;
+        while (p && *p == ',' && ++p);
+        break;
+    }
+  }
+  while (p && *p == ';' && *++p);
+
+  // As required by RFC 5545: COUNT and UNTIL are exclusive, BYSETPOS is used with another BYxxx rule part,
+  // BYMONTHDAY is not used with WEEKLY, and BYDAY ordinals are used with MONTHLY or YEARLY only.
+  if (!p || *p || !(seen & 1) || (rule->count && rule->until) || (rule->nbsetpos && !(seen & (7 << 4))) ||
+      ((seen >> 5 & 1) && rule->freq == TM_RRULE_WEEKLY) || (ordinals && rule->freq != TM_RRULE_MONTHLY && rule->freq != TM_RRULE_YEARLY))
+    return (errno = EINVAL), TM_ERROR;
+  return TM_OK;
+}
+
+/// First and last days of the period of index period (for FREQ and INTERVAL) from the day of DTSTART.
+static void
+tm_rruleperiod (const tm_rrule_iter *iter, long int period, long int *first, long int *last)
+{
+  long int year, offset = period * iter->rule.interval;
+  int month, day;
+  tm_civilfromdays (iter->start, &year, &month, &day);
+  switch (iter->rule.freq)
+  {
+    case TM_RRULE_YEARLY:
+      *first = tm_daysfromcivil (year + offset, 1, 1);
+      *last = tm_daysfromcivil (year + offset + 1, 1, 1) - 1;
+      break;
+    case TM_RRULE_MONTHLY:
+      offset += year * 12 + month - 1;
+      year = offset / 12 - (offset % 12 < 0);
+      month = (int) (offset - year * 12) + 1;
+      *first = tm_daysfromcivil (year, month, 1);
+      *last = *first + tm_daysincivilmonth (year, month) - 1;
+      break;
+    case TM_RRULE_WEEKLY:      // Weeks start on Monday (WKST=MO)
+      *first = iter->start - (tm_dayofweekfromdays (iter->start) + 6) % 7 + 7 * offset;
+      *last = *first + 6;
+      break;
+    default:
+      *first = *last = iter->start + offset;
+  }
+}
+
+/// 1 if the day number day (day of month mday, of a month of dim days) is selected by the rule.
+/// Days not constrained by any BYxxx rule part are taken from DTSTART.
+static int
+tm_rruleisday (const tm_rrule_iter *iter, long int day, long int year, int month, int mday, int dim)
+{
+  const tm_rrule *rule = &iter->rule;
+  int dow = tm_dayofweekfromdays (day);
+  if (rule->bymonthday | rule->bymonthdayneg)
+  {
+    if (!(rule->bymonthday >> mday & 1) && !(rule->bymonthdayneg >> (dim - mday + 1) & 1))
+      return 0;
+  }
+  else if (!iter->byday && (rule->freq == TM_RRULE_YEARLY || rule->freq == TM_RRULE_MONTHLY) && mday != iter->startmday)
+    return 0;
+  if (!rule->bymonth && !(rule->bymonthday | rule->bymonthdayneg) && !iter->byday && rule->freq == TM_RRULE_YEARLY && month != iter->startmonth)
+    return 0;
+
+  if (!iter->byday)
+    return rule->freq != TM_RRULE_WEEKLY || dow == iter->startwday;
+  if (rule->byday[dow] & 1)
+    return 1;
+  // Position of the day among the days of its month (MONTHLY, or YEARLY with BYMONTH) or year (YEARLY)
+  int index = mday - 1, length = dim;
+  if (rule->freq == TM_RRULE_YEARLY && !rule->bymonth)
+    index = (int) (day - tm_daysfromcivil (year, 1, 1)), length = 365 + tm_isleapcivilyear (year);
+  return (rule->byday[dow] >> (index / 7 + 1) & 1) || (rule->bydayneg[dow] >> ((length - 1 - index) / 7 + 1) & 1);
+}
+
+/// Sets the days of the period [first, last] selected by the rule (BYSETPOS applied), in ascending order.
+static void
+tm_rruleexpand (tm_rrule_iter *iter, long int first, long int last)
+{
+  iter->nb = iter->next = 0;
+  for (long int day = first; day <= last;)
+  {
+    long int year;
+    int month, mday;
+    tm_civilfromdays (day, &year, &month, &mday);
+    int dim = tm_daysincivilmonth (year, month);
+    long int end = day + dim - mday < last ? day + dim - mday : last;
+    if (!iter->rule.bymonth || (iter->rule.bymonth >> month & 1))
+      for (; day <= end; day++, mday++)
+        if (tm_rruleisday (iter, day, year, month, mday, dim))
+          iter->days[iter->nb++] = day;
+    day = end + 1;
+  }
+
+  if (iter->rule.nbsetpos)
+  {
+    int nb = 0;
+    for (int i = 0; i < iter->nb; i++)
+      for (int j = 0; j < iter->rule.nbsetpos; j++)
+        if (iter->rule.bysetpos[j] > 0 ? iter->rule.bysetpos[j] - 1 == i : iter->nb + iter->rule.bysetpos[j] == i)
+        {
+          iter->days[nb++] = iter->days[i];
+          break;
+        }
+    iter->nb = nb;
+  }
+}
+
+/// Sets date to the local time local on wallclock wc, as RFC 5545 defines it:
+/// a repeated local time is taken at its first occurrence, and a local time skipped by DST is taken with the UTC offset before the gap (02:30 becomes 03:30).
+static tm_status
+tm_rruleresolve (time_t local, const char *wc, struct tm *date)
+{
+  tm_zonetransition tr = { local, 0, 0 };
+  if (!tm_isutctimezone (wc))
+  {
+    const tm_zonetable *zt = tm_zonetableacquire (wc);
+    tm_zonelocal zl;
+    if (!zt || tm_zonetableclassify (zt, local, &zl) == TM_ERROR)
+    {
+      // Out of the range of the transition table
+      tm_zonetablerelease (zt);
+      tm_fromlocalseconds (local, date);
+      return tm_resolvefields (date, wc, TM_DST_OVER_ST);
+    }
+    tr = zl.tr[0];
+    if (!zl.nb)
+      tr.at = local - zt->tr[tm_zonetableindex (zt, tr.at - 1)].gmtoff;     // Offset before the gap
+    tm_zonetablerelease (zt);
+  }
+  tm_fromlocalseconds (tr.at + tr.gmtoff, date);
+  date->tm_gmtoff = tr.gmtoff;
+  date->tm_isdst = tr.isdst;
+  date->tm_zone = wc;
+  return TM_OK;
+}
+
+tm_status
+tm_rrule_begin (tm_rrule_iter *iter, const tm_rrule *rule, struct tm dtstart)
+{
+  if (!iter || !rule || rule->interval < 1)
+    return (errno = EINVAL), TM_ERROR;
+
+  iter->rule = *rule;
+  iter->wallclock = dtstart.tm_zone;
+  time_t local = tm_tolocalseconds (dtstart);
+  iter->start = (long int) (local / 86400 - (local % 86400 < 0));
+  iter->timeofday = (int) (local - (time_t) iter->start * 86400);
+  iter->startmonth = dtstart.tm_mon + 1;
+  iter->startmday = dtstart.tm_mday;
+  iter->startwday = tm_dayofweekfromdays (iter->start);
+  iter->byday = 0;
+  for (int d = 0; d < 7; d++)
+    iter->byday |= (rule->byday[d] | rule->bydayneg[d]) != 0;
+  iter->period = 0;
+  iter->last = iter->start;
+  iter->produced = iter->done = iter->nb = iter->next = 0;
+  return TM_OK;
+}
+
+size_t
+tm_rrule_next_n (tm_rrule_iter *iter, struct tm *occurrences, size_t n)
+{
+  if (!iter || !occurrences)
+    return (errno = EINVAL), 0;
+
+  size_t i = 0;
+  while (i < n && !iter->done)
+  {
+    if (iter->next == iter->nb)
+    {
+      long int first, last;
+      tm_rruleperiod (iter, iter->period++, &first, &last);
+      if (first > iter->last + TM_RRULE_DAILYLIMIT ||
+          (iter->rule.until && (time_t) first * 86400 + iter->timeofday > iter->rule.untiltime + TM_ZONETABLE_MAXOFFSET))
+        iter->done = 1;
+      else
+        for (tm_rruleexpand (iter, first, last); iter->next < iter->nb && iter->days[iter->next] < iter->start; iter->next++);      // Before DTSTART
+      continue;
+    }
+
+    time_t local = (time_t) iter->days[iter->next++] * 86400 + iter->timeofday;
+    if (iter->rule.until == 1 && local > iter->rule.untiltime)
+      iter->done = 1;
+    else if (tm_rruleresolve (local, iter->wallclock, occurrences + i) == TM_ERROR)
+      break;
+    else if (iter->rule.until == 2 && tm_tolocalseconds (occurrences[i]) - occurrences[i].tm_gmtoff > iter->rule.untiltime)
+      iter->done = 1;
+    else
+    {
+      iter->last = iter->days[iter->next - 1];
+      i++;
+      if (iter->rule.count && ++iter->produced == iter->rule.count)
+        iter->done = 1;
+    }
+  }
+  return i;
+}
+
+tm_status
+tm_rrule_next (tm_rrule_iter *iter, struct tm *occurrence)
+{
+  return tm_rrule_next_n (iter, occurrence, 1) == 1 ? TM_OK : TM_ERROR;
+}
+
+/*****************************************************
+*   BUSINESS DAYS                                    *
+*****************************************************/
+#define TM_BUSDAY_MONDAY 4L     // 1970-01-05, first Monday of the Epoch
+
+// Business day calendar: business days are counted arithmetically by week outside [first, end),
+// and read from a bitmap (with the number of business days before each word of 64 days) inside [first, end).
+struct tm_busdaycal
+{
+  int perweek;                  // Business days per week
+  int before[7];                // Business days of a week before each day (0 for Monday)
+  int nth[7];                   // Day (0 for Monday) of each business day of a week
+  long int first, end;          // Days covered by the bitmap (from the first holiday to the last)
+  long int holidays;            // Holidays of [first, end) not falling on a weekend
+  long int *rank;               // Business days of [first, end) before each word of bits
+  long int *select;             // Business days of [first, end)
+  unsigned long long bits[];    // Business days of [first, end), from first
+};
+
+static int
+tm_popcount (unsigned long long mask)
+{
+#if defined(__GNUC__)
+  return __builtin_popcountll (mask);
+#else
+  int nb = 0;
+  for (; mask; mask &= mask - 1)
+    nb++;
+  return nb;
+#endif
+}
+
+/// Number of business days of the weeks (without holidays) from the Epoch to day (excluded), negative before the Epoch.
+static long int
+tm_busdayweekly (const tm_busdaycal *cal, long int day)
+{
+  long int week = (day - TM_BUSDAY_MONDAY) / 7 - ((day - TM_BUSDAY_MONDAY) % 7 < 0);
+  return week * cal->perweek + cal->before[day - TM_BUSDAY_MONDAY - week * 7];
+}
+
+/// Number of business days from the Epoch to day (excluded), negative before the Epoch.
+static long int
+tm_busdayrank (const tm_busdaycal *cal, long int day)
+{
+  if (day <= cal->first)
+    return tm_busdayweekly (cal, day);
+  if (day >= cal->end)
+    return tm_busdayweekly (cal, day) - cal->holidays;
+  long int offset = day - cal->first;
+  return tm_busdayweekly (cal, cal->first) + cal->rank[offset / 64] + tm_popcount (cal->bits[offset / 64] & ((1ULL << offset % 64) - 1));
+}
+
+/// Day of the business day of rank rank (inverse of tm_busdayrank).
+static long int
+tm_busdayselect (const tm_busdaycal *cal, long int rank)
+{
+  long int before = tm_busdayweekly (cal, cal->first);
+  if (rank >= before && rank - before < tm_busdayweekly (cal, cal->end) - cal->holidays - before)
+    return cal->select[rank - before];
+  if (rank >= before)
+    rank += cal->holidays;
+  long int week = rank / cal->perweek - (rank % cal->perweek < 0);
+  return TM_BUSDAY_MONDAY + week * 7 + cal->nth[rank - week * cal->perweek];
+}
+
+static long int
+tm_busdayfromdate (struct tm date)
+{
+  return tm_daysfromcivil (date.tm_year + 1900L, date.tm_mon + 1, date.tm_mday);
+}
+
+tm_busdaycal *
+tm_busdaycal_create (unsigned int weekmask, const struct tm *holidays, size_t n)
+{
+  if (!(weekmask & 0xFE) || (weekmask & ~0xFEU) || (n && !holidays))
+    return (errno = EINVAL), (tm_busdaycal *) 0;
+
+  long int first = 0, end = 0;
+  for (size_t i = 0; i < n; i++)
+  {
+    long int day = tm_busdayfromdate (holidays[i]);
+    if (!i || day < first)
+      first = day;
+    if (!i || day + 1 > end)
+      end = day + 1;
+  }
+  size_t nbwords = (size_t) (end - first + 63) / 64;
+  tm_busdaycal *cal = malloc (sizeof (*cal) + nbwords * sizeof (*cal->bits));
+  if (!cal)
+    return 0;
+  cal->rank = malloc (nbwords * sizeof (*cal->rank) + 1);
+  cal->select = malloc ((size_t) (end - first) * sizeof (*cal->select) + 1);
+  if (!cal->rank || !cal->select)
+  {
+    tm_busdaycal_free (cal);
+    return 0;
+  }
+
+  cal->perweek = 0;
+  for (int d = 0; d < 7; d++)   // weekmask: bit 1 for Monday (TM_MONDAY) to bit 7 for Sunday (TM_SUNDAY)
+  {
+    cal->before[d] = cal->perweek;
+    if (weekmask >> (d + 1) & 1)
+      cal->nth[cal->perweek++] = d;
+  }
+  cal->first = first;
+  cal->end = end;
+
+  // Weekly business days, then holidays removed
+  memset (cal->bits, 0, nbwords * sizeof (*cal->bits));
+  for (long int day = first; day < end; day++)
+    if (weekmask >> (((day - TM_BUSDAY_MONDAY) % 7 + 7) % 7 + 1) & 1)
+      cal->bits[(day - first) / 64] |= 1ULL << (day - first) % 64;
+  long int weekly = 0;
+  for (size_t w = 0; w < nbwords; w++)
+    weekly += tm_popcount (cal->bits[w]);
+  for (size_t i = 0; i < n; i++)
+  {
+    long int offset = tm_busdayfromdate (holidays[i]) - first;
+    cal->bits[offset / 64] &= ~(1ULL << offset % 64);
+  }
+  long int nb = 0;
+  for (size_t w = 0; w < nbwords; w++)
+  {
+    cal->rank[w] = nb;
+    for (unsigned long long mask = cal->bits[w]; mask; mask &= mask - 1)
+      cal->select[nb++] = first + (long int) w * 64 + tm_cronnextbit (mask, 0);
+  }
+  cal->holidays = weekly - nb;
+  return cal;
+}
+
+void
+tm_busdaycal_free (tm_busdaycal *cal)
 {
-  return date.tm_yday + 1;      /* 1/1 = 1, 31/12 = 365 or 366 */
+  if (cal)
+  {
+    free (cal->rank);
+    free (cal->select);
+  }
+  free (cal);
 }
 
 int
-tm_getisoweek (struct tm date)
+tm_isbusday (const tm_busdaycal *cal, struct tm date)
 {
+  if (!cal)
+    return 0;
+  long int day = tm_busdayfromdate (date);
+  return tm_busdayrank (cal, day + 1) != tm_busdayrank (cal, day);
+}
 
-  /** ISO 8601 week date: The first week of a year (starting on Monday) is :
-     - the first week that contains at least 4 days of calendar year.
-     - the week that contains the first Thursday of a year.
-     - the week with January 4 in it
-   */
+tm_status
+tm_busday_add (const tm_busdaycal *cal, struct tm *date, long int n)
+{
+  if (!cal || !date)
+    return (errno = EINVAL), TM_ERROR;
 
-  int week = (date.tm_yday - (date.tm_wday + 6) % 7 + 10) / 7;
+  long int day = tm_busdayfromdate (*date), delta = tm_busdayselect (cal, tm_busdayrank (cal, day) + n) - day;
+  if (delta > INT_MAX || delta < INT_MIN)
+    return (errno = EOVERFLOW), TM_ERROR;
+  return delta ? tm_adddays (date, (int) delta) : TM_OK;
+}
 
-  if (week == 0)
-    return (date.tm_yday + 365 + tm_isleapyear (date.tm_year + 1900 - 1) - (date.tm_wday + 6) % 7 + 10) / 7;
-  else if (week > 52 && ((date.tm_yday - 365 - tm_isleapyear (date.tm_year + 1900) - (date.tm_wday + 6) % 7 + 10) / 7) > 0)
-    return (date.tm_yday - 365 - tm_isleapyear (date.tm_year + 1900) - (date.tm_wday + 6) % 7 + 10) / 7;
-  else
-    return week;
+long int
+tm_busday_diff (const tm_busdaycal *cal, struct tm begin, struct tm end)
+{
+  if (!cal)
+    return (errno = EINVAL), 0;
+  return tm_busdayrank (cal, tm_busdayfromdate (end)) - tm_busdayrank (cal, tm_busdayfromdate (begin));
 }
 
-int
-tm_getisoyear (struct tm date)
+size_t
+tm_busday_add_n (const tm_busdaycal *cal, long int *days, const long int *n, size_t nb)
 {
-  /* Year of which ISO week of date belongs to. */
-  int week = (date.tm_yday - (date.tm_wday + 6) % 7 + 10) / 7;
+  if (!cal || (nb && (!days || !n)))
+    return (errno = EINVAL), 0;
 
-  int isoyear;
-  if (week == 0)
-    isoyear = date.tm_year + 1900 - 1;
-  else if (week > 52 && ((date.tm_yday - 365 - tm_isleapyear (date.tm_year + 1900) - (date.tm_wday + 6) % 7 + 10) / 7) > 0)
-    isoyear = date.tm_year + 1900 + 1;
-  else
-    isoyear = date.tm_year + 1900;
-  if (isoyear < date.tm_year)
-    errno = EINVAL;
-  return isoyear;
+  for (size_t i = 0; i < nb; i++)
+    days[i] = tm_busdayselect (cal, tm_busdayrank (cal, days[i]) + n[i]);
+  return nb;
 }
 
-int
-tm_isdaylightsavingtimeineffect (struct tm date)
+size_t
+tm_busday_diff_n (const tm_busdaycal *cal, const long int *begin, const long int *end, size_t n, long int *diff)
 {
-  if (date.tm_isdst > 0)
-    return 1;
-  else if (date.tm_isdst == 0)
-    return 0;
-  else
+  if (!cal || (n && (!begin || !end || !diff)))
     return (errno = EINVAL), 0;
+
+  for (size_t i = 0; i < n; i++)
+    diff[i] = tm_busdayrank (cal, end[i]) - tm_busdayrank (cal, begin[i]);
+  return n;
 }
 
-int
-tm_isinsidedaylightsavingtimeoverlap (struct tm date)
+/*****************************************************
+*   OPENING HOURS                                    *
+*****************************************************/
+#define TM_SCHEDULE_MAXINTERVALS 8      // Opening hours per day
+#define TM_SCHEDULE_ZONES 16    // Wallclocks located once per batch
+
+typedef struct
 {
-  return tm_isdaylightsavingextrasummertime (date) || tm_isdaylightsavingextrawintertime (date);
+  long int start, end;          // Seconds from the beginning of the week (Monday 00:00) or of the day
+} tm_scheduleinterval;
+
+typedef struct
+{
+  long int day;                 // Days elapsed since 1970-01-01
+  int nb;
+  tm_scheduleinterval hours[TM_SCHEDULE_MAXINTERVALS];
+} tm_scheduleexception;
+
+struct tm_schedule
+{
+  const char *wallclock;
+  size_t nb;
+  size_t dayfirst[7];           // First interval ending after the beginning of each day of the week (0 for Monday)
+  tm_scheduleinterval week[8 * TM_SCHEDULE_MAXINTERVALS];       // Sorted and disjoint (hours overnight on Sunday split in two)
+  size_t nbexceptions, maxexceptions;
+  tm_scheduleexception *exceptions;     // Sorted by day
+};
+
+// Wallclock of a batch, located once in its transition table
+typedef struct
+{
+  const char *wallclock;
+  int located;                  // 0 if out of the range of the transition table
+  int fixed;                    // 1 for UTC (no transition)
+  tm_zonetransition tr;         // UTC offset at the instant of the batch
+  time_t until;                 // Next transition
+} tm_schedulezone;
+
+static const char tm_scheduledaynames[7][3] = { "Mo", "Tu", "We", "Th", "Fr", "Sa", "Su" };
+
+// Reads opening hours: "off" or "09:00-12:00,14:00-18:00". Hours ending before they start end the next day if overnight is set.
+static const char *
+tm_schedulescanhours (const char *p, int overnight, tm_scheduleinterval *hours, int *nb)
+{
+  *nb = 0;
+  if (tm_rfcnameequals (p, "off", 3))
+    return p + 3;
+  do
+  {
+    int h1, m1, h2, m2;
+    p = tm_rfcscandigits (tm_rfcscanchar (tm_rfcscandigits (p, 1, 2, &h1), ':'), 2, 2, &m1);
+    p = tm_rfcscandigits (tm_rfcscanchar (tm_rfcscandigits (tm_rfcscanchar (p, '-'), 1, 2, &h2), ':'), 2, 2, &m2);
+    if (!p || *nb == TM_SCHEDULE_MAXINTERVALS || h1 > 23 || m1 > 59 || m2 > 59 || h2 * 60 + m2 > 24 * 60)
+      return 0;
+    hours[*nb] = (tm_scheduleinterval) { h1 * 3600L + m1 * 60, h2 * 3600L + m2 * 60 };
+    if (hours[*nb].end <= hours[*nb].start && !(overnight && (hours[*nb].end += 86400) > hours[*nb].start))
+      return 0;
+    ++*nb;
+  }
+  while (*p == ',' && ++p);
+  return p;
 }
 
-int
-tm_getutcoffset (struct tm date)
+static const char *
+tm_schedulescanday (const char *p, int *day)
 {
-  return (int) date.tm_gmtoff;
+  for (*day = 0; p && *day < 7; ++*day)
+    if (tm_rfcnameequals (p, tm_scheduledaynames[*day], 2))
+      return p + 2;
+  return 0;
 }
 
-int                             /* set errno */
-tm_getsecondsofday (struct tm date)
+tm_schedule *
+tm_schedule_create (const char *hours, const char *wallclock)
 {
-  struct tm tmp = date;
+  const char *wc = tm_getregisteredwallclock (wallclock, 1);
+  if (!hours || wc == TM_REF_UNDEFINED)
+    return (errno = EINVAL), (tm_schedule *) 0;
+
+  // Rules "days hours" separated by ';', each rule replacing the hours of its days (every day if omitted)
+  tm_scheduleinterval days[7][TM_SCHEDULE_MAXINTERVALS], rule[TM_SCHEDULE_MAXINTERVALS];
+  int nbdays[7] = { 0 }, nb;
+  for (const char *p = tm_rfcskipspaces (hours); *p;)
+  {
+    int mask = 0, first, last;
+    for (const char *q; !tm_rfcnameequals (p, "off", 3) && (q = tm_schedulescanday (p, &first)); p = q + 1)
+    {
+      last = first;
+      if (*q == '-' && !(q = tm_schedulescanday (q + 1, &last)))
+        return (errno = EINVAL), (tm_schedule *) 0;
+      for (int day = first;; day = (day + 1) % 7)       // Ranges can wrap around the end of the week (Sa-Mo)
+        if ((mask |= 1 << day) && day == last)
+          break;
+      if (*q != ',')
+      {
+        p = q;
+        break;
+      }
+      else if (!tm_schedulescanday (q + 1, &last))
+        return (errno = EINVAL), (tm_schedule *) 0;
+    }
+    if (!(p = tm_schedulescanhours (tm_rfcskipspaces (p), 1, rule, &nb)))
+      return (errno = EINVAL), (tm_schedule *) 0;
+    for (int day = 0; day < 7; day++)
+      if (!mask || (mask >> day & 1))
+        memcpy (days[day], rule, sizeof (rule)), nbdays[day] = nb;
+    if (*(p = tm_rfcskipspaces (p)) == ';')
+      p = tm_rfcskipspaces (p + 1);
+    else if (*p)
+      return (errno = EINVAL), (tm_schedule *) 0;
+  }
 
-  if (tm_make_dtrc (&tmp, tm_getyear (date), tm_getmonth (date), tm_getday (date), 0, 0, 0, TM_REF_UNCHANGED,
-                    TM_ST_OVER_DST /* Suppose DST does get into effect just before midnight */ ) == TM_ERROR)
+  tm_schedule *schedule = calloc (1, sizeof (*schedule));
+  if (!schedule)
     return 0;
-
-  return (int) tm_diffseconds (tmp, date);
+  schedule->wallclock = wc;
+  // Hours of the week, sorted by start (insertion sort) and merged; hours overnight on Sunday wrap around to Monday.
+  tm_scheduleinterval week[8 * TM_SCHEDULE_MAXINTERVALS];      // 7 days, plus the hours overnight on Sunday wrapped around to Monday
+  size_t n = 0;
+  for (int day = 0; day < 7; day++)
+    for (int i = 0; i < nbdays[day]; i++)
+    {
+      tm_scheduleinterval in = { day * 86400L + days[day][i].start, day * 86400L + days[day][i].end };
+      if (in.end > 7 * 86400L)
+        week[n++] = (tm_scheduleinterval) { 0, in.end - 7 * 86400L }, in.end = 7 * 86400L;
+      week[n++] = in;
+    }
+  for (size_t i = 1; i < n; i++)
+    for (size_t j = i; j && week[j - 1].start > week[j].start; j--)
+    {
+      tm_scheduleinterval in = week[j];
+      week[j] = week[j - 1], week[j - 1] = in;
+    }
+  for (size_t i = 0; i < n; i++)
+    if (schedule->nb && week[i].start <= schedule->week[schedule->nb - 1].end)
+      schedule->week[schedule->nb - 1].end = week[i].end > schedule->week[schedule->nb - 1].end ? week[i].end : schedule->week[schedule->nb - 1].end;
+    else
+      schedule->week[schedule->nb++] = week[i];
+  for (int day = 0; day < 7; day++)
+    for (schedule->dayfirst[day] = day ? schedule->dayfirst[day - 1] : 0;
+         schedule->dayfirst[day] < schedule->nb && schedule->week[schedule->dayfirst[day]].end <= day * 86400L; schedule->dayfirst[day]++);
+  return schedule;
 }
 
-/*****************************************************
-*   OPERATORS                                        *
-*****************************************************/
+/// Index of the first exception on day or after.
+static size_t
+tm_scheduleexceptionindex (const tm_schedule *schedule, long int day)
+{
+  size_t lo = 0, hi = schedule->nbexceptions;
+  while (lo < hi)
+  {
+    size_t mid = lo + (hi - lo) / 2;
+    if (schedule->exceptions[mid].day < day)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
 
 tm_status
-tm_addseconds (struct tm *date, long int nbSecs)
+tm_schedule_addexception (tm_schedule *schedule, struct tm date, const char *hours)
 {
-  time_t t0;
-  if (tm_normalize (date, &t0) == TM_ERROR)
-    return TM_ERROR;
-  if ((nbSecs > 0 && t0 + (time_t) nbSecs < t0) || (nbSecs < 0 && t0 + (time_t) nbSecs > t0))
+  tm_scheduleexception exception;
+  const char *p;
+  if (!schedule || !(p = tm_schedulescanhours (tm_rfcskipspaces (hours), 0, exception.hours, &exception.nb)) || *tm_rfcskipspaces (p))
+    return (errno = EINVAL), TM_ERROR;
+
+  exception.day = tm_daysfromcivil (date.tm_year + 1900L, date.tm_mon + 1, date.tm_mday);
+  size_t i = tm_scheduleexceptionindex (schedule, exception.day);
+  if (i == schedule->nbexceptions || schedule->exceptions[i].day != exception.day)
   {
-    errno = EOVERFLOW;
-    return TM_ERROR;
+    if (schedule->nbexceptions == schedule->maxexceptions)
+    {
+      size_t max = schedule->maxexceptions ? 2 * schedule->maxexceptions : 16;
+      tm_scheduleexception *exceptions = realloc (schedule->exceptions, max * sizeof (*exceptions));
+      if (!exceptions)
+        return TM_ERROR;
+      schedule->exceptions = exceptions;
+      schedule->maxexceptions = max;
+    }
+    memmove (schedule->exceptions + i + 1, schedule->exceptions + i, (schedule->nbexceptions++ - i) * sizeof (*schedule->exceptions));
   }
-  t0 += nbSecs;
+  schedule->exceptions[i] = exception;
+  return TM_OK;
+}
 
-  if (tm_isdefinedinwallclock (*date, TM_REF_UTC))
+void
+tm_schedule_free (tm_schedule *schedule)
+{
+  if (schedule)
+    free (schedule->exceptions);
+  free (schedule);
+}
+
+/// Opening hours of a day (days elapsed since 1970-01-01), in seconds from the beginning of the day.
+static const tm_scheduleinterval *
+tm_scheduleday (const tm_schedule *schedule, long int day, tm_scheduleinterval *buffer, int *nb)
+{
+  size_t e = tm_scheduleexceptionindex (schedule, day);
+  if (e < schedule->nbexceptions && schedule->exceptions[e].day == day)
+    return (*nb = schedule->exceptions[e].nb), schedule->exceptions[e].hours;
+
+  int weekday = (int) (((day - TM_BUSDAY_MONDAY) % 7 + 7) % 7);
+  long int begin = weekday * 86400L;
+  *nb = 0;
+  for (size_t i = schedule->dayfirst[weekday]; i < schedule->nb && schedule->week[i].start < begin + 86400; i++, ++*nb)
   {
-    if ((gmtime_r (&t0, date)   // time syscall
-         && date->tm_year + 1900 + 1 > date->tm_year))
+    buffer[*nb].start = schedule->week[i].start > begin ? schedule->week[i].start - begin : 0;
+    buffer[*nb].end = schedule->week[i].end < begin + 86400 ? schedule->week[i].end - begin : 86400;
+  }
+  return buffer;
+}
+
+static int
+tm_scheduleisin (const tm_scheduleinterval *hours, int nb, long int sod)
+{
+  for (int i = 0; i < nb; i++)
+    if (sod >= hours[i].start && sod < hours[i].end)
+      return 1;
+  return 0;
+}
+
+static int
+tm_scheduleisopenlocal (const tm_schedule *schedule, time_t local)
+{
+  long int day = (long int) (local / 86400 - (local % 86400 < 0));
+  tm_scheduleinterval buffer[TM_SCHEDULE_MAXINTERVALS + 1];
+  int nb;
+  const tm_scheduleinterval *hours = tm_scheduleday (schedule, day, buffer, &nb);
+  return tm_scheduleisin (hours, nb, (long int) (local - (time_t) day * 86400));
+}
+
+/// First local time after local at which the schedule is not open (if open) or open (otherwise).
+/// @returns TM_ERROR if it never happens.
+static tm_status
+tm_schedulenextlocal (const tm_schedule *schedule, time_t local, int open, time_t *change)
+{
+  long int day = (long int) (local / 86400 - (local % 86400 < 0)), last = day + 7;
+  size_t e = tm_scheduleexceptionindex (schedule, day);
+  for (;; day++)
+  {
+    if (day > last)
     {
-      date->tm_zone = tm_getregisteredwallclock (TM_REF_UTC, 0);
-      return TM_OK;
+      // A whole week without change nor exception: no change until the next exception.
+      if (e == schedule->nbexceptions)
+        return (errno = EINVAL), TM_ERROR;
+      day = schedule->exceptions[e].day;
     }
-    else
+    if (e < schedule->nbexceptions && schedule->exceptions[e].day == day)
+      e++, last = day + 7;
+
+    tm_scheduleinterval buffer[TM_SCHEDULE_MAXINTERVALS + 1];
+    int nb;
+    const tm_scheduleinterval *hours = tm_scheduleday (schedule, day, buffer, &nb);
+    // Opening and closing times of the day, beginning of the day included
+    time_t base = (time_t) day * 86400;
+    for (int i = -1; i < nb; i++)
+      for (int bound = 0; bound < (i < 0 ? 1 : 2); bound++)
+      {
+        long int sod = i < 0 ? 0 : bound ? hours[i].end : hours[i].start;
+        if (base + sod > local && sod < 86400 && tm_scheduleisin (hours, nb, sod) != open)
+          return (*change = base + sod), TM_OK;
+      }
+  }
+}
+
+/// Locates utc on wallclock wc, once per batch (zones: wallclocks already located, the oldest ones replaced beyond TM_SCHEDULE_ZONES).
+static const tm_schedulezone *
+tm_schedulezonelocate (tm_schedulezone *zones, size_t *nb, const char *wc, time_t utc)
+{
+  for (size_t i = 0; i < *nb && i < TM_SCHEDULE_ZONES; i++)
+    if (zones[i].wallclock == wc)
+      return zones + i;
+
+  tm_schedulezone *zone = zones + (*nb)++ % TM_SCHEDULE_ZONES;
+  *zone = (tm_schedulezone) { wc, 1, 1, { utc, 0, 0 }, utc };
+  if (!tm_isutctimezone (wc))
+  {
+    const tm_zonetable *zt = tm_zonetableacquire (wc);
+    zone->fixed = 0;
+    if ((zone->located = zt && utc >= zt->begin && utc < zt->end))
     {
-      errno = EOVERFLOW;
-      return TM_ERROR;
+      size_t index = tm_zonetableindex (zt, utc);
+      zone->tr = zt->tr[index];
+      zone->until = index + 1 < zt->nb ? zt->tr[index + 1].at : zt->end;
     }
+    tm_zonetablerelease (zt);
   }
-  else
+  return zone;
+}
+
+/// First UTC instant after utc at which the schedule opens or closes, and the UTC offset from that instant.
+/// The transition table of the wallclock is only read if the UTC offset changes in between.
+static tm_status
+tm_schedulenextutc (const tm_schedule *schedule, const tm_schedulezone *zone, time_t utc, tm_zonetransition *next)
+{
+  tm_zonetransition tr = zone->tr;
+  time_t local = utc + tr.gmtoff, until = zone->until, change;
+  int open = tm_scheduleisopenlocal (schedule, local);
+  const tm_zonetable *zt = 0;
+  tm_status status = TM_OK;
+  while ((status = tm_schedulenextlocal (schedule, local, open, &change)) == TM_OK)
   {
-    const char *rep = tm_getregisteredwallclock (date->tm_zone, 0);
-    pthread_mutex_lock (&tzset_mutex);
-    const char *old_tz;
-    if (tm_tzset (rep, &old_tz) == TM_ERROR)
+    if (zone->fixed || change - tr.gmtoff < until)
     {
-      pthread_mutex_unlock (&tzset_mutex);
-      return TM_ERROR;
+      *next = tr;
+      next->at = change - tr.gmtoff;
+      break;
     }
-    if ((localtime_r (&t0, date)        // time syscall
-         && date->tm_year + 1900 + 1 > date->tm_year))
+    if ((!zt && !(zt = tm_zonetableacquire (zone->wallclock))) || until >= zt->end)
     {
-      date->tm_zone = rep;
-      tm_tzunset (old_tz);
-      pthread_mutex_unlock (&tzset_mutex);
-      return TM_OK;
+      status = TM_ERROR;        // Out of the range of the transition table
+      errno = EINVAL;
+      break;
     }
-    else
+    // The local time jumps when the UTC offset changes: the schedule might open or close at that instant.
+    size_t index = tm_zonetableindex (zt, until);
+    tr = zt->tr[index];
+    until = index + 1 < zt->nb ? zt->tr[index + 1].at : zt->end;
+    local = tr.at + tr.gmtoff;
+    if (tm_scheduleisopenlocal (schedule, local) != open)
     {
-      tm_tzunset (old_tz);
-      pthread_mutex_unlock (&tzset_mutex);
-      errno = EOVERFLOW;
-      return TM_ERROR;
+      *next = tr;
+      break;
+    }
+  }
+  tm_zonetablerelease (zt);
+  return status;
+}
+
+size_t
+tm_schedule_isopen_n (const tm_schedule *const *schedules, size_t n, struct tm now, int *open)
+{
+  if (n && (!schedules || !open))
+    return (errno = EINVAL), 0;
+
+  time_t utc = tm_tolocalseconds (now) - now.tm_gmtoff;
+  tm_schedulezone zones[TM_SCHEDULE_ZONES];
+  size_t nbzones = 0;
+  for (size_t i = 0; i < n; i++)
+  {
+    if (!schedules[i])
+      return (errno = EINVAL), i;
+    const tm_schedulezone *zone = tm_schedulezonelocate (zones, &nbzones, schedules[i]->wallclock, utc);
+    time_t local = utc + zone->tr.gmtoff;
+    if (!zone->located)
+    {
+      // Out of the range of the transition table
+      struct tm date = now;
+      if (tm_changetowallclock (&date, zone->wallclock) == TM_ERROR)
+        return i;
+      local = tm_tolocalseconds (date);
     }
+    open[i] = tm_scheduleisopenlocal (schedules[i], local);
+  }
+  return n;
+}
+
+int
+tm_schedule_isopen (const tm_schedule *schedule, struct tm now)
+{
+  int open;
+  return tm_schedule_isopen_n (&schedule, 1, now, &open) == 1 && open;
+}
+
+size_t
+tm_schedule_nextchange_n (const tm_schedule *const *schedules, size_t n, struct tm now, struct tm *next)
+{
+  if (n && (!schedules || !next))
+    return (errno = EINVAL), 0;
+
+  time_t utc = tm_tolocalseconds (now) - now.tm_gmtoff;
+  tm_schedulezone zones[TM_SCHEDULE_ZONES];
+  size_t nbzones = 0;
+  for (size_t i = 0; i < n; i++)
+  {
+    if (!schedules[i])
+      return (errno = EINVAL), i;
+    const char *wc = schedules[i]->wallclock;
+    const tm_schedulezone *zone = tm_schedulezonelocate (zones, &nbzones, wc, utc);
+    tm_zonetransition tr;
+    if (!zone->located)
+      return (errno = EINVAL), i;       // Out of the range of the transition table
+    if (tm_schedulenextutc (schedules[i], zone, utc, &tr) == TM_ERROR)
+      return i;
+    tm_fromlocalseconds (tr.at + tr.gmtoff, next + i);
+    next[i].tm_gmtoff = tr.gmtoff;
+    next[i].tm_isdst = tr.isdst;
+    next[i].tm_zone = wc;
   }
+  return n;
 }
 
 tm_status
-tm_adddays (struct tm *date, int nbDays)
+tm_schedule_nextchange (const tm_schedule *schedule, struct tm now, struct tm *next)
 {
-  if ((nbDays > 0 && date->tm_mday + nbDays < date->tm_mday) || (nbDays < 0 && date->tm_mday + nbDays > date->tm_mday))
+  return tm_schedule_nextchange_n (&schedule, 1, now, next) == 1 ? TM_OK : TM_ERROR;
+}
+
+/*****************************************************
+*   ROUNDING                                         *
+*****************************************************/
+/// Local time of the beginning of the unit containing local time local.
+static time_t
+tm_unitfloor (time_t local, tm_unit unit)
+{
+  long int days = (long int) (local / 86400 - (local % 86400 < 0)), year;
+  int month, day;
+  switch (unit)
   {
-    errno = EOVERFLOW;
+    case TM_UNIT_SECOND:
+      return local;
+    case TM_UNIT_MINUTE:
+      return local - ((local % 60) + 60) % 60;
+    case TM_UNIT_HOUR:
+      return local - ((local % 3600) + 3600) % 3600;
+    case TM_UNIT_DAY:
+      return (time_t) days * 86400;
+    case TM_UNIT_WEEK:         // ISO 8601 weeks, starting on Monday
+      return (time_t) (days - ((days - TM_BUSDAY_MONDAY) % 7 + 7) % 7) * 86400;
+    default:
+      tm_civilfromdays (days, &year, &month, &day);
+      month = unit == TM_UNIT_YEAR ? 1 : unit == TM_UNIT_QUARTER ? (month - 1) / 3 * 3 + 1 : month;
+      return (time_t) tm_daysfromcivil (year, month, 1) * 86400;
+  }
+}
+
+/// Local time of the beginning of the unit following the one beginning at local time start.
+static time_t
+tm_unitnext (time_t start, tm_unit unit)
+{
+  static const int seconds[] = { 1, 60, 3600, 86400, 7 * 86400 };
+  if (unit <= TM_UNIT_WEEK)
+    return start + seconds[unit];
+  long int year;
+  int month, day, months = unit == TM_UNIT_YEAR ? 12 : unit == TM_UNIT_QUARTER ? 3 : 1;
+  tm_civilfromdays ((long int) (start / 86400 - (start % 86400 < 0)), &year, &month, &day);
+  month += months;
+  return (time_t) tm_daysfromcivil (year + (month - 1) / 12, (month - 1) % 12 + 1, 1) * 86400;
+}
+
+/// UTC instant of local time local (transition table zt, 0 for UTC): the latest one not after utc (floor) or the earliest one not before utc (ceiling),
+/// the end of the gap if local is skipped by DST.
+/// index is the transition in effect at utc: local times between the end of the preceding overlap and the next transition only need its UTC offset.
+static tm_status
+tm_unitresolve (const tm_zonetable *zt, size_t index, time_t local, time_t utc, int ceiling, tm_zonetransition *res)
+{
+  tm_zonelocal zl;
+  if (!zt)
+    return (*res = (tm_zonetransition) { local, 0, 0 }), TM_OK;
+  const tm_zonetransition *tr = zt->tr + index;
+  if (local >= tr->at + (index && tr[-1].gmtoff > tr->gmtoff ? tr[-1].gmtoff : tr->gmtoff) &&
+      (index + 1 == zt->nb || local < tr[1].at + (tr[1].gmtoff < tr->gmtoff ? tr[1].gmtoff : tr->gmtoff)))
+    return (*res = *tr), (res->at = local - tr->gmtoff), TM_OK;
+  if (tm_zonetableclassify (zt, local, &zl) == TM_ERROR)
+    return (errno = EINVAL), TM_ERROR;
+  *res = zl.tr[zl.nb == 2 && (ceiling ? zl.tr[0].at < utc : zl.tr[1].at <= utc)];
+  return TM_OK;
+}
+
+/// Floor (direction < 0), ceiling (direction > 0) or rounding (direction 0, half up) of utc to unit, on the wallclock of transition table zt (0 for UTC).
+/// index is the transition in effect at the previous call (or zt->nb), updated.
+static tm_status
+tm_unitapply (const tm_zonetable *zt, size_t *index, time_t utc, tm_unit unit, int direction, tm_zonetransition *res)
+{
+  long int gmtoff = 0;
+  if (zt)
+  {
+    if (utc < zt->begin || utc >= zt->end)
+      return (errno = EINVAL), TM_ERROR;
+    // Successive instants of a time series mostly share the same UTC offset.
+    if (*index >= zt->nb || utc < zt->tr[*index].at || (*index + 1 < zt->nb && utc >= zt->tr[*index + 1].at))
+      *index = tm_zonetableindex (zt, utc);
+    gmtoff = zt->tr[*index].gmtoff;
+  }
+
+  // The beginning of the unit is repeated if inside a DST overlap: the next beginning is then its second occurrence.
+  time_t start = tm_unitfloor (utc + gmtoff, unit);
+  tm_zonetransition floor, ceiling;
+  if ((direction <= 0 && tm_unitresolve (zt, *index, start, utc, 0, &floor) == TM_ERROR) ||
+      (direction >= 0 && (tm_unitresolve (zt, *index, start, utc, 1, &ceiling) == TM_ERROR ||
+                          (ceiling.at < utc && tm_unitresolve (zt, *index, tm_unitnext (start, unit), utc, 1, &ceiling) == TM_ERROR))))
+    return TM_ERROR;
+  *res = direction < 0 || (!direction && utc - floor.at < ceiling.at - utc) ? floor : ceiling;
+  return TM_OK;
+}
+
+/// Same as tm_unitapply, for a date out of the range of the transition table of its wallclock.
+static tm_status
+tm_unitapplyfallback (struct tm *date, tm_unit unit, int direction)
+{
+  time_t local = tm_tolocalseconds (*date), start = tm_unitfloor (local, unit), utc = local - date->tm_gmtoff;
+  struct tm floor = *date, ceiling = *date;
+  tm_fromlocalseconds (start, &floor);
+  tm_fromlocalseconds (start == local ? start : tm_unitnext (start, unit), &ceiling);
+  if ((direction <= 0 && tm_resolvefields (&floor, date->tm_zone, TM_DST_OVER_ST) == TM_ERROR) ||
+      (direction >= 0 && tm_resolvefields (&ceiling, date->tm_zone, TM_DST_OVER_ST) == TM_ERROR))
     return TM_ERROR;
+  *date = direction < 0 || (!direction && utc - (tm_tolocalseconds (floor) - floor.tm_gmtoff) <
+                            tm_tolocalseconds (ceiling) - ceiling.tm_gmtoff - utc) ? floor : ceiling;
+  return TM_OK;
+}
+
+static tm_status
+tm_unitdate (struct tm *date, tm_unit unit, int direction)
+{
+  if (!date || unit < TM_UNIT_SECOND || unit > TM_UNIT_YEAR)
+    return (errno = EINVAL), TM_ERROR;
+
+  const char *wc = date->tm_zone;
+  const tm_zonetable *zt = tm_isutctimezone (wc) ? 0 : tm_zonetableacquire (wc);
+  time_t utc = tm_tolocalseconds (*date) - date->tm_gmtoff;
+  size_t index = zt ? zt->nb : 0;
+  tm_zonetransition res;
+  tm_status status = (zt || tm_isutctimezone (wc)) ? tm_unitapply (zt, &index, utc, unit, direction, &res) : TM_ERROR;
+  tm_zonetablerelease (zt);
+  if (status == TM_ERROR)
+    return tm_unitapplyfallback (date, unit, direction);
+
+  tm_fromlocalseconds (res.at + res.gmtoff, date);
+  date->tm_gmtoff = res.gmtoff;
+  date->tm_isdst = res.isdst;
+  return TM_OK;
+}
+
+tm_status
+tm_floor (struct tm *date, tm_unit unit)
+{
+  return tm_unitdate (date, unit, -1);
+}
+
+tm_status
+tm_ceil (struct tm *date, tm_unit unit)
+{
+  return tm_unitdate (date, unit, 1);
+}
+
+tm_status
+tm_round (struct tm *date, tm_unit unit)
+{
+  return tm_unitdate (date, unit, 0);
+}
+
+static size_t
+tm_unitinstants (tm_instant *instants, size_t n, tm_unit unit, const char *wallclock, int direction)
+{
+  const char *wc = tm_getregisteredwallclock (wallclock, 1);
+  if ((n && !instants) || unit < TM_UNIT_SECOND || unit > TM_UNIT_YEAR || wc == TM_REF_UNDEFINED)
+    return (errno = EINVAL), 0;
+
+  // The transition table is acquired once for all instants.
+  const tm_zonetable *zt = tm_isutctimezone (wc) ? 0 : tm_zonetableacquire (wc);
+  size_t index = zt ? zt->nb : 0, i = 0;
+  for (tm_zonetransition res; i < n; i++)
+  {
+    if ((zt || tm_isutctimezone (wc)) && tm_unitapply (zt, &index, instants[i].utc, unit, direction, &res) == TM_OK)
+      instants[i] = (tm_instant) { res.at, (int) res.gmtoff };
+    else
+    {
+      // Out of the range of the transition table
+      struct tm date;
+      if (tm_frombinary (&date, instants[i].utc, wc) == TM_ERROR || tm_unitapplyfallback (&date, unit, direction) == TM_ERROR)
+        break;
+      instants[i] = (tm_instant) { tm_tolocalseconds (date) - date.tm_gmtoff, (int) date.tm_gmtoff };
+    }
   }
-  date->tm_mday += nbDays;
-  date->tm_isdst = -1;          // Let timezone information and system databases define DST flag.
+  tm_zonetablerelease (zt);
+  return i;
+}
+
+size_t
+tm_floor_n (tm_instant *instants, size_t n, tm_unit unit, const char *wallclock)
+{
+  return tm_unitinstants (instants, n, unit, wallclock, -1);
+}
 
-  tm_status ret = tm_normalize (date, 0);
-  if (ret != TM_OK)
-    errno = EOVERFLOW;
-  return ret;
+size_t
+tm_ceil_n (tm_instant *instants, size_t n, tm_unit unit, const char *wallclock)
+{
+  return tm_unitinstants (instants, n, unit, wallclock, 1);
 }
 
-tm_status
-tm_addmonths (struct tm *date, int nbMonths)
+size_t
+tm_round_n (tm_instant *instants, size_t n, tm_unit unit, const char *wallclock)
 {
-  int mday = date->tm_mday;     // Day of the month (1-31)
+  return tm_unitinstants (instants, n, unit, wallclock, 0);
+}
 
-  if ((nbMonths > 0 && date->tm_mon + nbMonths < date->tm_mon) || (nbMonths < 0 && date->tm_mon + nbMonths > date->tm_mon))
+/*****************************************************
+*   ZONE CURSORS                                     *
+*****************************************************/
+/// Finds the UTC offset in effect at utc, and the UTC instants over which it applies.
+static tm_status
+tm_zonecursorlocate (tm_zonecursor *cursor, time_t utc)
+{
+  cursor->from = cursor->until = 0;
+  if (tm_isutctimezone (cursor->wallclock))
   {
-    errno = EOVERFLOW;
-    return TM_ERROR;
+    cursor->from = (time_t) tm_daysfromcivil (TM_ZONETABLE_FIRSTYEAR, 1, 1) * 86400;
+    cursor->until = (time_t) tm_daysfromcivil (TM_ZONETABLE_LASTYEAR + 1, 1, 1) * 86400;
+    cursor->utcoffset = cursor->isdst = 0;
+    return utc >= cursor->from && utc < cursor->until ? TM_OK : TM_ERROR;
   }
-  date->tm_mon += nbMonths;
-  date->tm_isdst = -1;          // Let timezone information and system databases define DST flag.
 
-  tm_status ret = tm_normalize (date, 0);
-  if (ret == TM_OK && date->tm_mday != mday)    // Handles lasts days of month
+  const tm_zonetable *zt = tm_zonetableacquire (cursor->wallclock);
+  if (!zt || utc < zt->begin || utc >= zt->end)
   {
-    date->tm_mday = 0;          // A 0 in tm_mday is interpreted as meaning the last day of the preceding month.
-    ret = tm_normalize (date, 0);
+    tm_zonetablerelease (zt);
+    return TM_ERROR;
   }
-  else if (ret == TM_ERROR)
-    errno = EOVERFLOW;
-  return ret;
+  size_t i = tm_zonetableindex (zt, utc);
+  cursor->from = zt->tr[i].at;
+  cursor->until = i + 1 < zt->nb ? zt->tr[i + 1].at : zt->end;
+  cursor->utcoffset = (int) zt->tr[i].gmtoff;
+  cursor->isdst = zt->tr[i].isdst;
+  tm_zonetablerelease (zt);
+  return TM_OK;
 }
 
 tm_status
-tm_trimtime (struct tm *tm)
-{
-  tm->tm_sec = tm->tm_min = tm->tm_hour = 0;
-  tm->tm_isdst = -1;            // Let timezone information and system databases define DST flag.
-
-  return tm_normalize (tm, 0);
-}
-
-/*****************************************************
-*   COMPARATORS                                      *
-*****************************************************/
-int
-tm_equals (struct tm a, struct tm b)
+tm_zonecursor_init (tm_zonecursor *cursor, const char *wallclock)
 {
-  return (a.tm_sec == b.tm_sec && a.tm_min == b.tm_min && a.tm_hour == b.tm_hour &&
-          a.tm_mday == b.tm_mday && a.tm_mon == b.tm_mon && a.tm_year == b.tm_year && a.tm_gmtoff == b.tm_gmtoff && a.tm_zone == b.tm_zone);
+  const char *wc = tm_getregisteredwallclock (wallclock, 1);
+  if (!cursor || wc == TM_REF_UNDEFINED)
+    return (errno = EINVAL), TM_ERROR;
+  memset (cursor, 0, sizeof (*cursor));
+  cursor->wallclock = wc;
+  return TM_OK;
 }
 
-long int
-tm_diffseconds (struct tm debut, struct tm fin)
+tm_status
+tm_zonecursor_convert (tm_zonecursor *cursor, time_t utc, struct tm *date)
 {
-  time_t d, f;
-  if (tm_normalize (&fin, &f) == TM_OK && tm_normalize (&debut, &d) == TM_OK)
-    return f - d;
+  if (!cursor || !date || !cursor->wallclock)
+    return (errno = EINVAL), TM_ERROR;
 
-  errno = EINVAL;               // Both dates have been normalized at creation, errno should not be set.
-  return (time_t) - 1;
+  // A compare for instants of the same period of the UTC offset, a lookup in the transition table otherwise.
+  if ((utc < cursor->from || utc >= cursor->until) && tm_zonecursorlocate (cursor, utc) == TM_ERROR)
+    return tm_frombinary (date, utc, cursor->wallclock);       // Out of the range of the transition table
 
+  // Calendar fields are computed once per local day.
+  time_t local = utc + cursor->utcoffset;
+  if (!cursor->day.tm_mday || local < cursor->daybegin || local - cursor->daybegin >= 86400)
+  {
+    tm_fromlocalseconds (local, &cursor->day);
+    cursor->daybegin = local - (cursor->day.tm_hour * 3600 + cursor->day.tm_min * 60 + cursor->day.tm_sec);
+    cursor->day.tm_hour = cursor->day.tm_min = cursor->day.tm_sec = 0;
+  }
+  int sod = (int) (local - cursor->daybegin);
+  *date = cursor->day;
+  date->tm_hour = sod / 3600;
+  date->tm_min = sod / 60 % 60;
+  date->tm_sec = sod % 60;
+  date->tm_gmtoff = cursor->utcoffset;
+  date->tm_isdst = cursor->isdst;
+  date->tm_zone = cursor->wallclock;
+  return TM_OK;
 }
 
-int
-tm_compare (const void *pdebut, const void *pfin)
+size_t
+tm_zonecursor_convert_n (tm_zonecursor *cursor, const time_t *utc, struct tm *dates, size_t n)
 {
-  long int diff = -tm_diffseconds (*(const struct tm *) pdebut, *(const struct tm *) pfin);
-
-  return diff < 0 ? -1 : (diff > 0 ? 1 : 0);
+  if (n && (!utc || !dates))
+    return (errno = EINVAL), 0;
+  size_t i = 0;
+  while (i < n && tm_zonecursor_convert (cursor, utc[i], dates + i) == TM_OK)
+    i++;
+  return i;
 }
 
-int                             /* set_errno */
-tm_diffcalendardays (struct tm debut, struct tm fin)
+size_t
+tm_zonecursor_instants (tm_zonecursor *cursor, tm_instant *instants, size_t n)
 {
-  if (tm_getwallclock (debut) != tm_getwallclock (fin))
+  if (!cursor || !cursor->wallclock || (n && !instants))
     return (errno = EINVAL), 0;
-
-  int coeff = 1;
-  int ret = 0;
-
-  if (fin.tm_year < debut.tm_year)
+  size_t i = 0;
+  for (; i < n; i++)
   {
-    struct tm tmp = debut;
+    time_t utc = instants[i].utc;
+    if ((utc < cursor->from || utc >= cursor->until) && tm_zonecursorlocate (cursor, utc) == TM_ERROR)
+    {
+      struct tm date;
+      if (tm_frombinary (&date, utc, cursor->wallclock) == TM_ERROR)
+        break;
+      instants[i].utcoffset = (int) date.tm_gmtoff;
+    }
+    else
+      instants[i].utcoffset = cursor->utcoffset;
+  }
+  return i;
+}
 
-    debut = fin;
-    fin = tmp;
-    coeff = -1;
+/*****************************************************
+*   CALENDAR ITERATORS                               *
+*****************************************************/
+/// Sets the date following the iter->count dates already produced.
+static tm_status
+tm_iteradvance (tm_iter *iter)
+{
+  static const int seconds[] = { 1, 60, 3600 };
+  if (iter->unit <= TM_UNIT_HOUR)
+  {
+    // Elapsed time: the UTC offset is only looked up again when a transition is crossed.
+    time_t utc = iter->utc + (time_t) iter->step * seconds[iter->unit];
+    if (utc < iter->utc || tm_zonecursor_convert (&iter->cursor, utc, &iter->date) == TM_ERROR)
+      return TM_ERROR;
+    iter->utc = utc;
+    return TM_OK;
   }
-  ret = fin.tm_yday - debut.tm_yday;
 
-  debut.tm_mon = 11;
-  debut.tm_mday = 31;
-  for (; debut.tm_year < fin.tm_year; debut.tm_year++)
+  // Calendar time: the time of day (and the day of month) of the first date are kept.
+  long int days = iter->start, year = iter->startyear;
+  if (iter->unit <= TM_UNIT_WEEK)
+    days += iter->count * iter->step * (iter->unit == TM_UNIT_WEEK ? 7 : 1);
+  else
   {
-    if (tm_normalize (&debut, 0) == TM_ERROR)
-      return (errno = EINVAL), TM_ERROR;
-    ret += debut.tm_yday + 1;
+    long int month = iter->startmonth - 1 + iter->count * iter->step * (iter->unit == TM_UNIT_YEAR ? 12 : iter->unit == TM_UNIT_QUARTER ? 3 : 1);
+    year += month / 12;
+    month = month % 12 + 1;
+    int mday = tm_daysincivilmonth (year, (int) month);
+    days = tm_daysfromcivil (year, (int) month, iter->startmday < mday ? iter->startmday : mday);
   }
+  if (year > INT_MAX - 1901)
+    return (errno = EOVERFLOW), TM_ERROR;
+  time_t local = (time_t) days * 86400 + iter->timeofday, utc = local - iter->cursor.utcoffset;
+
+  // The local time is unique inside the interval of the current UTC offset (far enough from its beginning not to be repeated).
+  if (utc >= iter->cursor.from + TM_ZONETABLE_MAXOFFSET && utc < iter->cursor.until)
+    tm_zonecursor_convert (&iter->cursor, utc, &iter->date);
+  else if (tm_rruleresolve (local, iter->cursor.wallclock, &iter->date) == TM_ERROR)
+    return TM_ERROR;
+  else
+    tm_zonecursorlocate (&iter->cursor, tm_tolocalseconds (iter->date) - iter->date.tm_gmtoff);
+  iter->utc = tm_tolocalseconds (iter->date) - iter->date.tm_gmtoff;
+  return TM_OK;
+}
 
-  return coeff * ret;
+tm_status
+tm_iter_begin (tm_iter *iter, struct tm start, struct tm stop, tm_unit unit, int step)
+{
+  if (!iter || unit < TM_UNIT_SECOND || unit > TM_UNIT_YEAR || step < 1 || tm_zonecursor_init (&iter->cursor, start.tm_zone) == TM_ERROR)
+    return (errno = EINVAL), TM_ERROR;
+
+  iter->unit = unit;
+  iter->step = step;
+  iter->count = 0;
+  time_t local = tm_tolocalseconds (start);
+  iter->utc = local - start.tm_gmtoff;
+  iter->stop = tm_tolocalseconds (stop) - stop.tm_gmtoff;
+  iter->start = (long int) (local / 86400 - (local % 86400 < 0));
+  iter->timeofday = (int) (local - (time_t) iter->start * 86400);
+  iter->startyear = start.tm_year + 1900L;
+  iter->startmonth = start.tm_mon + 1;
+  iter->startmday = start.tm_mday;
+
+  // The first date is start, on the interval of its UTC offset.
+  iter->date = start;
+  if (tm_zonecursorlocate (&iter->cursor, iter->utc) == TM_ERROR)
+    iter->cursor.from = iter->cursor.until = 0;
+  return TM_OK;
 }
 
-int                             /* set_errno */
-tm_diffdays (struct tm debut, struct tm fin, int *seconds)
+size_t
+tm_iter_next_n (tm_iter *iter, struct tm *dates, size_t n)
 {
-  if (tm_getwallclock (debut) != tm_getwallclock (fin))
+  if (!iter || (n && !dates))
     return (errno = EINVAL), 0;
 
-  int coeff = 1;
-
-  if (tm_diffseconds (debut, fin) < 0)
+  size_t i = 0;
+  for (; i < n && iter->utc < iter->stop; i++)
   {
-    struct tm tmp = debut;
-
-    debut = fin;
-    fin = tmp;
-    coeff = -1;
+    dates[i] = iter->date;
+    iter->count++;
+    if (tm_iteradvance (iter) == TM_ERROR)
+      iter->stop = iter->utc;   // No more dates
   }
+  return i;
+}
 
-  int ret = tm_diffcalendardays (debut, fin);
-
-  if (fin.tm_hour < debut.tm_hour || (fin.tm_hour == debut.tm_hour && fin.tm_min < debut.tm_min) ||
-      (fin.tm_hour == debut.tm_hour && fin.tm_min == debut.tm_min && fin.tm_sec < debut.tm_sec))
-    if (ret > 0)
-      ret--;
+tm_status
+tm_iter_next (tm_iter *iter, struct tm *date)
+{
+  return tm_iter_next_n (iter, date, 1) == 1 ? TM_OK : TM_ERROR;
+}
 
-  if (seconds)
+/*****************************************************
+*   AGGREGATORS                                      *
+*****************************************************/
+/// Sets the current bucket to the unit containing utc (counters reset).
+static tm_status
+tm_aggregatorlocate (tm_aggregator *agg, time_t utc)
+{
+  const char *wc = agg->wallclock;
+  const tm_zonetable *zt = tm_isutctimezone (wc) ? 0 : tm_zonetableacquire (wc);
+  size_t index = zt ? zt->nb : 0;
+  tm_zonetransition floor, ceiling;
+  // The end of the unit is the first beginning of unit after its beginning (the second occurrence of a beginning repeated by DST).
+  tm_status status = (zt || tm_isutctimezone (wc)) && tm_unitapply (zt, &index, utc, agg->unit, -1, &floor) == TM_OK &&
+    tm_unitapply (zt, &index, floor.at + 1, agg->unit, 1, &ceiling) == TM_OK ? TM_OK : TM_ERROR;
+  tm_zonetablerelease (zt);
+
+  if (status == TM_ERROR)
   {
-    tm_adddays (&debut, ret);
-    *seconds = coeff * (int) tm_diffseconds (debut, fin);
+    // Out of the range of the transition table
+    struct tm begin, end;
+    if (tm_frombinary (&begin, utc, wc) == TM_ERROR || tm_unitapplyfallback (&begin, agg->unit, -1) == TM_ERROR)
+      return TM_ERROR;
+    floor.at = tm_tolocalseconds (begin) - begin.tm_gmtoff;
+    floor.gmtoff = begin.tm_gmtoff;
+    if (tm_frombinary (&end, floor.at + 1, wc) == TM_ERROR || tm_unitapplyfallback (&end, agg->unit, 1) == TM_ERROR)
+      return TM_ERROR;
+    ceiling.at = tm_tolocalseconds (end) - end.tm_gmtoff;
   }
 
-  return coeff * ret;
+  agg->bucket = (tm_bucket) { (tm_instant) { floor.at, (int) floor.gmtoff }, ceiling.at, 0, 0, 0, 0 };
+  return TM_OK;
 }
 
-int                             /* set errno */
-tm_diffweeks (struct tm debut, struct tm fin, int *days, int *seconds)
+tm_status
+tm_aggregator_init (tm_aggregator *agg, const char *wallclock, tm_unit unit, void (*emit) (const tm_bucket * bucket, void *arg), void *arg)
 {
-  int d = tm_diffdays (debut, fin, seconds);
-
-  if (days)
-    *days = d >= 0 ? d % 7 : -((-d) % 7);
+  const char *wc = tm_getregisteredwallclock (wallclock, 1);
+  if (!agg || !emit || unit < TM_UNIT_SECOND || unit > TM_UNIT_YEAR || wc == TM_REF_UNDEFINED)
+    return (errno = EINVAL), TM_ERROR;
 
-  return d / 7;
+  agg->wallclock = wc;
+  agg->unit = unit;
+  agg->emit = emit;
+  agg->arg = arg;
+  agg->bucket = (tm_bucket) { { 0, 0 }, 0, 0, 0, 0, 0 };      // Empty
+  return TM_OK;
 }
 
-int                             /* set_errno */
-tm_diffcalendarmonths (struct tm debut, struct tm fin)
+size_t
+tm_aggregator_add (tm_aggregator *agg, const time_t *utc, const double *values, size_t n)
 {
-  if (tm_getwallclock (debut) != tm_getwallclock (fin))
+  if (!agg || (n && (!utc || !values)))
     return (errno = EINVAL), 0;
 
-  return 12 * (fin.tm_year - debut.tm_year) + fin.tm_mon - debut.tm_mon;
+  tm_bucket *b = &agg->bucket;
+  size_t i = 0;
+  for (; i < n; i++)
+  {
+    // Points of the current bucket only need two comparisons.
+    if (utc[i] < b->begin.utc || utc[i] >= b->end)
+    {
+      tm_aggregator_flush (agg);
+      if (tm_aggregatorlocate (agg, utc[i]) == TM_ERROR)
+        break;
+    }
+    double v = values[i];
+    if (!b->count++)
+      b->min = b->max = v;
+    else if (v < b->min)
+      b->min = v;
+    else if (v > b->max)
+      b->max = v;
+    b->sum += v;
+  }
+  return i;
 }
 
-int                             /* set_errno */
-tm_diffmonths (struct tm debut, struct tm fin, int *days, int *seconds)
+void
+tm_aggregator_flush (tm_aggregator *agg)
 {
-  if (tm_getwallclock (debut) != tm_getwallclock (fin))
-    return (errno = EINVAL), 0;
-
-  int coeff = 1;
-
-  if (tm_diffseconds (debut, fin) < 0)
-  {
-    struct tm tmp = debut;
+  if (!agg || !agg->bucket.count)
+    return;
+  agg->emit (&agg->bucket, agg->arg);
+  agg->bucket.count = 0;
+  agg->bucket.sum = 0;
+}
 
-    debut = fin;
-    fin = tmp;
-    coeff = -1;
-  }
+/*****************************************************
+*   SORTING                                          *
+*****************************************************/
+#define TM_SORT_MAXTHREADS 64
+#define TM_SORT_PARALLEL_MIN 65536      // Smaller arrays are sorted by a single thread.
 
-  int ret = tm_diffcalendarmonths (debut, fin);
+typedef struct
+{
+  uint64_t key;                 // UTC instant, sign bit flipped so that keys sort as unsigned integers
+  size_t index;                 // Position in the array to sort
+} tm_sortitem;
 
-  if (fin.tm_mday < debut.tm_mday ||
-      (fin.tm_mday == debut.tm_mday && fin.tm_hour < debut.tm_hour) ||
-      (fin.tm_mday == debut.tm_mday && fin.tm_hour == debut.tm_hour && fin.tm_min < debut.tm_min) ||
-      (fin.tm_mday == debut.tm_mday && fin.tm_hour == debut.tm_hour && fin.tm_min == debut.tm_min && fin.tm_sec < debut.tm_sec))
-    if (ret > 0)
-      ret--;
+typedef enum
+{
+  TM_SORT_KEYS,
+  TM_SORT_COUNT,
+  TM_SORT_SCATTER,
+} tm_sortphase;
 
-  tm_addmonths (&debut, ret);
-  int d = coeff * tm_diffdays (debut, fin, seconds);
-  if (days)
-    *days = d;
-  if (seconds)
-    *seconds *= coeff;
+// Part of the array processed by a thread
+typedef struct
+{
+  tm_sortphase phase;
+  const struct tm *dates;
+  tm_sortitem *src, *dst;
+  size_t begin, end;
+  int shift;                    // Digit of the pass
+  size_t count[256];            // Items per digit, then position of the first item per digit in dst
+  tm_status status;
+} tm_sortslice;
+
+/// UTC instant of a date, without normalizing it if its fields are in range.
+static tm_status
+tm_sortkey (const struct tm *date, int64_t *key)
+{
+  if (date->tm_year <= INT_MAX - 1901 && date->tm_mon >= 0 && date->tm_mon <= 11 && date->tm_mday >= 1 &&
+      date->tm_mday <= tm_daysincivilmonth (date->tm_year + 1900L, date->tm_mon + 1) && date->tm_hour >= 0 && date->tm_hour <= 23 &&
+      date->tm_min >= 0 && date->tm_min <= 59 && date->tm_sec >= 0 && date->tm_sec <= 59)
+    return (*key = (int64_t) (tm_tolocalseconds (*date) - date->tm_gmtoff)), TM_OK;
 
-  return coeff * ret;
+  struct tm copy = *date;
+  time_t utc;
+  if (tm_normalize (&copy, &utc) == TM_ERROR)
+    return (errno = EINVAL), TM_ERROR;
+  *key = (int64_t) utc;
+  return TM_OK;
 }
 
-int                             /* set_errno */
-tm_diffcalendaryears (struct tm debut, struct tm fin)
+static void *
+tm_sortworker (void *arg)
 {
-  if (tm_getwallclock (debut) != tm_getwallclock (fin))
-    return (errno = EINVAL), 0;
-
-  return tm_getyear (fin) - tm_getyear (debut);
+  tm_sortslice *s = arg;
+  switch (s->phase)
+  {
+    case TM_SORT_KEYS:
+      for (size_t i = s->begin; i < s->end; i++)
+      {
+        int64_t key;
+        if (tm_sortkey (s->dates + i, &key) == TM_ERROR)
+          s->status = TM_ERROR;
+        s->dst[i] = (tm_sortitem) { (uint64_t) key ^ ((uint64_t) 1 << 63), i };
+      }
+      break;
+    case TM_SORT_COUNT:
+      memset (s->count, 0, sizeof (s->count));
+      for (size_t i = s->begin; i < s->end; i++)
+        s->count[(s->src[i].key >> s->shift) & 0xFF]++;
+      break;
+    case TM_SORT_SCATTER:
+      for (size_t i = s->begin; i < s->end; i++)
+        s->dst[s->count[(s->src[i].key >> s->shift) & 0xFF]++] = s->src[i];
+      break;
+  }
+  return 0;
 }
 
-int                             /* set_errno */
-tm_diffyears (struct tm debut, struct tm fin, int *months, int *days, int *seconds)
+/// Runs a phase on all slices, the first one in the calling thread.
+static void
+tm_sortrun (tm_sortslice *slices, int nb, tm_sortphase phase)
 {
-  int m = tm_diffmonths (debut, fin, days, seconds);
-
-  if (months)
-    *months = m >= 0 ? m % 12 : -((-m) % 12);
-  return m / 12;
+  pthread_t threads[TM_SORT_MAXTHREADS];
+  int started[TM_SORT_MAXTHREADS] = { 0 };
+  for (int t = 0; t < nb; t++)
+    slices[t].phase = phase;
+  for (int t = 1; t < nb; t++)
+    started[t] = !pthread_create (threads + t, 0, tm_sortworker, slices + t);
+  tm_sortworker (slices);
+  for (int t = 1; t < nb; t++)
+    if (started[t])
+      pthread_join (threads[t], 0);
+    else
+      tm_sortworker (slices + t);       // Thread not available
 }
 
-int                             /* set_errno */
-tm_diffisoyears (struct tm debut, struct tm fin)
+/// Sorts the UTC instants of dates (LSD radix sort, 8 bits per pass), stable.
+/// @returns The sorted items, to be freed, or 0 on error.
+static tm_sortitem *
+tm_sortitems (const struct tm *dates, size_t n, int nbthreads)
 {
-  if (tm_getwallclock (debut) != tm_getwallclock (fin))
-    return (errno = EINVAL), 0;
+  tm_sortitem *items = malloc (2 * n * sizeof (*items)), *src = items, *dst = items + n;
+  if (!items)
+    return (errno = ENOMEM), (tm_sortitem *) 0;
+
+  tm_sortslice slices[TM_SORT_MAXTHREADS];
+  int nb = n < TM_SORT_PARALLEL_MIN || nbthreads < 1 ? 1 : nbthreads > TM_SORT_MAXTHREADS ? TM_SORT_MAXTHREADS : nbthreads;
+  for (int t = 0; t < nb; t++)
+    slices[t] = (tm_sortslice) { TM_SORT_KEYS, dates, src, src, n * t / nb, n * (t + 1) / nb, 0, { 0 }, TM_OK };
+  tm_sortrun (slices, nb, TM_SORT_KEYS);
+  for (int t = 0; t < nb; t++)
+    if (slices[t].status == TM_ERROR)
+    {
+      free (items);
+      return (errno = EINVAL), (tm_sortitem *) 0;
+    }
 
-  return tm_getisoyear (fin) - tm_getisoyear (debut);
+  for (int shift = 0; shift < 64; shift += 8)
+  {
+    tm_sortrun (slices, nb, TM_SORT_COUNT);
+
+    // Digits shared by all instants (the high bytes of close instants) do not need a pass.
+    size_t total[256] = { 0 };
+    for (int t = 0; t < nb; t++)
+      for (int d = 0; d < 256; d++)
+        total[d] += slices[t].count[d];
+    if (total[(src[0].key >> shift) & 0xFF] == n)
+    {
+      for (int t = 0; t < nb; t++)
+        slices[t].shift = shift + 8;
+      continue;
+    }
+
+    // Items of a digit are scattered in the order of the slices, to keep the sort stable.
+    size_t pos = 0;
+    for (int d = 0; d < 256; d++)
+      for (int t = 0; t < nb; t++)
+      {
+        size_t c = slices[t].count[d];
+        slices[t].count[d] = pos;
+        pos += c;
+      }
+    for (int t = 0; t < nb; t++)
+      slices[t].dst = dst;
+    tm_sortrun (slices, nb, TM_SORT_SCATTER);
+
+    tm_sortitem *tmp = src;
+    src = dst;
+    dst = tmp;
+    for (int t = 0; t < nb; t++)
+    {
+      slices[t].src = src;
+      slices[t].shift = shift + 8;
+    }
+  }
+
+  if (src != items)
+    memcpy (items, src, n * sizeof (*items));
+  return items;
 }
 
-time_t
-tm_tobinary (struct tm date)
+tm_status
+tm_sortkeys (const struct tm *dates, int64_t *keys, size_t n)
 {
-  struct tm dt0;
-  tm_set (&dt0, 1970, TM_JANUARY, 1, 0, 0, 0, TM_REF_UTC);      // Epoch, 1970-01-01 00:00:00 +0000 (UTC).
-  return tm_diffseconds (dt0, date);
+  if (n && (!dates || !keys))
+    return (errno = EINVAL), TM_ERROR;
+  for (size_t i = 0; i < n; i++)
+    if (tm_sortkey (dates + i, keys + i) == TM_ERROR)
+      return TM_ERROR;
+  return TM_OK;
 }
 
 tm_status
-tm_frombinary (struct tm *date, time_t binary, const char *rep)
+tm_sort (struct tm *dates, size_t n, int nbthreads)
 {
-  if (rep == TM_REF_UNCHANGED)
-    rep = tm_getwallclock (*date);
-
-  struct tm dt0;
-  tm_set (&dt0, 1970, TM_JANUARY, 1, 0, 0, 0, TM_REF_UTC);      // Epoch, 1970-01-01 00:00:00 +0000 (UTC).
-  *date = dt0;
-  if (tm_addseconds (date, binary) == TM_OK && tm_changetowallclock (date, rep) == TM_OK)
+  if (n && !dates)
+    return (errno = EINVAL), TM_ERROR;
+  if (n < 2)
     return TM_OK;
-  else
+
+  tm_sortitem *items = tm_sortitems (dates, n, nbthreads);
+  if (!items)
     return TM_ERROR;
+  struct tm *sorted = malloc (n * sizeof (*sorted));
+  if (!sorted)
+  {
+    free (items);
+    return (errno = ENOMEM), TM_ERROR;
+  }
+  for (size_t i = 0; i < n; i++)
+    sorted[i] = dates[items[i].index];
+  memcpy (dates, sorted, n * sizeof (*dates));
+  free (sorted);
+  free (items);
+  return TM_OK;
 }
@@ -22,6 +22,7 @@
 #  pragma once
 
 #  include "vfunc.h"
+#  include <stdint.h>
 
 typedef enum
 {
@@ -69,8 +70,17 @@ typedef enum
   TM_TODAY,                     // Today at midnight (for a specified referntial)
 } tm_predefined_instant;
 
+// Compact representation of an instant: absolute time and UTC offset of the wallclock it is represented in.
+typedef struct
+{
+  time_t utc;                   // Seconds elapsed since the Epoch, 1970-01-01 00:00:00 +0000 (UTC)
+  int utcoffset;                // In seconds
+} tm_instant;
+
 // Set to optimize performance in case TZ is not used anywhere else.
 extern int tm_is_TZ_owner;
+// Set to cache the current time per thread and per wallclock (TM_NOW is then refreshed once a second, TM_TODAY once a day).
+extern int tm_is_now_cached;
 
 // Date and time referentials
 extern const char *const TM_REF_SYSTEMTIME;     // Local time representation as defined by the system
@@ -105,7 +115,35 @@ tm_status tm_setdatefromstring (struct tm *dt, const char *str, const char *wc,
 #  define tm_setdatefromstring2(dt, text) tm_setdatefromstring3(dt, text, TM_REF_UNCHANGED)
 #  define tm_setdatefromstring(...) VFUNC(tm_setdatefromstring, __VA_ARGS__)
 
+typedef struct tm_parser tm_parser;     // Adaptive parser of dates and times (not to be shared between threads)
+tm_parser *tm_parser_create (void);     // Regional settings are taken into account at creation
+void tm_parser_free (tm_parser *parser);
+tm_status tm_parser_setdate (tm_parser *parser, struct tm *dt, const char *str, const char *wc, tm_time_precedence);
+#  define tm_parser_setdate5(parser, dt, text, rep, precedence) tm_parser_setdate(parser, dt, text, rep, precedence)
+#  define tm_parser_setdate4(parser, dt, text, rep) tm_parser_setdate5(parser, dt, text, rep, TM_ST_OVER_DST)
+#  define tm_parser_setdate3(parser, dt, text) tm_parser_setdate4(parser, dt, text, TM_REF_UNCHANGED)
+#  define tm_parser_setdate(...) VFUNC(tm_parser_setdate, __VA_ARGS__)
+tm_status tm_parser_settime (tm_parser *parser, struct tm *dt, const char *str, const char *wc, tm_time_precedence);
+#  define tm_parser_settime5(parser, dt, text, rep, precedence) tm_parser_settime(parser, dt, text, rep, precedence)
+#  define tm_parser_settime4(parser, dt, text, rep) tm_parser_settime5(parser, dt, text, rep, TM_ST_OVER_DST)
+#  define tm_parser_settime3(parser, dt, text) tm_parser_settime4(parser, dt, text, TM_REF_UNCHANGED)
+#  define tm_parser_settime(...) VFUNC(tm_parser_settime, __VA_ARGS__)
+
 tm_status tm_setfromiso8601 (struct tm *dt, char *str);
+tm_status tm_setfromrfc3339 (struct tm *dt, const char *str);
+tm_status tm_setfromrfc2822 (struct tm *dt, const char *str);
+tm_status tm_setfromhttpdate (struct tm *dt, const char *str);
+tm_status tm_setfromrfc9557 (struct tm *dt, const char *str);    // RFC 3339 with time zone suffix, e.g. [Europe/Paris]
+tm_status tm_setfromisoweekdate (struct tm *dt, const char *str, const char *wc);        // YYYY-Www-D or YYYYWwwD, at midnight
+#  define tm_setfromisoweekdate3(dt, str, wc) tm_setfromisoweekdate(dt, str, wc)
+#  define tm_setfromisoweekdate2(dt, str) tm_setfromisoweekdate3(dt, str, TM_REF_LOCALTIME)
+#  define tm_setfromisoweekdate(...) VFUNC(tm_setfromisoweekdate, __VA_ARGS__)
+tm_status tm_setfromisoordinaldate (struct tm *dt, const char *str, const char *wc);     // YYYY-DDD or YYYYDDD, at midnight
+#  define tm_setfromisoordinaldate3(dt, str, wc) tm_setfromisoordinaldate(dt, str, wc)
+#  define tm_setfromisoordinaldate2(dt, str) tm_setfromisoordinaldate3(dt, str, TM_REF_LOCALTIME)
+#  define tm_setfromisoordinaldate(...) VFUNC(tm_setfromisoordinaldate, __VA_ARGS__)
+size_t tm_daysfromisoweekdate_n (const char *const *in, size_t n, long int *days);      // Days elapsed since 1970-01-01
+size_t tm_daysfromisoordinaldate_n (const char *const *in, size_t n, long int *days);
 
 const char *tm_getwallclock (struct tm date);
 int tm_isdefinedinwallclock (struct tm, const char *);
@@ -139,6 +177,11 @@ int tm_isinsidedaylightsavingtimeoverlap (struct tm date);
 
 int tm_compare (const void *dta, const void *dtb);
 int tm_equals (struct tm a, struct tm b);
+tm_status tm_sortkeys (const struct tm *dates, int64_t *keys, size_t n); // Sets keys to the UTC instants of dates (sorting dates as tm_compare)
+tm_status tm_sort (struct tm *dates, size_t n, int nbthreads);  // Stable sort in increasing order, by nbthreads threads for large arrays
+#  define tm_sort3(dates, n, nbthreads) tm_sort(dates, n, nbthreads)
+#  define tm_sort2(dates, n) tm_sort3(dates, n, 1)
+#  define tm_sort(...) VFUNC (tm_sort, __VA_ARGS__)
 
 tm_status tm_datetostring (struct tm dt, size_t max, char *str);
 tm_status tm_timetostring (struct tm dt, size_t max, char *str);
@@ -147,6 +190,41 @@ tm_status tm_toiso8601 (struct tm dt, size_t max, char *str, int sep);
 #  define tm_toiso86014(date, max, str, sep) tm_toiso8601(date, max, str, sep)
 #  define tm_toiso86013(date, max, str) tm_toiso86014 (date, max, str, 0)
 #  define tm_toiso8601(...) VFUNC(tm_toiso8601, __VA_ARGS__)
+tm_status tm_torfc3339 (struct tm dt, size_t max, char *str);
+tm_status tm_torfc2822 (struct tm dt, size_t max, char *str);
+tm_status tm_tohttpdate (struct tm dt, size_t max, char *str);    // Always in GMT
+tm_status tm_torfc9557 (struct tm dt, size_t max, char *str);
+tm_status tm_toisoweekdate (struct tm dt, size_t max, char *str, int sep);
+#  define tm_toisoweekdate4(date, max, str, sep) tm_toisoweekdate(date, max, str, sep)
+#  define tm_toisoweekdate3(date, max, str) tm_toisoweekdate4 (date, max, str, 0)
+#  define tm_toisoweekdate(...) VFUNC(tm_toisoweekdate, __VA_ARGS__)
+tm_status tm_toisoordinaldate (struct tm dt, size_t max, char *str, int sep);
+#  define tm_toisoordinaldate4(date, max, str, sep) tm_toisoordinaldate(date, max, str, sep)
+#  define tm_toisoordinaldate3(date, max, str) tm_toisoordinaldate4 (date, max, str, 0)
+#  define tm_toisoordinaldate(...) VFUNC(tm_toisoordinaldate, __VA_ARGS__)
+
+// Options of the locale-free ISO 8601 formatter (can be combined with |)
+typedef enum
+{
+  TM_ISO8601_BASIC = 0,         // YYYYMMDDThhmmss±hhmm
+  TM_ISO8601_EXTENDED = 1,      // YYYY-MM-DDThh:mm:ss±hhmm
+  TM_ISO8601_OFFSET_COLON = 2,  // ±hh:mm rather than ±hhmm
+  TM_ISO8601_OFFSET_Z = 4,      // Z rather than a zero UTC offset
+  TM_ISO8601_NO_OFFSET = 8,     // No UTC offset
+  TM_ISO8601_DATE_ONLY = 16,    // YYYYMMDD or YYYY-MM-DD
+  TM_ISO8601_YEAR_UNPADDED = 32,        // Year not padded to 4 digits, as strftime %Y does
+} tm_iso8601_option;
+
+size_t tm_formatiso8601 (struct tm dt, size_t max, char *str, int options, int digits, long int nanoseconds);  // Returns the number of bytes written (0 on error)
+#  define tm_formatiso86016(date, max, str, options, digits, nanoseconds) tm_formatiso8601(date, max, str, options, digits, nanoseconds)
+#  define tm_formatiso86014(date, max, str, options) tm_formatiso86016(date, max, str, options, 0, 0)
+#  define tm_formatiso86013(date, max, str) tm_formatiso86014(date, max, str, TM_ISO8601_EXTENDED | TM_ISO8601_OFFSET_COLON)
+#  define tm_formatiso8601(...) VFUNC(tm_formatiso8601, __VA_ARGS__)
+size_t tm_formatiso8601_n (const tm_instant *in, size_t n, char *out, size_t outcap, char sep);        // Returns the number of bytes written
+typedef struct tm_format tm_format;     // Compiled format
+tm_format *tm_format_compile (const char *fmt); // fmt as for strftime
+size_t tm_format_run (const tm_format *prog, struct tm dt, size_t max, char *str);      // Returns the number of bytes written (0 on error)
+void tm_format_free (tm_format *prog);
 
 tm_status tm_addseconds (struct tm *date, long int nbSecs);
 #  define tm_addminutes(date, nbMins) tm_addseconds (date, 60 * (int)(nbMins))
@@ -156,6 +234,65 @@ tm_status tm_addmonths (struct tm *date, int nbMonths);
 #  define tm_addyears(date, nbYears) tm_addmonths (date, 12 * (int)(nbYears))
 tm_status tm_trimtime (struct tm *date);
 
+// Calendar units (on a wallclock)
+typedef enum
+{
+  TM_UNIT_SECOND,
+  TM_UNIT_MINUTE,
+  TM_UNIT_HOUR,
+  TM_UNIT_DAY,
+  TM_UNIT_WEEK,                 // ISO 8601 week, starting on Monday
+  TM_UNIT_MONTH,
+  TM_UNIT_QUARTER,
+  TM_UNIT_YEAR,
+} tm_unit;
+
+tm_status tm_floor (struct tm *date, tm_unit unit);     // Beginning of the unit containing date
+tm_status tm_ceil (struct tm *date, tm_unit unit);      // Beginning of the next unit (date if already at a beginning)
+tm_status tm_round (struct tm *date, tm_unit unit);     // Nearest of both (the next one if halfway)
+size_t tm_floor_n (tm_instant *instants, size_t n, tm_unit unit, const char *wallclock);       // Returns the number of instants processed
+size_t tm_ceil_n (tm_instant *instants, size_t n, tm_unit unit, const char *wallclock);
+size_t tm_round_n (tm_instant *instants, size_t n, tm_unit unit, const char *wallclock);
+
+// ISO 8601 duration (PnYnMnWnDTnHnMnS); all components have the same sign.
+typedef struct
+{
+  int years, months, weeks, days;       // Nominal (calendar) components
+  int hours, minutes, seconds;  // Exact (elapsed time) components
+} tm_duration;
+
+tm_status tm_setdurationfromiso8601 (tm_duration *duration, const char *str);   // P1Y2M10DT2H30M, P3W, -P1D
+tm_status tm_durationtoiso8601 (tm_duration duration, size_t max, char *str);
+tm_status tm_addduration (struct tm *date, tm_duration duration);
+size_t tm_addduration_n (struct tm *dates, size_t n, tm_duration duration);    // Returns the number of dates modified
+
+// Deferred operations on a date, resolved with a single normalization when the date is read (not to be shared between threads)
+typedef struct
+{
+  struct tm date;               // Last resolved date
+  tm_time_precedence precedence;        // As for tm_set, when fields are set
+  int pending;                  // Pending operations (private)
+  int year, month, day;         // Pending date (private)
+  int hour, minute, second;     // Pending time of day (private)
+  int months, days;             // Pending nominal offsets (private)
+  long int seconds;             // Pending exact offset (private)
+} tm_builder;
+
+void tm_builder_init (tm_builder *builder, struct tm date, tm_time_precedence);
+#  define tm_builder_init3(builder, date, precedence) tm_builder_init(builder, date, precedence)
+#  define tm_builder_init2(builder, date) tm_builder_init3(builder, date, TM_ST_OVER_DST)
+#  define tm_builder_init(...) VFUNC(tm_builder_init, __VA_ARGS__)
+tm_status tm_builder_setdate (tm_builder *builder, int year, tm_month month, int day);
+tm_status tm_builder_settime (tm_builder *builder, int hour, int min, int sec);
+tm_status tm_builder_trimtime (tm_builder *builder);
+tm_status tm_builder_addseconds (tm_builder *builder, long int nbSecs);
+#  define tm_builder_addminutes(builder, nbMins) tm_builder_addseconds (builder, 60 * (int)(nbMins))
+#  define tm_builder_addhours(builder, nbHours) tm_builder_addminutes (builder, 60 * (int)(nbHours))
+tm_status tm_builder_adddays (tm_builder *builder, int nbDays);
+tm_status tm_builder_addmonths (tm_builder *builder, int nbMonths);
+#  define tm_builder_addyears(builder, nbYears) tm_builder_addmonths (builder, 12 * (int)(nbYears))
+tm_status tm_builder_get (tm_builder *builder, struct tm *date);        // Resolves pending operations
+
 long int tm_diffseconds (struct tm start, struct tm stop);
 #  define tm_diffminutes(start, stop) ((int)(tm_diffseconds(start, stop)) / 60)
 #  define tm_diffhours(start, stop) ((int)(tm_diffminutes(start, stop)) / 60)
@@ -196,11 +333,173 @@ int tm_getlastweekdayinmonth (int year, tm_month month, tm_dayofweek dow);
 int tm_getfirstweekdayinisoyear (int isoyear, tm_dayofweek dow);
 
 time_t tm_tobinary (struct tm);
+tm_instant tm_toinstant (struct tm);
 tm_status tm_frombinary (struct tm *, time_t binary, const char *);
 #  define tm_frombinary3(date, instant, rep) tm_frombinary(date, instant, rep)
 #  define tm_frombinary2(date, instant) tm_frombinary3(date, instant, TM_REF_LOCALTIME)
 #  define tm_frombinary(...) VFUNC (tm_frombinary, __VA_ARGS__)
 
+// Conversion of UTC instants into a wallclock, for streams of instants in increasing order:
+// the UTC offset in effect and the current local day are kept from one instant to the next.
+typedef struct
+{
+  const char *wallclock;
+  time_t from, until;           // UTC instants over which utcoffset applies
+  int utcoffset, isdst;
+  time_t daybegin;              // Local time of the beginning of day
+  struct tm day;                // Current local day, at midnight
+} tm_zonecursor;
+
+tm_status tm_zonecursor_init (tm_zonecursor *cursor, const char *wallclock);
+#  define tm_zonecursor_init2(cursor, wallclock) tm_zonecursor_init(cursor, wallclock)
+#  define tm_zonecursor_init1(cursor) tm_zonecursor_init2(cursor, TM_REF_LOCALTIME)
+#  define tm_zonecursor_init(...) VFUNC (tm_zonecursor_init, __VA_ARGS__)
+tm_status tm_zonecursor_convert (tm_zonecursor *cursor, time_t utc, struct tm *date);
+size_t tm_zonecursor_convert_n (tm_zonecursor *cursor, const time_t *utc, struct tm *dates, size_t n);  // Returns the number of instants converted
+size_t tm_zonecursor_instants (tm_zonecursor *cursor, tm_instant *instants, size_t n);  // Sets the UTC offsets; returns the number of instants processed
+
+// Iterator over the dates from start (included) to stop (excluded), by steps of calendar units (not to be shared between threads):
+// seconds, minutes and hours are elapsed time, days, weeks, months, quarters and years keep the time of day (and the day of month) of start.
+typedef struct
+{
+  struct tm date;               // Next date
+  time_t utc, stop;             // UTC instants of date and of the end of iteration
+  tm_unit unit;
+  int step;
+  long int count;               // Dates produced
+  long int start, startyear;    // (private)
+  int timeofday, startmonth, startmday; // (private)
+  tm_zonecursor cursor;         // UTC offset of date (private)
+} tm_iter;
+
+tm_status tm_iter_begin (tm_iter *iter, struct tm start, struct tm stop, tm_unit unit, int step);
+#  define tm_iter_begin5(iter, start, stop, unit, step) tm_iter_begin(iter, start, stop, unit, step)
+#  define tm_iter_begin4(iter, start, stop, unit) tm_iter_begin5(iter, start, stop, unit, 1)
+#  define tm_iter_begin(...) VFUNC (tm_iter_begin, __VA_ARGS__)
+tm_status tm_iter_next (tm_iter *iter, struct tm *date);        // TM_ERROR after the last date
+size_t tm_iter_next_n (tm_iter *iter, struct tm *dates, size_t n);      // Returns the number of dates set
+
+// Statistics of the values of a time series over a calendar unit
+typedef struct
+{
+  tm_instant begin;             // Beginning of the unit (on the wallclock of the aggregator)
+  time_t end;                   // UTC instant of the beginning of the next unit
+  size_t count;
+  double sum, min, max;
+} tm_bucket;
+
+// Aggregator of the points of a time series into buckets of calendar units, for points in increasing order of UTC instants (not to be shared between threads)
+typedef struct
+{
+  const char *wallclock;
+  tm_unit unit;
+  void (*emit) (const tm_bucket * bucket, void *arg);  // Called for each completed bucket
+  void *arg;
+  tm_bucket bucket;             // Current bucket (private)
+} tm_aggregator;
+
+tm_status tm_aggregator_init (tm_aggregator *agg, const char *wallclock, tm_unit unit, void (*emit) (const tm_bucket * bucket, void *arg), void *arg);
+size_t tm_aggregator_add (tm_aggregator *agg, const time_t *utc, const double *values, size_t n);      // Returns the number of points aggregated
+void tm_aggregator_flush (tm_aggregator *agg);  // Emits the current bucket
+
+// Cron expression (minute hour day-of-month month day-of-week), compiled into sets of bits
+typedef struct
+{
+  unsigned long long minutes;   // Bits 0 to 59
+  unsigned long int hours;      // Bits 0 to 23
+  unsigned long int days;       // Days of month, bits 1 to 31
+  unsigned int months;          // Bits 1 (January) to 12
+  unsigned int weekdays;        // Bits 0 (Sunday) to 6
+  int flags;                    // (private)
+} tm_cron;
+
+tm_status tm_cron_compile (tm_cron *cron, const char *expr);      // "*/15 9-17 * * MON-FRI", "0 3 1,15 * *", "@daily"
+tm_status tm_cron_next (const tm_cron *cron, struct tm after, struct tm *next, const char *wallclock);
+#  define tm_cron_next4(cron, after, next, rep) tm_cron_next(cron, after, next, rep)
+#  define tm_cron_next3(cron, after, next) tm_cron_next4(cron, after, next, TM_REF_UNCHANGED)
+#  define tm_cron_next(...) VFUNC (tm_cron_next, __VA_ARGS__)
+size_t tm_cron_next_n (const tm_cron *crons, size_t n, struct tm after, struct tm *next, const char *wallclock);   // Returns the number of next set
+
+// Timer of a timer wheel, allocated by the caller. A pending timer must be cancelled before being inserted again.
+typedef struct tm_timer
+{
+  struct tm deadline;           // Wall time (on its wallclock) the timer expires at
+  void *data;                   // User data
+  time_t at;                    // UTC instant the timer expires at (private)
+  int slot;                     // (private)
+  struct tm_timer *next, **pprev;       // Timers of the same slot (private)
+  struct tm_timer *zonenext, **zonepprev;       // Timers of the same wallclock (private)
+} tm_timer;
+
+typedef struct tm_timerwheel tm_timerwheel;     // Hierarchical timer wheel (not to be shared between threads)
+tm_timerwheel *tm_timerwheel_create (struct tm now);
+void tm_timerwheel_free (tm_timerwheel *wheel);
+tm_status tm_timerwheel_insert (tm_timerwheel *wheel, tm_timer *timer, struct tm deadline, void *data);
+tm_status tm_timerwheel_cancel (tm_timerwheel *wheel, tm_timer *timer);
+size_t tm_timerwheel_advance (tm_timerwheel *wheel, struct tm now, void (*expire) (tm_timer ** timers, size_t n, void *arg), void *arg);       // Returns the number of timers expired
+size_t tm_timerwheel_reanchor (tm_timerwheel *wheel, const char *wallclock);   // Returns the number of timers moved
+
+// Recurrence rule (RFC 5545 subset: FREQ, INTERVAL, COUNT, UNTIL, BYMONTH, BYMONTHDAY, BYDAY, BYSETPOS; weeks start on Monday)
+typedef enum
+{
+  TM_RRULE_YEARLY,
+  TM_RRULE_MONTHLY,
+  TM_RRULE_WEEKLY,
+  TM_RRULE_DAILY,
+} tm_rrule_frequency;
+
+#  define TM_RRULE_MAXSETPOS 16
+typedef struct
+{
+  tm_rrule_frequency freq;
+  int interval;
+  int count;                    // 0 if none
+  int until;                    // 0 if none, 1 if untiltime is a local time, 2 if untiltime is a UTC time
+  time_t untiltime;             // Seconds elapsed since 1970-01-01 00:00:00
+  unsigned int bymonth;         // Bit n for month n (1 for January)
+  unsigned long int bymonthday, bymonthdayneg;  // Bit n for the nth day from the beginning (bymonthday) or the end (bymonthdayneg) of the month
+  unsigned long long int byday[7], bydayneg[7]; // For each day of the week (0 for Sunday), bit 0 for every one, bit n for the nth one from the beginning (byday) or the end (bydayneg)
+  int nbsetpos;
+  int bysetpos[TM_RRULE_MAXSETPOS];
+} tm_rrule;
+
+// Lazy iterator over the occurrences of a recurrence rule (not to be shared between threads)
+typedef struct
+{
+  tm_rrule rule;
+  const char *wallclock;        // Wallclock of DTSTART
+  long int start;               // Day of DTSTART (private)
+  int timeofday, startmonth, startmday, startwday, byday;       // (private)
+  long int period, last;        // (private)
+  int produced, done;           // (private)
+  int nb, next;                 // (private)
+  long int days[366];           // Days of the current period (private)
+} tm_rrule_iter;
+
+tm_status tm_rrule_compile (tm_rrule *rule, const char *str);       // "FREQ=MONTHLY;BYDAY=-1SU", "RRULE:FREQ=YEARLY;BYMONTH=3;BYDAY=2SU;COUNT=10"
+tm_status tm_rrule_begin (tm_rrule_iter *iter, const tm_rrule *rule, struct tm dtstart);
+tm_status tm_rrule_next (tm_rrule_iter *iter, struct tm *occurrence);   // TM_ERROR after the last occurrence
+size_t tm_rrule_next_n (tm_rrule_iter *iter, struct tm *occurrences, size_t n);        // Returns the number of occurrences set
+
+typedef struct tm_busdaycal tm_busdaycal;       // Business day calendar (read-only once created, can be shared between threads)
+#  define TM_BUSDAY_MONDAY_TO_FRIDAY ((1U << TM_MONDAY) | (1U << TM_TUESDAY) | (1U << TM_WEDNESDAY) | (1U << TM_THURSDAY) | (1U << TM_FRIDAY))
+tm_busdaycal *tm_busdaycal_create (unsigned int weekmask, const struct tm *holidays, size_t n); // weekmask: bit d set if day of week d (tm_dayofweek) is a business day
+void tm_busdaycal_free (tm_busdaycal *cal);
+int tm_isbusday (const tm_busdaycal *cal, struct tm date);
+tm_status tm_busday_add (const tm_busdaycal *cal, struct tm *date, long int n);        // Rolls forward to a business day first
+long int tm_busday_diff (const tm_busdaycal *cal, struct tm begin, struct tm end);      // Business days in [begin, end)
+size_t tm_busday_add_n (const tm_busdaycal *cal, long int *days, const long int *n, size_t nb);   // Days elapsed since 1970-01-01
+size_t tm_busday_diff_n (const tm_busdaycal *cal, const long int *begin, const long int *end, size_t n, long int *diff);
+
+typedef struct tm_schedule tm_schedule; // Weekly opening hours on a wallclock (can be shared between threads once the exceptions are added)
+tm_schedule *tm_schedule_create (const char *hours, const char *wallclock);     // "Mo-Fr 09:00-12:00,14:00-18:00; Sa 10:00-16:00; Su off"
+tm_status tm_schedule_addexception (tm_schedule *schedule, struct tm date, const char *hours);  // "off", "10:00-14:00"
+void tm_schedule_free (tm_schedule *schedule);
+int tm_schedule_isopen (const tm_schedule *schedule, struct tm now);
+tm_status tm_schedule_nextchange (const tm_schedule *schedule, struct tm now, struct tm *next);  // Next opening or closing time
+size_t tm_schedule_isopen_n (const tm_schedule *const *schedules, size_t n, struct tm now, int *open);  // Returns the number of schedules processed
+size_t tm_schedule_nextchange_n (const tm_schedule *const *schedules, size_t n, struct tm now, struct tm *next);
+
 tm_status dt_tostring (struct tm dt, size_t max, char *str);
 tm_status dt_toiso8601 (struct tm dt, size_t max, char *str, int sep);
 #  define dt_set4(date, YYYY, MM, DD)             tm_make8(date, YYYY, MM, DD, 0, 0, 0, TM_REF_UTC)
@@ -251,6 +251,45 @@ START_TEST (tu_set_from_local)
   ck_assert (tm_isdefinedinlocaltime (dt));
 }
 
+END_TEST
+START_TEST (tu_parser)
+{
+  struct tm dt, control;
+  char str[100];
+  tm_parser *parser = tm_parser_create ();
+  ck_assert (parser);
+
+  ck_assert (tm_set (&dt, 2012, 12, 31, 23, 59, 59) != TM_ERROR);
+  control = dt;
+  for (int i = 0; i < 400; i++, tm_adddays (&control, 17))
+  {
+    strftime (str, sizeof (str), "%x", &control);       // Regional settings
+    ck_assert (tm_parser_setdate (parser, &dt, str) == TM_OK);
+    ck_assert (tm_getyear (dt) == tm_getyear (control) && tm_getmonth (dt) == tm_getmonth (control) && tm_getday (dt) == tm_getday (control));
+  }
+  ck_assert (tm_isdefinedinlocaltime (dt));
+
+  ck_assert (tm_parser_setdate (parser, &dt, "1999-03-17") == TM_OK);   // ISO format
+  ck_assert (tm_getyear (dt) == 1999 && tm_getmonth (dt) == TM_MARCH && tm_getday (dt) == 17);
+  ck_assert (tm_parser_setdate (parser, &dt, "1999-02-29") == TM_ERROR);
+  ck_assert (tm_parser_setdate (parser, &dt, "33/4/1987") == TM_ERROR);
+  ck_assert (tm_parser_setdate (parser, &dt, "2016-02-29", TM_REF_UTC) == TM_OK);
+  ck_assert (tm_isdefinedinutc (dt));
+
+  ck_assert (tm_parser_settime (parser, &dt, "23:04") == TM_OK);
+  ck_assert (tm_gethour (dt) == 23 && tm_getminute (dt) == 4 && tm_getsecond (dt) == 0);
+  ck_assert (tm_parser_settime (parser, &dt, "25:04") == TM_ERROR);
+  ck_assert (tm_parser_settime (parser, &dt, "33/4/1987") == TM_ERROR);
+  ck_assert (tm_parser_settime (parser, &dt, "23:04:03") == TM_OK);
+  ck_assert (tm_gethour (dt) == 23 && tm_getminute (dt) == 4 && tm_getsecond (dt) == 3);
+  ck_assert (tm_isdefinedinutc (dt));
+
+  ck_assert (tm_parser_setdate (0, &dt, "1999-03-17") == TM_ERROR && errno == EINVAL);
+  ck_assert (tm_parser_settime (parser, &dt, 0) == TM_ERROR && errno == EINVAL);
+
+  tm_parser_free (parser);
+}
+
 END_TEST
 START_TEST (tu_set_from_utc)
 {
@@ -531,6 +570,75 @@ START_TEST (tu_dst_summer)
   ck_assert (tm_getsecondsofday (aDate) == 2 * 3600 + 1800);
 }
 
+END_TEST
+START_TEST (tu_dst_fold)
+{
+  const char *wallclocks[] = { "Europe/Paris", "America/New_York", "Australia/Lord_Howe" };
+  for (size_t w = 0; w < sizeof (wallclocks) / sizeof (*wallclocks); w++)
+    for (int precedence = 0; precedence < 2; precedence++)
+    {
+      int gaps = 0, overlaps = 0;
+      for (int month = TM_JANUARY; month <= TM_DECEMBER; month++)
+        for (int day = 1; day <= tm_getdaysinmonth (2019, month); day++)
+          for (int minutes = 0; minutes < 24 * 60; minutes += 30)
+          {
+            struct tm dt, ctrl;
+            if (tm_set (&dt, 2019, month, day, minutes / 60, minutes % 60, 0, wallclocks[w], precedence ? TM_DST_OVER_ST : TM_ST_OVER_DST) == TM_ERROR)
+            {
+              ck_assert (errno == EINVAL);
+              gaps++;
+              continue;
+            }
+            ck_assert (tm_getmonth (dt) == month && tm_getday (dt) == day && tm_gethour (dt) * 60 + tm_getminute (dt) == minutes);
+            ck_assert (tm_isdefinedinwallclock (dt, wallclocks[w]));
+            int overlap = tm_isinsidedaylightsavingtimeoverlap (dt);
+            if (overlap)
+            {
+              ck_assert (tm_isdaylightsavingtimeineffect (dt) == precedence);
+              overlaps++;
+            }
+            else if (minutes % 180)
+              continue;
+            ctrl = dt;
+            ck_assert (tm_changetowallclock (&ctrl, TM_REF_UTC) == TM_OK && tm_changetowallclock (&ctrl, wallclocks[w]) == TM_OK);
+            ck_assert (tm_equals (dt, ctrl) && tm_isdaylightsavingtimeineffect (dt) == tm_isdaylightsavingtimeineffect (ctrl));
+            ck_assert (tm_getdayofweek (dt) == tm_getdayofweek (ctrl) && tm_getdayofyear (dt) == tm_getdayofyear (ctrl));
+          }
+      // 1 hour (30 minutes for Lord Howe island) gap and overlap a year
+      ck_assert (gaps == (w == 2 ? 1 : 2) && overlaps == (w == 2 ? 1 : 2));
+    }
+
+  // Same resolution from the first uses of a wallclock (mktime) to the later ones (transition table)
+  for (int i = 0; i < 300; i++)
+  {
+    struct tm dt;
+    int precedence = i % 2;
+    ck_assert (tm_set (&dt, 2019, TM_OCTOBER, 27, 1, 30, 0, "Europe/Lisbon", precedence ? TM_DST_OVER_ST : TM_ST_OVER_DST) == TM_OK);
+    ck_assert (tm_isdaylightsavingtimeineffect (dt) == precedence && tm_getutcoffset (dt) == precedence * 3600);
+    ck_assert (tm_gethour (dt) == 1 && tm_getminute (dt) == 30);
+    ck_assert (tm_set (&dt, 2019, TM_MARCH, 31, 1, 30, 0, "Europe/Lisbon") == TM_ERROR && errno == EINVAL);
+  }
+}
+
+END_TEST
+START_TEST (tu_dst_overlap)
+{
+  const char *wallclocks[] = { "Europe/Paris", "America/New_York", "Australia/Lord_Howe", TM_REF_UTC };
+  for (size_t w = 0; w < sizeof (wallclocks) / sizeof (*wallclocks); w++)
+  {
+    struct tm dt, st, dst;
+    ck_assert (tm_set (&dt, 2019, TM_JANUARY, 1, 0, 0, 0, wallclocks[w]) == TM_OK);
+    for (int i = 0; i < 365 * 24; i++, tm_addminutes (&dt, 60))
+    {
+      // Inside an overlap, the same wallclock time refers to two instants.
+      ck_assert (tm_set (&st, tm_getyear (dt), tm_getmonth (dt), tm_getday (dt), tm_gethour (dt), tm_getminute (dt), 0, wallclocks[w], TM_ST_OVER_DST) == TM_OK);
+      ck_assert (tm_set (&dst, tm_getyear (dt), tm_getmonth (dt), tm_getday (dt), tm_gethour (dt), tm_getminute (dt), 0, wallclocks[w], TM_DST_OVER_ST) == TM_OK);
+      ck_assert (tm_isinsidedaylightsavingtimeoverlap (dt) == (tm_diffseconds (dst, st) != 0));
+      ck_assert (tm_isinsidedaylightsavingtimeoverlap (st) == tm_isinsidedaylightsavingtimeoverlap (dt));
+    }
+  }
+}
+
 END_TEST
 START_TEST (tu_dst_winter)
 {
@@ -1154,6 +1262,1505 @@ START_TEST (tu_iso8601)
              tm_equals (dt, control) && tm_toiso8601 (dt, 49, str) == TM_OK && strcmp (str, "20190828T010203+0000") == 0);
 }
 
+END_TEST
+START_TEST (tu_iso8601_fixed)
+{
+  struct tm control, dt;
+  ck_assert (tm_set (&control, 2019, 8, 28, 1, 2, 3, TM_REF_UTC) == TM_OK);
+  ck_assert (tm_setfromiso8601 (&dt, "2019-08-28T01:02:03Z") == TM_OK && tm_equals (dt, control));
+  ck_assert (tm_setfromiso8601 (&dt, "2019-08-28T01:02:03.456Z") == TM_OK && tm_equals (dt, control));
+  ck_assert (tm_setfromiso8601 (&dt, "20190828T010203Z") == TM_OK && tm_equals (dt, control));
+  ck_assert (tm_set (&control, 2019, 8, 29, 0, 0, 0, TM_REF_UTC) == TM_OK);
+  ck_assert (tm_setfromiso8601 (&dt, "2019-08-28T24:00:00Z") == TM_OK && tm_equals (dt, control));
+  ck_assert (tm_set (&control, 2019, 8, 28, 1, 2, 59, TM_REF_UTC) == TM_OK);
+  ck_assert (tm_setfromiso8601 (&dt, "2019-08-28T01:02:60Z") == TM_OK && tm_equals (dt, control));
+  ck_assert (tm_setfromiso8601 (&dt, "2019-02-29T01:02:03Z") == TM_ERROR && errno == EINVAL);
+  ck_assert (tm_setfromiso8601 (&dt, "2019-08-28T01:62:03Z") == TM_ERROR);
+  ck_assert (tm_setfromiso8601 (&dt, "2019-08-28T01:02:03X") == TM_ERROR);
+  ck_assert (tm_setfromiso8601 (&dt, "2019-08-28 01:02:03Z") == TM_ERROR);
+  ck_assert (tm_setfromiso8601 (&dt, "2019-08-28T01:02:03.4a6Z") == TM_ERROR);
+
+  ck_assert (tm_setlocalwallclock ("Europe/London") == TM_OK);
+  ck_assert (tm_set (&control, 2019, 1, 15, 10, 0, 0) == TM_OK);
+  ck_assert (tm_setfromiso8601 (&dt, "2019-01-15T10:00:00Z") == TM_OK && tm_isdefinedinlocaltime (dt) && tm_equals (dt, control));
+}
+
+END_TEST
+START_TEST (tu_formatiso8601)
+{
+  struct tm dt;
+  char str[49], control[49];
+  ck_assert (tm_set (&dt, 2019, 8, 27, 1, 2, 3) == TM_OK);
+  ck_assert (tm_formatiso8601 (dt, 49, str) == 25 && strcmp (str, "2019-08-27T01:02:03+02:00") == 0);
+  ck_assert (tm_formatiso8601 (dt, 49, str, TM_ISO8601_BASIC) == 20 && strftime (control, 49, "%Y%m%dT%H%M%S%z", &dt) && strcmp (str, control) == 0);
+  ck_assert (tm_formatiso8601 (dt, 49, str, TM_ISO8601_EXTENDED) == 24 && strftime (control, 49, "%Y-%m-%dT%H:%M:%S%z", &dt) && strcmp (str, control) == 0);
+  ck_assert (tm_formatiso8601 (dt, 49, str, TM_ISO8601_EXTENDED | TM_ISO8601_OFFSET_COLON, 3, 456789012) == 29
+             && strcmp (str, "2019-08-27T01:02:03.456+02:00") == 0);
+  ck_assert (tm_formatiso8601 (dt, 49, str, TM_ISO8601_BASIC | TM_ISO8601_NO_OFFSET, 9, 456789012) == 25 && strcmp (str, "20190827T010203.456789012") == 0);
+  ck_assert (tm_formatiso8601 (dt, 49, str, TM_ISO8601_EXTENDED | TM_ISO8601_DATE_ONLY) == 10 && strcmp (str, "2019-08-27") == 0);
+  ck_assert (tm_formatiso8601 (dt, 25, str) == 0);
+  ck_assert (tm_formatiso8601 (dt, 26, str) == 25);
+  ck_assert (tm_formatiso8601 (dt, 49, str, TM_ISO8601_EXTENDED, 10, 0) == 0 && errno == EINVAL);
+  ck_assert (tm_formatiso8601 (dt, 0, str) == 0 && errno == EINVAL);
+
+  ck_assert (tm_set (&dt, 2019, 8, 27, 1, 2, 3, TM_REF_UTC) == TM_OK);
+  ck_assert (tm_formatiso8601 (dt, 49, str, TM_ISO8601_EXTENDED | TM_ISO8601_OFFSET_Z) == 20 && strcmp (str, "2019-08-27T01:02:03Z") == 0);
+  ck_assert (tm_set (&dt, 2019, 8, 27, 1, 2, 3, "America/St_Johns") == TM_OK);
+  ck_assert (tm_formatiso8601 (dt, 49, str, TM_ISO8601_EXTENDED | TM_ISO8601_OFFSET_COLON | TM_ISO8601_OFFSET_Z) == 25
+             && strcmp (str, "2019-08-27T01:02:03-02:30") == 0);
+  ck_assert (tm_set (&dt, 712, 3, 4, 5, 6, 7, TM_REF_UTC) == TM_OK);
+  ck_assert (tm_formatiso8601 (dt, 49, str) == 25 && strcmp (str, "0712-03-04T05:06:07+00:00") == 0);
+  ck_assert (tm_toiso8601 (dt, 49, str, 1) == TM_OK && strcmp (str, "712-03-04T05:06:07+0000") == 0);
+  ck_assert (dt_toiso8601 (dt, 49, str, 0) == TM_OK && strcmp (str, "7120304") == 0);
+  ck_assert (tm_set (&dt, 12345, 3, 4, 5, 6, 7, TM_REF_UTC) == TM_OK);
+  ck_assert (tm_formatiso8601 (dt, 49, str, TM_ISO8601_BASIC) == 21 && strcmp (str, "123450304T050607+0000") == 0);
+
+  ck_assert (tm_set (&dt, 2019, 8, 27, 1, 2, 3, TM_REF_UTC) == TM_OK);
+  dt.tm_min = 150;
+  ck_assert (tm_formatiso8601 (dt, 49, str) == 0 && errno == EINVAL);
+  ck_assert (tm_toiso8601 (dt, 49, str) == TM_ERROR && errno == EINVAL);
+  dt.tm_min = 2;
+  dt.tm_mon = -1;
+  ck_assert (tm_formatiso8601 (dt, 49, str, TM_ISO8601_EXTENDED | TM_ISO8601_DATE_ONLY) == 0 && errno == EINVAL);
+}
+
+END_TEST
+START_TEST (tu_rfc)
+{
+  struct tm dt;
+  char str[100];
+
+  // RFC 3339
+  ck_assert (tm_setfromrfc3339 (&dt, "1985-04-12T23:20:50.52Z") == TM_OK && tm_tobinary (dt) == 482196050);
+  ck_assert (tm_setfromrfc3339 (&dt, "1996-12-19t16:39:57-08:00") == TM_OK && tm_tobinary (dt) == 851042397);
+  ck_assert (tm_setfromrfc3339 (&dt, "1990-12-31 23:59:60z") == TM_OK && tm_tobinary (dt) == 662687999);
+  ck_assert (tm_setfromrfc3339 (&dt, "1985-04-12T23:20:50") == TM_ERROR);
+  ck_assert (tm_setfromrfc3339 (&dt, "1985-02-29T23:20:50Z") == TM_ERROR);
+  ck_assert (tm_setfromrfc3339 (&dt, "1985-04-12T23:20:50+0100") == TM_ERROR);
+
+  // RFC 2822
+  ck_assert (tm_setfromrfc2822 (&dt, "Tue, 1 Jul 2003 10:52:37 +0200") == TM_OK && tm_tobinary (dt) == 1057049557);
+  ck_assert (tm_setfromrfc2822 (&dt, "01 jul 2003 10:52:37 +0200") == TM_OK && tm_tobinary (dt) == 1057049557);
+  ck_assert (tm_setfromrfc2822 (&dt, "Fri, 21 Nov 1997 09:55:06 -0600") == TM_OK && tm_tobinary (dt) == 880127706);
+  ck_assert (tm_setfromrfc2822 (&dt, "FRI ,21 NOV 97 09 : 55 : 06 GMT") == TM_OK && tm_tobinary (dt) == 880106106);
+  ck_assert (tm_setfromrfc2822 (&dt, "Thu, 13 Feb 1969 23:32 -0330") == TM_OK && tm_tobinary (dt) == -27723426 - 54);
+  ck_assert (tm_setfromrfc2822 (&dt, "Mon, 1 Jul 2003 10:52:37 +0200") == TM_ERROR);     // Tuesday
+  ck_assert (tm_setfromrfc2822 (&dt, "Tue, 1 Jul 2003 10:52:37") == TM_ERROR);
+
+  // HTTP-date
+  ck_assert (tm_setfromhttpdate (&dt, "Sun, 06 Nov 1994 08:49:37 GMT") == TM_OK && tm_tobinary (dt) == 784111777);
+  ck_assert (tm_setfromhttpdate (&dt, "Sunday, 06-Nov-94 08:49:37 GMT") == TM_OK && tm_tobinary (dt) == 784111777);
+  ck_assert (tm_setfromhttpdate (&dt, "Sun Nov  6 08:49:37 1994") == TM_OK && tm_tobinary (dt) == 784111777);
+  ck_assert (tm_setfromhttpdate (&dt, "Sun, 06 Nov 1994 08:49:37 +0000") == TM_ERROR);
+  ck_assert (tm_setfromhttpdate (&dt, "Sun, 6 Nov 1994 08:49:37 GMT") == TM_ERROR);
+
+  ck_assert (tm_set (&dt, 2019, TM_AUGUST, 27, 1, 2, 3, TM_REF_UTC) == TM_OK);
+  ck_assert (tm_tohttpdate (dt, sizeof (str), str) == TM_OK && !strcmp (str, "Tue, 27 Aug 2019 01:02:03 GMT"));
+  ck_assert (tm_torfc2822 (dt, sizeof (str), str) == TM_OK && !strcmp (str, "Tue, 27 Aug 2019 01:02:03 +0000"));
+  ck_assert (tm_torfc3339 (dt, sizeof (str), str) == TM_OK && !strcmp (str, "2019-08-27T01:02:03Z"));
+  ck_assert (tm_changetowallclock (&dt, TM_REF_LOCALTIME) == TM_OK);
+  ck_assert (tm_tohttpdate (dt, sizeof (str), str) == TM_OK && !strcmp (str, "Tue, 27 Aug 2019 01:02:03 GMT"));
+  ck_assert (tm_tohttpdate (dt, 29, str) == TM_ERROR);
+  ck_assert (tm_torfc2822 (dt, sizeof (str), str) == TM_OK && !strcmp (str, "Tue, 27 Aug 2019 03:02:03 +0200"));
+  ck_assert (tm_setfromrfc2822 (&dt, str) == TM_OK && tm_isdefinedinlocaltime (dt) && tm_gethour (dt) == 3);
+  ck_assert (tm_torfc3339 (dt, sizeof (str), str) == TM_OK && !strcmp (str, "2019-08-27T03:02:03+02:00"));
+  ck_assert (tm_setfromrfc3339 (&dt, str) == TM_OK && tm_isdefinedinlocaltime (dt) && tm_gethour (dt) == 3);
+}
+
+END_TEST
+START_TEST (tu_rfc9557)
+{
+  struct tm dt;
+  char str[100];
+
+  ck_assert (tm_setfromrfc9557 (&dt, "2019-08-27T01:02:03+02:00[Europe/Paris]") == TM_OK);
+  ck_assert (!strcmp (tm_getwallclock (dt), "Europe/Paris") && tm_isdefinedinwallclock (dt, "Europe/Paris"));
+  ck_assert (tm_gethour (dt) == 1 && tm_getutcoffset (dt) == 7200 && tm_isdaylightsavingtimeineffect (dt));
+  ck_assert (tm_tobinary (dt) == 1566860523);
+  ck_assert (tm_torfc9557 (dt, sizeof (str), str) == TM_OK && !strcmp (str, "2019-08-27T01:02:03+02:00[Europe/Paris]"));
+  ck_assert (tm_torfc9557 (dt, 39, str) == TM_ERROR);
+
+  ck_assert (tm_setfromrfc9557 (&dt, "2019-08-27T01:02:03Z[!Europe/Paris]") == TM_OK);
+  ck_assert (tm_gethour (dt) == 3 && tm_getutcoffset (dt) == 7200 && tm_tobinary (dt) == 1566867723);
+  ck_assert (tm_setfromrfc9557 (&dt, "2019-01-27T01:02:03+01:00[Europe/Paris][u-ca=gregory]") == TM_OK);
+  ck_assert (tm_gethour (dt) == 1 && !tm_isdaylightsavingtimeineffect (dt));
+  ck_assert (tm_setfromrfc9557 (&dt, "2019-08-27T01:02:03+01:00[Europe/Paris]") == TM_OK);  // Elective: offset of the time zone prevails
+  ck_assert (tm_gethour (dt) == 2 && tm_getutcoffset (dt) == 7200);
+  ck_assert (tm_setfromrfc9557 (&dt, "2019-08-27T01:02:03+01:00[!Europe/Paris]") == TM_ERROR);
+  ck_assert (tm_setfromrfc9557 (&dt, "2019-08-27T01:02:03+02:00[!u-ca=gregory]") == TM_ERROR);
+  ck_assert (tm_setfromrfc9557 (&dt, "2019-08-27T01:02:03+02:00[u-ca=gregory][Europe/Paris]") == TM_ERROR);
+  ck_assert (tm_setfromrfc9557 (&dt, "2019-08-27T01:02:03+02:00[Europe/Paris") == TM_ERROR);
+  ck_assert (tm_setfromrfc9557 (&dt, "2019-08-27T01:02:03+02:00[]") == TM_ERROR);
+  ck_assert (tm_setfromrfc9557 (&dt, "2019-08-27T01:02:03+02:00[6th_continent]") == TM_ERROR);
+  // Other spellings of a zone are not time zone names: they would each take a slot of the registry of wallclocks.
+  const char *spellings[] = { "[Europe//Paris]", "[./Europe/Paris]", "[/Europe/Paris]", "[Europe/../Europe/Paris]", "[Europe/Paris/]", "[-Europe/Paris]" };
+  for (size_t i = 0; i < sizeof (spellings) / sizeof (*spellings); i++)
+  {
+    snprintf (str, sizeof (str), "2019-08-27T01:02:03+02:00%s", spellings[i]);
+    ck_assert (tm_setfromrfc9557 (&dt, str) == TM_ERROR && errno == EINVAL);
+  }
+  ck_assert (tm_setfromrfc9557 (&dt, "2019-08-27T01:02:03-04:00[America/Port-au-Prince]") == TM_OK);
+  ck_assert (!strcmp (tm_getwallclock (dt), "America/Port-au-Prince") && tm_getutcoffset (dt) == -4 * 3600);
+  ck_assert (tm_setfromrfc9557 (&dt, "2019-08-27T01:02:03+02:00[!+02:00]") == TM_OK && tm_tobinary (dt) == 1566860523);
+  ck_assert (tm_setfromrfc9557 (&dt, "2019-08-27T01:02:03+02:00") == TM_OK && tm_isdefinedinlocaltime (dt));
+
+  ck_assert (tm_setfromrfc9557 (&dt, "1850-08-27T01:02:03Z[America/New_York]") == TM_OK);    // Out of the range of the transition table
+  ck_assert (!strcmp (tm_getwallclock (dt), "America/New_York") && tm_getutcoffset (dt) == -(4 * 3600 + 56 * 60 + 2));
+}
+
+END_TEST
+START_TEST (tu_isoweekdate)
+{
+  struct tm dt;
+  char str[20], control[20];
+
+  ck_assert (tm_setfromisoweekdate (&dt, "2019-W35-2") == TM_OK && tm_isdefinedinlocaltime (dt));
+  ck_assert (tm_getyear (dt) == 2019 && tm_getmonth (dt) == TM_AUGUST && tm_getday (dt) == 27 && tm_gethour (dt) == 0);
+  ck_assert (tm_setfromisoweekdate (&dt, "2019W352", TM_REF_UTC) == TM_OK && tm_isdefinedinutc (dt));
+  ck_assert (tm_getday (dt) == 27 && tm_getdayofweek (dt) == TM_TUESDAY && tm_getdayofyear (dt) == 239);
+  ck_assert (tm_setfromisoweekdate (&dt, "2019-W35", TM_REF_UTC) == TM_OK && tm_getday (dt) == 26);
+  ck_assert (tm_setfromisoweekdate (&dt, "2020-W53-7", TM_REF_UTC) == TM_OK && tm_getyear (dt) == 2021 && tm_getday (dt) == 3);
+  ck_assert (tm_setfromisoweekdate (&dt, "2019-W53-1") == TM_ERROR);
+  ck_assert (tm_setfromisoweekdate (&dt, "2019-W35-8") == TM_ERROR);
+  ck_assert (tm_setfromisoweekdate (&dt, "2019W35-2") == TM_ERROR);
+  ck_assert (tm_setfromisoweekdate (&dt, "2019-W352") == TM_ERROR);
+
+  ck_assert (tm_setfromisoordinaldate (&dt, "2019-239") == TM_OK && tm_isdefinedinlocaltime (dt));
+  ck_assert (tm_getmonth (dt) == TM_AUGUST && tm_getday (dt) == 27);
+  ck_assert (tm_setfromisoordinaldate (&dt, "2020366", TM_REF_UTC) == TM_OK && tm_getmonth (dt) == TM_DECEMBER && tm_getday (dt) == 31);
+  ck_assert (tm_setfromisoordinaldate (&dt, "2019-366") == TM_ERROR);
+  ck_assert (tm_setfromisoordinaldate (&dt, "2019-000") == TM_ERROR);
+  ck_assert (tm_setfromisoordinaldate (&dt, "20190827") == TM_ERROR);
+
+  ck_assert (tm_set (&dt, 1995, TM_DECEMBER, 20, 12, 0, 0, TM_REF_UTC) == TM_OK);
+  for (int i = 0; i < 366 * 10; i++, tm_adddays (&dt, 3))
+  {
+    struct tm parsed;
+    strftime (control, sizeof (control), "%G-W%V-%u", &dt);
+    ck_assert (tm_toisoweekdate (dt, sizeof (str), str, 1) == TM_OK && !strcmp (str, control));
+    ck_assert (tm_setfromisoweekdate (&parsed, str, TM_REF_UTC) == TM_OK && tm_diffcalendardays (parsed, dt) == 0);
+    strftime (control, sizeof (control), "%Y%j", &dt);
+    ck_assert (tm_toisoordinaldate (dt, sizeof (str), str) == TM_OK && !strcmp (str, control));
+    ck_assert (tm_setfromisoordinaldate (&parsed, str, TM_REF_UTC) == TM_OK && tm_diffcalendardays (parsed, dt) == 0);
+  }
+  ck_assert (tm_toisoweekdate (dt, 10, str, 1) == TM_ERROR);
+  ck_assert (tm_toisoweekdate (dt, 8, str) == TM_ERROR && tm_toisoweekdate (dt, 9, str) == TM_OK);
+  ck_assert (tm_getweeksinisoyear (2020) == 53 && tm_getweeksinisoyear (2015) == 53 && tm_getweeksinisoyear (2019) == 52);
+
+  const char *weeks[] = { "1970-W01-4", "2019-W35-2", "2019W352", "1969-W52-1", "2019-W35-9" };
+  const char *ordinals[] = { "1970-001", "2019-239", "2019239", "1969365", "2019-400" };
+  long int days[5];
+  ck_assert (tm_daysfromisoweekdate_n (weeks, 4, days) == 4);
+  ck_assert (days[0] == 0 && days[1] == 18135 && days[2] == 18135 && days[3] == -10);
+  ck_assert (tm_daysfromisoweekdate_n (weeks, 5, days) == 4 && errno == EINVAL);
+  ck_assert (tm_daysfromisoordinaldate_n (ordinals, 4, days) == 4);
+  ck_assert (days[0] == 0 && days[1] == 18135 && days[2] == 18135 && days[3] == -1);
+  ck_assert (tm_daysfromisoordinaldate_n (ordinals, 5, days) == 4 && errno == EINVAL);
+}
+
+END_TEST
+START_TEST (tu_duration)
+{
+  tm_duration d;
+  char str[100];
+
+  ck_assert (tm_setdurationfromiso8601 (&d, "P1Y2M10DT2H30M") == TM_OK);
+  ck_assert (d.years == 1 && d.months == 2 && d.weeks == 0 && d.days == 10 && d.hours == 2 && d.minutes == 30 && d.seconds == 0);
+  ck_assert (tm_durationtoiso8601 (d, sizeof (str), str) == TM_OK && !strcmp (str, "P1Y2M10DT2H30M"));
+  ck_assert (tm_durationtoiso8601 (d, 14, str) == TM_ERROR && tm_durationtoiso8601 (d, 15, str) == TM_OK);
+  ck_assert (tm_setdurationfromiso8601 (&d, "P3W") == TM_OK && d.weeks == 3 && d.days == 0);
+  ck_assert (tm_durationtoiso8601 (d, sizeof (str), str) == TM_OK && !strcmp (str, "P3W"));
+  ck_assert (tm_setdurationfromiso8601 (&d, "-P1DT1S") == TM_OK && d.days == -1 && d.seconds == -1);
+  ck_assert (tm_durationtoiso8601 (d, sizeof (str), str) == TM_OK && !strcmp (str, "-P1DT1S"));
+  ck_assert (tm_setdurationfromiso8601 (&d, "+PT36H") == TM_OK && d.hours == 36 && d.days == 0);
+  ck_assert (tm_setdurationfromiso8601 (&d, "P0D") == TM_OK);
+  ck_assert (tm_durationtoiso8601 (d, sizeof (str), str) == TM_OK && !strcmp (str, "PT0S"));
+  d.days = 1, d.hours = -1;
+  ck_assert (tm_durationtoiso8601 (d, sizeof (str), str) == TM_ERROR && errno == EINVAL);
+
+  const char *invalid[] = { "", "P", "PT", "P1DT", "1D", "P1H", "PT1D", "P1M1Y", "P1D1D", "P1.5D", "P1D2", "P-1D", "P1234567890D", "p1d", "P1DT1H1M1S1" };
+  for (size_t i = 0; i < sizeof (invalid) / sizeof (*invalid); i++)
+    ck_assert (tm_setdurationfromiso8601 (&d, invalid[i]) == TM_ERROR && errno == EINVAL);
+
+  struct tm dt, ref;
+  ck_assert (tm_setdurationfromiso8601 (&d, "P1Y2M10DT2H30M") == TM_OK);
+  const char *wallclocks[] = { TM_REF_UTC, "Europe/Paris", "America/New_York" };
+  for (size_t w = 0; w < sizeof (wallclocks) / sizeof (*wallclocks); w++)
+  {
+    ck_assert (tm_set (&dt, 2018, TM_DECEMBER, 25, 0, 30, 0, wallclocks[w]) == TM_OK);
+    for (int i = 0; i < 8 * 400; i++, tm_addseconds (&dt, 3 * 3600 + 60))
+    {
+      if (tm_gethour (dt) == 2)
+        continue;               // Sequential operations would shift the time of day in DST gaps of intermediate dates.
+      struct tm res = ref = dt;
+      ck_assert (tm_addmonths (&ref, 14) == TM_OK && tm_adddays (&ref, 10) == TM_OK && tm_addseconds (&ref, 9000) == TM_OK);
+      ck_assert (tm_addduration (&res, d) == TM_OK);
+      ck_assert (tm_equals (res, ref) && tm_isdaylightsavingtimeineffect (res) == tm_isdaylightsavingtimeineffect (ref));
+    }
+  }
+
+  // End of month
+  ck_assert (tm_set (&dt, 2020, TM_JANUARY, 31, 12, 0, 0, TM_REF_UTC) == TM_OK);
+  ck_assert (tm_setdurationfromiso8601 (&d, "P1M") == TM_OK && tm_addduration (&dt, d) == TM_OK);
+  ck_assert (tm_getmonth (dt) == TM_FEBRUARY && tm_getday (dt) == 29 && tm_gethour (dt) == 12);
+  ck_assert (tm_setdurationfromiso8601 (&d, "P1Y") == TM_OK && tm_addduration (&dt, d) == TM_OK);
+  ck_assert (tm_getyear (dt) == 2021 && tm_getmonth (dt) == TM_FEBRUARY && tm_getday (dt) == 28);
+  ck_assert (tm_setdurationfromiso8601 (&d, "-P1Y1M1D") == TM_OK && tm_addduration (&dt, d) == TM_OK);
+  ck_assert (tm_getyear (dt) == 2020 && tm_getmonth (dt) == TM_JANUARY && tm_getday (dt) == 27);
+
+  // Nominal days keep the time of day, exact hours do not, across DST changes
+  ck_assert (tm_set (&dt, 2019, TM_MARCH, 30, 12, 0, 0, "Europe/Paris") == TM_OK);
+  ref = dt;
+  ck_assert (tm_setdurationfromiso8601 (&d, "P1D") == TM_OK && tm_addduration (&dt, d) == TM_OK && tm_gethour (dt) == 12);
+  ck_assert (tm_setdurationfromiso8601 (&d, "PT24H") == TM_OK && tm_addduration (&ref, d) == TM_OK && tm_gethour (ref) == 13);
+
+  // Exact components keep the side of the overlap
+  ck_assert (tm_set (&dt, 2019, TM_OCTOBER, 27, 1, 30, 0, "Europe/Paris") == TM_OK);
+  ck_assert (tm_setdurationfromiso8601 (&d, "PT1H") == TM_OK && tm_addduration (&dt, d) == TM_OK);
+  ck_assert (tm_gethour (dt) == 2 && tm_isdaylightsavingtimeineffect (dt));
+  ck_assert (tm_addduration (&dt, d) == TM_OK && tm_gethour (dt) == 2 && !tm_isdaylightsavingtimeineffect (dt));
+  ck_assert (tm_addduration (&dt, d) == TM_OK && tm_gethour (dt) == 3);
+
+  struct tm dates[100], controls[100];
+  ck_assert (tm_setdurationfromiso8601 (&d, "P1MT1M") == TM_OK);
+  ck_assert (tm_set (dates, 2019, TM_JANUARY, 1, 0, 0, 0, "America/New_York") == TM_OK);
+  for (size_t i = 1; i < sizeof (dates) / sizeof (*dates); i++)
+    dates[i] = dates[i - 1], tm_adddays (dates + i, 1);
+  for (size_t i = 0; i < sizeof (dates) / sizeof (*dates); i++)
+  {
+    controls[i] = dates[i];
+    ck_assert (tm_addduration (controls + i, d) == TM_OK);
+  }
+  ck_assert (tm_addduration_n (dates, 100, d) == 100);
+  for (size_t i = 0; i < sizeof (dates) / sizeof (*dates); i++)
+    ck_assert (tm_equals (dates[i], controls[i]));
+  ck_assert (tm_changetowallclock (dates + 50, "Europe/Paris") == TM_OK);
+  ck_assert (tm_addduration_n (dates, 100, d) == 50 && errno == EINVAL);
+  ck_assert (tm_addduration_n (dates, 0, d) == 0);
+
+  ck_assert (tm_set (dates, 2019, TM_JANUARY, 1, 0, 0, 0, TM_REF_UTC) == TM_OK);
+  d.years = INT_MAX;
+  ref = *dates;
+  ck_assert (tm_addduration (dates, d) == TM_ERROR && errno == EOVERFLOW && tm_equals (*dates, ref));
+}
+
+END_TEST
+START_TEST (tu_builder)
+{
+  tm_builder b;
+  struct tm dt, ref;
+
+  // Successive months are limited to the last day of each month
+  ck_assert (tm_set (&dt, 2020, TM_JANUARY, 31, 12, 0, 0, TM_REF_UTC) == TM_OK);
+  tm_builder_init (&b, dt);
+  ck_assert (tm_builder_addmonths (&b, 1) == TM_OK && tm_builder_addmonths (&b, 1) == TM_OK);
+  ck_assert (tm_builder_get (&b, &dt) == TM_OK && tm_getmonth (dt) == TM_MARCH && tm_getday (dt) == 29);
+  ck_assert (tm_set (&dt, 2020, TM_JANUARY, 30, 12, 0, 0) == TM_OK);
+  tm_builder_init (&b, dt);
+  ck_assert (tm_builder_adddays (&b, 1) == TM_OK && tm_builder_addmonths (&b, 1) == TM_OK && tm_builder_trimtime (&b) == TM_OK);
+  ck_assert (tm_builder_get (&b, &dt) == TM_OK && tm_getmonth (dt) == TM_FEBRUARY && tm_getday (dt) == 29 && tm_gethour (dt) == 0);
+  ck_assert (tm_isdefinedinlocaltime (dt));
+
+  // Fields are checked as by tm_set
+  ck_assert (tm_builder_setdate (&b, 2019, TM_FEBRUARY, 29) == TM_ERROR && errno == EINVAL);
+  ck_assert (tm_builder_settime (&b, 24, 0, 0) == TM_ERROR && errno == EINVAL);
+  ck_assert (tm_set (&dt, 2019, TM_JANUARY, 1, 0, 0, 0, "Europe/Paris") == TM_OK);
+  tm_builder_init (&b, dt);
+  ck_assert (tm_builder_setdate (&b, 2019, TM_MARCH, 31) == TM_OK && tm_builder_settime (&b, 2, 30, 0) == TM_OK);
+  ck_assert (tm_builder_get (&b, &ref) == TM_ERROR && errno == EINVAL);
+  ck_assert (tm_builder_get (&b, &ref) == TM_OK && tm_equals (ref, dt));
+  ck_assert (tm_builder_setdate (&b, 2019, TM_OCTOBER, 27) == TM_OK && tm_builder_settime (&b, 2, 30, 0) == TM_OK);
+  ck_assert (tm_builder_get (&b, &ref) == TM_OK && tm_gethour (ref) == 2 && !tm_isdaylightsavingtimeineffect (ref));
+  tm_builder_init (&b, dt, TM_DST_OVER_ST);
+  ck_assert (tm_builder_setdate (&b, 2019, TM_OCTOBER, 27) == TM_OK && tm_builder_settime (&b, 2, 30, 0) == TM_OK);
+  ck_assert (tm_builder_get (&b, &ref) == TM_OK && tm_gethour (ref) == 2 && tm_isdaylightsavingtimeineffect (ref));
+  ck_assert (tm_builder_addhours (&b, 1) == TM_OK && tm_builder_get (&b, &ref) == TM_OK);
+  ck_assert (tm_gethour (ref) == 2 && !tm_isdaylightsavingtimeineffect (ref));
+
+  // Same results as immediate operations
+  const char *wallclocks[] = { TM_REF_UTC, "Europe/Paris", "America/New_York" };
+  unsigned int seed = 1;
+  for (size_t w = 0; w < sizeof (wallclocks) / sizeof (*wallclocks); w++)
+    for (int i = 0; i < 2000; i++)
+    {
+      ck_assert (tm_set (&dt, 2019, TM_JANUARY, 1, 12, 0, 0, wallclocks[w]) == TM_OK);
+      tm_builder_init (&b, dt);
+      int skip = 0;
+      for (int op = 0; op < 6; op++)
+      {
+        seed = seed * 1103515245 + 12345;
+        int arg = (int) ((seed >> 8) % 1000);
+        switch ((seed >> 20) % 6)
+        {
+          case 0:
+            ck_assert (tm_builder_addmonths (&b, arg % 40 - 20) == TM_OK && tm_addmonths (&dt, arg % 40 - 20) == TM_OK);
+            break;
+          case 1:
+            ck_assert (tm_builder_adddays (&b, arg - 500) == TM_OK && tm_adddays (&dt, arg - 500) == TM_OK);
+            break;
+          case 2:
+            ck_assert (tm_builder_addseconds (&b, arg * 731 - 365000) == TM_OK && tm_addseconds (&dt, arg * 731 - 365000) == TM_OK);
+            break;
+          case 3:
+            ck_assert (tm_builder_trimtime (&b) == TM_OK && tm_trimtime (&dt) == TM_OK);
+            break;
+          case 4:
+            ck_assert (tm_builder_settime (&b, arg % 20 + 4, arg % 60, 0) == TM_OK);
+            ck_assert (tm_set (&dt, tm_getyear (dt), tm_getmonth (dt), tm_getday (dt), arg % 20 + 4, arg % 60, 0, TM_REF_UNCHANGED) == TM_OK);
+            break;
+          case 5:
+            ck_assert (tm_builder_setdate (&b, 2000 + arg % 40, arg % 12 + 1, arg % 28 + 1) == TM_OK);
+            ck_assert (tm_set (&dt, 2000 + arg % 40, arg % 12 + 1, arg % 28 + 1, tm_gethour (dt), tm_getminute (dt), tm_getsecond (dt), TM_REF_UNCHANGED) == TM_OK);
+            break;
+        }
+        if (tm_gethour (dt) >= 1 && tm_gethour (dt) <= 3)
+          skip = 1;             // Immediate operations would shift the time of day in DST gaps of intermediate dates.
+      }
+      ck_assert (tm_builder_get (&b, &ref) == TM_OK);
+      ck_assert (skip || (tm_equals (ref, dt) && tm_isdaylightsavingtimeineffect (ref) == tm_isdaylightsavingtimeineffect (dt)));
+    }
+
+  ck_assert (tm_set (&dt, 2019, TM_JANUARY, 1, 12, 0, 0) == TM_OK);
+  tm_builder_init (&b, dt);
+  tm_builder_addmonths (&b, 1);
+  tm_builder_adddays (&b, 3);
+  tm_builder_trimtime (&b);
+  tm_builder_addhours (&b, 8);
+  ck_assert (tm_builder_get (&b, &ref) == TM_OK);
+  ck_assert (tm_set (&dt, 2019, TM_FEBRUARY, 4, 8, 0, 0) == TM_OK && tm_equals (ref, dt));
+}
+
+END_TEST
+// 1 if the local time (seconds elapsed since 1970-01-01 00:00:00 on the wallclock) is selected by cron.
+static int
+tu_cron_matches (const tm_cron *cron, int either, time_t local)
+{
+  struct tm f;
+  gmtime_r (&local, &f);
+  int bymonthday = (int) (cron->days >> f.tm_mday & 1), byweekday = (int) (cron->weekdays >> f.tm_wday & 1);
+  return (cron->minutes >> f.tm_min & 1) && (cron->hours >> f.tm_hour & 1) && (cron->months >> (f.tm_mon + 1) & 1) &&
+    (either ? bymonthday || byweekday : bymonthday && byweekday);
+}
+
+// Next firing (UTC seconds) of cron after after, found by walking minute by minute from 3 hours before after (to know which local times were already passed).
+// UTC offsets are only read every 30 minutes (the UTC offsets of the wallclocks tested change on UTC hours or half hours).
+static int
+tu_cron_walk (const tm_cron *cron, int either, struct tm after, int nbmins, time_t *next)
+{
+  struct tm dt = after, copy = after;
+  time_t utcafter = timegm (&copy) - tm_getutcoffset (after);
+  ck_assert (tm_addseconds (&dt, -10800 - tm_getsecond (after) - 60 * ((tm_getminute (after) + 1440 - tm_getutcoffset (after) / 60) % 30)) == TM_OK);
+  copy = dt;
+  time_t prev = timegm (&copy);
+  for (int i = (nbmins + 240) / 30; i; i--, tm_addminutes (&dt, 30))
+  {
+    copy = dt;
+    time_t local0 = timegm (&copy), utc0 = local0 - tm_getutcoffset (dt);
+    for (int k = 0; k < 30; k++)
+    {
+      time_t local = local0 + 60 * k;
+      int fired = 0;
+      for (time_t m = (prev / 60 + 1) * 60; !fired && m <= local; m += 60)
+        fired = tu_cron_matches (cron, either, m);
+      if (fired && utc0 + 60 * k > utcafter)
+        return (*next = utc0 + 60 * k), 1;
+      if (local > prev)
+        prev = local;
+    }
+  }
+  return 0;
+}
+
+START_TEST (tu_cron)
+{
+  tm_cron cron;
+  struct tm after, next;
+  char str[64];
+
+  const char *invalid[] = { "", "* * * *", "* * * * * *", "60 * * * *", "* 24 * * *", "* * 0 * *", "* * 32 * *", "* * * 13 * ", "* * * * 8",
+    "5-1 * * * *", "*/0 * * * *", "1,,2 * * * *", "* * * JANV *", "@foo", "@daily *", "-1 * * * *", "*/100 * * * *"
+  };
+  for (size_t i = 0; i < sizeof (invalid) / sizeof (*invalid); i++)
+  {
+    errno = 0;
+    ck_assert (tm_cron_compile (&cron, invalid[i]) == TM_ERROR && errno == EINVAL);
+  }
+
+  ck_assert (tm_cron_compile (&cron, " */15 9-17 * * mon-FRI ") == TM_OK);
+  ck_assert (cron.minutes == (1ULL | 1ULL << 15 | 1ULL << 30 | 1ULL << 45) && cron.hours == 0x3FE00UL && cron.days == 0xFFFFFFFEUL);
+  ck_assert (cron.months == 0x1FFEU && cron.weekdays == 0x3EU);
+  ck_assert (tm_cron_compile (&cron, "0 0 * * 7") == TM_OK && cron.weekdays == 1U);
+  ck_assert (tm_cron_compile (&cron, "5/20 0 1,15 jan,Jul-dec/2 *") == TM_OK && cron.minutes == (1ULL << 5 | 1ULL << 25 | 1ULL << 45));
+  ck_assert (cron.days == (1UL << 1 | 1UL << 15) && cron.months == (1U << 1 | 1U << 7 | 1U << 9 | 1U << 11));
+
+  // UTC
+  ck_assert (tm_set (&after, 2021, TM_JANUARY, 1, 0, 0, 0, TM_REF_UTC) == TM_OK);
+  ck_assert (tm_cron_compile (&cron, "*/15 * * * *") == TM_OK && tm_cron_next (&cron, after, &next) == TM_OK);
+  ck_assert (tm_formatiso8601 (next, sizeof (str), str) && !strcmp (str, "2021-01-01T00:15:00+00:00"));
+  ck_assert (tm_cron_compile (&cron, "@yearly") == TM_OK && tm_cron_next (&cron, after, &next) == TM_OK);
+  ck_assert (tm_formatiso8601 (next, sizeof (str), str) && !strcmp (str, "2022-01-01T00:00:00+00:00"));
+  ck_assert (tm_cron_compile (&cron, "0 12 29 2 *") == TM_OK && tm_cron_next (&cron, after, &next) == TM_OK);
+  ck_assert (tm_formatiso8601 (next, sizeof (str), str) && !strcmp (str, "2024-02-29T12:00:00+00:00"));
+  // Either the 13th or a Friday
+  ck_assert (tm_cron_compile (&cron, "0 0 13 * FRI") == TM_OK && tm_cron_next (&cron, after, &next) == TM_OK);
+  ck_assert (tm_formatiso8601 (next, sizeof (str), str) && !strcmp (str, "2021-01-08T00:00:00+00:00"));
+  ck_assert (tm_cron_compile (&cron, "0 0 30 2 *") == TM_OK && tm_cron_next (&cron, after, &next) == TM_ERROR && errno == EINVAL);
+
+  // Local time skipped by DST: fired when DST starts, once.
+  ck_assert (tm_set (&after, 2021, TM_MARCH, 27, 12, 0, 0, "Europe/Paris") == TM_OK);
+  ck_assert (tm_cron_compile (&cron, "30 2 * * *") == TM_OK && tm_cron_next (&cron, after, &next) == TM_OK);
+  ck_assert (tm_isdefinedinwallclock (next, "Europe/Paris"));
+  ck_assert (tm_formatiso8601 (next, sizeof (str), str) && !strcmp (str, "2021-03-28T03:00:00+02:00"));
+  ck_assert (tm_cron_next (&cron, next, &next) == TM_OK);
+  ck_assert (tm_formatiso8601 (next, sizeof (str), str) && !strcmp (str, "2021-03-29T02:30:00+02:00"));
+  ck_assert (tm_cron_compile (&cron, "*/20 * * * *") == TM_OK);
+  ck_assert (tm_set (&after, 2021, TM_MARCH, 28, 1, 50, 0, "Europe/Paris") == TM_OK && tm_cron_next (&cron, after, &next) == TM_OK);
+  ck_assert (tm_formatiso8601 (next, sizeof (str), str) && !strcmp (str, "2021-03-28T03:00:00+02:00"));
+  ck_assert (tm_cron_next (&cron, next, &next) == TM_OK);
+  ck_assert (tm_formatiso8601 (next, sizeof (str), str) && !strcmp (str, "2021-03-28T03:20:00+02:00"));
+
+  // Local time repeated by DST: fired at its first occurrence only.
+  ck_assert (tm_set (&after, 2021, TM_OCTOBER, 30, 12, 0, 0, "Europe/Paris") == TM_OK);
+  ck_assert (tm_cron_compile (&cron, "30 2 * * *") == TM_OK && tm_cron_next (&cron, after, &next) == TM_OK);
+  ck_assert (tm_formatiso8601 (next, sizeof (str), str) && !strcmp (str, "2021-10-31T02:30:00+02:00"));
+  ck_assert (tm_cron_next (&cron, next, &next) == TM_OK);
+  ck_assert (tm_formatiso8601 (next, sizeof (str), str) && !strcmp (str, "2021-11-01T02:30:00+01:00"));
+
+  // Results expressed in another wallclock
+  ck_assert (tm_cron_compile (&cron, "0 9 * * *") == TM_OK && tm_cron_next (&cron, after, &next, "Asia/Tokyo") == TM_OK);
+  ck_assert (tm_isdefinedinwallclock (next, "Asia/Tokyo"));
+  ck_assert (tm_formatiso8601 (next, sizeof (str), str) && !strcmp (str, "2021-10-31T09:00:00+09:00"));
+  ck_assert (tm_cron_next (&cron, after, &next, TM_REF_UTC) == TM_OK && tm_isdefinedinutc (next));
+  ck_assert (tm_formatiso8601 (next, sizeof (str), str) && !strcmp (str, "2021-10-31T09:00:00+00:00"));
+
+  // Random schedules around DST changes, compared to a walk minute by minute
+  const char *wallclocks[] = { "Europe/Paris", "America/New_York", "Australia/Lord_Howe", "Asia/Kolkata" };
+  const int starts[][3] = { {2021, 3, 27}, {2021, 3, 28}, {2021, 3, 14}, {2021, 4, 4}, {2021, 10, 31}, {2021, 11, 7}, {2021, 10, 3} };
+  const int bounds[5][2] = { {0, 59}, {0, 23}, {1, 31}, {1, 12}, {0, 6} };
+  int nbfound = 0;
+  srand (40);
+  for (int i = 0; i < 400; i++)
+  {
+    char expr[128], *p = expr;
+    int stars[5];
+    const int *d = starts[rand () % (sizeof (starts) / sizeof (*starts))];
+    for (int f = 0; f < 5; f++)
+    {
+      // Hours and minutes around DST changes favored
+      int lo = bounds[f][0], hi = f == 1 && rand () % 2 ? 4 : bounds[f][1];
+      if ((stars[f] = f >= 2 ? rand () % 4 != 0 : rand () % 4 == 0))
+        p += sprintf (p, "*%s", rand () % 2 ? "" : "/2");
+      else
+        for (int n = 1 + rand () % 4; n; n--)
+          p += sprintf (p, "%d%s", f == 3 && n == 1 ? d[1] : lo + rand () % (hi - lo + 1), n > 1 ? "," : "");
+      *p++ = f < 4 ? ' ' : 0;
+    }
+    ck_assert (tm_cron_compile (&cron, expr) == TM_OK);
+
+    if (tm_set (&after, d[0], d[1], d[2], rand () % 5, rand () % 60, rand () % 60, wallclocks[rand () % 4]) == TM_ERROR)
+      continue;                 // Inside a DST gap
+    if (rand () % 2)
+      ck_assert (tm_addhours (&after, -rand () % 24) == TM_OK);
+    time_t walked, utcafter, utcnext;
+    int nbmins = 3 * 24 * 60;
+    int found = tu_cron_walk (&cron, !stars[2] && !stars[4], after, nbmins, &walked);
+    tm_status ret = tm_cron_next (&cron, after, &next);
+    ck_assert (ret == TM_OK || !found);
+    if (ret == TM_ERROR)
+      continue;                 // Never selected (e.g. February 30)
+    ck_assert (tm_isdefinedinwallclock (next, tm_getwallclock (after)));
+    struct tm copy = after;
+    utcafter = timegm (&copy) - tm_getutcoffset (after);
+    copy = next;
+    utcnext = timegm (&copy) - tm_getutcoffset (next);
+    ck_assert (found ? walked == utcnext : utcnext > utcafter + nbmins * 60 - 60);
+    nbfound += found;
+  }
+  ck_assert (nbfound > 200);
+
+  // Many schedules evaluated at once
+  tm_cron *crons = malloc (100000 * sizeof (*crons));
+  struct tm *nexts = malloc (100000 * sizeof (*nexts));
+  ck_assert (crons && nexts);
+  for (int i = 0; i < 100000; i++)
+  {
+    snprintf (str, sizeof (str), "%d %d,%d * * %s", i % 60, i % 24, (i + 7) % 24, i % 3 ? "*" : "MON-FRI");
+    ck_assert (tm_cron_compile (crons + i, str) == TM_OK);
+  }
+  ck_assert (tm_set (&after, 2021, TM_OCTOBER, 30, 12, 0, 0, "Europe/Paris") == TM_OK);
+  ck_assert (tm_cron_next_n (crons, 100000, after, nexts, TM_REF_UNCHANGED) == 100000);
+  for (int i = 0; i < 100000; i += 997)
+  {
+    ck_assert (tm_cron_next (crons + i, after, &next) == TM_OK);
+    ck_assert (tm_diffseconds (next, nexts[i]) == 0 && tm_diffseconds (after, next) > 0);
+  }
+  crons[1].minutes = 0;
+  errno = 0;
+  ck_assert (tm_cron_next_n (crons, 100000, after, nexts, TM_REF_UNCHANGED) == 1 && errno == EINVAL);
+  free (crons);
+  free (nexts);
+}
+
+END_TEST
+// Expiration handler of tu_timerwheel: checks that timers are due, in chronological order, and counts them.
+typedef struct
+{
+  time_t now, last;
+  size_t nb, batches;
+  tm_timerwheel *wheel;
+  struct tm *reinsert;          // Deadline of the timers with data 1, inserted again
+} tu_timerwheel_ctx;
+
+static void
+tu_timerwheel_expire (tm_timer **timers, size_t n, void *arg)
+{
+  tu_timerwheel_ctx *ctx = arg;
+  ck_assert (n > 0 && n <= 64);
+  ctx->batches++;
+  for (size_t i = 0; i < n; i++)
+  {
+    struct tm copy = timers[i]->deadline;
+    time_t at = timegm (&copy) - tm_getutcoffset (timers[i]->deadline);
+    ck_assert (at <= ctx->now && at >= ctx->last);
+    ctx->last = at;
+    ctx->nb++;
+    if (timers[i]->data == (void *) 1)
+    {
+      ck_assert (tm_addseconds (ctx->reinsert, 30) == TM_OK);
+      ck_assert (tm_timerwheel_insert (ctx->wheel, timers[i], *ctx->reinsert, (void *) 2) == TM_OK);
+    }
+    else
+      timers[i]->data = (void *) 3;     // Expired
+  }
+}
+
+START_TEST (tu_timerwheel)
+{
+  struct tm now, deadline;
+  tu_timerwheel_ctx ctx = { 0 };
+  tm_timer timers[6];
+
+  ck_assert (tm_set (&now, 2021, TM_MARCH, 27, 12, 0, 0, "Europe/Paris") == TM_OK);
+  ck_assert ((ctx.wheel = tm_timerwheel_create (now)));
+  ctx.last = ctx.now = tm_tobinary (now);
+
+  // Wall times: skipped by DST (fired at 03:00), repeated (each occurrence), in other wallclocks
+  ck_assert (tm_set (&deadline, 2021, TM_MARCH, 28, 2, 30, 0, "Europe/Paris") == TM_ERROR);
+  deadline.tm_hour = 2, deadline.tm_min = 30;
+  ck_assert (tm_timerwheel_insert (ctx.wheel, timers + 0, deadline, 0) == TM_OK);
+  ck_assert (tm_set (&deadline, 2021, TM_OCTOBER, 31, 2, 30, 0, "Europe/Paris", TM_DST_OVER_ST) == TM_OK);
+  ck_assert (tm_timerwheel_insert (ctx.wheel, timers + 1, deadline, 0) == TM_OK);
+  ck_assert (tm_set (&deadline, 2021, TM_OCTOBER, 31, 2, 30, 0, "Europe/Paris", TM_ST_OVER_DST) == TM_OK);
+  ck_assert (tm_timerwheel_insert (ctx.wheel, timers + 2, deadline, 0) == TM_OK);
+  ck_assert (tm_set (&deadline, 2021, TM_MARCH, 28, 9, 0, 0, "Asia/Tokyo") == TM_OK);
+  ck_assert (tm_timerwheel_insert (ctx.wheel, timers + 3, deadline, 0) == TM_OK);
+  ck_assert (tm_set (&deadline, 2021, TM_MARCH, 27, 11, 0, 0, TM_REF_UTC) == TM_OK);       // Already due
+  ck_assert (tm_timerwheel_insert (ctx.wheel, timers + 4, deadline, 0) == TM_OK);
+  ck_assert (tm_set (&deadline, 2071, TM_MARCH, 27, 11, 0, 0, TM_REF_UTC) == TM_OK);       // Far away
+  ck_assert (tm_timerwheel_insert (ctx.wheel, timers + 5, deadline, 0) == TM_OK);
+  ck_assert (tm_timerwheel_cancel (ctx.wheel, timers + 3) == TM_OK && tm_timerwheel_cancel (ctx.wheel, timers + 3) == TM_ERROR);
+  ck_assert (tm_timerwheel_reanchor (ctx.wheel, "Europe/Paris") == 0);
+  // Instants resolved with stale UTC offsets (as after an update of the time zone database) are moved back to their wall times:
+  // the skipped 02:30 with the offset before the gap (01:30 UTC instead of 01:00 UTC), the second 02:30 with the offset of the first one.
+  timers[0].at += 1800;
+  ck_assert (tm_timerwheel_reanchor (ctx.wheel, "Europe/Paris") == 1);
+  timers[2].at -= 3600;
+  ck_assert (tm_timerwheel_reanchor (ctx.wheel, "Europe/Paris") == 1 && tm_timerwheel_reanchor (ctx.wheel, "Europe/Paris") == 0);
+
+  ck_assert (tm_timerwheel_advance (ctx.wheel, now, tu_timerwheel_expire, &ctx) == 1 && timers[4].data == (void *) 3);
+  ck_assert (tm_set (&now, 2021, TM_MARCH, 28, 2, 59, 59, "Europe/Paris") == TM_ERROR);
+  ck_assert (tm_set (&now, 2021, TM_MARCH, 28, 1, 59, 59, "Europe/Paris") == TM_OK);
+  ctx.now = tm_tobinary (now);
+  ck_assert (tm_timerwheel_advance (ctx.wheel, now, tu_timerwheel_expire, &ctx) == 0);
+  ck_assert (tm_addseconds (&now, 1) == TM_OK && tm_gethour (now) == 3);
+  ctx.now = tm_tobinary (now);
+  ck_assert (tm_timerwheel_advance (ctx.wheel, now, tu_timerwheel_expire, &ctx) == 1 && timers[0].data == (void *) 3);
+  ck_assert (tm_set (&now, 2021, TM_OCTOBER, 31, 2, 30, 0, "Europe/Paris", TM_DST_OVER_ST) == TM_OK);
+  ctx.now = tm_tobinary (now);
+  ck_assert (tm_timerwheel_advance (ctx.wheel, now, tu_timerwheel_expire, &ctx) == 1 && timers[1].data == (void *) 3 && !timers[2].data);
+  ck_assert (tm_addhours (&now, 1) == TM_OK);
+  ctx.now = tm_tobinary (now);
+  ck_assert (tm_timerwheel_advance (ctx.wheel, now, tu_timerwheel_expire, &ctx) == 1 && timers[2].data == (void *) 3);
+  ck_assert (tm_set (&now, 2071, TM_MARCH, 27, 10, 59, 59, TM_REF_UTC) == TM_OK);
+  ctx.now = tm_tobinary (now);
+  ck_assert (tm_timerwheel_advance (ctx.wheel, now, tu_timerwheel_expire, &ctx) == 0);
+  ck_assert (tm_addseconds (&now, 1) == TM_OK);
+  ctx.now = tm_tobinary (now);
+  ck_assert (tm_timerwheel_advance (ctx.wheel, now, tu_timerwheel_expire, &ctx) == 1 && timers[5].data == (void *) 3);
+  tm_timerwheel_free (ctx.wheel);
+
+  // Random deadlines, some cancelled, some inserted again when expired, checked against their wall times
+  const char *wallclocks[] = { "Europe/Paris", "America/New_York", "Australia/Lord_Howe", "Asia/Tokyo", TM_REF_UTC };
+  size_t nbtimers = 20000;
+  tm_timer *many = malloc (nbtimers * sizeof (*many));
+  ck_assert (many != 0);
+  ck_assert (tm_set (&now, 2021, TM_OCTOBER, 20, 0, 0, 0, TM_REF_UTC) == TM_OK);
+  ck_assert ((ctx.wheel = tm_timerwheel_create (now)));
+  ctx.last = ctx.now = tm_tobinary (now);
+  ctx.nb = ctx.batches = 0;
+  struct tm reinsert = now;
+  ctx.reinsert = &reinsert;
+  srand (41);
+  size_t nbcancelled = 0, nbreinserted = 0;
+  for (size_t i = 0; i < nbtimers; i++)
+  {
+    deadline = now;
+    ck_assert (tm_changetowallclock (&deadline, wallclocks[i % 5]) == TM_OK);
+    ck_assert (tm_addseconds (&deadline, rand () % (i % 7 ? 3600 : 40 * 86400)) == TM_OK);
+    ck_assert (tm_timerwheel_insert (ctx.wheel, many + i, deadline, i % 11 ? (void *) 0 : (void *) 1) == TM_OK);
+    nbreinserted += i % 11 == 0;
+  }
+  for (size_t i = 0; i < nbtimers; i += 13)
+    if (many[i].data == 0 && tm_timerwheel_cancel (ctx.wheel, many + i) == TM_OK)
+      many[i].data = (void *) 4, nbcancelled++;
+  size_t total = 0;
+  for (int step = 0; step < 100000 && ctx.nb < nbtimers - nbcancelled + nbreinserted; step++)
+  {
+    ck_assert (tm_addseconds (&now, rand () % (step < 5000 ? 2 : 3600)) == TM_OK);
+    ctx.now = tm_tobinary (now);
+    if (tm_diffseconds (reinsert, now) > 0)
+      reinsert = now;
+    total += tm_timerwheel_advance (ctx.wheel, now, tu_timerwheel_expire, &ctx);
+  }
+  ck_assert (total == ctx.nb && total == nbtimers - nbcancelled + nbreinserted);
+  ck_assert (ctx.batches < total);
+  for (size_t i = 0; i < nbtimers; i++)
+    ck_assert (many[i].data == (void *) 3 || many[i].data == (void *) 4);
+  tm_timerwheel_free (ctx.wheel);
+  free (many);
+}
+
+END_TEST
+
+// Occurrences of rule from dtstart (at most n), as space separated ISO 8601 strings.
+static size_t
+tu_rrule_list (const char *rule, struct tm dtstart, size_t n, char *str, size_t max)
+{
+  tm_rrule rr;
+  tm_rrule_iter it;
+  struct tm dt;
+  size_t nb = 0, len = 0;
+  *str = 0;
+  if (tm_rrule_compile (&rr, rule) == TM_ERROR || tm_rrule_begin (&it, &rr, dtstart) == TM_ERROR)
+    return 0;
+  for (; nb < n && tm_rrule_next (&it, &dt) == TM_OK; nb++)
+  {
+    if (nb)
+      str[len++] = ' ';
+    len += tm_formatiso8601 (dt, max - len, str + len);
+  }
+  return nb;
+}
+
+START_TEST (tu_rrule)
+{
+  tm_rrule rule;
+  tm_rrule_iter it;
+  struct tm dtstart, dts[64], dt;
+  char str[1024];
+
+  const char *invalid[] = { "", "FREQ=HOURLY", "COUNT=3", "FREQ=DAILY;FREQ=DAILY", "FREQ=DAILY;COUNT=3;UNTIL=20210101",
+    "FREQ=DAILY;INTERVAL=0", "FREQ=MONTHLY;BYMONTH=13", "FREQ=MONTHLY;BYMONTHDAY=0", "FREQ=MONTHLY;BYMONTHDAY=32",
+    "FREQ=WEEKLY;BYMONTHDAY=1", "FREQ=WEEKLY;BYDAY=1MO", "FREQ=DAILY;BYSETPOS=1", "FREQ=MONTHLY;BYDAY=MX", "FREQ=MONTHLY;BYDAY=0MO",
+    "FREQ=YEARLY;UNTIL=20210230", "FREQ=YEARLY;UNTIL=20210101T240000Z", "FREQ=YEARLY;WKST=MO", "FREQ=DAILY;;COUNT=1", "FREQ=DAILY;BYMONTH=1,"
+  };
+  for (size_t i = 0; i < sizeof (invalid) / sizeof (*invalid); i++)
+  {
+    errno = 0;
+    ck_assert (tm_rrule_compile (&rule, invalid[i]) == TM_ERROR && errno == EINVAL);
+  }
+  ck_assert (tm_rrule_compile (&rule, "rrule:freq=monthly;byday=-1su,+2MO,FR;bymonthday=1,-1;bysetpos=1,-1;until=20211231T120000Z") == TM_OK);
+  ck_assert (rule.freq == TM_RRULE_MONTHLY && rule.interval == 1 && rule.count == 0 && rule.until == 2);
+  ck_assert (rule.bydayneg[0] == 2ULL && rule.byday[1] == 4ULL && rule.byday[5] == 1ULL && rule.bymonthday == 2UL && rule.bymonthdayneg == 2UL);
+  ck_assert (rule.nbsetpos == 2 && rule.bysetpos[0] == 1 && rule.bysetpos[1] == -1);
+
+  // Examples of RFC 5545
+  ck_assert (tm_set (&dtstart, 1997, TM_SEPTEMBER, 2, 9, 0, 0, "America/New_York") == TM_OK);
+  ck_assert (tu_rrule_list ("FREQ=DAILY;COUNT=10", dtstart, 64, str, sizeof (str)) == 10);
+  ck_assert (!strcmp (str, "1997-09-02T09:00:00-04:00 1997-09-03T09:00:00-04:00 1997-09-04T09:00:00-04:00 1997-09-05T09:00:00-04:00 "
+                      "1997-09-06T09:00:00-04:00 1997-09-07T09:00:00-04:00 1997-09-08T09:00:00-04:00 1997-09-09T09:00:00-04:00 "
+                      "1997-09-10T09:00:00-04:00 1997-09-11T09:00:00-04:00"));
+  ck_assert (tu_rrule_list ("FREQ=WEEKLY;UNTIL=19971007T000000Z;INTERVAL=2;BYDAY=TU,TH", dtstart, 64, str, sizeof (str)) == 6);
+  ck_assert (!strcmp (str, "1997-09-02T09:00:00-04:00 1997-09-04T09:00:00-04:00 1997-09-16T09:00:00-04:00 1997-09-18T09:00:00-04:00 "
+                      "1997-09-30T09:00:00-04:00 1997-10-02T09:00:00-04:00"));
+  ck_assert (tu_rrule_list ("FREQ=MONTHLY;INTERVAL=2;COUNT=6;BYDAY=1SU,-1SU", dtstart, 64, str, sizeof (str)) == 6);
+  ck_assert (!strcmp (str, "1997-09-07T09:00:00-04:00 1997-09-28T09:00:00-04:00 1997-11-02T09:00:00-05:00 1997-11-30T09:00:00-05:00 "
+                      "1998-01-04T09:00:00-05:00 1998-01-25T09:00:00-05:00"));
+  ck_assert (tu_rrule_list ("FREQ=MONTHLY;BYMONTHDAY=-3;COUNT=4", dtstart, 64, str, sizeof (str)) == 4);
+  ck_assert (!strcmp (str, "1997-09-28T09:00:00-04:00 1997-10-29T09:00:00-05:00 1997-11-28T09:00:00-05:00 1997-12-29T09:00:00-05:00"));
+  ck_assert (tu_rrule_list ("FREQ=YEARLY;BYDAY=20MO;COUNT=3", dtstart, 64, str, sizeof (str)) == 3);
+  ck_assert (!strcmp (str, "1998-05-18T09:00:00-04:00 1999-05-17T09:00:00-04:00 2000-05-15T09:00:00-04:00"));
+  ck_assert (tu_rrule_list ("FREQ=YEARLY;BYMONTH=3;BYDAY=TH;COUNT=5", dtstart, 64, str, sizeof (str)) == 5);
+  ck_assert (!strcmp (str, "1998-03-05T09:00:00-05:00 1998-03-12T09:00:00-05:00 1998-03-19T09:00:00-05:00 1998-03-26T09:00:00-05:00 "
+                      "1999-03-04T09:00:00-05:00"));
+  ck_assert (tu_rrule_list ("FREQ=MONTHLY;BYDAY=FR;BYMONTHDAY=13;COUNT=3", dtstart, 64, str, sizeof (str)) == 3);
+  ck_assert (!strcmp (str, "1998-02-13T09:00:00-05:00 1998-03-13T09:00:00-05:00 1998-11-13T09:00:00-05:00"));
+  ck_assert (tu_rrule_list ("FREQ=MONTHLY;COUNT=3;BYDAY=TU,WE,TH;BYSETPOS=3", dtstart, 64, str, sizeof (str)) == 3);
+  ck_assert (!strcmp (str, "1997-09-04T09:00:00-04:00 1997-10-07T09:00:00-04:00 1997-11-06T09:00:00-05:00"));
+  ck_assert (tu_rrule_list ("FREQ=MONTHLY;BYDAY=MO,TU,WE,TH,FR;BYSETPOS=-2;COUNT=3", dtstart, 64, str, sizeof (str)) == 3);
+  ck_assert (!strcmp (str, "1997-09-29T09:00:00-04:00 1997-10-30T09:00:00-05:00 1997-11-27T09:00:00-05:00"));
+  // Defaults taken from DTSTART
+  ck_assert (tu_rrule_list ("FREQ=YEARLY;COUNT=2", dtstart, 64, str, sizeof (str)) == 2);
+  ck_assert (!strcmp (str, "1997-09-02T09:00:00-04:00 1998-09-02T09:00:00-04:00"));
+  ck_assert (tu_rrule_list ("FREQ=WEEKLY;UNTIL=19970916", dtstart, 64, str, sizeof (str)) == 3);
+  ck_assert (!strcmp (str, "1997-09-02T09:00:00-04:00 1997-09-09T09:00:00-04:00 1997-09-16T09:00:00-04:00"));
+  ck_assert (tm_set (&dtstart, 2021, TM_JANUARY, 31, 9, 0, 0, TM_REF_UTC) == TM_OK);
+  ck_assert (tu_rrule_list ("FREQ=MONTHLY;COUNT=3", dtstart, 64, str, sizeof (str)) == 3);
+  ck_assert (!strcmp (str, "2021-01-31T09:00:00+00:00 2021-03-31T09:00:00+00:00 2021-05-31T09:00:00+00:00"));
+  ck_assert (tu_rrule_list ("FREQ=YEARLY;BYMONTH=2;BYMONTHDAY=29", dtstart, 3, str, sizeof (str)) == 3);
+  ck_assert (!strcmp (str, "2024-02-29T09:00:00+00:00 2028-02-29T09:00:00+00:00 2032-02-29T09:00:00+00:00"));
+  // No occurrence at all
+  ck_assert (tu_rrule_list ("FREQ=YEARLY;BYMONTH=2;BYMONTHDAY=30", dtstart, 3, str, sizeof (str)) == 0);
+
+  // Local time skipped by DST: shifted by the length of the gap. Local time repeated: first occurrence.
+  ck_assert (tm_set (&dtstart, 2021, TM_MARCH, 27, 2, 30, 0, "Europe/Paris") == TM_OK);
+  ck_assert (tu_rrule_list ("FREQ=DAILY;COUNT=3", dtstart, 64, str, sizeof (str)) == 3);
+  ck_assert (!strcmp (str, "2021-03-27T02:30:00+01:00 2021-03-28T03:30:00+02:00 2021-03-29T02:30:00+02:00"));
+  ck_assert (tm_set (&dtstart, 2021, TM_OCTOBER, 30, 2, 30, 0, "Europe/Paris") == TM_OK);
+  ck_assert (tu_rrule_list ("FREQ=DAILY;COUNT=3", dtstart, 64, str, sizeof (str)) == 3);
+  ck_assert (!strcmp (str, "2021-10-30T02:30:00+02:00 2021-10-31T02:30:00+02:00 2021-11-01T02:30:00+01:00"));
+  // UNTIL as a UTC time or a local time
+  ck_assert (tu_rrule_list ("FREQ=DAILY;UNTIL=20211101T012959Z", dtstart, 64, str, sizeof (str)) == 2);
+  ck_assert (tu_rrule_list ("FREQ=DAILY;UNTIL=20211101T013000Z", dtstart, 64, str, sizeof (str)) == 3);
+  ck_assert (tu_rrule_list ("FREQ=DAILY;UNTIL=20211101T022959", dtstart, 64, str, sizeof (str)) == 2);
+  ck_assert (tu_rrule_list ("FREQ=DAILY;UNTIL=20211101T023000", dtstart, 64, str, sizeof (str)) == 3);
+
+  // Batches
+  ck_assert (tm_set (&dtstart, 2021, TM_JANUARY, 1, 8, 0, 0, "Europe/Paris") == TM_OK);
+  ck_assert (tm_rrule_compile (&rule, "FREQ=WEEKLY;BYDAY=MO,WE,FR;COUNT=100") == TM_OK);
+  ck_assert (tm_rrule_begin (&it, &rule, dtstart) == TM_OK);
+  ck_assert (tm_rrule_next_n (&it, dts, 64) == 64 && tm_rrule_next_n (&it, dts, 64) == 36 && tm_rrule_next_n (&it, dts, 64) == 0);
+  ck_assert (tm_rrule_next (&it, &dt) == TM_ERROR);
+  ck_assert (tm_rrule_begin (&it, &rule, dtstart) == TM_OK && tm_rrule_next_n (&it, dts, 64) == 64);
+  ck_assert (tm_rrule_begin (&it, &rule, dtstart) == TM_OK);
+  for (int i = 0; i < 100; i++)
+  {
+    ck_assert (tm_rrule_next (&it, &dt) == TM_OK && dt.tm_hour == 8 && tm_isdefinedinwallclock (dt, "Europe/Paris"));
+    ck_assert (dt.tm_wday == TM_MONDAY || dt.tm_wday == TM_WEDNESDAY || dt.tm_wday == TM_FRIDAY);
+    ck_assert (i >= 64 || tm_equals (dt, dts[i]));
+  }
+}
+END_TEST
+
+START_TEST (tu_busday)
+{
+  struct tm holidays[9], date, end;
+  const int bankholidays[][3] = { {2024, TM_JANUARY, 1}, {2024, TM_MARCH, 29}, {2024, TM_APRIL, 1}, {2024, TM_MAY, 6}, {2024, TM_MAY, 27},
+  {2024, TM_AUGUST, 26}, {2024, TM_DECEMBER, 25}, {2024, TM_DECEMBER, 26}, {2024, TM_JULY, 6} /* Saturday */
+  };
+  for (size_t i = 0; i < sizeof (holidays) / sizeof (*holidays); i++)
+    ck_assert (tm_set (holidays + i, bankholidays[i][0], bankholidays[i][1], bankholidays[i][2], 0, 0, 0, "Europe/London") == TM_OK);
+
+  errno = 0;
+  ck_assert (!tm_busdaycal_create (0, holidays, 9) && errno == EINVAL);
+  errno = 0;
+  ck_assert (!tm_busdaycal_create (TM_BUSDAY_MONDAY_TO_FRIDAY | 1, holidays, 9) && errno == EINVAL);
+
+  tm_busdaycal *cal = tm_busdaycal_create (TM_BUSDAY_MONDAY_TO_FRIDAY, holidays, 9);
+  ck_assert (cal);
+  // T+2 settlement, time of day and wallclock kept
+  ck_assert (tm_set (&date, 2024, TM_DECEMBER, 23, 16, 30, 0, "Europe/London") == TM_OK && tm_busday_add (cal, &date, 2) == TM_OK);
+  ck_assert (tm_getyear (date) == 2024 && tm_getmonth (date) == TM_DECEMBER && tm_getday (date) == 27 && tm_gethour (date) == 16);
+  ck_assert (tm_isdefinedinwallclock (date, "Europe/London"));
+  ck_assert (tm_busday_add (cal, &date, -3) == TM_OK && tm_getmonth (date) == TM_DECEMBER && tm_getday (date) == 20);
+  // Rolled forward first
+  ck_assert (tm_set (&date, 2024, TM_MARCH, 30, 0, 0, 0, "Europe/London") == TM_OK && !tm_isbusday (cal, date));
+  ck_assert (tm_busday_add (cal, &date, 0) == TM_OK && tm_getmonth (date) == TM_APRIL && tm_getday (date) == 2 && tm_isbusday (cal, date));
+  ck_assert (tm_set (&end, 2025, TM_MARCH, 30, 0, 0, 0, "Europe/London") == TM_OK);
+  ck_assert (tm_busday_diff (cal, date, end) == 254 && tm_busday_diff (cal, end, date) == -254);
+
+  // Against a day by day walk, from 2023-01-01 (day 19358) to 2025-12-31
+  long int days[3 * 366], offsets[3 * 366], diffs[3 * 366], begins[3 * 366], ref[3 * 366];
+  int isbusday[3 * 366];
+  size_t nb = 0;
+  ck_assert (tm_set (&date, 2023, TM_JANUARY, 1, 12, 0, 0, TM_REF_UTC) == TM_OK);
+  for (; tm_getyear (date) < 2026; nb++, tm_adddays (&date, 1))
+  {
+    int holiday = 0;
+    for (size_t i = 0; i < sizeof (holidays) / sizeof (*holidays); i++)
+      holiday |= tm_getyear (holidays[i]) == tm_getyear (date) && tm_getdayofyear (holidays[i]) == tm_getdayofyear (date);
+    isbusday[nb] = !holiday && tm_getdayofweek (date) <= TM_FRIDAY;
+    ck_assert (tm_isbusday (cal, date) == isbusday[nb]);
+  }
+  srand (43);
+  for (size_t i = 0; i < nb - 100; i++)
+  {
+    days[i] = begins[i] = 19358 + (long int) i;
+    offsets[i] = rand () % 60 - 20;
+    long int j = (long int) i;
+    while (!isbusday[j])
+      j++;
+    for (long int k = offsets[i]; k > 0; k--)
+      while (!isbusday[++j]);
+    for (long int k = offsets[i]; k < 0; k++)
+      while (j > 0 && !isbusday[--j]);
+    ref[i] = 19358 + j;
+  }
+  ck_assert (tm_busday_add_n (cal, days, offsets, nb - 100) == nb - 100);
+  for (size_t i = 0; i < nb - 100; i++)
+    ck_assert (days[i] == ref[i] || (ref[i] == 19358 && offsets[i] < 0));
+  ck_assert (tm_busday_diff_n (cal, begins, days, nb - 100, diffs) == nb - 100);
+  for (size_t i = 0; i < nb - 100; i++)
+  {
+    long int count = 0;
+    for (long int d = begins[i]; d < days[i]; d++)
+      count += isbusday[d - 19358];
+    for (long int d = days[i]; d < begins[i]; d++)
+      count -= isbusday[d - 19358];
+    ck_assert (days[i] < 19358 || diffs[i] == count);
+  }
+  days[0] = -1000002;          // A Monday, far from the holidays
+  offsets[0] = 5 * 100000;
+  ck_assert (tm_busday_add_n (cal, days, offsets, 1) == 1 && days[0] == -1000002 + 7 * 100000);
+  tm_busdaycal_free (cal);
+
+  // Weekend on Friday and Saturday, no holidays
+  cal = tm_busdaycal_create ((1U << TM_SUNDAY) | (1U << TM_MONDAY) | (1U << TM_TUESDAY) | (1U << TM_WEDNESDAY) | (1U << TM_THURSDAY), 0, 0);
+  ck_assert (cal);
+  ck_assert (tm_set (&date, 2024, TM_MAY, 16, 0, 0, 0, TM_REF_UTC) == TM_OK && tm_busday_add (cal, &date, 1) == TM_OK);
+  ck_assert (tm_getdayofweek (date) == TM_SUNDAY && tm_getday (date) == 19);
+  tm_busdaycal_free (cal);
+}
+END_TEST
+
+// Next opening or closing time of schedule after now, as an ISO 8601 string ("" if none).
+static const char *
+tu_schedule_next (const tm_schedule *schedule, struct tm now, char *str, size_t max)
+{
+  struct tm next;
+  *str = 0;
+  if (tm_schedule_nextchange (schedule, now, &next) == TM_OK)
+    tm_formatiso8601 (next, max, str);
+  return str;
+}
+
+START_TEST (tu_schedule)
+{
+  struct tm now, date;
+  char str[64];
+
+  const char *invalid[] = { "Mo-Fr", "Mo-Fr 9h00-12:00", "Xx 09:00-10:00", "Mo 24:00-10:00", "Mo 09:60-10:00", "Mo 09:00-24:01", "Mo, 09:00-10:00",
+    "Mo-Fr 09:00-12:00 Sa 10:00-12:00", "Mo 09:00-10:00,10:00-11:00,11:00-12:00,12:00-13:00,13:00-14:00,14:00-15:00,15:00-16:00,16:00-17:00,17:00-18:00"
+  };
+  for (size_t i = 0; i < sizeof (invalid) / sizeof (*invalid); i++)
+  {
+    errno = 0;
+    ck_assert (!tm_schedule_create (invalid[i], "Europe/Paris") && errno == EINVAL);
+  }
+
+  tm_schedule *shop = tm_schedule_create ("Mo-Fr 09:00-12:00,14:00-18:00; Sa 10:00-16:00; Su off", "Europe/Paris");
+  ck_assert (shop);
+  ck_assert (tm_set (&now, 2024, TM_MAY, 15, 10, 0, 0, "Europe/Paris") == TM_OK && tm_schedule_isopen (shop, now));
+  ck_assert (!strcmp (tu_schedule_next (shop, now, str, sizeof (str)), "2024-05-15T12:00:00+02:00"));
+  // Whatever the wallclock of now
+  ck_assert (tm_set (&now, 2024, TM_MAY, 15, 6, 59, 59, TM_REF_UTC) == TM_OK && !tm_schedule_isopen (shop, now));
+  ck_assert (!strcmp (tu_schedule_next (shop, now, str, sizeof (str)), "2024-05-15T09:00:00+02:00"));
+  ck_assert (tm_set (&now, 2024, TM_MAY, 15, 7, 0, 0, TM_REF_UTC) == TM_OK && tm_schedule_isopen (shop, now));
+  ck_assert (tm_set (&now, 2024, TM_MAY, 18, 16, 0, 0, "Europe/Paris") == TM_OK && !tm_schedule_isopen (shop, now));
+  ck_assert (!strcmp (tu_schedule_next (shop, now, str, sizeof (str)), "2024-05-20T09:00:00+02:00"));
+  // Exceptions
+  ck_assert (tm_set (&date, 2024, TM_MAY, 1, 0, 0, 0, "Europe/Paris") == TM_OK && tm_schedule_addexception (shop, date, "off") == TM_OK);
+  ck_assert (tm_set (&date, 2024, TM_MAY, 12, 0, 0, 0, "Europe/Paris") == TM_OK && tm_schedule_addexception (shop, date, "10:00-11:00") == TM_OK);
+  ck_assert (tm_set (&date, 2024, TM_MAY, 8, 0, 0, 0, "Europe/Paris") == TM_OK && tm_schedule_addexception (shop, date, "10:00-11:00") == TM_OK);
+  ck_assert (tm_schedule_addexception (shop, date, "off") == TM_OK);    // Replaced
+  ck_assert (tm_schedule_addexception (shop, date, "22:00-02:00") == TM_ERROR && errno == EINVAL);
+  ck_assert (tm_set (&now, 2024, TM_MAY, 1, 10, 0, 0, "Europe/Paris") == TM_OK && !tm_schedule_isopen (shop, now));
+  ck_assert (!strcmp (tu_schedule_next (shop, now, str, sizeof (str)), "2024-05-02T09:00:00+02:00"));
+  ck_assert (tm_set (&now, 2024, TM_MAY, 7, 18, 0, 0, "Europe/Paris") == TM_OK);
+  ck_assert (!strcmp (tu_schedule_next (shop, now, str, sizeof (str)), "2024-05-09T09:00:00+02:00"));
+  ck_assert (tm_set (&now, 2024, TM_MAY, 11, 16, 0, 0, "Europe/Paris") == TM_OK);
+  ck_assert (!strcmp (tu_schedule_next (shop, now, str, sizeof (str)), "2024-05-12T10:00:00+02:00"));
+  tm_schedule_free (shop);
+
+  // Overnight, across the end of the week
+  tm_schedule *bar = tm_schedule_create ("Fr-Sa 22:00-02:00; Su 23:00-01:00", TM_REF_UTC);
+  ck_assert (bar);
+  ck_assert (tm_set (&now, 2024, TM_MAY, 18, 1, 0, 0, TM_REF_UTC) == TM_OK && tm_schedule_isopen (bar, now));
+  ck_assert (tm_set (&now, 2024, TM_MAY, 19, 1, 59, 59, TM_REF_UTC) == TM_OK && tm_schedule_isopen (bar, now));
+  ck_assert (!strcmp (tu_schedule_next (bar, now, str, sizeof (str)), "2024-05-19T02:00:00+00:00"));
+  ck_assert (tm_set (&now, 2024, TM_MAY, 19, 3, 0, 0, TM_REF_UTC) == TM_OK && !tm_schedule_isopen (bar, now));
+  ck_assert (!strcmp (tu_schedule_next (bar, now, str, sizeof (str)), "2024-05-19T23:00:00+00:00"));
+  ck_assert (tm_set (&now, 2024, TM_MAY, 20, 0, 30, 0, TM_REF_UTC) == TM_OK && tm_schedule_isopen (bar, now));
+  ck_assert (!strcmp (tu_schedule_next (bar, now, str, sizeof (str)), "2024-05-20T01:00:00+00:00"));
+  ck_assert (!strcmp (tu_schedule_next (bar, date, str, sizeof (str)), "2024-05-10T22:00:00+00:00"));
+  tm_schedule_free (bar);
+  // As many hours overnight as possible every day, those of Sunday wrapping around to Monday
+  bar = tm_schedule_create ("Mo-Su 23:00-01:00,23:01-01:00,23:02-01:00,23:03-01:00,23:04-01:00,23:05-01:00,23:06-01:00,23:07-01:00", TM_REF_UTC);
+  ck_assert (bar);
+  ck_assert (tm_set (&now, 2024, TM_MAY, 20, 0, 30, 0, TM_REF_UTC) == TM_OK && tm_schedule_isopen (bar, now));
+  ck_assert (!strcmp (tu_schedule_next (bar, now, str, sizeof (str)), "2024-05-20T01:00:00+00:00"));
+  ck_assert (tm_set (&now, 2024, TM_MAY, 19, 12, 0, 0, TM_REF_UTC) == TM_OK && !tm_schedule_isopen (bar, now));
+  ck_assert (!strcmp (tu_schedule_next (bar, now, str, sizeof (str)), "2024-05-19T23:00:00+00:00"));
+  tm_schedule_free (bar);
+
+  // Opening hours skipped or repeated by DST
+  tm_schedule *night = tm_schedule_create ("02:15-02:45", "Europe/Paris");
+  ck_assert (tm_set (&now, 2024, TM_MARCH, 31, 0, 30, 0, TM_REF_UTC) == TM_OK);
+  ck_assert (!strcmp (tu_schedule_next (night, now, str, sizeof (str)), "2024-04-01T02:15:00+02:00"));
+  ck_assert (tm_set (&now, 2024, TM_OCTOBER, 27, 0, 0, 0, TM_REF_UTC) == TM_OK);
+  ck_assert (!strcmp (tu_schedule_next (night, now, str, sizeof (str)), "2024-10-27T02:15:00+02:00"));
+  ck_assert (tm_set (&now, 2024, TM_OCTOBER, 27, 0, 15, 0, TM_REF_UTC) == TM_OK && tm_schedule_isopen (night, now));
+  ck_assert (!strcmp (tu_schedule_next (night, now, str, sizeof (str)), "2024-10-27T02:45:00+02:00"));
+  ck_assert (tm_set (&now, 2024, TM_OCTOBER, 27, 0, 45, 0, TM_REF_UTC) == TM_OK && !tm_schedule_isopen (night, now));
+  ck_assert (!strcmp (tu_schedule_next (night, now, str, sizeof (str)), "2024-10-27T02:15:00+01:00"));
+  tm_schedule_free (night);
+  tm_schedule *early = tm_schedule_create ("02:00-04:00", "Europe/Paris");
+  ck_assert (tm_set (&now, 2024, TM_MARCH, 31, 0, 30, 0, TM_REF_UTC) == TM_OK && !tm_schedule_isopen (early, now));
+  ck_assert (!strcmp (tu_schedule_next (early, now, str, sizeof (str)), "2024-03-31T03:00:00+02:00"));
+  tm_schedule_free (early);
+
+  // Never closing, never opening but on exceptions
+  tm_schedule *always = tm_schedule_create ("00:00-24:00", "Europe/Paris"), *never = tm_schedule_create ("", "Europe/Paris");
+  ck_assert (always && never && tm_schedule_isopen (always, now) && !tm_schedule_isopen (never, now));
+  ck_assert (tm_schedule_nextchange (always, now, &date) == TM_ERROR && tm_schedule_nextchange (never, now, &date) == TM_ERROR);
+  ck_assert (tm_set (&date, 2030, TM_JANUARY, 1, 0, 0, 0, "Europe/Paris") == TM_OK && tm_schedule_addexception (never, date, "10:00-11:00") == TM_OK);
+  ck_assert (!strcmp (tu_schedule_next (never, now, str, sizeof (str)), "2030-01-01T10:00:00+01:00"));
+  tm_schedule_free (always);
+  tm_schedule_free (never);
+
+  // Batches over several wallclocks, against queries one by one
+  const char *wallclocks[] = { "Europe/Paris", "America/New_York", TM_REF_UTC, "Australia/Lord_Howe" };
+  const char *hours[] = { "Mo-Fr 09:00-18:00", "Mo-Sa 08:30-12:00,13:30-19:30; Su 10:00-13:00", "Th-Tu 18:00-03:00", "07:00-23:00; Su off" };
+  tm_schedule *schedules[64];
+  int open[64];
+  struct tm next[64];
+  for (size_t i = 0; i < 64; i++)
+    ck_assert ((schedules[i] = tm_schedule_create (hours[i % 4], wallclocks[i / 4 % 4])));
+  ck_assert (tm_set (&now, 2024, TM_APRIL, 7, 1, 0, 0, TM_REF_UTC) == TM_OK);
+  for (int step = 0; step < 200; step++, tm_addseconds (&now, 3607 * 11))
+  {
+    ck_assert (tm_schedule_isopen_n ((const tm_schedule * const *) schedules, 64, now, open) == 64);
+    ck_assert (tm_schedule_nextchange_n ((const tm_schedule * const *) schedules, 64, now, next) == 64);
+    for (size_t i = 0; i < 64; i++)
+    {
+      ck_assert (open[i] == tm_schedule_isopen (schedules[i], now));
+      ck_assert (tm_schedule_nextchange (schedules[i], now, &date) == TM_OK && tm_equals (date, next[i]));
+      ck_assert (tm_compare (&date, &now) > 0 && tm_isdefinedinwallclock (date, wallclocks[i / 4 % 4]));
+      ck_assert (tm_schedule_isopen (schedules[i], date) != open[i]);
+      ck_assert (tm_addseconds (&date, -1) == TM_OK && (tm_compare (&date, &now) <= 0 || tm_schedule_isopen (schedules[i], date) == open[i]));
+    }
+  }
+  for (size_t i = 0; i < 64; i++)
+    tm_schedule_free (schedules[i]);
+}
+END_TEST
+
+// date rounded (direction < 0: floor, 0: round, > 0: ceiling) to unit, as an ISO 8601 string.
+static const char *
+tu_unit (struct tm date, tm_unit unit, int direction, char *str, size_t max)
+{
+  *str = 0;
+  if ((direction < 0 ? tm_floor (&date, unit) : direction > 0 ? tm_ceil (&date, unit) : tm_round (&date, unit)) == TM_OK)
+    tm_formatiso8601 (date, max, str);
+  return str;
+}
+
+START_TEST (tu_rounding)
+{
+  struct tm date;
+  char str[64];
+
+  ck_assert (tm_set (&date, 2024, TM_MAY, 15, 10, 34, 56, TM_REF_UTC) == TM_OK);
+  const char *expected[][3] = {
+    {"2024-05-15T10:34:56+00:00", "2024-05-15T10:34:56+00:00", "2024-05-15T10:34:56+00:00"},
+    {"2024-05-15T10:34:00+00:00", "2024-05-15T10:35:00+00:00", "2024-05-15T10:35:00+00:00"},
+    {"2024-05-15T10:00:00+00:00", "2024-05-15T11:00:00+00:00", "2024-05-15T11:00:00+00:00"},
+    {"2024-05-15T00:00:00+00:00", "2024-05-16T00:00:00+00:00", "2024-05-15T00:00:00+00:00"},
+    {"2024-05-13T00:00:00+00:00", "2024-05-20T00:00:00+00:00", "2024-05-13T00:00:00+00:00"},
+    {"2024-05-01T00:00:00+00:00", "2024-06-01T00:00:00+00:00", "2024-05-01T00:00:00+00:00"},
+    {"2024-04-01T00:00:00+00:00", "2024-07-01T00:00:00+00:00", "2024-04-01T00:00:00+00:00"},
+    {"2024-01-01T00:00:00+00:00", "2025-01-01T00:00:00+00:00", "2024-01-01T00:00:00+00:00"},
+  };
+  for (tm_unit unit = TM_UNIT_SECOND; unit <= TM_UNIT_YEAR; unit++)
+  {
+    ck_assert (!strcmp (tu_unit (date, unit, -1, str, sizeof (str)), expected[unit][0]));
+    ck_assert (!strcmp (tu_unit (date, unit, 1, str, sizeof (str)), expected[unit][1]));
+    ck_assert (!strcmp (tu_unit (date, unit, 0, str, sizeof (str)), expected[unit][2]));
+  }
+  ck_assert (tm_floor (&date, 8) == TM_ERROR && errno == EINVAL);
+  ck_assert (tm_set (&date, 2024, TM_DECEMBER, 31, 12, 0, 0, TM_REF_UTC) == TM_OK);
+  ck_assert (!strcmp (tu_unit (date, TM_UNIT_DAY, 0, str, sizeof (str)), "2025-01-01T00:00:00+00:00"));       // Halfway
+  ck_assert (!strcmp (tu_unit (date, TM_UNIT_WEEK, -1, str, sizeof (str)), "2024-12-30T00:00:00+00:00"));
+  ck_assert (!strcmp (tu_unit (date, TM_UNIT_QUARTER, 1, str, sizeof (str)), "2025-01-01T00:00:00+00:00"));
+
+  // DST gap (02:00 to 03:00) and overlap (02:00 to 03:00 twice)
+  ck_assert (tm_set (&date, 2024, TM_MARCH, 31, 3, 30, 0, "Europe/Paris") == TM_OK);
+  ck_assert (!strcmp (tu_unit (date, TM_UNIT_DAY, -1, str, sizeof (str)), "2024-03-31T00:00:00+01:00"));
+  ck_assert (!strcmp (tu_unit (date, TM_UNIT_HOUR, -1, str, sizeof (str)), "2024-03-31T03:00:00+02:00"));
+  ck_assert (!strcmp (tu_unit (date, TM_UNIT_DAY, 1, str, sizeof (str)), "2024-04-01T00:00:00+02:00"));
+  ck_assert (tm_set (&date, 2024, TM_MARCH, 31, 1, 40, 0, "Europe/Paris") == TM_OK);
+  ck_assert (!strcmp (tu_unit (date, TM_UNIT_HOUR, 1, str, sizeof (str)), "2024-03-31T03:00:00+02:00"));
+  ck_assert (!strcmp (tu_unit (date, TM_UNIT_HOUR, 0, str, sizeof (str)), "2024-03-31T03:00:00+02:00"));
+  ck_assert (tm_set (&date, 2024, TM_OCTOBER, 27, 0, 30, 0, TM_REF_UTC) == TM_OK && tm_changetowallclock (&date, "Europe/Paris") == TM_OK);
+  ck_assert (!strcmp (tu_unit (date, TM_UNIT_HOUR, -1, str, sizeof (str)), "2024-10-27T02:00:00+02:00"));
+  ck_assert (!strcmp (tu_unit (date, TM_UNIT_HOUR, 1, str, sizeof (str)), "2024-10-27T02:00:00+01:00"));
+  ck_assert (!strcmp (tu_unit (date, TM_UNIT_DAY, 1, str, sizeof (str)), "2024-10-28T00:00:00+01:00"));
+  ck_assert (tm_addseconds (&date, 3600) == TM_OK);
+  ck_assert (!strcmp (tu_unit (date, TM_UNIT_HOUR, -1, str, sizeof (str)), "2024-10-27T02:00:00+01:00"));
+  ck_assert (!strcmp (tu_unit (date, TM_UNIT_MINUTE, 1, str, sizeof (str)), "2024-10-27T02:30:00+01:00"));
+  ck_assert (!strcmp (tu_unit (date, TM_UNIT_DAY, -1, str, sizeof (str)), "2024-10-27T00:00:00+02:00"));
+
+  // Properties, one by one and by batches, around DST changes of 1 hour and of 30 minutes
+  const char *wallclocks[] = { "Europe/Paris", "Australia/Lord_Howe", TM_REF_UTC };
+  tm_instant instants[3][256], expect[3][256];
+  srand (45);
+  for (size_t w = 0; w < 3; w++)
+    for (tm_unit unit = TM_UNIT_SECOND; unit <= TM_UNIT_YEAR; unit++)
+    {
+      ck_assert (tm_set (&date, 2023, TM_JANUARY, 1, 0, 0, 0, wallclocks[w]) == TM_OK);
+      for (int i = 0; i < 256; i++)
+      {
+        ck_assert (tm_addseconds (&date, rand () % 2 ? rand () % 7200 : rand () % (6 * 86400)) == TM_OK);
+        instants[0][i] = instants[1][i] = instants[2][i] = tm_toinstant (date);
+        struct tm floor = date, ceiling = date, round = date, again;
+        ck_assert (tm_floor (&floor, unit) == TM_OK && tm_ceil (&ceiling, unit) == TM_OK && tm_round (&round, unit) == TM_OK);
+        ck_assert (tm_compare (&floor, &date) <= 0 && tm_compare (&date, &ceiling) <= 0);
+        ck_assert (tm_equals (round, floor) || tm_equals (round, ceiling));
+        ck_assert (tm_isdefinedinwallclock (floor, wallclocks[w]) && tm_isdefinedinwallclock (ceiling, wallclocks[w]));
+        ck_assert ((tm_compare (&floor, &date) == 0) == (tm_compare (&ceiling, &date) == 0));
+        again = floor;
+        ck_assert (tm_floor (&again, unit) == TM_OK && tm_equals (again, floor));
+        again = ceiling;
+        ck_assert (tm_floor (&again, unit) == TM_OK && tm_equals (again, ceiling));
+        // No beginning of unit in between
+        again = floor;
+        ck_assert (unit == TM_UNIT_SECOND || (tm_addseconds (&again, -1) == TM_OK && tm_ceil (&again, unit) == TM_OK && tm_equals (again, floor)));
+        again = ceiling;
+        ck_assert (unit == TM_UNIT_SECOND || (tm_addseconds (&again, 1) == TM_OK && tm_floor (&again, unit) == TM_OK && tm_equals (again, ceiling)));
+        expect[0][i] = tm_toinstant (floor);
+        expect[1][i] = tm_toinstant (round);
+        expect[2][i] = tm_toinstant (ceiling);
+      }
+      ck_assert (tm_floor_n (instants[0], 256, unit, wallclocks[w]) == 256);
+      ck_assert (tm_round_n (instants[1], 256, unit, wallclocks[w]) == 256);
+      ck_assert (tm_ceil_n (instants[2], 256, unit, wallclocks[w]) == 256);
+      for (int d = 0; d < 3; d++)
+        for (int i = 0; i < 256; i++)
+          ck_assert (instants[d][i].utc == expect[d][i].utc && instants[d][i].utcoffset == expect[d][i].utcoffset);
+    }
+}
+END_TEST
+
+
+
+
+START_TEST (tu_day_boundaries)
+{
+  struct tm date;
+
+  // Midnight skipped by DST: the beginning of the day is undefined
+  ck_assert (tm_getsecondsinday (2018, TM_NOVEMBER, 4, "America/Sao_Paulo") == 0 && errno == EINVAL);
+  ck_assert (tm_set (&date, 2018, TM_NOVEMBER, 4, 1, 30, 0, "America/Sao_Paulo") == TM_OK);
+  errno = 0;
+  ck_assert (tm_getsecondsofday (date) == 0 && errno == EINVAL);
+  ck_assert (tm_getsecondsinday (2018, TM_NOVEMBER, 3, "America/Sao_Paulo") == 24 * 3600);
+  // Midnight repeated by DST: the day begins at its occurrence in standard time (as TM_ST_OVER_DST resolves it)
+  ck_assert (tm_getsecondsinday (2019, TM_NOVEMBER, 3, "America/Havana") == 24 * 3600);
+  ck_assert (tm_set (&date, 2019, TM_NOVEMBER, 3, 4, 30, 0, TM_REF_UTC) == TM_OK);
+  ck_assert (tm_changetowallclock (&date, "America/Havana") == TM_OK && tm_gethour (date) == 0);
+  ck_assert (tm_getsecondsofday (date) == -1800);
+  ck_assert (tm_addseconds (&date, 3600) == TM_OK && tm_gethour (date) == 0);
+  ck_assert (tm_getsecondsofday (date) == 1800);
+  // Half an hour shift
+  ck_assert (tm_getsecondsinday (2024, TM_APRIL, 7, "Australia/Lord_Howe") == 24 * 3600 + 1800);
+  ck_assert (tm_getsecondsinday (2024, TM_OCTOBER, 6, "Australia/Lord_Howe") == 23 * 3600 + 1800);
+  // Out of the range of the transition tables
+  ck_assert (tm_getsecondsinday (1850, TM_JULY, 1, "Europe/Paris") == 24 * 3600);
+  ck_assert (tm_getsecondsinday (2200, TM_JULY, 1, "Europe/Paris") == 24 * 3600);
+  ck_assert (tm_getsecondsinday (2018, TM_FEBRUARY, 29, "Europe/Paris") == 0 && errno == EINVAL);
+
+  const char *wallclocks[] = { "Europe/Paris", "Australia/Lord_Howe" };      // DST changes apart from midnight
+  for (size_t w = 0; w < sizeof (wallclocks) / sizeof (*wallclocks); w++)
+  {
+    long int seconds = 0;
+    for (tm_month month = TM_JANUARY; month <= TM_DECEMBER; month++)
+      for (int day = 1; day <= tm_getdaysinmonth (2019, month); day++)
+        seconds += tm_getsecondsinday (2019, month, day, wallclocks[w]);
+    ck_assert (seconds == 365 * 86400L);
+
+    ck_assert (tm_set (&date, 2019, TM_JANUARY, 1, 0, 0, 0, wallclocks[w]) == TM_OK);
+    for (int hour = 0; hour < 365 * 24; hour++, tm_addseconds (&date, 3600 + 60))
+    {
+      int sod = tm_getsecondsofday (date);
+      ck_assert (sod >= 0 && sod < tm_getsecondsinday (tm_getyear (date), tm_getmonth (date), tm_getday (date), wallclocks[w]));
+      ck_assert (sod % 3600 == (tm_getminute (date) * 60 + tm_getsecond (date)) % 3600 ||
+                 sod % 3600 == (tm_getminute (date) * 60 + tm_getsecond (date) + 1800) % 3600);
+    }
+  }
+}
+END_TEST
+
+
+static int
+tu_zonecursor_same (struct tm a, struct tm b)
+{
+  return a.tm_year == b.tm_year && a.tm_mon == b.tm_mon && a.tm_mday == b.tm_mday && a.tm_hour == b.tm_hour && a.tm_min == b.tm_min &&
+    a.tm_sec == b.tm_sec && a.tm_wday == b.tm_wday && a.tm_yday == b.tm_yday && a.tm_isdst == b.tm_isdst && a.tm_gmtoff == b.tm_gmtoff &&
+    a.tm_zone == b.tm_zone;
+}
+
+START_TEST (tu_zonecursor)
+{
+  const char *wallclocks[] = { "Europe/Paris", "Australia/Lord_Howe", TM_REF_UTC };
+  for (size_t w = 0; w < sizeof (wallclocks) / sizeof (*wallclocks); w++)
+  {
+    tm_zonecursor cursor;
+    ck_assert (tm_zonecursor_init (&cursor, wallclocks[w]) == TM_OK);
+
+    // Sorted stream over two years, converted by chunks
+    time_t utc[1000];
+    struct tm dates[1000], expected;
+    tm_instant instants[1000];
+    time_t t = 1546300800 - 7200;       // 2018-12-31T22:00:00Z
+    for (int chunk = 0; chunk < 20; chunk++)
+    {
+      for (int i = 0; i < 1000; i++)
+      {
+        utc[i] = t += (i * 7919) % 5003;
+        instants[i].utc = utc[i];
+      }
+      ck_assert (tm_zonecursor_convert_n (&cursor, utc, dates, 1000) == 1000);
+      ck_assert (tm_zonecursor_instants (&cursor, instants, 1000) == 1000);
+      for (int i = 0; i < 1000; i++)
+      {
+        ck_assert (tm_frombinary (&expected, utc[i], wallclocks[w]) == TM_OK);
+        ck_assert (tu_zonecursor_same (dates[i], expected));
+        ck_assert (instants[i].utcoffset == expected.tm_gmtoff);
+      }
+    }
+
+    // Backwards and out of the range of the transition tables
+    const time_t others[] = { 1546300800, -4102444800 /* 1840 */ , 7258118400 /* 2200 */ , 1561939200, 1561939199 };
+    for (size_t i = 0; i < sizeof (others) / sizeof (*others); i++)
+    {
+      ck_assert (tm_zonecursor_convert (&cursor, others[i], dates) == TM_OK);
+      ck_assert (tm_frombinary (&expected, others[i], wallclocks[w]) == TM_OK);
+      ck_assert (tu_zonecursor_same (dates[0], expected));
+    }
+  }
+
+  tm_zonecursor cursor;
+  char str[64];
+  struct tm date;
+  ck_assert (tm_zonecursor_init (&cursor, "Europe/Paris") == TM_OK);
+  ck_assert (tm_zonecursor_convert (&cursor, 1711846799, &date) == TM_OK);     // Just before DST gets into effect
+  ck_assert (tm_formatiso8601 (date, sizeof (str), str) && !strcmp (str, "2024-03-31T01:59:59+01:00"));
+  ck_assert (tm_zonecursor_convert (&cursor, 1711846800, &date) == TM_OK);
+  ck_assert (tm_formatiso8601 (date, sizeof (str), str) && !strcmp (str, "2024-03-31T03:00:00+02:00"));
+  ck_assert (tm_zonecursor_init (&cursor, "") == TM_ERROR && errno == EINVAL);
+}
+END_TEST
+
+
+static const char *
+tu_iter_list (tm_iter *iter, char *str, size_t max)
+{
+  struct tm dates[8];
+  size_t nb = tm_iter_next_n (iter, dates, 8), len = 0;
+  *str = 0;
+  for (size_t i = 0; i < nb && len + 1 < max; i++)
+    len += tm_formatiso8601 (dates[i], max - len - 1, str + len), str[len++] = ' ', str[len] = 0;
+  return str;
+}
+
+START_TEST (tu_iter)
+{
+  struct tm start, stop, date, expected;
+  tm_iter iter;
+  char str[512];
+
+  // Elapsed hours over a day shortened by DST
+  ck_assert (tm_set (&start, 2016, TM_MARCH, 27, 0, 0, 0, "Europe/Paris") == TM_OK);
+  stop = start;
+  ck_assert (tm_adddays (&stop, 1) == TM_OK);
+  ck_assert (tm_iter_begin (&iter, start, stop, TM_UNIT_HOUR) == TM_OK);
+  expected = start;
+  int nb = 0;
+  for (; tm_iter_next (&iter, &date) == TM_OK; nb++, tm_addhours (&expected, 1))
+    ck_assert (tm_equals (date, expected) && tm_gethour (date) == tm_gethour (expected) && tm_getutcoffset (date) == tm_getutcoffset (expected));
+  ck_assert (nb == 23 && tm_compare (&expected, &stop) == 0);
+  ck_assert (tm_iter_next (&iter, &date) == TM_ERROR);
+
+  // Local days keep the time of day: skipped by DST (taken before the gap), repeated by DST (first occurrence)
+  ck_assert (tm_set (&start, 2024, TM_MARCH, 30, 2, 30, 0, "Europe/Paris") == TM_OK);
+  ck_assert (tm_set (&stop, 2024, TM_APRIL, 2, 0, 0, 0, "Europe/Paris") == TM_OK);
+  ck_assert (tm_iter_begin (&iter, start, stop, TM_UNIT_DAY) == TM_OK);
+  ck_assert (!strcmp (tu_iter_list (&iter, str, sizeof (str)),
+                      "2024-03-30T02:30:00+01:00 2024-03-31T03:30:00+02:00 2024-04-01T02:30:00+02:00 "));
+  ck_assert (tm_set (&start, 2024, TM_OCTOBER, 26, 2, 30, 0, "Europe/Paris") == TM_OK);
+  ck_assert (tm_set (&stop, 2024, TM_OCTOBER, 29, 0, 0, 0, "Europe/Paris") == TM_OK);
+  ck_assert (tm_iter_begin (&iter, start, stop, TM_UNIT_DAY) == TM_OK);
+  ck_assert (!strcmp (tu_iter_list (&iter, str, sizeof (str)),
+                      "2024-10-26T02:30:00+02:00 2024-10-27T02:30:00+02:00 2024-10-28T02:30:00+01:00 "));
+
+  // Months keep the day of month, or the last day of shorter months
+  ck_assert (tm_set (&start, 2024, TM_JANUARY, 31, 12, 0, 0, "Europe/Paris") == TM_OK);
+  ck_assert (tm_set (&stop, 2024, TM_MAY, 31, 12, 0, 0, "Europe/Paris") == TM_OK);
+  ck_assert (tm_iter_begin (&iter, start, stop, TM_UNIT_MONTH) == TM_OK);
+  ck_assert (!strcmp (tu_iter_list (&iter, str, sizeof (str)),
+                      "2024-01-31T12:00:00+01:00 2024-02-29T12:00:00+01:00 2024-03-31T12:00:00+02:00 2024-04-30T12:00:00+02:00 "));
+  ck_assert (tm_iter_begin (&iter, start, stop, TM_UNIT_WEEK, 6) == TM_OK);
+  ck_assert (!strcmp (tu_iter_list (&iter, str, sizeof (str)),
+                      "2024-01-31T12:00:00+01:00 2024-03-13T12:00:00+01:00 2024-04-24T12:00:00+02:00 "));
+  ck_assert (tm_iter_begin (&iter, start, stop, TM_UNIT_DAY, 0) == TM_ERROR && errno == EINVAL);
+
+  const char *wallclocks[] = { "Europe/Paris", "Australia/Lord_Howe", TM_REF_UTC };
+  for (size_t w = 0; w < sizeof (wallclocks) / sizeof (*wallclocks); w++)
+  {
+    // Elapsed minutes, as tm_addminutes
+    ck_assert (tm_set (&start, 2019, TM_JANUARY, 1, 0, 0, 0, wallclocks[w]) == TM_OK);
+    ck_assert (tm_set (&stop, 2020, TM_JANUARY, 1, 0, 0, 0, wallclocks[w]) == TM_OK);
+    ck_assert (tm_iter_begin (&iter, start, stop, TM_UNIT_MINUTE, 397) == TM_OK);
+    expected = start;
+    for (; tm_iter_next (&iter, &date) == TM_OK; tm_addminutes (&expected, 397))
+      ck_assert (tm_toinstant (date).utc == tm_toinstant (expected).utc && tm_getutcoffset (date) == tm_getutcoffset (expected) &&
+                 tm_getday (date) == tm_getday (expected) && tm_gethour (date) == tm_gethour (expected) && tm_getminute (date) == tm_getminute (expected));
+    ck_assert (tm_compare (&expected, &stop) >= 0);
+
+    // Local days at 02:15 (02:45 on the day Lord Howe Island skips 02:00 to 02:30), as tm_adddays
+    ck_assert (tm_set (&start, 2019, TM_JANUARY, 1, 2, 15, 0, wallclocks[w]) == TM_OK);
+    ck_assert (tm_iter_begin (&iter, start, stop, TM_UNIT_DAY) == TM_OK);
+    for (nb = 0; tm_iter_next (&iter, &date) == TM_OK; nb++)
+    {
+      expected = start;
+      ck_assert (tm_adddays (&expected, nb) == TM_OK);
+      ck_assert (tm_getday (date) == tm_getday (expected) && tm_getmonth (date) == tm_getmonth (expected) &&
+                 tm_gethour (date) == tm_gethour (expected) && tm_getminute (date) == tm_getminute (expected));
+    }
+    ck_assert (nb == 365);
+  }
+}
+END_TEST
+
+
+typedef struct
+{
+  size_t nb;
+  tm_bucket buckets[64];
+} tu_buckets;
+
+static void
+tu_aggregator_emit (const tm_bucket *bucket, void *arg)
+{
+  tu_buckets *res = arg;
+  if (res->nb < sizeof (res->buckets) / sizeof (*res->buckets))
+    res->buckets[res->nb++] = *bucket;
+}
+
+START_TEST (tu_aggregator)
+{
+  tm_aggregator agg;
+  tu_buckets res = { 0 };
+  time_t utc[2000];
+  double values[2000];
+  char str[64];
+
+  // A point every 15 minutes from 2024-03-30 to 2024-04-02 in Paris: the day skipped by DST has 23 hours
+  for (int i = 0; i < 288; i++)
+    utc[i] = 1711753200 + i * 900, values[i] = i % 96;
+  ck_assert (tm_aggregator_init (&agg, "Europe/Paris", TM_UNIT_DAY, tu_aggregator_emit, &res) == TM_OK);
+  ck_assert (tm_aggregator_add (&agg, utc, values, 100) == 100 && tm_aggregator_add (&agg, utc + 100, values + 100, 188) == 188);
+  ck_assert (res.nb == 3);
+  tm_aggregator_flush (&agg);
+  ck_assert (res.nb == 4);
+  ck_assert (res.buckets[0].count == 96 && res.buckets[1].count == 92 && res.buckets[2].count == 96 && res.buckets[3].count == 4);
+  ck_assert (res.buckets[1].end - res.buckets[1].begin.utc == 23 * 3600 && res.buckets[1].begin.utcoffset == 3600);
+  ck_assert (res.buckets[0].sum == 95 * 48 && res.buckets[0].min == 0 && res.buckets[0].max == 95);
+  ck_assert (tm_formatiso8601_n (&res.buckets[2].begin, 1, str, sizeof (str), 'T') && !strncmp (str, "2024-04-01T00:00:00+02:00", 25));
+
+  // Hours repeated by DST are two buckets
+  res.nb = 0;
+  for (int i = 0; i < 16; i++)
+    utc[i] = 1729987200 + i * 900, values[i] = 1;    // 2024-10-27T02:00:00+02:00
+  ck_assert (tm_aggregator_init (&agg, "Europe/Paris", TM_UNIT_HOUR, tu_aggregator_emit, &res) == TM_OK);
+  ck_assert (tm_aggregator_add (&agg, utc, values, 16) == 16);
+  tm_aggregator_flush (&agg);
+  ck_assert (res.nb == 4 && res.buckets[0].count == 4 && res.buckets[0].begin.utcoffset == 7200 && res.buckets[1].begin.utcoffset == 3600);
+  ck_assert (res.buckets[0].end == res.buckets[1].begin.utc && res.buckets[1].end - res.buckets[1].begin.utc == 3600);
+
+  // Same buckets as tm_floor, for any chunking
+  const char *wallclocks[] = { "Europe/Paris", "Australia/Lord_Howe", TM_REF_UTC };
+  for (size_t w = 0; w < sizeof (wallclocks) / sizeof (*wallclocks); w++)
+    for (tm_unit unit = TM_UNIT_HOUR; unit <= TM_UNIT_YEAR; unit++)
+    {
+      time_t t = 1546300800;    // 2019-01-01T00:00:00Z
+      for (int i = 0; i < 2000; i++)
+        utc[i] = t += (unit == TM_UNIT_HOUR ? 37 : unit == TM_UNIT_DAY ? 997 : unit == TM_UNIT_WEEK ? 7001 : 40009) + i % 17, values[i] = i % 101;
+      res.nb = 0;
+      ck_assert (tm_aggregator_init (&agg, wallclocks[w], unit, tu_aggregator_emit, &res) == TM_OK);
+      for (size_t i = 0, chunk = 1; i < 2000; i += chunk, chunk = chunk * 3 % 251)
+        ck_assert (tm_aggregator_add (&agg, utc + i, values + i, i + chunk < 2000 ? chunk : 2000 - i) == (i + chunk < 2000 ? chunk : 2000 - i));
+      tm_aggregator_flush (&agg);
+      ck_assert (res.nb >= 2 && res.nb < 64);
+      size_t b = 0, count = 0;
+      for (int i = 0; i < 2000; i += 7)
+      {
+        struct tm date;
+        ck_assert (tm_frombinary (&date, utc[i], wallclocks[w]) == TM_OK && tm_floor (&date, unit) == TM_OK);
+        while (b < res.nb && res.buckets[b].end <= utc[i])
+          b++;
+        ck_assert (b < res.nb && res.buckets[b].begin.utc == tm_toinstant (date).utc && res.buckets[b].begin.utcoffset == tm_getutcoffset (date));
+      }
+      for (b = 0; b < res.nb; b++)
+        count += res.buckets[b].count;
+      ck_assert (count == 2000);
+    }
+}
+END_TEST
+
+
+START_TEST (tu_sort)
+{
+  enum
+  { N = 30000 };
+  static struct tm dates[3 * N], sorted[3 * N], parallel[3 * N];
+  static int64_t keys[3 * N];
+  const char *wallclocks[] = { "Europe/Paris", TM_REF_UTC, "America/New_York" };
+
+  // Triples of a same instant on several wallclocks, in random order (and hours repeated by DST)
+  tm_zonecursor cursors[3];
+  for (int w = 0; w < 3; w++)
+    ck_assert (tm_zonecursor_init (cursors + w, wallclocks[w]) == TM_OK);
+  unsigned int seed = 1;
+  for (int i = 0; i < N; i++)
+  {
+    seed = seed * 1103515245 + 12345;
+    time_t utc = i < 16 ? 1729987200 + i * 900 : 1546300800 + (time_t) ((seed >> 4) % 200000000) * 4 + i % 4;
+    for (int w = 0; w < 3; w++)
+      ck_assert (tm_zonecursor_convert (cursors + w, utc, dates + 3 * i + w) == TM_OK);
+  }
+  ck_assert (tm_set (dates, 2024, TM_OCTOBER, 27, 2, 30, 0, "Europe/Paris") == TM_OK);
+  dates[0].tm_mday += 5;        // Not normalized: 2024-11-01T02:30:00+01:00
+  dates[0].tm_isdst = -1;
+  memcpy (sorted, dates, sizeof (dates));
+  memcpy (parallel, dates, sizeof (dates));
+
+  ck_assert (tm_sortkeys (dates, keys, 3 * N) == TM_OK);
+  ck_assert (keys[0] == 1730424600 && keys[3] == 1729987200 + 900);
+  ck_assert (tm_sort (sorted, 3 * N) == TM_OK);
+  ck_assert (tm_sort (parallel, 3 * N, 4) == TM_OK);
+  for (int i = 0; i < 3 * N; i++)
+    ck_assert (tu_zonecursor_same (sorted[i], parallel[i]));
+  ck_assert (tm_sortkeys (sorted, keys, 3 * N) == TM_OK);
+  for (int i = 1; i < 3 * N; i++)
+    ck_assert (keys[i - 1] < keys[i] ||
+               (keys[i - 1] == keys[i] && (sorted[i - 1].tm_gmtoff != sorted[i].tm_gmtoff || sorted[i - 1].tm_zone != sorted[i].tm_zone)));
+
+  // Same order as qsort with tm_compare, stable
+  memcpy (sorted, dates + 3 * 16, 300 * sizeof (*dates));
+  memcpy (parallel, dates + 3 * 16, 300 * sizeof (*dates));
+  qsort (sorted, 300, sizeof (*sorted), tm_compare);
+  ck_assert (tm_sort (parallel, 300) == TM_OK);
+  for (int i = 0; i < 300; i++)
+    ck_assert (tm_compare (sorted + i, parallel + i) == 0);
+  for (int i = 0; i < 300; i += 3)
+    for (int w = 0; w < 3; w++)
+      ck_assert (tm_getwallclock (parallel[i + w]) == tm_getwallclock (dates[w]));
+
+  ck_assert (tm_sort (sorted, 0) == TM_OK);
+  ck_assert (tm_sort (0, 1) == TM_ERROR && errno == EINVAL);
+}
+END_TEST
+
+
+START_TEST (tu_format_compile)
+{
+  const char *fmt = "%Y-%m-%dT%H:%M:%S%z %Z|%C %y %e %I %j %u %w|%F %T %R %D%n%t%%|%a %b %x %X %-d %Ey %p|";
+  tm_format *prog = tm_format_compile (fmt);
+  ck_assert (prog);
+
+  struct tm dt[5];
+  ck_assert (tm_set (dt + 0, 2002, TM_OCTOBER, 27, 1, 30, 0) == TM_OK);
+  ck_assert (tm_set (dt + 1, 2013, TM_NOVEMBER, 30, 22, 58, 57, TM_REF_UTC) == TM_OK);
+  dt[2] = dt[0];
+  ck_assert (tm_changetowallclock (dt + 2, "America/Los_Angeles") == TM_OK);
+  ck_assert (tm_set (dt + 3, 5, TM_JANUARY, 1, 12, 0, 0, TM_REF_UTC) == TM_OK);
+  ck_assert (tm_set (dt + 4, 1999, TM_DECEMBER, 31, 0, 0, 0, TM_REF_SYSTEMTIME) == TM_OK);
+  for (size_t i = 0; i < sizeof (dt) / sizeof (*dt); i++)
+  {
+    char str[200], control[200];
+    size_t len = strftime (control, sizeof (control), fmt, dt + i);
+    ck_assert (tm_format_run (prog, dt[i], sizeof (str), str) == len);
+    ck_assert (strcmp (str, control) == 0);
+    ck_assert (tm_format_run (prog, dt[i], len, str) == 0);
+    ck_assert (tm_format_run (prog, dt[i], len + 1, str) == len && strcmp (str, control) == 0);
+  }
+
+  char str[100];
+  ck_assert (tm_format_run (prog, dt[0], 0, str) == 0 && errno == EINVAL);
+  ck_assert (tm_format_run (0, dt[0], sizeof (str), str) == 0 && errno == EINVAL);
+  tm_format_free (prog);
+  ck_assert (tm_format_compile (0) == 0 && errno == EINVAL);
+
+  prog = tm_format_compile ("");
+  ck_assert (tm_format_run (prog, dt[0], 1, str) == 0 && *str == 0);
+  tm_format_free (prog);
+
+  // Inside the DST overlap (Europe/Rome), tm_tostring displays the UTC offset.
+  char control[100];
+  ck_assert (tm_tostring (dt[0], sizeof (str), str) == TM_OK);
+  strftime (control, sizeof (control), "%x %X", dt);
+  ck_assert (strcmp (str, control) == 0);
+  tm_addhours (dt, 1);
+  ck_assert (tm_tostring (dt[0], sizeof (str), str) == TM_OK);
+  strftime (control, sizeof (control), "%x %X (UTC%z)", dt);
+  ck_assert (strcmp (str, control) == 0);
+  tm_addhours (dt, 1);
+  ck_assert (tm_timetostring (dt[0], sizeof (str), str) == TM_OK);
+  strftime (control, sizeof (control), "%X (UTC%z)", dt);
+  ck_assert (strcmp (str, control) == 0);
+  tm_addhours (dt, 1);
+  ck_assert (tm_tostring (dt[0], sizeof (str), str) == TM_OK);
+  strftime (control, sizeof (control), "%x %X", dt);
+  ck_assert (strcmp (str, control) == 0);
+  ck_assert (tm_tostring (dt[2], sizeof (str), str) == TM_OK);
+  strftime (control, sizeof (control), "%x %X (%Z)", dt + 2);
+  ck_assert (strcmp (str, control) == 0);
+  ck_assert (tm_datetostring (dt[1], sizeof (str), str) == TM_OK);
+  strftime (control, sizeof (control), "%x (%Z)", dt + 1);
+  ck_assert (strcmp (str, control) == 0);
+
+  // Exact fit of a result ending with a conversion delegated to strftime.
+  ck_assert (tm_set (dt, 2019, TM_AUGUST, 27, 1, 2, 3) == TM_OK);
+  size_t len = strftime (control, sizeof (control), "%x", dt);
+  ck_assert (tm_datetostring (dt[0], len + 1, str) == TM_OK && strcmp (str, control) == 0);
+  ck_assert (tm_datetostring (dt[0], len, str) == TM_ERROR);
+  len = strftime (control, sizeof (control), "%x %X", dt);
+  ck_assert (tm_tostring (dt[0], len + 1, str) == TM_OK && strcmp (str, control) == 0);
+  ck_assert (tm_tostring (dt[0], len, str) == TM_ERROR);
+}
+
+END_TEST
+START_TEST (tu_formatiso8601_n)
+{
+  struct tm dt;
+  tm_instant in[100];
+  char out[100 * 26 + 1], control[49];
+
+  ck_assert (tm_set (&dt, 2016, TM_OCTOBER, 29, 22, 0, 0) == TM_OK);
+  for (size_t i = 0; i < sizeof (in) / sizeof (*in); i++, tm_addminutes (&dt, 17))
+    in[i] = tm_toinstant (dt);
+  ck_assert (tm_formatiso8601_n (in, 100, out, sizeof (out), '\n') == 100 * 26);
+  ck_assert (tm_set (&dt, 2016, TM_OCTOBER, 29, 22, 0, 0) == TM_OK);
+  for (size_t i = 0; i < sizeof (in) / sizeof (*in); i++, tm_addminutes (&dt, 17))
+  {
+    ck_assert (tm_formatiso8601 (dt, sizeof (control), control) == 25);
+    ck_assert (strncmp (out + 26 * i, control, 25) == 0 && out[26 * i + 25] == '\n');
+  }
+
+  in[0].utc = -1;
+  in[0].utcoffset = -(9 * 3600 + 30 * 60);
+  in[1].utc = 253402300799;
+  in[1].utcoffset = 0;
+  ck_assert (tm_formatiso8601_n (in, 2, out, sizeof (out), 0) == 50);
+  ck_assert (strncmp (out, "1969-12-31T14:29:59-09:30" "9999-12-31T23:59:59+00:00", 50) == 0);
+
+  errno = 0;
+  ck_assert (tm_formatiso8601_n (in, 100, out, 60, ';') == 52 && errno == EOVERFLOW);
+  ck_assert (tm_formatiso8601_n (in, 0, 0, 0, ';') == 0);
+  ck_assert (tm_formatiso8601_n (0, 1, out, sizeof (out), ';') == 0 && errno == EINVAL);
+}
+
 END_TEST
 START_TEST (tu_perf)
 {
@@ -1164,6 +2771,114 @@ START_TEST (tu_perf)
     tm_set (&dt);
 }
 
+END_TEST
+// Run only if TM_BENCH is set in the environment.
+START_TEST (tu_perf_rfc)
+{
+  const char *httpdate = "Sun, 06 Nov 1994 08:49:37 GMT";
+  struct tm dt, control = { 0 };
+  ck_assert (strptime (httpdate, "%a, %d %b %Y %H:%M:%S GMT", &control));
+  ck_assert (tm_setfromhttpdate (&dt, httpdate) == TM_OK && tm_changetowallclock (&dt, TM_REF_UTC) == TM_OK);
+  ck_assert (tm_getyear (dt) == control.tm_year + 1900 && tm_getmonth (dt) == control.tm_mon + 1 && tm_getday (dt) == control.tm_mday);
+  ck_assert (tm_gethour (dt) == control.tm_hour && tm_getminute (dt) == control.tm_min && tm_getsecond (dt) == control.tm_sec);
+
+  // Compared to strptime
+  clock_t start = clock ();
+  for (size_t i = 200000; i; i--)
+    strptime (httpdate, "%a, %d %b %Y %H:%M:%S GMT", &control);
+  clock_t middle = clock ();
+  for (size_t i = 200000; i; i--)
+    tm_setfromhttpdate (&dt, httpdate);
+  clock_t end = clock ();
+  char str[30];
+  for (size_t i = 200000; i; i--)
+    tm_tohttpdate (dt, sizeof (str), str);
+  printf ("HTTP-date (200000 calls): strptime %li, tm_setfromhttpdate %li, tm_tohttpdate %li (clock ticks)\n", (long int) (middle - start),
+          (long int) (end - middle), (long int) (clock () - end));
+  ck_assert (!strcmp (str, httpdate));
+}
+
+END_TEST
+START_TEST (tu_now_cached)
+{
+  const char *wallclocks[] = { TM_REF_LOCALTIME, TM_REF_UTC, "Europe/Paris", "Asia/Tokyo", "America/New_York", "Australia/Lord_Howe" };
+  struct tm dt, ctrl;
+
+  for (int round = 0; round < 2; round++)
+    for (size_t w = 0; w < sizeof (wallclocks) / sizeof (*wallclocks); w++)
+    {
+      tm_is_now_cached = 0;
+      ck_assert (tm_set (&ctrl, TM_NOW, wallclocks[w]) == TM_OK);
+      tm_is_now_cached = 1;
+      ck_assert (tm_set (&dt, TM_NOW, wallclocks[w]) == TM_OK && tm_isdefinedinwallclock (dt, wallclocks[w]));
+      ck_assert (tm_diffseconds (ctrl, dt) >= 0 && tm_diffseconds (ctrl, dt) <= 1);
+      ck_assert (tm_getutcoffset (dt) == tm_getutcoffset (ctrl) && tm_isdaylightsavingtimeineffect (dt) == tm_isdaylightsavingtimeineffect (ctrl));
+
+      tm_is_now_cached = 0;
+      ck_assert (tm_set (&ctrl, TM_TODAY, wallclocks[w]) == TM_OK);
+      tm_is_now_cached = 1;
+      ck_assert (tm_set (&dt, TM_TODAY, wallclocks[w]) == TM_OK && tm_isdefinedinwallclock (dt, wallclocks[w]));
+      ck_assert (tm_diffcalendardays (ctrl, dt) == 0 && tm_equals (dt, ctrl));
+    }
+
+  // The cache follows the local wallclock
+  ck_assert (tm_setlocalwallclock ("Asia/Tokyo") == TM_OK);
+  ck_assert (tm_set (&dt) == TM_OK && tm_isdefinedinwallclock (dt, "Asia/Tokyo"));
+  ck_assert (tm_setlocalwallclock ("America/Los_Angeles") == TM_OK);
+  ck_assert (tm_set (&dt) == TM_OK && tm_isdefinedinwallclock (dt, "America/Los_Angeles"));
+  ck_assert (tm_set (&dt, TM_TODAY) == TM_OK && tm_isdefinedinwallclock (dt, "America/Los_Angeles") && tm_gethour (dt) == 0);
+  ck_assert (tm_set (&dt, TM_NOW, "6th_continent") == TM_ERROR);
+  tm_is_now_cached = 0;
+}
+
+END_TEST
+START_TEST (tu_iso8601_cached)
+{
+  const char *wallclocks[] = { TM_REF_UTC, "Europe/Paris", "Asia/Tokyo", "America/New_York", "Australia/Lord_Howe", "Asia/Kolkata" };
+  const int options[] = { TM_ISO8601_EXTENDED, TM_ISO8601_BASIC, TM_ISO8601_EXTENDED | TM_ISO8601_OFFSET_COLON | TM_ISO8601_OFFSET_Z };
+  const long int steps[] = { 1, 59, 61, 3599, 86401 };
+  struct tm dt[sizeof (wallclocks) / sizeof (*wallclocks)];
+  char str[64], ctrl[64], offset[8];
+
+  for (size_t w = 0; w < sizeof (wallclocks) / sizeof (*wallclocks); w++)
+    ck_assert (tm_set (dt + w, 2021, 3, 27, 23, 58, 30, wallclocks[w]) == TM_OK);
+
+  // More wallclocks than cached per thread, across DST changes, with changing seconds, minutes, hours and days
+  for (int i = 0; i < 20000; i++)
+  {
+    size_t w = (size_t) i % (sizeof (wallclocks) / sizeof (*wallclocks));
+    int o = options[(size_t) i / 7 % (sizeof (options) / sizeof (*options))];
+    int digits = i % 3 ? 0 : i % 10;
+    ck_assert (tm_addseconds (dt + w, steps[(size_t) i / 11 % (sizeof (steps) / sizeof (*steps))]) == TM_OK);
+
+    size_t len = tm_formatiso8601 (dt[w], sizeof (str), str, o, digits, 123456789);
+    ck_assert (len == strlen (str));
+
+    char *p = ctrl + strftime (ctrl, sizeof (ctrl), (o & TM_ISO8601_EXTENDED) ? "%Y-%m-%dT%H:%M:%S" : "%Y%m%dT%H%M%S", dt + w);
+    if (digits)
+      p += sprintf (p, ".%.*s", digits, "123456789");
+    strftime (offset, sizeof (offset), "%z", dt + w);
+    if ((o & TM_ISO8601_OFFSET_Z) && !tm_getutcoffset (dt[w]))
+      strcpy (p, "Z");
+    else if (o & TM_ISO8601_OFFSET_COLON)
+      sprintf (p, "%.3s:%s", offset, offset + 3);
+    else
+      strcpy (p, offset);
+    ck_assert (!strcmp (str, ctrl));
+  }
+
+  // Too small buffers do not corrupt the cache
+  ck_assert (tm_set (dt, 2021, 10, 31, 1, 59, 59, "Europe/Paris") == TM_OK);
+  ck_assert (tm_formatiso8601 (dt[0], 25, str, TM_ISO8601_EXTENDED | TM_ISO8601_OFFSET_COLON) == 0);
+  ck_assert (tm_formatiso8601 (dt[0], 26, str, TM_ISO8601_EXTENDED | TM_ISO8601_OFFSET_COLON) == 25);
+  ck_assert (!strcmp (str, "2021-10-31T01:59:59+02:00"));
+  ck_assert (tm_addseconds (dt, 3601) == TM_OK);
+  ck_assert (tm_formatiso8601 (dt[0], 26, str, TM_ISO8601_EXTENDED | TM_ISO8601_OFFSET_COLON) == 25);
+  ck_assert (!strcmp (str, "2021-10-31T02:00:00+01:00"));
+  ck_assert (tm_formatiso8601 (dt[0], 26, str, TM_ISO8601_EXTENDED | TM_ISO8601_DATE_ONLY) == 10);
+  ck_assert (!strcmp (str, "2021-10-31"));
+}
+
 END_TEST
 START_TEST (tu_localwallclock)
 {
@@ -1319,9 +3034,30 @@ mm_suite (int is_TZ_owner)
   tcase_add_test (tc, tu_utc);
   tcase_add_test (tc, tu_set_from_local);
   tcase_add_test (tc, tu_set_from_utc);
+  tcase_add_test (tc, tu_parser);
   tcase_add_test (tc, tu_tostring_local);
   tcase_add_test (tc, tu_tostring_utc);
   tcase_add_test (tc, tu_iso8601);
+  tcase_add_test (tc, tu_iso8601_fixed);
+  tcase_add_test (tc, tu_formatiso8601);
+  tcase_add_test (tc, tu_formatiso8601_n);
+  tcase_add_test (tc, tu_format_compile);
+  tcase_add_test (tc, tu_rfc);
+  tcase_add_test (tc, tu_rfc9557);
+  tcase_add_test (tc, tu_isoweekdate);
+  tcase_add_test (tc, tu_duration);
+  tcase_add_test (tc, tu_builder);
+  tcase_add_test (tc, tu_cron);
+  tcase_add_test (tc, tu_timerwheel);
+  tcase_add_test (tc, tu_rrule);
+  tcase_add_test (tc, tu_busday);
+  tcase_add_test (tc, tu_schedule);
+  tcase_add_test (tc, tu_rounding);
+  tcase_add_test (tc, tu_day_boundaries);
+  tcase_add_test (tc, tu_zonecursor);
+  tcase_add_test (tc, tu_iter);
+  tcase_add_test (tc, tu_aggregator);
+  tcase_add_test (tc, tu_sort);
   tcase_add_test (tc, tu_getters_local);
   tcase_add_test (tc, tu_getters_utc);
   tcase_add_test (tc, tu_ops_local);
@@ -1331,6 +3067,8 @@ mm_suite (int is_TZ_owner)
   tcase_add_test (tc, tu_dst);
   tcase_add_test (tc, tu_dst_winter);
   tcase_add_test (tc, tu_dst_summer);
+  tcase_add_test (tc, tu_dst_fold);
+  tcase_add_test (tc, tu_dst_overlap);
   tcase_add_test (tc, tu_iso);
   tcase_add_test (tc, tu_calendar);
   tcase_add_test (tc, tu_equality);
@@ -1342,6 +3080,10 @@ mm_suite (int is_TZ_owner)
   tcase_add_test (tc, tu_date);
   tcase_add_test (tc, tu_localwallclock);
   tcase_add_test (tc, tu_perf);
+  if (getenv ("TM_BENCH"))
+    tcase_add_test (tc, tu_perf_rfc);
+  tcase_add_test (tc, tu_now_cached);
+  tcase_add_test (tc, tu_iso8601_cached);
   tcase_add_test (tc, tu_error);
   tcase_add_test (tc, tu_coverage);
 